@@ -4,18 +4,52 @@
 #include "eventloop.hh"
 
 #include <algorithm>
+#include <fcntl.h>
 #include <iostream>
+#include <limits>
+#include <sys/stat.h>
 #include <unistd.h>
 
 using namespace std;
 
+namespace {
+constexpr size_t buffer_size = 1048576;
+}
+
 void bidirectional_stream_copy( Socket& socket, string_view peer_name )
 {
-  constexpr size_t buffer_size = 1048576;
+  FileDescriptor input { STDIN_FILENO };
+  FileDescriptor output { STDOUT_FILENO };
+  byte_stream_copy( socket, input, output, peer_name );
+}
+
+void bidirectional_stream_copy( TCPSocket& socket, string_view peer_name )
+{
+  FileDescriptor input { STDIN_FILENO };
+  FileDescriptor output { STDOUT_FILENO };
+  if ( can_splice( input ) and can_splice( output ) ) {
+    splice_stream_copy( socket, input, output, peer_name );
+  } else {
+    byte_stream_copy( socket, input, output, peer_name );
+  }
+}
+
+bool can_splice( const FileDescriptor& fd )
+{
+  struct stat info {};
+  if ( ::fstat( fd.fd_num(), &info ) < 0 ) {
+    return false;
+  }
+  // NOLINTNEXTLINE(*-vararg)
+  if ( S_ISREG( info.st_mode ) and ( ::fcntl( fd.fd_num(), F_GETFL ) & O_APPEND ) ) { // NOLINT(*-bitwise)
+    return false; // splice(2) can't write to a file opened for appending
+  }
+  return S_ISFIFO( info.st_mode ) or S_ISSOCK( info.st_mode ) or S_ISREG( info.st_mode );
+}
 
+void byte_stream_copy( Socket& socket, FileDescriptor& _input, FileDescriptor& _output, string_view peer_name )
+{
   EventLoop _eventloop {};
-  FileDescriptor _input { STDIN_FILENO };
-  FileDescriptor _output { STDOUT_FILENO };
   ByteStream _outbound { buffer_size };
   ByteStream _inbound { buffer_size };
   bool _outbound_shutdown { false };
@@ -31,10 +65,8 @@ void bidirectional_stream_copy( Socket& socket, string_view peer_name )
     _input,
     Direction::In,
     [&] {
-      string data;
-      data.resize( _outbound.writer().available_capacity() );
-      _input.read( data );
-      _outbound.writer().push( move( data ) );
+      auto& writer = _outbound.writer();
+      writer.commit( _input.read_into( writer.reserve_spans( writer.available_capacity() ) ) );
       if ( _input.eof() ) {
         _outbound.writer().close();
       }
@@ -81,10 +113,8 @@ void bidirectional_stream_copy( Socket& socket, string_view peer_name )
     socket,
     Direction::In,
     [&] {
-      string data;
-      data.resize( _inbound.writer().available_capacity() );
-      socket.read( data );
-      _inbound.writer().push( move( data ) );
+      auto& writer = _inbound.writer();
+      writer.commit( socket.read_into( writer.reserve_spans( writer.available_capacity() ) ) );
       if ( socket.eof() ) {
         _inbound.writer().close();
       }
@@ -126,6 +156,9 @@ void bidirectional_stream_copy( Socket& socket, string_view peer_name )
       _inbound.set_error();
     } );
 
+  // there are only four rules: serve every one that is ready on each wakeup
+  _eventloop.set_batch_limit( numeric_limits<size_t>::max() );
+
   // loop until completion
   while ( true ) {
     if ( EventLoop::Result::Exit == _eventloop.wait_next_event( -1 ) ) {
@@ -133,3 +166,118 @@ void bidirectional_stream_copy( Socket& socket, string_view peer_name )
     }
   }
 }
+
+void splice_stream_copy( Socket& socket, FileDescriptor& input, FileDescriptor& output, string_view peer_name )
+{
+  // One direction of the copy: bytes are spliced from the source into a pipe, then from the pipe to the
+  // destination, without ever being copied into user space.
+  struct Relay
+  {
+    FileDescriptor pipe_read;
+    FileDescriptor pipe_write;
+    size_t buffered {};       // bytes in the pipe
+    bool pipe_full {};        // the last splice into the pipe found no room
+    bool source_done {};      // the source reached EOF (or went away)
+    bool destination_done {}; // the destination has been shut down
+
+    explicit Relay( pair<FileDescriptor, FileDescriptor>&& ends )
+      : pipe_read( std::move( ends.first ) ), pipe_write( std::move( ends.second ) )
+    {}
+
+    void fill( FileDescriptor& source )
+    {
+      const size_t moved = pipe_write.splice_from( source, buffer_size );
+      buffered += moved;
+      // a pipe holds fewer bytes than its capacity when the spliced pages are only partly used
+      pipe_full = moved == 0 and buffered > 0;
+      source_done = source.eof();
+    }
+
+    void drain( FileDescriptor& destination )
+    {
+      const size_t moved = destination.splice_from( pipe_read, buffered );
+      buffered -= moved;
+      pipe_full = pipe_full and moved == 0;
+    }
+
+    bool wants_fill( const FileDescriptor& source ) const
+    {
+      return not source_done and not source.eof() and not pipe_full;
+    }
+    bool wants_drain() const { return buffered > 0 or ( source_done and not destination_done ); }
+  };
+
+  EventLoop eventloop {};
+  Relay outbound { make_pipe( buffer_size ) };
+  Relay inbound { make_pipe( buffer_size ) };
+  bool error {};
+
+  socket.set_blocking( false );
+  input.set_blocking( false );
+  output.set_blocking( false );
+
+  const auto fail = [&]( const string_view what ) {
+    return [&error, what] {
+      cerr << "DEBUG: " << what << ".\n";
+      error = true;
+    };
+  };
+
+  // rule 1: splice from stdin into the outbound pipe
+  eventloop.add_rule(
+    "splice from stdin into outbound pipe",
+    input,
+    Direction::In,
+    [&] { outbound.fill( input ); },
+    [&] { return not error and outbound.wants_fill( input ); },
+    [&] { outbound.source_done = true; },
+    fail( "Outbound stream had error from source" ) );
+
+  // rule 2: splice from the outbound pipe into the socket
+  eventloop.add_rule(
+    "splice from outbound pipe into socket",
+    socket,
+    Direction::Out,
+    [&] {
+      outbound.drain( socket );
+      if ( outbound.source_done and outbound.buffered == 0 ) {
+        socket.shutdown( SHUT_WR );
+        outbound.destination_done = true;
+        cerr << "DEBUG: Outbound stream to " << peer_name << " finished.\n";
+      }
+    },
+    [&] { return not error and outbound.wants_drain(); },
+    [&] { outbound.source_done = true; },
+    fail( "Outbound stream had error from destination" ) );
+
+  // rule 3: splice from the socket into the inbound pipe
+  eventloop.add_rule(
+    "splice from socket into inbound pipe",
+    socket,
+    Direction::In,
+    [&] { inbound.fill( socket ); },
+    [&] { return not error and inbound.wants_fill( socket ); },
+    [&] { inbound.source_done = true; },
+    fail( "Inbound stream had error from source" ) );
+
+  // rule 4: splice from the inbound pipe into stdout
+  eventloop.add_rule(
+    "splice from inbound pipe into stdout",
+    output,
+    Direction::Out,
+    [&] {
+      inbound.drain( output );
+      if ( inbound.source_done and inbound.buffered == 0 ) {
+        output.close();
+        inbound.destination_done = true;
+        cerr << "DEBUG: Inbound stream from " << peer_name << " finished" << ( error ? " uncleanly.\n" : ".\n" );
+      }
+    },
+    [&] { return not error and inbound.wants_drain(); },
+    [&] { inbound.source_done = true; },
+    fail( "Inbound stream had error from destination" ) );
+
+  eventloop.set_batch_limit( numeric_limits<size_t>::max() );
+
+  while ( eventloop.wait_next_event( -1 ) != EventLoop::Result::Exit ) {}
+}
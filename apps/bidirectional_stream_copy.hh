@@ -4,3 +4,20 @@
 
 //! Copy socket input/output to stdin/stdout until finished
 void bidirectional_stream_copy( Socket& socket, std::string_view peer_name );
+
+//! Copy kernel TCP socket input/output to stdin/stdout until finished, with splice_stream_copy() if both
+//! stdin and stdout support it
+void bidirectional_stream_copy( TCPSocket& socket, std::string_view peer_name );
+
+//! Copy between the socket and `input`/`output` until finished, through ByteStreams in user space
+void byte_stream_copy( Socket& socket, FileDescriptor& input, FileDescriptor& output, std::string_view peer_name );
+
+//! Copy between the socket and `input`/`output` until finished, with [splice(2)](\ref man2::splice) through a
+//! pipe in each direction, so the bytes never leave the kernel. `input` and `output` must pass can_splice().
+void splice_stream_copy( Socket& socket,
+                         FileDescriptor& input,
+                         FileDescriptor& output,
+                         std::string_view peer_name );
+
+//! Is the fd a pipe, a socket or a (non-appending) regular file, which splice(2) can read and write?
+bool can_splice( const FileDescriptor& fd );
@@ -35,7 +35,8 @@ void show_usage( const char* argv0, const char* msg )
 
        << "   -t <tmout>      Set rt_timeout to tmout                         " << TCPConfig::TIMEOUT_DFLT << "\n\n"
 
-       << "   -d <tundev>     Connect to tun <tundev>                         " << TUN_DFLT << "\n\n"
+       << "   -d <tundev>     Connect to tun <tundev>                         " << TUN_DFLT << "\n"
+       << "   -o              Offload TCP checksums and segmentation to tun   (no offload)\n\n"
 
        << "   -Lu <loss>      Set uplink loss to <rate> (float in 0..1)       (no loss)\n"
        << "   -Ld <loss>      Set downlink loss to <rate> (float in 0..1)     (no loss)\n\n"
@@ -56,13 +57,14 @@ void check_argc( const span<char*>& args, size_t curr, const char* err )
   }
 }
 
-tuple<TCPConfig, FdAdapterConfig, bool, const char*> get_config( const span<char*>& args )
+tuple<TCPConfig, FdAdapterConfig, bool, const char*, TunTapOptions> get_config( const span<char*>& args )
 {
   TCPConfig c_fsm {};
   c_fsm.isn = Wrap32 { random_device()() };
 
   FdAdapterConfig c_filt {};
   const char* tundev = nullptr;
+  TunTapOptions tun_options {};
 
   size_t curr = 1;
   bool listen = false;
@@ -101,6 +103,11 @@ tuple<TCPConfig, FdAdapterConfig, bool, const char*> get_config( const span<char
       tundev = args[curr + 1];
       curr += 2;
 
+    } else if ( strncmp( "-o", args[curr], 3 ) == 0 ) {
+      tun_options.vnet_header = true;
+      tun_options.offloads = TUN_F_CSUM | TUN_F_TSO4;
+      curr += 1;
+
     } else if ( strncmp( "-Lu", args[curr], 3 ) == 0 ) {
       check_argc( args, curr, "ERROR: -Lu requires one argument." );
       const float lossrate = strtof( args[curr + 1], nullptr );
@@ -139,7 +146,7 @@ tuple<TCPConfig, FdAdapterConfig, bool, const char*> get_config( const span<char
     c_filt.source = { source_address, source_port };
   }
 
-  return make_tuple( c_fsm, c_filt, listen, tundev );
+  return make_tuple( c_fsm, c_filt, listen, tundev, tun_options );
 }
 } // namespace
 
@@ -157,9 +164,9 @@ int main( int argc, char** argv )
       return EXIT_FAILURE;
     }
 
-    auto [c_fsm, c_filt, listen, tun_dev_name] = get_config( args );
+    auto [c_fsm, c_filt, listen, tun_dev_name, tun_options] = get_config( args );
     LossyTCPOverIPv4MinnowSocket tcp_socket( LossyFdAdapter<TCPOverIPv4OverTunFdAdapter>(
-      TCPOverIPv4OverTunFdAdapter( TunFD( tun_dev_name == nullptr ? TUN_DFLT : tun_dev_name ) ) ) );
+      TCPOverIPv4OverTunFdAdapter( TunFD( tun_dev_name == nullptr ? TUN_DFLT : tun_dev_name, tun_options ) ) ) );
 
     if ( listen ) {
       tcp_socket.listen_and_accept( c_fsm, c_filt );
@@ -22,6 +22,7 @@ ttest(byte_stream_capacity)
 ttest(byte_stream_one_write)
 ttest(byte_stream_two_writes)
 ttest(byte_stream_many_writes)
+ttest(byte_stream_reserve)
 ttest(byte_stream_stress_test)
 
 ttest(reassembler_single)
@@ -31,6 +32,7 @@ ttest(reassembler_dup)
 ttest(reassembler_holes)
 ttest(reassembler_overlapping)
 ttest(reassembler_win)
+ttest(reassembler_pool)
 
 ttest(wrapping_integers_cmp)
 ttest(wrapping_integers_wrap)
@@ -57,6 +59,13 @@ ttest(send_extra)
 ttest(net_interface)
 
 ttest(router)
+ttest(ip_fragmentation)
+ttest(egress_queue)
+ttest(arp_pending)
+
+ttest(eventloop_interest)
+ttest(internet_checksum)
+ttest(tcp_minnow_timers)
 
 add_custom_target (check0 COMMAND ${CMAKE_CTEST_COMMAND} --output-on-failure --stop-on-failure --timeout 12 -R 'webget|^byte_stream_')
 
@@ -70,7 +79,7 @@ add_custom_target (check3 COMMAND ${CMAKE_CTEST_COMMAND} --output-on-failure --s
 
 add_custom_target (check5 COMMAND ${CMAKE_CTEST_COMMAND} --output-on-failure --stop-on-failure --timeout 12 -R '^net_interface')
 
-add_custom_target (check6 COMMAND ${CMAKE_CTEST_COMMAND} --output-on-failure --stop-on-failure --timeout 12 -R '^net_interface|^router')
+add_custom_target (check6 COMMAND ${CMAKE_CTEST_COMMAND} --output-on-failure --stop-on-failure --timeout 12 -R '^net_interface|^router|^ip_fragmentation|^egress_queue|^arp_pending')
 
 ###
 
@@ -90,3 +99,13 @@ set_tests_properties(${compile_name_opt} PROPERTIES FIXTURES_SETUP compile_opt)
 
 stest(byte_stream_speed_test)
 stest(reassembler_speed_test)
+stest(eventloop_speed_test)
+stest(echo_speed_test)
+stest(packet_io_speed_test)
+stest(packet_buffer_speed_test)
+stest(connection_churn_speed_test)
+stest(checksum_speed_test)
+stest(router_speed_test)
+stest(ecmp_speed_test)
+stest(route_load_speed_test)
+stest(stream_copy_speed_test)
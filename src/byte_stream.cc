@@ -1,8 +1,25 @@
 #include "byte_stream.hh"
 
+#include <algorithm>
+#include <utility>
+
 using namespace std;
 
-ByteStream::ByteStream( uint64_t capacity ) : capacity_( capacity ) {}
+namespace {
+// Smallest block to allocate for reserve(), so that small reservations can share one
+constexpr uint64_t min_block_size = 16384;
+// Largest: a block outlives the reservation for as long as any byte committed into it is buffered
+constexpr uint64_t max_block_size = 65536;
+
+uint64_t block_size( uint64_t len, uint64_t available_capacity )
+{
+  return min( max( len, min( available_capacity, min_block_size ) ), max_block_size );
+}
+} // namespace
+
+ByteStream::ByteStream( uint64_t capacity, pmr::memory_resource* resource )
+  : capacity_( capacity ), buffer_( resource )
+{}
 
 bool Writer::is_closed() const
 {
@@ -17,22 +34,159 @@ void Writer::push( string data )
   if ( data.size() > available_capacity() ) {
     data.resize( available_capacity() );
   }
+  push_chunk( move( data ) );
+}
+
+void Writer::push( Buffer data )
+{
+  if ( is_closed() ) {
+    return;
+  }
+  if ( data.size() > available_capacity() ) {
+    data.remove_suffix( data.size() - available_capacity() );
+  }
+  if ( data.size() < MIN_SHARED_SIZE && reserved_ == 0 && reserved_next_ == 0 ) {
+    push_copy( data );
+    return;
+  }
+  push_chunk( move( data ) );
+}
+
+void ByteStream::push_chunk( Buffer data )
+{
   if ( data.empty() ) {
     return;
   }
   bytes_buffered_ += data.size();
   bytes_pushed_ += data.size();
-  buffer_.emplace( move( data ) );
-  if ( view_.empty() && !buffer_.empty() ) {
-    view_ = buffer_.front();
+  buffer_.push_back( move( data ) );
+}
+
+// Copy into the current block (and new ones once it is full), as if written there in place and committed
+void ByteStream::push_copy( string_view data )
+{
+  while ( !data.empty() ) {
+    if ( spare_used_ == spare_size_ ) {
+      start_block( data.size() );
+    }
+    const uint64_t len = min<uint64_t>( data.size(), spare_size_ - spare_used_ );
+    copy_n( data.data(), len, spare_.get() + spare_used_ );
+    commit_to_block( len );
+    data.remove_prefix( len );
   }
 }
 
+Buffer ByteStream::compact( Buffer data ) const
+{
+  if ( data.empty() || data.size() >= MIN_SHARED_SIZE ) {
+    return data;
+  }
+  auto block = allocate_block( data.size() );
+  copy_n( data.data(), data.size(), block.get() );
+  const string_view copied { block.get(), data.size() };
+  return { move( block ), copied };
+}
+
+// The reservation is the unused tail of the current block, if it is long enough; otherwise a new block (left
+// uninitialized) replaces it. Committed bytes share the block, which is freed once they have all been popped.
+span<char> Writer::reserve( uint64_t len )
+{
+  len = min( len, available_capacity() );
+  reserved_next_ = 0;
+  if ( is_closed() || len == 0 ) {
+    reserved_ = 0;
+    return {};
+  }
+
+  const uint64_t spare = spare_size_ - spare_used_;
+  if ( spare < len && spare < min_block_size ) {
+    start_block( len );
+  }
+
+  reserved_ = min( len, spare_size_ - spare_used_ );
+  return { spare_.get() + spare_used_, reserved_ };
+}
+
+// Unlike reserve(), this doesn't leave a short tail unused: a block is only replaced once it is full.
+array<span<char>, 2> Writer::reserve_spans( uint64_t len )
+{
+  len = min( len, available_capacity() );
+  if ( is_closed() || len == 0 ) {
+    reserved_ = reserved_next_ = 0;
+    return {};
+  }
+
+  if ( spare_used_ == spare_size_ ) {
+    start_block( len );
+  }
+  reserved_ = min( len, spare_size_ - spare_used_ );
+  reserved_next_ = 0;
+  if ( len > reserved_ ) {
+    if ( !next_block_ ) {
+      next_block_size_ = block_size( len - reserved_, available_capacity() - reserved_ );
+      next_block_ = allocate_block( next_block_size_ );
+    }
+    reserved_next_ = min( len - reserved_, next_block_size_ );
+  }
+  return { span<char> { spare_.get() + spare_used_, reserved_ }, span<char> { next_block_.get(), reserved_next_ } };
+}
+
+void Writer::commit( uint64_t len )
+{
+  const uint64_t first = exchange( reserved_, 0 );
+  len = min( len, first + exchange( reserved_next_, 0 ) );
+  if ( is_closed() || len == 0 ) {
+    return;
+  }
+
+  commit_to_block( min( len, first ) );
+  if ( len > first ) {
+    start_block( len - first );
+    commit_to_block( len - first );
+  }
+}
+
+shared_ptr<char[]> ByteStream::allocate_block( uint64_t size ) const // NOLINT(*-avoid-c-arrays)
+{
+  return allocate_shared_for_overwrite<char[]>( pmr::polymorphic_allocator<char> { resource() }, size ); // NOLINT
+}
+
+// Fill a new block from now on: the one reserve_spans() set aside, if any, or a fresh one
+void ByteStream::start_block( uint64_t len )
+{
+  if ( next_block_ ) {
+    spare_ = move( next_block_ );
+    spare_size_ = exchange( next_block_size_, 0 );
+  } else {
+    spare_size_ = block_size( len, capacity_ - bytes_buffered_ );
+    spare_ = allocate_block( spare_size_ );
+  }
+  spare_used_ = 0;
+}
+
+void ByteStream::commit_to_block( uint64_t len )
+{
+  // extend the last chunk if it ends where this one starts
+  const char* start = spare_.get() + spare_used_;
+  if ( !buffer_.empty() && buffer_.back().owner() == spare_
+       && buffer_.back().data() + buffer_.back().size() == start ) {
+    Buffer& last = buffer_.back();
+    last = { last.owner(), { last.data(), last.size() + len } };
+    bytes_buffered_ += len;
+    bytes_pushed_ += len;
+  } else {
+    push_chunk( { spare_, { start, len } } );
+  }
+
+  spare_used_ += len;
+}
+
 void Writer::close()
 {
   if ( !is_closed_ ) {
     is_closed_ = true;
-    buffer_.emplace( string( 1, EOF ) );
+    static const Buffer eof_marker { string( 1, EOF ) }; // shared by every stream, so closing doesn't allocate
+    buffer_.push_back( eof_marker );
   }
 }
 
@@ -58,7 +212,12 @@ uint64_t Reader::bytes_popped() const
 
 string_view Reader::peek() const
 {
-  return view_;
+  return buffer_.empty() ? string_view {} : buffer_.front().str();
+}
+
+Buffer Reader::peek_buffer() const
+{
+  return buffer_.empty() ? Buffer {} : buffer_.front();
 }
 
 void Reader::pop( uint64_t len )
@@ -67,13 +226,12 @@ void Reader::pop( uint64_t len )
     len = bytes_buffered_;
   }
   auto remain = len;
-  while ( remain >= view_.size() && !buffer_.empty() ) {
-    remain -= view_.size();
-    buffer_.pop();
-    view_ = buffer_.empty() ? std::string_view() : buffer_.front();
+  while ( !buffer_.empty() && remain >= buffer_.front().size() ) {
+    remain -= buffer_.front().size();
+    buffer_.pop_front();
   }
   if ( remain > 0 ) {
-    view_.remove_prefix( remain );
+    buffer_.front().remove_prefix( remain );
   }
   bytes_buffered_ -= len;
   bytes_popped_ += len;
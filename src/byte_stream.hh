@@ -1,7 +1,13 @@
 #pragma once
 
+#include "buffer.hh"
+
+#include <array>
 #include <cstdint>
-#include <queue>
+#include <deque>
+#include <memory>
+#include <memory_resource>
+#include <span>
 #include <string>
 #include <string_view>
 
@@ -11,7 +17,13 @@ class Writer;
 class ByteStream
 {
 public:
-  explicit ByteStream( uint64_t capacity );
+  // The stream's bookkeeping and the blocks handed out by reserve() come from `resource`. Buffers shared out of
+  // the stream by peek_buffer() point into it, so it must outlive them (TCPSender copies what it sends instead,
+  // unless `resource` is the default one).
+  explicit ByteStream( uint64_t capacity, std::pmr::memory_resource* resource = std::pmr::get_default_resource() );
+
+  // The resource the stream allocates from (a copy of a stream allocates from the default one)
+  std::pmr::memory_resource* resource() const { return buffer_.get_allocator().resource(); }
 
   // Helper functions (provided) to access the ByteStream's Reader and Writer interfaces
   Reader& reader();
@@ -19,6 +31,13 @@ public:
   Writer& writer();
   const Writer& writer() const;
 
+  // Shorter Buffers are copied, into a block of the stream's own, rather than kept: a short slice of a packet
+  // would otherwise keep the whole packet buffer (e.g. a 2 KiB slot of the PacketBufferPool) alive.
+  static constexpr uint64_t MIN_SHARED_SIZE = PacketBufferPool::MTU_BUFFER_SIZE / 4;
+
+  // `data` itself, or (if shorter than MIN_SHARED_SIZE) a copy of it in a block of its own from resource()
+  Buffer compact( Buffer data ) const;
+
   void set_error() { error_ = true; };       // Signal that the stream suffered an error.
   bool has_error() const { return error_; }; // Has the stream had an error?
 
@@ -29,17 +48,44 @@ protected:
   uint64_t bytes_buffered_ { 0 };
   uint64_t bytes_pushed_ { 0 };
   uint64_t bytes_popped_ { 0 };
-  std::queue<std::string> buffer_ {};
+  // Pieces of the buffered stream: Buffers pushed in, or bytes committed in place into a block that was handed
+  // out by reserve(). Popping shrinks the front Buffer; peek_buffer() shares it.
+  std::pmr::deque<Buffer> buffer_;
   bool is_closed_ { false };
-  std::string_view view_ {};
+
+  void push_chunk( Buffer data );
+  void push_copy( std::string_view data );
+
+  std::shared_ptr<char[]> spare_ {}; // NOLINT(*-avoid-c-arrays) Block whose tail is handed out by reserve()
+  uint64_t spare_size_ { 0 };
+  uint64_t spare_used_ { 0 }; // Bytes of spare_ already committed
+  uint64_t reserved_ { 0 };   // Length of the span returned by the last reserve() (the first, by reserve_spans())
+  std::shared_ptr<char[]> next_block_ {}; // NOLINT(*-avoid-c-arrays) Block to follow spare_ (see reserve_spans())
+  uint64_t next_block_size_ { 0 };
+  uint64_t reserved_next_ { 0 }; // Length of the second span returned by the last reserve_spans()
+
+  std::shared_ptr<char[]> allocate_block( uint64_t size ) const; // NOLINT(*-avoid-c-arrays)
+  void start_block( uint64_t len );
+  void commit_to_block( uint64_t len );
 };
 
 class Writer : public ByteStream
 {
 public:
   void push( std::string data ); // Push data to stream, but only as much as available capacity allows.
+  void push( Buffer data );      // The same, sharing the Buffer's storage (if not too short) instead of copying it
   void close();                  // Signal that the stream has reached its ending. Nothing more will be written.
 
+  // Writable space for up to `len` bytes (and no more than available_capacity()), to be filled in place (e.g. by
+  // FileDescriptor::read_into) and then published with commit(). The span may be shorter than asked for (blocks
+  // are allocated 64 KiB at most, so that asking for a whole window doesn't make a short read pin one), and is
+  // only valid until the next reserve(), reserve_spans() or commit().
+  std::span<char> reserve( uint64_t len );
+  // The same as two spans, to be filled in order (e.g. by one readv): the rest of the current block, however
+  // short, then a new block for the rest. Together they may also be shorter than asked for.
+  std::array<std::span<char>, 2> reserve_spans( uint64_t len );
+  void commit( uint64_t len ); // Push the first `len` bytes written into the span(s) from the last reservation
+
   bool is_closed() const;              // Has the stream been closed?
   uint64_t available_capacity() const; // How many bytes can be pushed to the stream right now?
   uint64_t bytes_pushed() const;       // Total number of bytes cumulatively pushed to the stream
@@ -49,6 +95,7 @@ class Reader : public ByteStream
 {
 public:
   std::string_view peek() const; // Peek at the next bytes in the buffer
+  Buffer peek_buffer() const;     // The same bytes as peek(), sharing the stream's storage
   void pop( uint64_t len );      // Remove `len` bytes from the buffer
 
   bool is_finished() const;        // Is the stream finished (closed and fully popped)?
@@ -0,0 +1,183 @@
+#include "egress_queue.hh"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+
+size_t frame_size( const EthernetFrame& frame )
+{
+  return EthernetHeader::LENGTH + frame.payload.size();
+}
+
+} // namespace
+
+EgressQueue::Class EgressQueue::classify( const uint8_t tos )
+{
+  const uint8_t precedence = tos >> 5;
+  const uint8_t dscp = tos >> 2;
+  if ( precedence >= 4 ) {
+    return INTERACTIVE;
+  }
+  if ( precedence == 1 or dscp == 1 ) {
+    return BULK;
+  }
+  return BEST_EFFORT;
+}
+
+// The share of the link each IPv4 class gets when they're all busy
+int64_t EgressQueue::weight( const Class traffic_class )
+{
+  switch ( traffic_class ) {
+    case INTERACTIVE:
+      return 4 * QUANTUM;
+    case BEST_EFFORT:
+      return 2 * QUANTUM;
+    default:
+      return QUANTUM;
+  }
+}
+
+void EgressQueue::set_rate( const uint64_t bytes_per_second, const size_t burst )
+{
+  rate_ = bytes_per_second;
+  burst_ = static_cast<int64_t>( max( burst, QUANTUM ) ) * 1000;
+  tokens_ = burst_;
+}
+
+void EgressQueue::push( EthernetFrame&& frame, const Class traffic_class, const uint64_t flow )
+{
+  const size_t size = frame_size( frame );
+  auto& queue = classes_[traffic_class];
+  if ( queue.flows.empty() ) {
+    queue.flows.resize( FLOWS );
+  }
+  const size_t index = flow % FLOWS;
+  auto& f = queue.flows[index];
+  f.frames.push_back( move( frame ) );
+  f.bytes += size;
+  queue.bytes += size;
+  queued_bytes_ += size;
+
+  if ( not f.active ) {
+    f.active = true;
+    queue.round.push_back( index );
+  }
+  if ( traffic_class != CONTROL and not queue.active ) {
+    queue.active = true;
+    round_.push_back( traffic_class );
+  }
+
+  while ( queue.bytes > CLASS_LIMIT ) {
+    drop_from_longest( traffic_class );
+  }
+}
+
+optional<EthernetFrame> EgressQueue::pop()
+{
+  if ( queued_bytes_ == 0 or ( rate_ != 0 and tokens_ <= 0 ) ) {
+    return nullopt;
+  }
+
+  // ARP first; otherwise, the IPv4 class whose turn it is, once it has the deficit for its next frame
+  Class traffic_class = CONTROL;
+  if ( classes_[CONTROL].bytes == 0 ) {
+    while ( true ) {
+      traffic_class = round_.front();
+      auto& queue = classes_[traffic_class];
+      const auto& next = queue.flows[next_flow( queue )].frames.front();
+      if ( queue.deficit >= static_cast<int64_t>( frame_size( next ) ) ) {
+        break;
+      }
+      queue.deficit += weight( traffic_class );
+      round_.pop_front();
+      round_.push_back( traffic_class );
+    }
+  }
+
+  auto& queue = classes_[traffic_class];
+  auto frame = take( queue, next_flow( queue ) );
+  const auto size = static_cast<int64_t>( frame_size( frame ) );
+  if ( traffic_class != CONTROL ) {
+    queue.deficit -= size;
+    if ( queue.bytes == 0 ) {
+      queue.deficit = 0;
+      queue.active = false;
+      round_.pop_front();
+    }
+  }
+  if ( rate_ != 0 ) {
+    tokens_ -= size * 1000;
+  }
+  ++stats_.sent[traffic_class];
+  return frame;
+}
+
+void EgressQueue::tick( const size_t ms_since_last_tick )
+{
+  if ( rate_ != 0 ) {
+    tokens_ = min( burst_, tokens_ + static_cast<int64_t>( rate_ * ms_since_last_tick ) );
+  }
+}
+
+// The flow whose turn it is in a class (with frames to send, and the deficit for the first)
+size_t EgressQueue::next_flow( Queue& queue )
+{
+  while ( true ) {
+    const size_t index = queue.round.front();
+    auto& flow = queue.flows[index];
+    if ( flow.deficit >= static_cast<int64_t>( frame_size( flow.frames.front() ) ) ) {
+      return index;
+    }
+    flow.deficit += QUANTUM;
+    queue.round.pop_front();
+    queue.round.push_back( index );
+  }
+}
+
+// Take the first frame of the flow whose turn it is
+EthernetFrame EgressQueue::take( Queue& queue, const size_t index )
+{
+  auto& flow = queue.flows[index];
+  EthernetFrame frame = move( flow.frames.front() );
+  flow.frames.pop_front();
+  const size_t size = frame_size( frame );
+  flow.deficit -= static_cast<int64_t>( size );
+  flow.bytes -= size;
+  queue.bytes -= size;
+  queued_bytes_ -= size;
+
+  if ( flow.frames.empty() ) {
+    flow.deficit = 0;
+    flow.active = false;
+    queue.round.pop_front();
+  }
+  return frame;
+}
+
+// Make room in a class by dropping the oldest frame of its longest flow queue: the flow most likely to be the one
+// filling it, and the sooner it notices the better
+void EgressQueue::drop_from_longest( const Class traffic_class )
+{
+  auto& queue = classes_[traffic_class];
+  const auto longest = ranges::max_element( queue.flows, {}, &Flow::bytes );
+  const size_t index = longest - queue.flows.begin();
+  const size_t size = frame_size( longest->frames.front() );
+  longest->frames.pop_front();
+  longest->bytes -= size;
+  queue.bytes -= size;
+  queued_bytes_ -= size;
+  ++stats_.dropped[traffic_class];
+
+  if ( longest->frames.empty() ) {
+    longest->deficit = 0;
+    longest->active = false;
+    queue.round.erase( ranges::find( queue.round, index ) );
+  }
+  if ( queue.bytes == 0 and traffic_class != CONTROL ) {
+    queue.deficit = 0;
+    queue.active = false;
+    round_.erase( ranges::find( round_, traffic_class ) );
+  }
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <vector>
+
+#include "ethernet_frame.hh"
+
+// The queues a NetworkInterface's frames wait in to go out (its "queueing discipline").
+//
+// Frames are sorted into classes: ARP, which always goes first, then three classes of IPv4 traffic by the
+// precedence bits of the header's type of service. The IPv4 classes share the link by weighted deficit round
+// robin, and within a class, flows (hashed into a fixed number of queues) share it by deficit round robin, so a
+// bulk transfer can't hold up a sparse, latency-sensitive flow in the same class. Each class has a byte limit;
+// when it's over, the longest flow queue in the class loses the frame at its head.
+//
+// The link's rate is a token bucket, refilled as time passes. Unshaped (the default), frames go out as soon as
+// they're sent and never wait.
+class EgressQueue
+{
+public:
+  enum Class : uint8_t
+  {
+    CONTROL,     // ARP
+    INTERACTIVE, // IP precedence 4 to 7 (e.g. DSCP EF, AF4x and the network control classes)
+    BEST_EFFORT,
+    BULK, // IP precedence 1 (DSCP CS1 and AF1x) and DSCP LE
+    CLASS_COUNT
+  };
+
+  static constexpr size_t CLASS_LIMIT = 256 * 1024; // bytes queued per class
+  static constexpr size_t FLOWS = 64;               // queues per class (flows that hash alike share one)
+  static constexpr size_t QUANTUM = 1514;           // bytes a flow may send per round: a full-sized frame
+
+  struct Stats
+  {
+    std::array<uint64_t, CLASS_COUNT> sent {};    // frames sent, by class (queued or not: see sent_directly)
+    std::array<uint64_t, CLASS_COUNT> dropped {}; // frames dropped for being over the class's limit
+  };
+
+  static Class classify( uint8_t tos );
+
+  // Shape the link to `bytes_per_second`, with bursts of up to `burst` bytes (at least a full-sized frame).
+  // A rate of 0 leaves it unshaped.
+  void set_rate( uint64_t bytes_per_second, size_t burst );
+  bool shaped() const { return rate_ != 0; }
+
+  // Whether a frame could go out right away without queueing (the link is unshaped and nothing is waiting)
+  bool idle() const { return rate_ == 0 and queued_bytes_ == 0; }
+
+  // Count a frame of a class that went out without queueing, while the queue was idle
+  void sent_directly( Class traffic_class ) { ++stats_.sent[traffic_class]; }
+
+  // Queue a frame of a class, and flow (a hash that's the same for all of the flow's frames)
+  void push( EthernetFrame&& frame, Class traffic_class, uint64_t flow );
+
+  // The next frame to go out, if it may go now
+  std::optional<EthernetFrame> pop();
+
+  // Called periodically when time elapses; refills the token bucket
+  void tick( size_t ms_since_last_tick );
+
+  size_t queued_bytes() const { return queued_bytes_; }
+  const Stats& stats() const { return stats_; }
+
+private:
+  struct Flow
+  {
+    std::deque<EthernetFrame> frames {};
+    size_t bytes {};
+    int64_t deficit {};
+    bool active {}; // in its class's round
+  };
+
+  struct Queue
+  {
+    std::vector<Flow> flows {};  // FLOWS of them, once the class has been used
+    std::deque<size_t> round {}; // the flows with frames, in turn
+    size_t bytes {};
+    int64_t deficit {};
+    bool active {};
+  };
+
+  std::array<Queue, CLASS_COUNT> classes_ {};
+  std::deque<Class> round_ {}; // the IPv4 classes with frames, in turn
+  size_t queued_bytes_ {};
+
+  uint64_t rate_ {}; // bytes per second (0: unshaped)
+  int64_t burst_ {}; // in thousandths of a byte, like tokens_
+  int64_t tokens_ {}; // may go below zero by (less than) a frame: the last one goes out on credit
+  Stats stats_ {};
+
+  static int64_t weight( Class traffic_class );
+  size_t next_flow( Queue& queue );
+  EthernetFrame take( Queue& queue, size_t index );
+  void drop_from_longest( Class traffic_class );
+};
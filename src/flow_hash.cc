@@ -0,0 +1,55 @@
+#include "flow_hash.hh"
+
+using namespace std;
+
+namespace {
+
+// The finalizer of MurmurHash3: every input bit affects every output bit
+uint64_t mix( uint64_t x )
+{
+  x ^= x >> 33;
+  x *= 0xff51'afd7'ed55'8ccd;
+  x ^= x >> 33;
+  x *= 0xc4ce'b9fe'1a85'ec53;
+  x ^= x >> 33;
+  return x;
+}
+
+uint64_t addresses( const IPv4Header& header )
+{
+  return ( static_cast<uint64_t>( header.src ) << 32 ) | header.dst;
+}
+
+// The first four bytes of a TCP segment (source and destination ports), or 0 if there aren't four
+uint32_t ports( const BufferList& payload )
+{
+  uint32_t ret = 0;
+  size_t needed = sizeof( ret );
+  for ( const auto& buffer : payload ) {
+    for ( const char c : buffer.str().substr( 0, needed ) ) {
+      ret = ( ret << 8 ) | static_cast<uint8_t>( c );
+      --needed;
+    }
+    if ( needed == 0 ) {
+      return ret;
+    }
+  }
+  return 0;
+}
+
+} // namespace
+
+uint64_t address_hash( const IPv4Header& header )
+{
+  return mix( addresses( header ) ^ header.proto );
+}
+
+uint64_t flow_hash( const InternetDatagram& dgram )
+{
+  const IPv4Header& header = dgram.header;
+  uint64_t rest = header.proto;
+  if ( header.proto == IPv4Header::PROTO_TCP and not header.mf and header.offset == 0 ) {
+    rest |= static_cast<uint64_t>( ports( dgram.payload ) ) << 8;
+  }
+  return mix( addresses( header ) ^ mix( rest ) );
+}
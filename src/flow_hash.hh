@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdint>
+
+#include "ipv4_datagram.hh"
+
+// Hashes that keep the datagrams of a flow together while spreading flows apart (e.g. across paths, or threads).
+// They're well mixed in all 64 bits, so any bits of them can pick among a few choices.
+
+// Hash of the source and destination addresses and the protocol. This is the same for every datagram of a flow,
+// fragments included.
+uint64_t address_hash( const IPv4Header& header );
+
+// Hash of the 5-tuple: the addresses and protocol, plus the TCP ports when the datagram carries them (i.e. it's
+// TCP and not a fragment). Flows between the same two hosts hash apart, but a flow's fragmented datagrams may
+// hash differently from its whole ones.
+uint64_t flow_hash( const InternetDatagram& dgram );
@@ -0,0 +1,276 @@
+#include "forwarding_table.hh"
+#include "flow_hash.hh"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+
+// (shifting a 32-bit value by 32 is undefined, so the default route's mask is spelled out)
+uint32_t mask( const uint8_t prefix_length )
+{
+  return prefix_length == 0 ? 0 : static_cast<uint32_t>( 0xFFFF'FFFF << ( 32 - prefix_length ) );
+}
+
+} // namespace
+
+// An empty table: every slot is group 0, no route
+ForwardingTable::ForwardingTable()
+{
+  static const auto empty_chunk = make_shared<const RootChunk>();
+  static const auto empty_groups = make_shared<const GroupBlock>();
+  root_.fill( empty_chunk );
+  groups_.push_back( empty_groups );
+}
+
+ForwardingTable::Paths ForwardingTable::lookup( const uint32_t dst ) const
+{
+  const RootChunk& chunk = *root_[dst >> 24];
+  uint32_t slot = chunk.slots[( dst >> 16 ) & 0xFF];
+  if ( slot & CHILD ) {
+    const Subtree& subtree = *chunk.subtrees[( dst >> 16 ) & 0xFF];
+    slot = subtree.node[( dst >> 8 ) & 0xFF];
+    if ( slot & CHILD ) {
+      slot = subtree.children[slot & ~CHILD][dst & 0xFF];
+    }
+  }
+  return group_at( slot );
+}
+
+const RoutePath& ForwardingTable::path( const Paths route, const InternetDatagram& dgram ) const
+{
+  if ( route.count == 1 ) {
+    return path_at( route.first );
+  }
+  // scale 32 bits of the hash to the number of paths (cheaper than %)
+  const uint64_t choice = ( ( flow_hash( dgram ) >> 32 ) * route.count ) >> 32;
+  return path_at( route.first + static_cast<uint32_t>( choice ) );
+}
+
+size_t ForwardingTable::node_count() const
+{
+  size_t count = 0;
+  for ( const auto& chunk : root_ ) {
+    for ( const auto& subtree : chunk->subtrees ) {
+      count += subtree ? 1 + subtree->children.size() : 0;
+    }
+  }
+  return count;
+}
+
+ForwardingTableBuilder::ForwardingTableBuilder()
+{
+  load( {} );
+}
+
+shared_ptr<const ForwardingTable> ForwardingTableBuilder::load( vector<Route> routes )
+{
+  rib_.clear();
+  group_ids_.clear();
+  group_blocks_.clear();
+  path_blocks_.clear();
+  group_count_ = 0;
+  path_count_ = 0;
+  auto table = make_shared<ForwardingTable>();
+  table->groups_.clear();
+  group( *table, {} ); // group 0: no route
+
+  // sorted by prefix (stable, so a prefix's paths keep their order), each prefix's paths make a group
+  for ( auto& route : routes ) {
+    route.prefix &= mask( route.prefix_length );
+  }
+  ranges::stable_sort( routes, {}, []( const Route& r ) { return pair { r.prefix, r.prefix_length }; } );
+  vector<RoutePath> paths;
+  for ( size_t i = 0; i < routes.size(); ) {
+    const Key key { routes[i].prefix, routes[i].prefix_length };
+    paths.clear();
+    for ( ; i < routes.size() and Key { routes[i].prefix, routes[i].prefix_length } == key; ++i ) {
+      if ( ranges::find( paths, routes[i].path ) == paths.end() ) {
+        paths.push_back( routes[i].path );
+      }
+    }
+    rib_.emplace_hint( rib_.end(), key, group( *table, paths ) );
+  }
+
+  // the root's slots, shortest prefixes first so longer ones overwrite them...
+  vector<pair<Key, uint32_t>> short_prefixes;
+  for ( const auto& entry : rib_ ) {
+    if ( entry.first.second <= 16 ) {
+      short_prefixes.push_back( entry );
+    }
+  }
+  ranges::stable_sort( short_prefixes, {}, []( const auto& entry ) { return entry.first.second; } );
+  for ( const auto& [key, group_id] : short_prefixes ) {
+    const uint32_t first = key.first >> 16;
+    for ( uint32_t slot = first; slot < first + ( 1U << ( 16 - key.second ) ); ++slot ) {
+      writable_chunk( *table, slot ).slots[slot & 0xFF] = group_id;
+    }
+  }
+
+  // ...then a subtree for each of the root's slots that longer prefixes start under
+  for ( auto it = rib_.begin(); it != rib_.end(); ++it ) {
+    const uint32_t slot = it->first.first >> 16;
+    const uint32_t current = table->root_[slot >> 8]->slots[slot & 0xFF];
+    if ( it->first.second > 16 and not( current & ForwardingTable::CHILD ) ) {
+      rebuild_subtree( *table, slot, current );
+    }
+  }
+
+  return publish( move( table ) );
+}
+
+shared_ptr<const ForwardingTable> ForwardingTableBuilder::add( const Route& route )
+{
+  const Key key { route.prefix & mask( route.prefix_length ), route.prefix_length };
+
+  vector<RoutePath> paths;
+  if ( const auto it = rib_.find( key ); it != rib_.end() ) {
+    const auto old = table_->group_at( it->second );
+    for ( uint32_t i = old.first; i < old.first + old.count; ++i ) {
+      paths.push_back( table_->path_at( i ) );
+    }
+  }
+  if ( ranges::find( paths, route.path ) != paths.end() ) {
+    return table_; // nothing new
+  }
+  paths.push_back( route.path );
+
+  // (copying a table copies only its pointers to root chunks and blocks)
+  auto table = make_shared<ForwardingTable>( *table_ );
+  rib_[key] = group( *table, paths );
+  update( *table, key );
+  return publish( move( table ) );
+}
+
+shared_ptr<const ForwardingTable> ForwardingTableBuilder::remove( const uint32_t prefix,
+                                                                   const uint8_t prefix_length )
+{
+  const Key key { prefix & mask( prefix_length ), prefix_length };
+  if ( rib_.erase( key ) == 0 ) {
+    return table_;
+  }
+  auto table = make_shared<ForwardingTable>( *table_ );
+  update( *table, key );
+  return publish( move( table ) );
+}
+
+// The group for a set of paths, adding it if it's new. (Groups are kept even when no prefix uses them any more,
+// but there are only as many as distinct sets of next hops.) New groups and paths go in the blocks' free entries,
+// which the tables already published never read, or in new blocks.
+uint32_t ForwardingTableBuilder::group( ForwardingTable& table, const vector<RoutePath>& paths )
+{
+  const auto [it, added] = group_ids_.try_emplace( paths, group_count_ );
+  if ( not added ) {
+    return it->second;
+  }
+
+  const ForwardingTable::Paths entry { .first = path_count_, .count = static_cast<uint32_t>( paths.size() ) };
+  for ( const auto& path : paths ) {
+    if ( ( path_count_ & ForwardingTable::BLOCK_MASK ) == 0 ) {
+      table.paths_.push_back( path_blocks_.emplace_back( make_shared<ForwardingTable::PathBlock>() ) );
+    }
+    ( *path_blocks_.back() )[path_count_++ & ForwardingTable::BLOCK_MASK] = path;
+  }
+  if ( ( group_count_ & ForwardingTable::BLOCK_MASK ) == 0 ) {
+    table.groups_.push_back( group_blocks_.emplace_back( make_shared<ForwardingTable::GroupBlock>() ) );
+  }
+  ( *group_blocks_.back() )[group_count_++ & ForwardingTable::BLOCK_MASK] = entry;
+  return it->second;
+}
+
+// The group of the longest prefix, of at most 16 bits, that covers an address
+uint32_t ForwardingTableBuilder::covering_group( const uint32_t address ) const
+{
+  for ( int length = 16; length >= 0; --length ) {
+    const auto prefix_length = static_cast<uint8_t>( length );
+    if ( const auto it = rib_.find( { address & mask( prefix_length ), prefix_length } ); it != rib_.end() ) {
+      return it->second;
+    }
+  }
+  return 0;
+}
+
+// Bring the slots under a prefix up to date with the routes
+void ForwardingTableBuilder::update( ForwardingTable& table, const Key key )
+{
+  const auto [prefix, prefix_length] = key;
+  if ( prefix_length > 16 ) {
+    const uint32_t slot = prefix >> 16;
+    rebuild_subtree( table, slot, covering_group( prefix ) );
+    return;
+  }
+
+  // a short prefix covers many of the root's slots, and is the default for their subtrees
+  const uint32_t first = prefix >> 16;
+  for ( uint32_t slot = first; slot < first + ( 1U << ( 16 - prefix_length ) ); ++slot ) {
+    const uint32_t base = covering_group( slot << 16 );
+    if ( table.root_[slot >> 8]->slots[slot & 0xFF] & ForwardingTable::CHILD ) {
+      rebuild_subtree( table, slot, base );
+    } else {
+      writable_chunk( table, slot ).slots[slot & 0xFF] = base;
+    }
+  }
+}
+
+// Rebuild what's under one of the root's slots, from the prefixes longer than 16 bits that start there (and
+// `base`, the group of the longest shorter one). The old subtree lives on in the tables that still have it.
+void ForwardingTableBuilder::rebuild_subtree( ForwardingTable& table, const uint32_t slot, const uint32_t base )
+{
+  const uint32_t first = slot << 16;
+  const uint32_t last = first | 0xFFFF;
+  vector<pair<Key, uint32_t>> longer;
+  for ( auto it = rib_.lower_bound( { first, 0 } ); it != rib_.end() and it->first.first <= last; ++it ) {
+    if ( it->first.second > 16 ) {
+      longer.push_back( *it );
+    }
+  }
+
+  auto& chunk = writable_chunk( table, slot );
+  if ( longer.empty() ) {
+    chunk.slots[slot & 0xFF] = base;
+    chunk.subtrees[slot & 0xFF].reset();
+    return;
+  }
+
+  // shortest prefixes first, so longer ones overwrite them; prefixes longer than 24 bits get a node of their own
+  ranges::stable_sort( longer, {}, []( const auto& entry ) { return entry.first.second; } );
+  auto subtree = make_shared<ForwardingTable::Subtree>();
+  auto& node = subtree->node;
+  node.fill( base );
+  for ( const auto& [key, group_id] : longer ) {
+    const auto [prefix, prefix_length] = key;
+    const uint32_t index = ( prefix >> 8 ) & 0xFF;
+    if ( prefix_length <= 24 ) {
+      fill_n( node.begin() + index, 1 << ( 24 - prefix_length ), group_id );
+      continue;
+    }
+    if ( not( node[index] & ForwardingTable::CHILD ) ) {
+      subtree->children.emplace_back().fill( node[index] );
+      node[index] = ForwardingTable::CHILD | static_cast<uint32_t>( subtree->children.size() - 1 );
+    }
+    auto& child = subtree->children[node[index] & ~ForwardingTable::CHILD];
+    fill_n( child.begin() + ( prefix & 0xFF ), 1 << ( 32 - prefix_length ), group_id );
+  }
+
+  chunk.slots[slot & 0xFF] = ForwardingTable::CHILD;
+  chunk.subtrees[slot & 0xFF] = move( subtree );
+}
+
+// The root chunk holding a slot, copied first if it's shared with another table. A chunk only this (unpublished)
+// table holds was made by the builder, and nobody else can be reading it.
+ForwardingTable::RootChunk& ForwardingTableBuilder::writable_chunk( ForwardingTable& table, const uint32_t slot )
+{
+  auto& chunk = table.root_[slot >> 8];
+  if ( chunk.use_count() != 1 ) {
+    chunk = make_shared<ForwardingTable::RootChunk>( *chunk );
+  }
+  return const_cast<ForwardingTable::RootChunk&>( *chunk ); // NOLINT(*-const-cast)
+}
+
+shared_ptr<const ForwardingTable> ForwardingTableBuilder::publish( shared_ptr<ForwardingTable> table )
+{
+  table->generation_ = ++generation_;
+  table_ = move( table );
+  return table_;
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <array>
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "ipv4_datagram.hh"
+
+// A way out for datagrams: the interface to send them on, and the next hop (none if the destination is directly
+// attached, in which case the next hop is the destination itself)
+struct RoutePath
+{
+  std::optional<uint32_t> next_hop {};
+  size_t interface_idx {};
+
+  auto operator<=>( const RoutePath& other ) const = default;
+};
+
+// A forwarding rule: datagrams whose destination starts with the `prefix_length` high bits of `prefix` go out
+// by `path` (unless a longer prefix matches too)
+struct Route
+{
+  uint32_t prefix {};
+  uint8_t prefix_length {};
+  RoutePath path {};
+};
+
+// An immutable longest-prefix-match table, which threads can read without locking while a newer one is built.
+//
+// It's a 16-8-8 multibit trie: the top 16 bits of an address index the root, and the slots under which longer
+// prefixes start point to a subtree: a node of 256 slots for the next 8 bits (whose slots can point to a node for
+// the last 8). Each slot ends up at a next-hop group, the equal-cost paths of the longest prefix covering the slot.
+//
+// Everything a table holds is shared with the tables derived from it, so a new one costs only what changed: the
+// root is 256 chunks of 256 slots each (a change copies the chunks it touches), subtrees are replaced whole, and
+// groups and paths are kept in blocks that later tables only append to.
+class ForwardingTable
+{
+public:
+  // A group's paths: paths[first, first + count), or none (count == 0) if no route matches
+  struct Paths
+  {
+    uint32_t first;
+    uint32_t count;
+  };
+
+  ForwardingTable();
+
+  Paths lookup( uint32_t dst ) const;
+
+  // One of a route's paths, picked by a hash of the datagram's 5-tuple if there are several
+  const RoutePath& path( Paths route, const InternetDatagram& dgram ) const;
+
+  // Tells this table apart from earlier ones (e.g. to invalidate lookups cached from them)
+  uint32_t generation() const { return generation_; }
+
+  size_t node_count() const;
+
+private:
+  friend class ForwardingTableBuilder;
+
+  using Node = std::array<uint32_t, 256>;
+  static constexpr uint32_t CHILD = 1U << 31; // a slot with this bit set leads to a node; otherwise, to a group
+
+  // What's under one of the root's slots: a node for the next 8 bits, whose CHILD slots hold an index in `children`
+  struct Subtree
+  {
+    Node node {};
+    std::vector<Node> children {};
+  };
+
+  // 256 of the root's slots, each a group or CHILD (and then the slot's subtree)
+  struct RootChunk
+  {
+    Node slots {};
+    std::array<std::shared_ptr<const Subtree>, 256> subtrees {};
+  };
+
+  static constexpr size_t BLOCK_BITS = 10; // groups and paths are stored in blocks of 1024
+  static constexpr uint32_t BLOCK_MASK = ( 1U << BLOCK_BITS ) - 1;
+  using GroupBlock = std::array<Paths, 1U << BLOCK_BITS>;
+  using PathBlock = std::array<RoutePath, 1U << BLOCK_BITS>;
+
+  std::array<std::shared_ptr<const RootChunk>, 256> root_ {};
+  std::vector<std::shared_ptr<const GroupBlock>> groups_ {}; // group 0 is no route
+  std::vector<std::shared_ptr<const PathBlock>> paths_ {};
+  uint32_t generation_ {};
+
+  const Paths& group_at( uint32_t id ) const { return ( *groups_[id >> BLOCK_BITS] )[id & BLOCK_MASK]; }
+  const RoutePath& path_at( uint32_t index ) const { return ( *paths_[index >> BLOCK_BITS] )[index & BLOCK_MASK]; }
+};
+
+// The routes behind a ForwardingTable, and the changes to them that make new tables. A change rebuilds only the
+// subtrees under the changed prefix, and copies only the root chunks they hang from; everything else is shared
+// with the old table.
+class ForwardingTableBuilder
+{
+public:
+  ForwardingTableBuilder();
+
+  // Replace all the routes. Building the table at once is much faster than adding them one at a time.
+  std::shared_ptr<const ForwardingTable> load( std::vector<Route> routes );
+
+  // Add a route. Routes for the same prefix (and length) are equal-cost paths.
+  std::shared_ptr<const ForwardingTable> add( const Route& route );
+
+  // Remove the routes for a prefix (returning the same table if there weren't any)
+  std::shared_ptr<const ForwardingTable> remove( uint32_t prefix, uint8_t prefix_length );
+
+  std::shared_ptr<const ForwardingTable> table() const { return table_; }
+  size_t prefixes() const { return rib_.size(); }
+
+private:
+  using Key = std::pair<uint32_t, uint8_t>; // (masked prefix, length): a prefix's longer prefixes follow it
+
+  std::map<Key, uint32_t> rib_ {};                           // => group
+  std::map<std::vector<RoutePath>, uint32_t> group_ids_ {}; // each distinct set of paths is one group
+
+  // The blocks of groups and paths, which the builder fills in (past the end of what published tables use)
+  std::vector<std::shared_ptr<ForwardingTable::GroupBlock>> group_blocks_ {};
+  std::vector<std::shared_ptr<ForwardingTable::PathBlock>> path_blocks_ {};
+  uint32_t group_count_ {};
+  uint32_t path_count_ {};
+
+  uint32_t generation_ {};
+  std::shared_ptr<const ForwardingTable> table_ {};
+
+  uint32_t group( ForwardingTable& table, const std::vector<RoutePath>& paths );
+  uint32_t covering_group( uint32_t address ) const;
+  void update( ForwardingTable& table, Key key );
+  void rebuild_subtree( ForwardingTable& table, uint32_t slot, uint32_t base );
+  static ForwardingTable::RootChunk& writable_chunk( ForwardingTable& table, uint32_t slot );
+  std::shared_ptr<const ForwardingTable> publish( std::shared_ptr<ForwardingTable> table );
+};
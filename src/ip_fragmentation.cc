@@ -0,0 +1,210 @@
+#include "ip_fragmentation.hh"
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+
+using namespace std;
+
+namespace {
+// The most payload a datagram can have: its total length is a 16-bit field
+constexpr uint64_t max_payload_length = 0xffff - IPv4Header::LENGTH;
+
+// The header of a fragment after the first: only the options with the copied flag set, padded to whole words
+IPv4Header copied_options_header( const IPv4Header& header )
+{
+  constexpr uint8_t end_of_options = 0;
+  constexpr uint8_t no_operation = 1;
+  constexpr uint8_t copied_flag = 0x80;
+
+  IPv4Header copied = header;
+  copied.options = {};
+  size_t length = 0;
+  for ( size_t i = 0; i < header.options_length(); ) {
+    const uint8_t type = header.options.at( i );
+    if ( type == end_of_options ) {
+      break;
+    }
+    if ( type == no_operation ) {
+      ++i;
+      continue;
+    }
+    // every other option has a length byte, counting the type and itself
+    if ( i + 1 >= header.options_length() or header.options.at( i + 1 ) < 2
+         or i + header.options.at( i + 1 ) > header.options_length() ) {
+      break;
+    }
+    const size_t option_length = header.options.at( i + 1 );
+    if ( type & copied_flag ) {
+      copy_n( header.options.begin() + i, option_length, copied.options.begin() + length );
+      length += option_length;
+    }
+    i += option_length;
+  }
+  copied.hlen = ( IPv4Header::LENGTH + length + 3 ) / 4;
+  return copied;
+}
+} // namespace
+
+size_t FragmentReassembler::KeyHash::operator()( const Key& key ) const
+{
+  const uint64_t addresses = ( static_cast<uint64_t>( key.src ) << 32 ) | key.dst;
+  const uint64_t rest = ( static_cast<uint64_t>( key.id ) << 8 ) | key.proto;
+  return hash<uint64_t> {}( addresses ^ ( rest * 0x9e37'79b9'7f4a'7c15 ) );
+}
+
+FragmentReassembler::FragmentReassembler( size_t memory_limit, size_t timeout_ms, size_t max_datagrams )
+  : memory_limit_( memory_limit ), timeout_ms_( timeout_ms ), max_datagrams_( max_datagrams )
+{}
+
+optional<InternetDatagram> FragmentReassembler::add( InternetDatagram fragment )
+{
+  const IPv4Header& header = fragment.header;
+  const uint64_t start = static_cast<uint64_t>( header.offset ) * 8;
+  const uint64_t length = header.payload_length();
+
+  // every fragment but the last carries a multiple of 8 bytes, and none reaches past the largest datagram (the
+  // payload may also have been padded by the link layer)
+  if ( fragment.payload.size() < length or length == 0 or ( header.mf and length % 8 != 0 )
+       or start + length > max_payload_length ) {
+    ++stats_.malformed;
+    return {};
+  }
+  fragment.payload = fragment.payload.substr( 0, length );
+
+  const Key key { .src = header.src, .dst = header.dst, .id = header.id, .proto = header.proto };
+  auto it = pending_.find( key );
+  if ( it == pending_.end() ) {
+    // make room for a new datagram by dropping the oldest one
+    if ( pending_.size() >= max_datagrams_ and not by_age_.empty() ) {
+      evict_oldest();
+    }
+    it = pending_.emplace( key, Pending { .created_ms = now_ms_, .age_order = next_age_order_ } ).first;
+    by_age_.emplace( next_age_order_++, key );
+    bytes_pending_ += DATAGRAM_OVERHEAD;
+  }
+  Pending& datagram = it->second;
+
+  // the last fragment gives the datagram's length, which no other fragment may contradict
+  const uint64_t end = start + length;
+  uint64_t known_end = 0;
+  if ( not datagram.pieces.empty() ) {
+    const auto& [last_offset, last_piece] = *datagram.pieces.rbegin();
+    known_end = last_offset + last_piece.size();
+  }
+  if ( not header.mf ) {
+    if ( ( datagram.total_length.has_value() and datagram.total_length != end ) or known_end > end ) {
+      ++stats_.malformed;
+      drop( it );
+      return {};
+    }
+    datagram.total_length = end;
+  } else if ( datagram.total_length.has_value() and end > *datagram.total_length ) {
+    ++stats_.malformed;
+    drop( it );
+    return {};
+  }
+
+  // a duplicate is ignored, but any other overlap drops the datagram
+  auto next = datagram.pieces.lower_bound( start );
+  if ( next != datagram.pieces.end() and next->first == start and next->second.size() == length ) {
+    return {};
+  }
+  const bool overlaps_next = next != datagram.pieces.end() and next->first < end;
+  const bool overlaps_prev
+    = next != datagram.pieces.begin() and prev( next )->first + prev( next )->second.size() > start;
+  if ( overlaps_next or overlaps_prev ) {
+    ++stats_.malformed;
+    drop( it );
+    return {};
+  }
+
+  if ( start == 0 ) {
+    datagram.first_header = header;
+  }
+  datagram.pieces.emplace_hint( next, start, move( fragment.payload ) );
+  datagram.bytes += length;
+  bytes_pending_ += length + PIECE_OVERHEAD;
+
+  // without overlaps, the pieces cover the datagram once they add up to its length
+  if ( datagram.total_length == datagram.bytes ) {
+    InternetDatagram whole;
+    whole.header = *datagram.first_header;
+    whole.header.mf = false; // with the first fragment's options, which are all of them
+    whole.header.offset = 0;
+    whole.header.len = whole.header.hlen * 4 + datagram.bytes;
+    whole.header.compute_checksum();
+    for ( const auto& [offset, piece] : datagram.pieces ) {
+      whole.payload.append( piece );
+    }
+
+    drop( it );
+    ++stats_.reassembled;
+    return whole;
+  }
+
+  // make room by dropping the oldest datagrams (possibly this one)
+  while ( bytes_pending_ > memory_limit_ and not by_age_.empty() ) {
+    evict_oldest();
+  }
+
+  return {};
+}
+
+void FragmentReassembler::tick( const size_t ms_since_last_tick )
+{
+  now_ms_ += ms_since_last_tick;
+  while ( not by_age_.empty() ) {
+    const auto it = pending_.find( by_age_.begin()->second );
+    if ( now_ms_ - it->second.created_ms < timeout_ms_ ) {
+      break;
+    }
+    drop( it );
+    ++stats_.timed_out;
+  }
+}
+
+void FragmentReassembler::drop( unordered_map<Key, Pending, KeyHash>::iterator it )
+{
+  bytes_pending_ -= DATAGRAM_OVERHEAD + it->second.bytes + it->second.pieces.size() * PIECE_OVERHEAD;
+  by_age_.erase( it->second.age_order );
+  pending_.erase( it );
+}
+
+void FragmentReassembler::evict_oldest()
+{
+  drop( pending_.find( by_age_.begin()->second ) );
+  ++stats_.evicted;
+}
+
+vector<InternetDatagram> fragment_datagram( const InternetDatagram& dgram, const size_t mtu )
+{
+  if ( dgram.header.hlen * 4UL + dgram.payload.size() <= mtu ) {
+    return { dgram };
+  }
+  if ( mtu < dgram.header.hlen * 4UL + 8 ) {
+    throw runtime_error( "fragment_datagram: MTU of " + to_string( mtu ) + " bytes is too small" );
+  }
+
+  // the first fragment keeps all of the options, and the others only those with the copied flag
+  const IPv4Header later_header = copied_options_header( dgram.header );
+
+  const BufferList payload = dgram.payload.substr( 0, dgram.header.payload_length() );
+
+  vector<InternetDatagram> fragments;
+  for ( size_t pos = 0; pos < payload.size(); ) {
+    const IPv4Header& header = pos == 0 ? dgram.header : later_header;
+    const size_t max_piece = ( mtu - header.hlen * 4UL ) / 8 * 8; // offsets are in units of 8 bytes
+    const size_t piece = min( max_piece, payload.size() - pos );
+    InternetDatagram& fragment = fragments.emplace_back();
+    fragment.header = header;
+    fragment.header.len = header.hlen * 4 + piece;
+    fragment.header.offset = dgram.header.offset + pos / 8;
+    fragment.header.mf = dgram.header.mf or pos + piece < payload.size();
+    fragment.header.compute_checksum();
+    fragment.payload = payload.substr( pos, piece );
+    pos += piece;
+  }
+  return fragments;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include "ipv4_datagram.hh"
+
+// Reassembles IPv4 datagrams from their fragments ([RFC 791](\ref rfc::rfc791), section 3.2).
+//
+// Fragments are grouped by (source, destination, identification, protocol). Each group keeps its pieces of
+// payload in a map from offset to bytes (sharing the fragments' storage), so that it can tell when the pieces
+// cover the whole datagram. A group that doesn't complete within the timeout is dropped, and so are the oldest
+// groups when the memory held would exceed the limit, or a new group would exceed the maximum number of groups.
+// Each group and each piece is charged a fixed overhead on top of its payload, so a flood of tiny fragments
+// can't hold much more memory than the limit. Overlapping fragments (other than exact duplicates) drop their whole
+// group, since reassembling them is ambiguous (and a known attack).
+class FragmentReassembler
+{
+public:
+  static constexpr size_t DEFAULT_MEMORY_LIMIT = 4 * 1024 * 1024; // bytes held at once, overheads included
+  static constexpr size_t DEFAULT_TIMEOUT_MS = 30000;             // before an incomplete datagram is dropped
+  static constexpr size_t DEFAULT_MAX_DATAGRAMS = 1024;           // incomplete datagrams held at once
+
+  static constexpr size_t DATAGRAM_OVERHEAD = 256; // bytes charged per incomplete datagram (hash and age entries)
+  static constexpr size_t PIECE_OVERHEAD = 64;     // ...and per piece of payload (map node and buffer handle)
+
+  struct Stats
+  {
+    uint64_t reassembled {}; // Datagrams completed
+    uint64_t timed_out {};   // Incomplete datagrams dropped by the timeout
+    uint64_t evicted {};     // Incomplete datagrams dropped to stay within the memory or datagram limit
+    uint64_t malformed {};   // Fragments (or whole groups, for overlaps) dropped as invalid
+  };
+
+  explicit FragmentReassembler( size_t memory_limit = DEFAULT_MEMORY_LIMIT,
+                                size_t timeout_ms = DEFAULT_TIMEOUT_MS,
+                                size_t max_datagrams = DEFAULT_MAX_DATAGRAMS );
+
+  // Is the datagram a fragment (rather than a whole datagram)?
+  static bool is_fragment( const IPv4Header& header ) { return header.mf or header.offset != 0; }
+
+  // Add a fragment. Returns the whole datagram if this was the last piece missing.
+  std::optional<InternetDatagram> add( InternetDatagram fragment );
+
+  // Called periodically when time elapses; drops incomplete datagrams that have waited too long
+  void tick( size_t ms_since_last_tick );
+
+  size_t datagrams_pending() const { return pending_.size(); }
+  size_t bytes_pending() const { return bytes_pending_; } // payload held, plus the overheads
+  const Stats& stats() const { return stats_; }
+
+private:
+  struct Key
+  {
+    uint32_t src;
+    uint32_t dst;
+    uint16_t id;
+    uint8_t proto;
+
+    bool operator==( const Key& other ) const = default;
+  };
+
+  struct KeyHash
+  {
+    size_t operator()( const Key& key ) const;
+  };
+
+  // A datagram being reassembled
+  struct Pending
+  {
+    std::map<uint64_t, BufferList> pieces {}; // offset => payload bytes, not overlapping
+    std::optional<IPv4Header> first_header {}; // from the fragment at offset 0
+    std::optional<uint64_t> total_length {};   // payload length, once the last fragment has arrived
+    uint64_t bytes {};                         // payload bytes held
+    uint64_t created_ms {};
+    uint64_t age_order {}; // key in by_age_
+  };
+
+  size_t memory_limit_;
+  size_t timeout_ms_;
+  size_t max_datagrams_;
+  uint64_t now_ms_ {};
+  uint64_t next_age_order_ {};
+
+  std::unordered_map<Key, Pending, KeyHash> pending_ {};
+  std::map<uint64_t, Key> by_age_ {}; // pending datagrams, oldest first
+  size_t bytes_pending_ {};
+  Stats stats_ {};
+
+  void drop( std::unordered_map<Key, Pending, KeyHash>::iterator it );
+  void evict_oldest();
+};
+
+// Split a datagram into fragments that fit within `mtu` bytes (which must hold at least the header and 8 bytes of
+// payload). The fragments share the datagram's payload. The first fragment keeps all of the datagram's options,
+// and the others only those to be copied into every fragment. A datagram that already fits is returned as it is.
+std::vector<InternetDatagram> fragment_datagram( const InternetDatagram& dgram, size_t mtu );
@@ -2,6 +2,7 @@
 
 #include "arp_message.hh"
 #include "exception.hh"
+#include "flow_hash.hh"
 #include "network_interface.hh"
 
 using namespace std;
@@ -22,7 +23,7 @@ NetworkInterface::NetworkInterface( string_view name,
 }
 
 // 在该方法中，我们要将给定的下一跳 IP 地址转换为对应的以太网地址，并把 IP 数据报封装为以太网帧的 payload。
-// 当目的以太网地址已知时，使用serialize() 函数将 dgram 序列化为 std::vector<std::string>类型，并装入
+// 当目的以太网地址已知时，使用serialize() 函数将 dgram 序列化为 BufferList类型，并装入
 // EthernetFrame::payload 中； 接着完成以太网帧头部EthernetFrame::header
 // 的变量设置，最后把组装好的数据帧转发出去。 如果目的以太网地址未知，这时就需要组装一个 ARPMessage
 // 请求对应的以太网地址，再将这个ARP请求序列化后装载以太网帧中发出。 文档提到：为了避免频繁的 ARP
@@ -36,23 +37,32 @@ void NetworkInterface::send_datagram( const InternetDatagram& dgram, const Addre
   // 当调用者（如你的TCPConnection或路由器）希望将出站互联网（IP）数据报发送到下一跳时调用此方法。你的接口的任务是将此数据报转换为以太网帧并（最终）发送它。
   const auto ip = next_hop.ipv4_numeric();
   // 如果目标以太网地址已知，立即发送。创建一个以太网帧（类型为EthernetHeader::TYPE_IPv4），将有效载荷设置为序列化的数据报，并设置源地址和目标地址。
-  if ( arp_map_.contains( ip ) ) {
+  if ( const auto entry = arp_map_.find( ip ); entry != arp_map_.end() ) {
+    auto& mapping = entry->second;
+    mapping.used = true;
+    // 刷新过的映射在旧映射本该过期之后第一次被使用：若没有刷新，这个数据报就要等待 ARP 解析
+    if ( mapping.old_expiry_ms.has_value() && mapping.age >= *mapping.old_expiry_ms ) {
+      ++arp_stats_.stalls_avoided;
+      mapping.old_expiry_ms.reset();
+    }
     EthernetHeader header {
-      .dst = arp_map_[ip].first, .src = ethernet_address_, .type = EthernetHeader::TYPE_IPv4 };
-    transmit( { .header = header, .payload = serialize( dgram ) } );
+      .dst = mapping.ethernet_address, .src = ethernet_address_, .type = EthernetHeader::TYPE_IPv4 };
+    send_ipv4( { .header = header, .payload = serialize( dgram ) }, dgram );
   }
   // 如果目标以太网地址未知，广播一个ARP请求以获取下一跳的以太网地址，并将IP数据报排队，以便在收到ARP回复后发送。
   else {
-    if ( wait_list_.contains( ip ) ) // 过去5000ms内已发送过相同IP地址的ARP请求
-      return;
-    EthernetHeader header { .dst = ETHERNET_BROADCAST, .src = ethernet_address_, .type = EthernetHeader::TYPE_ARP };
-    ARPMessage req { .opcode = ARPMessage::OPCODE_REQUEST,
-                     .sender_ethernet_address = ethernet_address_,
-                     .sender_ip_address = ip_address_.ipv4_numeric(),
-                     .target_ethernet_address = ETHERNET_REQUEST_ADDRESS,
-                     .target_ip_address = ip };
-    transmit( { .header = header, .payload = serialize( req ) } );
-    wait_list_[ip].first.emplace_back( dgram );
+    // 已在等待回复的下一跳不再发送请求，由 tick() 负责重传
+    if ( const auto it = wait_list_.find( ip ); it != wait_list_.end() ) {
+      queue_pending( it->second, dgram );
+    } else {
+      // 新的下一跳：数据报因接口上限被丢弃时，不为它建立等待项，也不发送请求。
+      // 先排队再发送请求：回复可能在 transmit() 返回之前就到达
+      Pending pending;
+      if ( queue_pending( pending, dgram ) ) {
+        wait_list_.emplace( ip, move( pending ) );
+        send_arp_request( ip );
+      }
+    }
   }
   // 例外：你不想用ARP请求淹没网络。如果网络接口在过去5秒内已发送过相同IP地址的ARP请求，不要发送第二个请求——只需等待第一个请求的回复。同样，将数据报排队直到你获取目标以太网地址。
 }
@@ -78,7 +88,14 @@ void NetworkInterface::recv_frame( const EthernetFrame& frame )
   if ( header.type == EthernetHeader::TYPE_IPv4 ) {
     InternetDatagram dgram;
     if ( parse( dgram, frame.payload ) ) {
-      datagrams_received_.push( dgram );
+      // 发给本接口的分片先重组，凑齐后再推送完整的数据报；路过的分片（路由器转发的）原样推送。
+      if ( FragmentReassembler::is_fragment( dgram.header ) && dgram.header.dst == ip_address_.ipv4_numeric() ) {
+        if ( auto whole = fragments_.add( move( dgram ) ) ) {
+          datagrams_received_.push( move( *whole ) );
+        }
+      } else {
+        datagrams_received_.push( move( dgram ) );
+      }
     }
   }
 
@@ -89,7 +106,20 @@ void NetworkInterface::recv_frame( const EthernetFrame& frame )
       // 学习新的地址映射关系
       const auto sender_ip = arp.sender_ip_address;
       const auto sender_ethernet = arp.sender_ethernet_address;
-      arp_map_[sender_ip].first = sender_ethernet;
+      auto& mapping = arp_map_[sender_ip];
+      if ( mapping.refreshing ) {
+        ++arp_stats_.refreshed;
+        mapping.old_expiry_ms = ARP_MAP_TTL - mapping.age;
+      } else {
+        // 未经刷新、由主动的请求或回复重新学到的映射：没有旧映射可以比较
+        mapping.old_expiry_ms.reset();
+      }
+      mapping.ethernet_address = sender_ethernet;
+      mapping.age = 0;
+      mapping.used = false;
+      mapping.refreshing = false;
+      // 无论请求还是响应，学到映射后就把等待它的数据报发出去
+      send_pending( sender_ip, sender_ethernet );
       // 如果是询问我们IP地址的ARP请求，发送一个适当的ARP回复。
       if ( arp.opcode == ARPMessage::OPCODE_REQUEST && arp.target_ip_address == ip_address_.ipv4_numeric() ) {
         EthernetHeader reply_header {
@@ -99,18 +129,7 @@ void NetworkInterface::recv_frame( const EthernetFrame& frame )
                            .sender_ip_address = ip_address_.ipv4_numeric(),
                            .target_ethernet_address = arp.sender_ethernet_address,
                            .target_ip_address = arp.sender_ip_address };
-        transmit( { .header = reply_header, .payload = serialize( reply ) } );
-      }
-      // 如果是 ARP 响应，那么就将先前缓存的、现在能发送的IP数据报全部发送出去。
-      else {
-        if ( wait_list_.contains( sender_ip ) ) {
-          for ( auto& dgram : wait_list_[sender_ip].first ) {
-            EthernetHeader dgram_header {
-              .dst = sender_ethernet, .src = ethernet_address_, .type = EthernetHeader::TYPE_IPv4 };
-            transmit( { .header = dgram_header, .payload = serialize( dgram ) } );
-          }
-        }
-        wait_list_.erase( sender_ip );
+        send_arp( { .header = reply_header, .payload = serialize( reply ) } );
       }
     }
   }
@@ -120,20 +139,175 @@ void NetworkInterface::recv_frame( const EthernetFrame& frame )
 void NetworkInterface::tick( const size_t ms_since_last_tick )
 {
   // 随着时间流逝调用此方法。使任何已过期的IP到以太网映射失效。
+  // 开启刷新时，快要过期、且正在使用的映射先单播一个 ARP 请求；等待回复期间旧映射照常使用
+  vector<pair<uint32_t, EthernetAddress>> refresh;
   for ( auto it = arp_map_.begin(); it != arp_map_.end(); ) {
-    it->second.second += ms_since_last_tick;
-    if ( it->second.second >= ARP_MAP_TTL ) {
+    auto& mapping = it->second;
+    mapping.age += ms_since_last_tick;
+    if ( mapping.age >= ARP_MAP_TTL ) {
       it = arp_map_.erase( it );
-    } else {
-      ++it;
+      continue;
+    }
+    if ( arp_refresh_ && mapping.used && !mapping.refreshing && mapping.age + ARP_REFRESH_LEAD >= ARP_MAP_TTL ) {
+      mapping.refreshing = true;
+      refresh.emplace_back( it->first, mapping.ethernet_address );
     }
+    ++it;
   }
+  // （遍历结束后再发送：回复可能同步到达并修改 arp_map_）
+  for ( const auto& [ip, ethernet_address] : refresh ) {
+    send_arp_refresh( ip, ethernet_address );
+  }
+  // 没有回复的下一跳按指数退避重传 ARP 请求；发满 ARP_MAX_REQUESTS 次仍无回复则放弃，丢弃排队的数据报
+  vector<uint32_t> retransmit;
   for ( auto it = wait_list_.begin(); it != wait_list_.end(); ) {
-    it->second.second += ms_since_last_tick;
-    if ( it->second.second >= ARP_RETX_PERIOD ) {
-      it = wait_list_.erase( it );
-    } else {
+    auto& pending = it->second;
+    pending.ms_since_request += ms_since_last_tick;
+    if ( pending.ms_since_request < ARP_RETX_PERIOD << ( pending.requests - 1 ) ) {
+      ++it;
+    } else if ( pending.requests < ARP_MAX_REQUESTS ) {
+      retransmit.push_back( it->first );
       ++it;
+    } else {
+      ++arp_stats_.unresolved;
+      arp_stats_.dropped_unresolved += pending.datagrams.size();
+      pending_bytes_ -= pending.bytes;
+      it = wait_list_.erase( it );
+    }
+  }
+  // （遍历结束后再发送：回复可能同步到达并修改 wait_list_）
+  for ( const auto ip : retransmit ) {
+    if ( wait_list_.contains( ip ) ) {
+      ++arp_stats_.retransmissions;
+      send_arp_request( ip );
     }
   }
+  // 丢弃超时仍未重组完成的分片
+  fragments_.tick( ms_since_last_tick );
+  // 令牌桶随时间补充令牌，排队的帧按调度顺序发出
+  egress_.tick( ms_since_last_tick );
+  transmit_queued();
+}
+
+// 把数据报加入下一跳的等待队列。超过单个下一跳的上限时丢弃它最旧的数据报；超过整个接口的上限时丢弃新的数据报。
+// 先算出腾出空间要丢弃几个旧数据报，确认新数据报放得下之后才真正丢弃，免得新旧数据报都丢失。返回是否已排队。
+bool NetworkInterface::queue_pending( Pending& pending, const InternetDatagram& dgram )
+{
+  const size_t size = dgram.header.len;
+  size_t evicted = 0;
+  size_t freed = 0;
+  while ( evicted < pending.datagrams.size() && pending.bytes - freed + size > PENDING_NEIGHBOR_LIMIT ) {
+    freed += pending.datagrams[evicted].header.len;
+    ++evicted;
+  }
+  if ( pending_bytes_ - freed + size > PENDING_INTERFACE_LIMIT ) {
+    ++arp_stats_.dropped_interface_limit;
+    return false;
+  }
+
+  pending.datagrams.erase( pending.datagrams.begin(),
+                           pending.datagrams.begin() + static_cast<ptrdiff_t>( evicted ) );
+  pending.bytes -= freed;
+  pending_bytes_ -= freed;
+  arp_stats_.dropped_neighbor_limit += evicted;
+
+  pending.datagrams.push_back( dgram );
+  pending.bytes += size;
+  pending_bytes_ += size;
+  return true;
+}
+
+// 广播 ARP 请求，并记下发送的次数和时间
+void NetworkInterface::send_arp_request( const uint32_t ip )
+{
+  auto& pending = wait_list_.at( ip );
+  ++pending.requests;
+  pending.ms_since_request = 0;
+  ++arp_stats_.requests;
+
+  EthernetHeader header { .dst = ETHERNET_BROADCAST, .src = ethernet_address_, .type = EthernetHeader::TYPE_ARP };
+  ARPMessage req { .opcode = ARPMessage::OPCODE_REQUEST,
+                   .sender_ethernet_address = ethernet_address_,
+                   .sender_ip_address = ip_address_.ipv4_numeric(),
+                   .target_ethernet_address = ETHERNET_REQUEST_ADDRESS,
+                   .target_ip_address = ip };
+  send_arp( { .header = header, .payload = serialize( req ) } );
+}
+
+// 向映射的主人单播 ARP 请求，确认映射仍然有效
+void NetworkInterface::send_arp_refresh( const uint32_t ip, const EthernetAddress& ethernet_address )
+{
+  ++arp_stats_.refreshes;
+  EthernetHeader header { .dst = ethernet_address, .src = ethernet_address_, .type = EthernetHeader::TYPE_ARP };
+  ARPMessage req { .opcode = ARPMessage::OPCODE_REQUEST,
+                   .sender_ethernet_address = ethernet_address_,
+                   .sender_ip_address = ip_address_.ipv4_numeric(),
+                   .target_ethernet_address = ethernet_address,
+                   .target_ip_address = ip };
+  send_arp( { .header = header, .payload = serialize( req ) } );
+}
+
+// 按顺序发出等待某个下一跳的数据报
+void NetworkInterface::send_pending( const uint32_t ip, const EthernetAddress& ethernet_address )
+{
+  const auto it = wait_list_.find( ip );
+  if ( it == wait_list_.end() ) {
+    return;
+  }
+  // 先从 wait_list_ 中取出：发送时可能再次进入本接口
+  Pending pending = move( it->second );
+  wait_list_.erase( it );
+  pending_bytes_ -= pending.bytes;
+  for ( const auto& dgram : pending.datagrams ) {
+    EthernetHeader header { .dst = ethernet_address, .src = ethernet_address_, .type = EthernetHeader::TYPE_IPv4 };
+    send_ipv4( { .header = header, .payload = serialize( dgram ) }, dgram );
+  }
+}
+
+void NetworkInterface::set_mtu( const size_t mtu )
+{
+  if ( mtu < MIN_MTU ) {
+    throw runtime_error( "set_mtu: MTU of " + to_string( mtu ) + " bytes is below the IPv4 minimum of "
+                         + to_string( MIN_MTU ) );
+  }
+  mtu_ = mtu;
+}
+
+void NetworkInterface::set_egress_rate( const uint64_t bytes_per_second, const size_t burst )
+{
+  egress_.set_rate( bytes_per_second, burst );
+  transmit_queued();
+}
+
+// 链路空闲（不限速且没有排队的帧）时直接发送；否则进入出口队列，按类别和流调度。ARP 帧严格优先。
+void NetworkInterface::send_arp( EthernetFrame&& frame )
+{
+  if ( egress_.idle() ) {
+    egress_.sent_directly( EgressQueue::CONTROL );
+    transmit( frame );
+    return;
+  }
+  egress_.push( move( frame ), EgressQueue::CONTROL, 0 );
+  transmit_queued();
+}
+
+// IPv4 帧按 TOS 分类，按五元组哈希分流
+void NetworkInterface::send_ipv4( EthernetFrame&& frame, const InternetDatagram& dgram )
+{
+  const auto traffic_class = EgressQueue::classify( dgram.header.tos );
+  if ( egress_.idle() ) {
+    egress_.sent_directly( traffic_class );
+    transmit( frame );
+    return;
+  }
+  egress_.push( move( frame ), traffic_class, flow_hash( dgram ) );
+  transmit_queued();
+}
+
+// 在令牌允许的范围内发出排队的帧
+void NetworkInterface::transmit_queued()
+{
+  while ( auto frame = egress_.pop() ) {
+    transmit( *frame );
+  }
 }
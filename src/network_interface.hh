@@ -1,10 +1,15 @@
 #pragma once
 
+#include <deque>
 #include <map>
+#include <optional>
 #include <queue>
 
 #include "address.hh"
+#include "buffer_pool.hh"
+#include "egress_queue.hh"
 #include "ethernet_frame.hh"
+#include "ip_fragmentation.hh"
 #include "ipv4_datagram.hh"
 
 // A "network interface" that connects IP (the internet layer, or network layer)
@@ -31,6 +36,10 @@
 class NetworkInterface
 {
 public:
+  // Received datagrams, queued in blocks from the PacketBufferPool
+  using DatagramQueue
+    = std::queue<InternetDatagram, std::deque<InternetDatagram, PacketAllocator<InternetDatagram>>>;
+
   // An abstraction for the physical output port where the NetworkInterface sends Ethernet frames
   class OutputPort
   {
@@ -52,7 +61,8 @@ public:
   void send_datagram( const InternetDatagram& dgram, const Address& next_hop );
 
   // Receives an Ethernet frame and responds appropriately.
-  // If type is IPv4, pushes the datagram to the datagrams_in queue.
+  // If type is IPv4, pushes the datagram to the datagrams_in queue (fragments addressed to this interface are
+  // reassembled first; fragments passing through are pushed as they are).
   // If type is ARP request, learn a mapping from the "sender" fields, and send an ARP reply.
   // If type is ARP reply, learn a mapping from the "sender" fields.
   void recv_frame( const EthernetFrame& frame );
@@ -64,10 +74,54 @@ public:
   const std::string& name() const { return name_; }
   const OutputPort& output() const { return *port_; }
   OutputPort& output() { return *port_; }
-  std::queue<InternetDatagram>& datagrams_received() { return datagrams_received_; }
+  DatagramQueue& datagrams_received() { return datagrams_received_; }
+  const FragmentReassembler::Stats& fragment_stats() const { return fragments_.stats(); }
+
+  // The largest datagram the link carries (a router fragments larger ones it sends out of this interface). Throws
+  // for an MTU below MIN_MTU, which every IPv4 link must carry.
+  size_t mtu() const { return mtu_; }
+  void set_mtu( size_t mtu );
+
+  // Shape what the interface sends to `bytes_per_second`, in bursts of up to `burst` bytes (a rate of 0, the
+  // default, leaves it unshaped). Frames that can't go out yet wait in the EgressQueue, which schedules them by
+  // class (ARP first, then IPv4 by type of service) and by flow.
+  void set_egress_rate( uint64_t bytes_per_second, size_t burst );
+  size_t egress_queued_bytes() const { return egress_.queued_bytes(); }
+  const EgressQueue::Stats& egress_stats() const { return egress_.stats(); }
+
+  // How the interface has fared resolving addresses with ARP, and what it did with datagrams that waited on it
+  struct ARPStats
+  {
+    uint64_t requests {};                // ARP requests sent (including retransmissions)
+    uint64_t retransmissions {};         // requests sent again for lack of a reply
+    uint64_t unresolved {};              // next hops given up on after ARP_MAX_REQUESTS unanswered requests
+    uint64_t dropped_unresolved {};      // datagrams dropped for their next hop's giving up
+    uint64_t dropped_neighbor_limit {};  // datagrams dropped for a next hop's PENDING_NEIGHBOR_LIMIT
+    uint64_t dropped_interface_limit {}; // datagrams dropped for the PENDING_INTERFACE_LIMIT
+    uint64_t refreshes {};               // unicast requests sent to refresh mappings in use (see set_arp_refresh)
+    uint64_t refreshed {};               // mappings renewed by a reply to one
+    uint64_t stalls_avoided {};          // refreshed mappings used after their old one would have expired (once
+                                         // each: the datagram then would have waited for ARP without refresh)
+  };
+  const ARPStats& arp_stats() const { return arp_stats_; }
+
+  // Bytes of datagrams waiting for their next hop's Ethernet address
+  size_t pending_bytes() const { return pending_bytes_; }
 
-  static constexpr size_t ARP_RETX_PERIOD = 5000;
+  // Refresh mappings that are in use before they expire (off by default): ARP_REFRESH_LEAD ms before a mapping
+  // that datagrams have been sent with reaches ARP_MAP_TTL, ask its owner again with a unicast request, and keep
+  // using the mapping meanwhile. A reply renews it, so busy flows don't stall on ARP every ARP_MAP_TTL; without
+  // one, the mapping expires as usual.
+  void set_arp_refresh( bool enabled ) { arp_refresh_ = enabled; }
+
+  static constexpr size_t ARP_RETX_PERIOD = 5000; // before the first retransmission (doubling after each one)
+  static constexpr size_t ARP_MAX_REQUESTS = 3;   // sent before giving up on a next hop (after 35 s in all)
   static constexpr size_t ARP_MAP_TTL = 30000;
+  static constexpr size_t ARP_REFRESH_LEAD = 5000;
+  static constexpr size_t PENDING_NEIGHBOR_LIMIT = 64 * 1024;    // bytes waiting on one next hop (oldest dropped)
+  static constexpr size_t PENDING_INTERFACE_LIMIT = 1024 * 1024; // waiting on any (newest dropped)
+  static constexpr size_t DEFAULT_MTU = 1500;
+  static constexpr size_t MIN_MTU = 68; // RFC 791: a 60-byte header and an 8-byte fragment
 
 private:
   // Human-readable name of the interface
@@ -77,6 +131,12 @@ private:
   std::shared_ptr<OutputPort> port_;
   void transmit( const EthernetFrame& frame ) const { port_->transmit( *this, frame ); }
 
+  // Frames waiting for the link, and helpers that send frames through them
+  EgressQueue egress_ {};
+  void send_arp( EthernetFrame&& frame );
+  void send_ipv4( EthernetFrame&& frame, const InternetDatagram& dgram );
+  void transmit_queued();
+
   // Ethernet (known as hardware, network-access-layer, or link-layer) address of the interface
   EthernetAddress ethernet_address_;
 
@@ -84,11 +144,43 @@ private:
   Address ip_address_;
 
   // Datagrams that have been received
-  std::queue<InternetDatagram> datagrams_received_ {};
+  DatagramQueue datagrams_received_ {};
+
+  // Fragments of datagrams addressed to this interface, until they are whole
+  FragmentReassembler fragments_ {};
+
+  size_t mtu_ { DEFAULT_MTU };
+
+  // 以太网地址缓存中的一项
+  struct ARPEntry
+  {
+    EthernetAddress ethernet_address {};
+    size_t age {};                          // 学到（或刷新）以来的毫秒数
+    bool used {};                           // 学到以来是否用它发送过数据报
+    bool refreshing {};                     // 是否已发出刷新请求、正在等待回复
+    std::optional<size_t> old_expiry_ms {}; // 刷新后：旧映射本该过期的时刻（以 age 计）
+  };
 
   // 以太网地址缓存
-  std::map<uint32_t, std::pair<EthernetAddress, size_t>> arp_map_ {};
+  std::map<uint32_t, ARPEntry> arp_map_ {};
+  bool arp_refresh_ {};
+
+  // 等待 ARP 解析的下一跳：排队的数据报，以及 ARP 请求的重传状态
+  struct Pending
+  {
+    std::deque<InternetDatagram> datagrams {};
+    size_t bytes {};
+    size_t ms_since_request {};
+    size_t requests {}; // 已发送的 ARP 请求数
+  };
 
   // ARP请求缓存
-  std::map<uint32_t, std::pair<std::vector<InternetDatagram>, size_t>> wait_list_ {};
+  std::map<uint32_t, Pending> wait_list_ {};
+  size_t pending_bytes_ {};
+  ARPStats arp_stats_ {};
+
+  bool queue_pending( Pending& pending, const InternetDatagram& dgram );
+  void send_arp_request( uint32_t ip );
+  void send_pending( uint32_t ip, const EthernetAddress& ethernet_address );
+  void send_arp_refresh( uint32_t ip, const EthernetAddress& ethernet_address );
 };
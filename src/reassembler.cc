@@ -3,7 +3,7 @@
 
 using namespace std;
 
-void Reassembler::insert( uint64_t first_index, string data, bool is_last_substring )
+void Reassembler::insert( uint64_t first_index, Buffer data, bool is_last_substring )
 {
   // 检查是否接收字符串
   auto& writer_ = output_.writer();
@@ -22,51 +22,40 @@ void Reassembler::insert( uint64_t first_index, string data, bool is_last_substr
 
   // 去掉过时数据
   if ( first_index < expecting_index_ ) {
-    data.erase( 0, expecting_index_ - first_index );
+    data.remove_prefix( expecting_index_ - first_index );
     first_index = expecting_index_;
   }
   // 去掉超出可接受范围的数据
-  if ( first_index + data.size() >= unacceptable_index_ ) {
-    data.resize( unacceptable_index_ - first_index );
-  }
-
-  // 寻找需要合并的区间
-  auto left = upper_bound( lists.begin(), lists.end(), first_index, []( uint64_t idx, auto&& e ) {
-    return idx < e.first + e.second.size(); // 找到第一个满足idx<e.first的元素
-  } );
-  auto right = lower_bound( lists.begin(), lists.end(), first_index + data.size(), []( auto&& e, uint64_t idx ) {
-    return e.first < idx; // 找到第一个满足idx<=e.first的元素
-  } );
-
-  // 如果有必要，合并左端点数据
-  if ( left != lists.end() && first_index > left->first ) {
-    data.insert( 0, left->second, 0, first_index - left->first );
-    first_index = left->first; // 更新first_index
-  }
+  const uint64_t end_index = max( first_index, min( first_index + data.size(), unacceptable_index_ ) );
+  data.remove_suffix( first_index + data.size() - end_index );
 
-  // 如果有必要，合并右端点数据
-  if ( right != lists.begin() && first_index + data.size() < prev( right )->first + prev( right )->second.size() ) {
-    auto temp = prev( right )->second.substr( first_index + data.size() - prev( right )->first );
-    data.append( temp );
+  // 只保存尚未收到的部分，已保存的片段互不重叠
+  // 切片与data共享存储，不复制；过短的切片则复制一份，以免占住整个数据包缓冲区
+  uint64_t index = first_index;
+  auto next = pending_.upper_bound( index ); // 第一个起点在index之后的片段
+  if ( next != pending_.begin() ) {
+    const auto& [start, piece] = *prev( next );
+    index = max( index, start + piece.size() );
   }
-
-  // 去掉中间的数据重复的节点
-  for ( ; left != right; left = lists.erase( left ) ) {
-    bytes_pending_ -= left->second.size();
+  while ( index < end_index ) {
+    const uint64_t gap_end = next == pending_.end() ? end_index : min( end_index, next->first );
+    if ( gap_end > index ) {
+      pending_.emplace_hint( next, index, output_.compact( data.substr( index - first_index, gap_end - index ) ) );
+      bytes_pending_ += gap_end - index;
+    }
+    if ( next == pending_.end() ) {
+      break;
+    }
+    index = next->first + next->second.size(); // 跳过已保存的片段
+    ++next;
   }
 
-  // 插入
-  bytes_pending_ += data.size();
-  if ( !data.empty() )
-    lists.insert( left, { first_index, move( data ) } );
-
   // push数据
-  while ( !lists.empty() && lists.front().first == expecting_index_ ) {
-    auto it = lists.front();
-    bytes_pending_ -= it.second.size();
-    expecting_index_ += it.second.size();
-    writer_.push( move( it.second ) );
-    lists.pop_front();
+  while ( !pending_.empty() && pending_.begin()->first == expecting_index_ ) {
+    auto node = pending_.extract( pending_.begin() );
+    bytes_pending_ -= node.mapped().size();
+    expecting_index_ += node.mapped().size();
+    writer_.push( move( node.mapped() ) );
   }
 
   // 判断写端是否需要关闭
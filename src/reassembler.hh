@@ -1,20 +1,19 @@
 #pragma once
 
 #include "byte_stream.hh"
-#include <list>
+#include <map>
 #include <string>
-#include <tuple>
 
 class Reassembler
 {
 public:
-  // Construct Reassembler to write into given ByteStream.
+  // Construct Reassembler to write into given ByteStream (pending substrings are kept in its memory resource).
   explicit Reassembler( ByteStream&& output ) : output_( std::move( output ) ) {}
 
   /*
    * Insert a new substring to be reassembled into a ByteStream.
    *   `first_index`: the index of the first byte of the substring
-   *   `data`: the substring itself
+   *   `data`: the substring itself (kept, or pushed on, without copying it unless it is short)
    *   `is_last_substring`: this substring represents the end of the stream
    *   `output`: a mutable reference to the Writer
    *
@@ -31,7 +30,7 @@ public:
    *
    * The Reassembler should close the stream after writing the last byte.
    */
-  void insert( uint64_t first_index, std::string data, bool is_last_substring );
+  void insert( uint64_t first_index, Buffer data, bool is_last_substring );
 
   // How many bytes are stored in the Reassembler itself?
   uint64_t bytes_pending() const;
@@ -45,7 +44,7 @@ public:
 
 private:
   ByteStream output_; // the Reassembler writes to this ByteStream
-  std::list<std::pair<uint64_t, std::string>> lists {};
+  std::pmr::map<uint64_t, Buffer> pending_ { output_.resource() }; // 尚未写入的片段（按起点排序，互不重叠）
   uint64_t bytes_pending_ {};
   uint64_t expecting_index_ {};
   uint64_t terminate_index_ {};
@@ -1,9 +1,88 @@
 #include "router.hh"
 #include "address.hh"
+#include "flow_hash.hh"
+#include "ip_fragmentation.hh"
 
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <fstream>
 #include <iostream>
+#include <stdexcept>
+#include <string_view>
+
+#include <arpa/inet.h>
 
 using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+uint32_t parse_ipv4( const string& text, const size_t line_number )
+{
+  in_addr address {};
+  if ( inet_pton( AF_INET, text.c_str(), &address ) != 1 ) {
+    throw runtime_error( "route file line " + to_string( line_number ) + ": bad address \"" + text + "\"" );
+  }
+  return ntohl( address.s_addr );
+}
+
+template<class T>
+bool parse_number( const string& text, T& number )
+{
+  const auto [end, error] = from_chars( text.data(), text.data() + text.size(), number );
+  return error == errc {} and end == text.data() + text.size();
+}
+
+// A line of a route file, "prefix/length next-hop interface" (or nothing, if it's blank or a comment)
+optional<Route> parse_route( string_view line, const size_t line_number )
+{
+  line = line.substr( 0, line.find( '#' ) );
+  vector<string> fields;
+  while ( not line.empty() ) {
+    const auto start = line.find_first_not_of( " \t\r" );
+    if ( start == string_view::npos ) {
+      break;
+    }
+    line.remove_prefix( start );
+    const auto end = min( line.find_first_of( " \t\r" ), line.size() );
+    fields.emplace_back( line.substr( 0, end ) );
+    line.remove_prefix( end );
+  }
+  if ( fields.empty() ) {
+    return nullopt;
+  }
+
+  const auto bad_line = [&]( const string& why ) {
+    return runtime_error( "route file line " + to_string( line_number ) + ": " + why );
+  };
+  const auto slash = fields[0].find( '/' );
+  unsigned prefix_length = 0;
+  size_t interface_idx = 0;
+  if ( fields.size() != 3 or slash == string::npos ) {
+    throw bad_line( "expected \"prefix/length next-hop interface\"" );
+  }
+  const string length_text = fields[0].substr( slash + 1 );
+  if ( not parse_number( length_text, prefix_length ) or prefix_length > 32 ) {
+    throw bad_line( "bad prefix length \"" + length_text + "\"" );
+  }
+  if ( not parse_number( fields[2], interface_idx ) ) {
+    throw bad_line( "bad interface \"" + fields[2] + "\"" );
+  }
+
+  return Route { .prefix = parse_ipv4( fields[0].substr( 0, slash ), line_number ),
+                 .prefix_length = static_cast<uint8_t>( prefix_length ),
+                 .path = { .next_hop = fields[1] == "direct" ? nullopt
+                                                             : optional { parse_ipv4( fields[1], line_number ) },
+                           .interface_idx = interface_idx } };
+}
+
+} // namespace
+
+Router::~Router()
+{
+  stop_workers();
+}
 
 // route_prefix: The "up-to-32-bit" IPv4 address prefix to match the datagram's destination address against
 // prefix_length: For this route to be applicable, how many high-order (most-significant) bits of
@@ -16,41 +95,228 @@ void Router::add_route( const uint32_t route_prefix,
                         const optional<Address> next_hop,
                         const size_t interface_num )
 {
-  cerr << "DEBUG: adding route " << Address::from_ipv4_numeric( route_prefix ).ip() << "/"
-       << static_cast<int>( prefix_length ) << " => " << ( next_hop.has_value() ? next_hop->ip() : "(direct)" )
-       << " on interface " << interface_num << "\n";
+  const lock_guard lock { routes_mutex_ };
+  const auto hop = next_hop.has_value() ? optional { next_hop->ipv4_numeric() } : nullopt;
+  table_.store( routes_.add( { .prefix = route_prefix,
+                               .prefix_length = prefix_length,
+                               .path = { .next_hop = hop, .interface_idx = interface_num } } ) );
+}
+
+bool Router::remove_route( const uint32_t route_prefix, const uint8_t prefix_length )
+{
+  const lock_guard lock { routes_mutex_ };
+  const auto before = routes_.table();
+  table_.store( routes_.remove( route_prefix, prefix_length ) );
+  return routes_.table() != before;
+}
+
+Router::LoadReport Router::load_routes( const string& filename )
+{
+  ifstream file { filename };
+  if ( not file ) {
+    throw runtime_error( "load_routes: can't open " + filename );
+  }
+  return load_routes( file );
+}
+
+Router::LoadReport Router::load_routes( istream& routes )
+{
+  // parse the whole file first, so a bad line leaves the routes as they were
+  const auto start_time = steady_clock::now();
+  vector<Route> parsed;
+  string line;
+  for ( size_t line_number = 1; getline( routes, line ); ++line_number ) {
+    if ( auto route = parse_route( line, line_number ); route.has_value() ) {
+      if ( route->path.interface_idx >= _interfaces.size() ) {
+        throw runtime_error( "route file line " + to_string( line_number ) + ": no interface "
+                             + to_string( route->path.interface_idx ) );
+      }
+      parsed.push_back( *route );
+    }
+  }
+  const auto parsed_time = steady_clock::now();
+
+  LoadReport report { .routes = parsed.size() };
+  {
+    const lock_guard lock { routes_mutex_ };
+    auto table = routes_.load( move( parsed ) );
+    report.build_time = duration_cast<microseconds>( steady_clock::now() - parsed_time );
+    report.prefixes = routes_.prefixes();
+    table_.store( move( table ) );
+  }
+  report.parse_time = duration_cast<microseconds>( parsed_time - start_time );
+  return report;
+}
+
+ForwardingTable::Paths Router::DestinationCache::lookup( const ForwardingTable& table, const uint32_t dst )
+{
+  // Fibonacci hashing: the top bits of the product depend on all of the address
+  constexpr int index_bits = countr_zero( SIZE );
+  Entry& entry = entries_[( dst * 0x9e37'79b9U ) >> ( 32 - index_bits )];
+  if ( entry.generation == table.generation() and entry.dst == dst ) {
+    ++stats_.hits;
+    return entry.paths;
+  }
+  ++stats_.misses;
+  entry = { .dst = dst, .generation = table.generation(), .paths = table.lookup( dst ) };
+  return entry.paths;
+}
+
+Router::CacheStats Router::cache_stats() const
+{
+  CacheStats total = cache_->stats();
+  for ( const auto& worker : workers_ ) {
+    total.hits += worker->cache.stats().hits;
+    total.misses += worker->cache.stats().misses;
+  }
+  return total;
+}
+
+template<class Send>
+void Router::forward( const ForwardingTable& table,
+                      DestinationCache& cache,
+                      InternetDatagram&& dgram,
+                      Send&& send ) const
+{
+  const auto route = cache.lookup( table, dgram.header.dst );
+  // a datagram whose TTL would reach zero is dropped; otherwise the header changes, and so does its checksum
+  if ( dgram.header.ttl <= 1 || route.count == 0 ) {
+    return;
+  }
+  --dgram.header.ttl;
+  dgram.header.compute_checksum();
 
-  router_map_.emplace_back( route_prefix, prefix_length, next_hop, interface_num );
+  const auto& path = table.path( route, dgram );
+  const uint32_t next_hop = path.next_hop.value_or( dgram.header.dst );
+  const size_t mtu = _interfaces[path.interface_idx]->mtu();
+  if ( dgram.header.len <= mtu ) {
+    send( path.interface_idx, next_hop, move( dgram ) );
+  } else if ( !dgram.header.df ) {
+    for ( auto& fragment : fragment_datagram( dgram, mtu ) ) {
+      send( path.interface_idx, next_hop, move( fragment ) );
+    }
+  }
+  // (too big and not to be fragmented: dropped, as there's no ICMP to report it)
 }
 
 // Go through all the interfaces, and route every incoming datagram to its proper outgoing interface.
 void Router::route()
 {
+  if ( not workers_.empty() ) {
+    route_parallel();
+    return;
+  }
+
+  const auto table = table_.load();
+  const auto send = [this]( size_t out, uint32_t next_hop, InternetDatagram&& d ) {
+    _interfaces[out]->send_datagram( d, Address::from_ipv4_numeric( next_hop ) );
+  };
   for ( const auto& interface : _interfaces ) {
     auto& dgrams = interface->datagrams_received();
     while ( !dgrams.empty() ) {
-      auto dgram = dgrams.front();
+      auto dgram = move( dgrams.front() );
       dgrams.pop();
-      auto dst_ip = dgram.header.dst;
-      // given the destination ip address, get the next interface through _interfaces
-      auto cur_best_match = router_map_.end();
-      for ( auto it = router_map_.begin(); it != router_map_.end(); it = next( it ) ) {
-        auto netmask = static_cast<uint32_t>( 0xFFFF'FFFF << ( 32 - it->netmask ) );
-        auto cur_net_addr = it->ipv4 & netmask;
-        auto dst_net_addr = dst_ip & netmask;
-        if ( cur_net_addr == dst_net_addr
-             && ( cur_best_match == router_map_.end() || it->netmask > cur_best_match->netmask ) ) {
-          cur_best_match = it;
+      forward( *table, *cache_, move( dgram ), send );
+    }
+  }
+}
+
+// Hand every queued datagram to the worker for its flow, and send out what the workers forward. (Datagrams that
+// arrive at an interface meanwhile wait for the next call.)
+void Router::route_parallel()
+{
+  snapshot_ = table_.load();
+  for ( auto& worker : workers_ ) {
+    while ( worker->egress.size() < _interfaces.size() ) {
+      worker->egress.push_back( make_unique<SPSCRing<Outgoing>>( RING_SIZE ) );
+    }
+  }
+  running_.store( true, memory_order_release );
+  running_.notify_all();
+
+  for ( const auto& interface : _interfaces ) {
+    auto& dgrams = interface->datagrams_received();
+    while ( !dgrams.empty() ) {
+      auto dgram = move( dgrams.front() );
+      dgrams.pop();
+      // (not by 5-tuple: fragments after the first don't carry ports, and must stay in order with their flow)
+      auto& ingress = workers_[address_hash( dgram.header ) % workers_.size()]->ingress;
+      while ( not ingress.try_push( move( dgram ) ) ) {
+        // the worker may be waiting for room to pass on a datagram
+        if ( not send_forwarded() ) {
+          this_thread::yield();
         }
       }
-      if ( dgram.header.ttl-- <= 0 || cur_best_match == router_map_.end() ) {
-        continue;
-      }
-      if ( cur_best_match->next_hop.has_value() ) {
-        _interfaces[cur_best_match->interface_idx]->send_datagram( dgram, cur_best_match->next_hop.value() );
+      ++dispatched_;
+    }
+  }
+
+  while ( finished_.load( memory_order_acquire ) != dispatched_ ) {
+    if ( not send_forwarded() ) {
+      this_thread::yield();
+    }
+  }
+  send_forwarded();
+  running_.store( false, memory_order_release );
+}
+
+void Router::work( Worker& worker, const stop_token& stop )
+{
+  InternetDatagram dgram;
+  while ( not stop.stop_requested() ) {
+    if ( not worker.ingress.try_pop( dgram ) ) {
+      if ( running_.load( memory_order_acquire ) ) {
+        this_thread::yield();
       } else {
-        _interfaces[cur_best_match->interface_idx]->send_datagram( dgram, Address::from_ipv4_numeric( dst_ip ) );
+        running_.wait( false, memory_order_acquire );
       }
+      continue;
     }
+
+    const auto pass_on = [&worker]( size_t out, uint32_t next_hop, InternetDatagram&& d ) {
+      Outgoing outgoing { move( d ), next_hop };
+      while ( not worker.egress[out]->try_push( move( outgoing ) ) ) {
+        this_thread::yield();
+      }
+    };
+    forward( *snapshot_, worker.cache, move( dgram ), pass_on );
+    finished_.fetch_add( 1, memory_order_release );
+  }
+}
+
+// Send out the datagrams the workers have forwarded so far. Returns whether there were any.
+bool Router::send_forwarded()
+{
+  bool sent = false;
+  Outgoing outgoing;
+  for ( const auto& worker : workers_ ) {
+    for ( size_t out = 0; out < worker->egress.size(); ++out ) {
+      while ( worker->egress[out]->try_pop( outgoing ) ) {
+        _interfaces[out]->send_datagram( outgoing.first, Address::from_ipv4_numeric( outgoing.second ) );
+        sent = true;
+      }
+    }
+  }
+  return sent;
+}
+
+void Router::set_workers( const size_t n )
+{
+  stop_workers();
+  for ( size_t i = 0; i < n; ++i ) {
+    auto& worker = workers_.emplace_back( make_unique<Worker>( RING_SIZE ) );
+    worker->thread = jthread( [this, &w = *worker]( const stop_token& stop ) { work( w, stop ); } );
+  }
+}
+
+void Router::stop_workers()
+{
+  for ( auto& worker : workers_ ) {
+    worker->thread.request_stop();
   }
+  // wake up the idle ones, so they see the request
+  running_.store( true );
+  running_.notify_all();
+  workers_.clear();
+  running_.store( false );
 }
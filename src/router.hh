@@ -1,17 +1,35 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <istream>
 #include <memory>
+#include <mutex>
 #include <optional>
+#include <string>
+#include <stop_token>
+#include <thread>
+#include <utility>
 #include <vector>
 
 #include "exception.hh"
+#include "forwarding_table.hh"
 #include "network_interface.hh"
+#include "spsc_ring.hh"
 
 // \brief A router that has multiple network interfaces and
 // performs longest-prefix-match routing between them.
+//
+// Routes can change (from any thread) while another thread routes: each change builds a new ForwardingTable off
+// to the side and publishes it with an atomic pointer swap, and route() keeps using the table it started with, so
+// forwarding never waits for the routes.
 class Router
 {
 public:
+  Router() = default;
+  ~Router();
+
   // Add an interface to the router
   // \param[in] interface an already-constructed network interface
   // \returns The index of the interface after it has been added to the router
@@ -24,26 +42,107 @@ public:
   // Access an interface by index
   std::shared_ptr<NetworkInterface> interface( const size_t N ) { return _interfaces.at( N ); }
 
-  // Add a route (a forwarding rule)
+  // Add a route (a forwarding rule). Routes for the same prefix (and length) are equal-cost paths: each flow
+  // takes one of them, picked by a hash of its 5-tuple, so flows spread across the paths but stay in order.
   void add_route( uint32_t route_prefix,
                   uint8_t prefix_length,
                   std::optional<Address> next_hop,
                   size_t interface_num );
 
+  // Remove the routes for a prefix (and length). Returns whether there were any.
+  bool remove_route( uint32_t route_prefix, uint8_t prefix_length );
+
+  // Replace all the routes with those in a route file: one per line, as "prefix/length next-hop interface", where
+  // the next hop is an address or "direct" (e.g. "10.0.0.0/8 192.168.0.1 2"). A "#" starts a comment.
+  struct LoadReport
+  {
+    size_t routes {};
+    size_t prefixes {};
+    std::chrono::microseconds parse_time {};
+    std::chrono::microseconds build_time {}; // of the forwarding table
+  };
+  LoadReport load_routes( std::istream& routes );
+  LoadReport load_routes( const std::string& filename );
+
   // Route packets between the interfaces
   void route();
 
-  // The Entry of Router map
-  struct RouterEntry
+  // Forward datagrams on `n` worker threads from now on (0, the default, forwards them on the thread calling
+  // route()). The caller's thread still drains the interfaces and sends datagrams out, since interfaces aren't
+  // thread-safe; the workers look up routes and rewrite headers. Datagrams are spread across workers by a hash
+  // of (source, destination, protocol), so each flow keeps its order.
+  void set_workers( size_t n );
+  size_t workers() const { return workers_.size(); }
+
+  // How often route lookups were answered by a destination cache (summed over the caller's and the workers')
+  struct CacheStats
   {
-    uint32_t ipv4 {};
-    uint8_t netmask {};
-    std::optional<Address> next_hop {};
-    size_t interface_idx {};
+    uint64_t hits {};
+    uint64_t misses {};
   };
+  CacheStats cache_stats() const;
 
 private:
+  // A direct-mapped cache of lookups in the ForwardingTable, by destination address. Entries from an earlier
+  // table have an older generation, so a new table invalidates them all at once. Each thread has its own.
+  class DestinationCache
+  {
+  public:
+    static constexpr size_t SIZE = 4096; // entries (a power of two)
+
+    ForwardingTable::Paths lookup( const ForwardingTable& table, uint32_t dst );
+    const CacheStats& stats() const { return stats_; }
+
+  private:
+    struct Entry
+    {
+      uint32_t dst;
+      uint32_t generation; // 0 (no table's) if the entry is empty
+      ForwardingTable::Paths paths;
+    };
+
+    alignas( 64 ) std::array<Entry, SIZE> entries_ {}; // four to a cache line
+    CacheStats stats_ {};
+  };
+
+  // A datagram on its way out, and the (numeric) address of its next hop
+  using Outgoing = std::pair<InternetDatagram, uint32_t>;
+
+  struct Worker
+  {
+    SPSCRing<InternetDatagram> ingress;                         // from the caller's thread
+    std::vector<std::unique_ptr<SPSCRing<Outgoing>>> egress {}; // back to it, one per interface
+    DestinationCache cache {};
+    std::jthread thread {};
+
+    explicit Worker( size_t ring_size ) : ingress( ring_size ) {}
+  };
+
+  static constexpr size_t RING_SIZE = 1024;
+
   // The router's collection of network interfaces
   std::vector<std::shared_ptr<NetworkInterface>> _interfaces {};
-  std::vector<RouterEntry> router_map_ {};
+  std::mutex routes_mutex_ {}; // serializes changes to the routes (but not lookups)
+  ForwardingTableBuilder routes_ {};
+  std::atomic<std::shared_ptr<const ForwardingTable>> table_ { routes_.table() }; // the latest
+  std::shared_ptr<const ForwardingTable> snapshot_ {}; // the table the workers use during route()
+  std::unique_ptr<DestinationCache> cache_ { std::make_unique<DestinationCache>() }; // the caller's
+
+  std::vector<std::unique_ptr<Worker>> workers_ {};
+  std::atomic<bool> running_ {};       // whether route() is handing out datagrams (idle workers wait for it)
+  std::atomic<uint64_t> finished_ {};  // datagrams the workers are done with
+  uint64_t dispatched_ {};             // datagrams handed to the workers
+
+  // Look up a datagram's route and rewrite its header, then call send( interface, next hop, datagram ) for it
+  // (or for each of its fragments, if it's too big for the interface)
+  template<class Send>
+  void forward( const ForwardingTable& table,
+                DestinationCache& cache,
+                InternetDatagram&& dgram,
+                Send&& send ) const;
+
+  void route_parallel();
+  void work( Worker& worker, const std::stop_token& stop );
+  bool send_forwarded();
+  void stop_workers();
 };
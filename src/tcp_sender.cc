@@ -1,4 +1,5 @@
 #include "tcp_sender.hh"
+#include "checksum.hh"
 #include "tcp_config.hh"
 #include <algorithm>
 
@@ -12,6 +13,9 @@ void TCPSender::push( const TransmitFunction& transmit )
   if ( !window_size_ && !sequence_numbers_in_flight_
        && established ) // 只有连接建立之后，才准许在窗口为0的时候，假装它是1
     curr_size = 1;
+  // 流的存储来自调用者的内存资源时（可能随连接一起释放），发出的报文不能引用它：
+  // payload 像拼接时一样复制到缓冲池中
+  const bool copy_payloads = input_.resource() != pmr::get_default_resource();
   while ( 1 ) { // 只要窗口还没排满，就一直发送
     TCPSenderMessage msg {};
     msg.seqno = Wrap32::wrap( next_seqno_, isn_ );
@@ -26,13 +30,27 @@ void TCPSender::push( const TransmitFunction& transmit )
       ++next_seqno_;
       --curr_size;
     }
+    shared_ptr<char[]> joined {}; // NOLINT(*-avoid-c-arrays) 拼接payload用的缓冲区
+    InternetChecksum payload_sum;
     while ( curr_size > 0 ) {
-      string data( reader().peek() );
+      const Buffer data = reader().peek_buffer();
       if ( data.empty() || data == "\377" ) {
         break; // 没有更多数据可读
       }
-      msg.payload += data.substr( 0, curr_size );
       auto mn = min( curr_size, data.size() );
+      if ( msg.payload.empty() && !copy_payloads ) {
+        msg.payload = data.substr( 0, mn ); // 与ByteStream共享存储，不复制数据
+      } else { // 跨越了ByteStream中的两块数据，只能拼接：复制的同时计算校验和，发送时就不必再读一遍
+        const size_t joined_size = msg.payload.size();
+        if ( !joined ) { // 第一次拼接：分配足够整个payload的缓冲区，先复制已有的部分
+          const uint64_t capacity = joined_size + min( curr_size, reader().bytes_buffered() );
+          joined = PacketBufferPool::global().make_buffer( capacity );
+          payload_sum.add_copy( msg.payload, joined.get() );
+        }
+        payload_sum.add_copy( data.str().substr( 0, mn ), joined.get() + joined_size );
+        msg.payload = Buffer { joined, { joined.get(), joined_size + mn } };
+        msg.payload_sum = payload_sum.sum();
+      }
       curr_size -= mn;
       writer().reader().pop( mn );
       next_seqno_ += mn;
@@ -129,6 +147,14 @@ uint64_t TCPSender::consecutive_retransmissions() const
   return consecutive_retransmissions_;
 }
 
+optional<uint64_t> TCPSender::ms_until_timeout() const
+{
+  if ( unacknowledged_messages_.empty() ) {
+    return {}; // 没有未确认的消息，重传计时器没有运行
+  }
+  return curr_RTO_ms_ > last_tick_ms_ ? curr_RTO_ms_ - last_tick_ms_ : 0;
+}
+
 uint64_t TCPSender::sequence_numbers_in_flight() const
 {
   return sequence_numbers_in_flight_;
@@ -5,7 +5,9 @@
 #include "tcp_sender_message.hh"
 
 #include <cstdint>
+#include <deque>
 #include <functional>
+#include <optional>
 #include <queue>
 #include <utility>
 
@@ -21,7 +23,8 @@
 class TCPSender
 {
 public:
-  /* Construct TCP sender with given default Retransmission Timeout and possible ISN */
+  /* Construct TCP sender with given default Retransmission Timeout and possible ISN (outstanding segments are
+   * kept in the input stream's memory resource) */
   TCPSender( ByteStream&& input, Wrap32 isn, uint64_t initial_RTO_ms )
     : input_( std::move( input ) ), isn_( isn ), initial_RTO_ms_( initial_RTO_ms ), curr_RTO_ms_( initial_RTO_ms )
   {}
@@ -42,8 +45,9 @@ public:
   void tick( uint64_t ms_since_last_tick, const TransmitFunction& transmit );
 
   // Accessors
-  uint64_t sequence_numbers_in_flight() const;  // How many sequence numbers are outstanding?
-  uint64_t consecutive_retransmissions() const; // How many consecutive *re*transmissions have happened?
+  uint64_t sequence_numbers_in_flight() const;      // How many sequence numbers are outstanding?
+  uint64_t consecutive_retransmissions() const;     // How many consecutive *re*transmissions have happened?
+  std::optional<uint64_t> ms_until_timeout() const; // When will tick() next retransmit? (empty if no timer)
   Writer& writer() { return input_.writer(); }
   const Writer& writer() const { return input_.writer(); }
 
@@ -53,21 +57,23 @@ public:
 private:
   // TCPSenderMessage make_message( uint64_t seqno, std::string payload, bool SYN, bool FIN = false ) const;
 
+  using MessageQueue = std::queue<TCPSenderMessage, std::pmr::deque<TCPSenderMessage>>;
+
   // Variables initialized in constructor
   ByteStream input_;
   Wrap32 isn_;
   const uint64_t initial_RTO_ms_;
 
-  uint64_t next_seqno_ { 0 };                               // 将要发送的下一个字节序号
-  uint64_t impossible_ackno { 0 };                          // 不可能的确认序号
-  uint64_t window_size_ { 0 };                              // 窗口大小
-  uint64_t curr_RTO_ms_;                                    // 当前超时重传时延
-  uint64_t last_tick_ms_ { 0 };                             // 自上次重置或第一次启动以来，过去的时间
-  uint64_t consecutive_retransmissions_ { 0 };              // 超时重传次数
-  uint64_t sequence_numbers_in_flight_ { 0 };               // 未确认的字节总数
-  std::queue<TCPSenderMessage> unacknowledged_messages_ {}; // 未确认的字节序列
-  bool first_ack { false };                                 // SYN信号已发送，用于保证全局只会push一次SYN信号
-  bool is_closed_ { false };                                // 连接将要关闭，但尚未发送FIN
-  bool FIN_sent { false };                                  // FIN信号已发送，用于保证只会push一次FIN信号
-  bool established { false };                               // 已建立连接
+  uint64_t next_seqno_ { 0 };                                  // 将要发送的下一个字节序号
+  uint64_t impossible_ackno { 0 };                             // 不可能的确认序号
+  uint64_t window_size_ { 0 };                                 // 窗口大小
+  uint64_t curr_RTO_ms_;                                       // 当前超时重传时延
+  uint64_t last_tick_ms_ { 0 };                                // 自上次重置或第一次启动以来，过去的时间
+  uint64_t consecutive_retransmissions_ { 0 };                 // 超时重传次数
+  uint64_t sequence_numbers_in_flight_ { 0 };                  // 未确认的字节总数
+  MessageQueue unacknowledged_messages_ { input_.resource() }; // 未确认的字节序列（与input_使用同一内存资源）
+  bool first_ack { false };                                    // SYN信号已发送，用于保证全局只会push一次SYN信号
+  bool is_closed_ { false };                                   // 连接将要关闭，但尚未发送FIN
+  bool FIN_sent { false };                                     // FIN信号已发送，用于保证只会push一次FIN信号
+  bool established { false };                                  // 已建立连接
 };
@@ -0,0 +1,257 @@
+#include "arp_message.hh"
+#include "ethernet_header.hh"
+#include "network_interface_test_harness.hh"
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+namespace {
+
+using ARPStats = NetworkInterface::ARPStats;
+
+const EthernetAddress local_eth { 2, 0, 0, 0, 0, 1 };
+const EthernetAddress remote_eth { 2, 0, 0, 0, 0, 2 };
+const Address local_ip { "10.0.0.1", 0 };
+const Address remote_ip { "10.0.0.2", 0 };
+
+InternetDatagram make_datagram( const uint16_t id, const size_t length = 1500 )
+{
+  InternetDatagram dgram;
+  dgram.header.src = local_ip.ipv4_numeric();
+  dgram.header.dst = Address( "192.168.0.1", 0 ).ipv4_numeric();
+  dgram.header.id = id;
+  dgram.payload = string( length - IPv4Header::LENGTH, 'x' );
+  dgram.header.len = length;
+  dgram.header.compute_checksum();
+  return dgram;
+}
+
+// The frame carrying datagram `id` to the remote host
+EthernetFrame datagram_frame( const uint16_t id )
+{
+  return make_frame( local_eth, remote_eth, EthernetHeader::TYPE_IPv4, serialize( make_datagram( id ) ) );
+}
+
+// An ARP message from one host to the other (target_eth is left zero in a request)
+EthernetFrame arp_frame( const bool from_local,
+                         const uint16_t opcode,
+                         const EthernetAddress& dst,
+                         const Address& target_ip = remote_ip )
+{
+  const auto& sender_eth = from_local ? local_eth : remote_eth;
+  const auto& sender_ip = from_local ? local_ip : remote_ip;
+  const EthernetAddress target_eth = dst == ETHERNET_BROADCAST ? EthernetAddress {} : dst;
+  return make_frame(
+    sender_eth,
+    dst,
+    EthernetHeader::TYPE_ARP,
+    serialize( make_arp( opcode, sender_eth, sender_ip.ip(), target_eth, target_ip.ip() ) ) );
+}
+
+// The interface's broadcast request for `next_hop`
+EthernetFrame arp_request( const Address& next_hop = remote_ip )
+{
+  return arp_frame( true, ARPMessage::OPCODE_REQUEST, ETHERNET_BROADCAST, next_hop );
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    {
+      // unanswered requests are retransmitted after 5, 10 and 20 seconds, and then the interface gives up
+      NetworkInterfaceTestHarness test { "retransmit", local_eth, local_ip };
+      test.execute( SendDatagram { make_datagram( 1 ), remote_ip } );
+      test.execute( SendDatagram { make_datagram( 2 ), remote_ip } );
+      test.execute( ExpectFrame { arp_request() } );
+      test.execute( ExpectNoFrame {} );
+
+      for ( const size_t period : { 5000, 10000 } ) {
+        test.execute( Tick { period - 1 } );
+        test.execute( ExpectNoFrame {} );
+        test.execute( Tick { 1 } );
+        test.execute( ExpectFrame { arp_request() } );
+        test.execute( ExpectNoFrame {} );
+      }
+      test.execute( ExpectARPStat { "requests", &ARPStats::requests, 3 } );
+      test.execute( ExpectARPStat { "retransmissions", &ARPStats::retransmissions, 2 } );
+
+      test.execute( Tick { 19999 } );
+      test.execute( ExpectPendingBytes { 3000 } );
+      test.execute( Tick { 1 } );
+      test.execute( ExpectNoFrame {} );
+      test.execute( ExpectPendingBytes { 0 } );
+      test.execute( ExpectARPStat { "unresolved", &ARPStats::unresolved, 1 } );
+      test.execute( ExpectARPStat { "dropped_unresolved", &ARPStats::dropped_unresolved, 2 } );
+
+      // and starts over for the next datagram
+      test.execute( SendDatagram { make_datagram( 3 ), remote_ip } );
+      test.execute( ExpectFrame { arp_request() } );
+    }
+
+    {
+      // a reply to a retransmission delivers everything queued, in order
+      NetworkInterfaceTestHarness test { "late reply", local_eth, local_ip };
+      test.execute( SendDatagram { make_datagram( 1 ), remote_ip } );
+      test.execute( Tick { 5000 } );
+      test.execute( SendDatagram { make_datagram( 2 ), remote_ip } );
+      test.execute( Tick { 7000 } );
+      test.execute( SendDatagram { make_datagram( 3 ), remote_ip } );
+      test.execute( ExpectFrame { arp_request() } );
+      test.execute( ExpectFrame { arp_request() } );
+      test.execute( ExpectNoFrame {} );
+
+      test.execute( ReceiveFrame { arp_frame( false, ARPMessage::OPCODE_REPLY, local_eth, local_ip ), {} } );
+      for ( const uint16_t id : { 1, 2, 3 } ) {
+        test.execute( ExpectFrame { datagram_frame( id ) } );
+      }
+      test.execute( ExpectPendingBytes { 0 } );
+      test.execute( Tick { 60000 } );
+      test.execute( ExpectNoFrame {} );
+    }
+
+    {
+      // a next hop's queue is capped, losing its oldest datagrams
+      NetworkInterfaceTestHarness test { "neighbor limit", local_eth, local_ip };
+      const uint16_t fit = NetworkInterface::PENDING_NEIGHBOR_LIMIT / 1500;
+      for ( uint16_t id = 0; id < fit + 10; ++id ) {
+        test.execute( SendDatagram { make_datagram( id ), remote_ip } );
+      }
+      test.execute( ExpectFrame { arp_request() } );
+      test.execute( ExpectPendingBytes { fit * 1500UL } );
+      test.execute( ExpectARPStat { "dropped_neighbor_limit", &ARPStats::dropped_neighbor_limit, 10 } );
+
+      // learning the address from the next hop's own request works as well as a reply (the newest datagrams go
+      // out before the interface answers it)
+      test.execute(
+        ReceiveFrame { arp_frame( false, ARPMessage::OPCODE_REQUEST, ETHERNET_BROADCAST, local_ip ), {} } );
+      for ( uint16_t id = 10; id < fit + 10; ++id ) {
+        test.execute( ExpectFrame { datagram_frame( id ) } );
+      }
+      test.execute( ExpectFrame { arp_frame( true, ARPMessage::OPCODE_REPLY, remote_eth ) } );
+      test.execute( ExpectNoFrame {} );
+    }
+
+    {
+      // so is the interface's, losing new datagrams (e.g. in a scan of addresses that don't answer); a next hop
+      // whose first datagram is lost isn't resolved, so the scan can't grow the wait list without bound either
+      NetworkInterfaceTestHarness test { "interface limit", local_eth, local_ip };
+      const size_t fit = NetworkInterface::PENDING_INTERFACE_LIMIT / 1500;
+      for ( uint32_t i = 0; i < fit + 5; ++i ) {
+        const Address next_hop = Address::from_ipv4_numeric( 0x0A01'0000 + i );
+        test.execute( SendDatagram { make_datagram( 0 ), next_hop } );
+        if ( i < fit ) {
+          test.execute( ExpectFrame { arp_request( next_hop ) } );
+        }
+      }
+      test.execute( ExpectNoFrame {} );
+      test.execute( ExpectPendingBytes { fit * 1500 } );
+      test.execute( ExpectARPStat { "dropped_interface_limit", &ARPStats::dropped_interface_limit, 5 } );
+      test.execute( ExpectARPStat { "requests", &ARPStats::requests, fit } );
+    }
+
+    {
+      // a datagram that won't fit in the interface's limit anyway doesn't make its next hop lose older ones
+      NetworkInterfaceTestHarness test { "limits checked together", local_eth, local_ip };
+      for ( uint16_t id = 0; id < 10; ++id ) {
+        test.execute( SendDatagram { make_datagram( id, 100 ), remote_ip } );
+      }
+      for ( uint16_t id = 10; id < 52; ++id ) {
+        test.execute( SendDatagram { make_datagram( id ), remote_ip } );
+      }
+      test.execute( SendDatagram { make_datagram( 52, 500 ), remote_ip } );
+
+      // fill the interface to 500 bytes short of its limit, with other next hops (43 datagrams each)
+      const size_t other_bytes = NetworkInterface::PENDING_INTERFACE_LIMIT - 500 - 64500;
+      const size_t other_datagrams = other_bytes / 1500;
+      for ( size_t i = 0; i < other_datagrams; ++i ) {
+        const Address next_hop = Address::from_ipv4_numeric( 0x0A01'0000 + i / 43 );
+        test.execute( SendDatagram { make_datagram( 0 ), next_hop } );
+      }
+      test.execute( SendDatagram { make_datagram( 0, other_bytes % 1500 ), Address( "10.2.0.1", 0 ) } );
+      test.execute( ExpectPendingBytes { NetworkInterface::PENDING_INTERFACE_LIMIT - 500 } );
+
+      // making room for this one would lose five of the remote host's 100-byte datagrams but free only 500 bytes
+      test.execute( SendDatagram { make_datagram( 53 ), remote_ip } );
+      test.execute( ExpectPendingBytes { NetworkInterface::PENDING_INTERFACE_LIMIT - 500 } );
+      test.execute( ExpectARPStat { "dropped_interface_limit", &ARPStats::dropped_interface_limit, 1 } );
+      test.execute( ExpectARPStat { "dropped_neighbor_limit", &ARPStats::dropped_neighbor_limit, 0 } );
+    }
+
+    {
+      // with refresh on, a mapping in use is refreshed by unicast before it expires, and stays usable meanwhile
+      NetworkInterfaceTestHarness test { "refresh", local_eth, local_ip };
+      test.execute( SetARPRefresh { true } );
+      test.execute( ReceiveFrame { arp_frame( false, ARPMessage::OPCODE_REPLY, local_eth, local_ip ), {} } );
+      test.execute( SendDatagram { make_datagram( 1 ), remote_ip } );
+      test.execute( ExpectFrame { datagram_frame( 1 ) } );
+
+      test.execute( Tick { NetworkInterface::ARP_MAP_TTL - NetworkInterface::ARP_REFRESH_LEAD - 1 } );
+      test.execute( ExpectNoFrame {} );
+      test.execute( Tick { 1 } );
+      test.execute( ExpectFrame { arp_frame( true, ARPMessage::OPCODE_REQUEST, remote_eth ) } );
+      test.execute( Tick { NetworkInterface::ARP_REFRESH_LEAD - 1 } );
+      test.execute( SendDatagram { make_datagram( 2 ), remote_ip } );
+      test.execute( ExpectFrame { datagram_frame( 2 ) } );
+
+      // once renewed, there's no stall when the old mapping would have expired
+      test.execute( ReceiveFrame { arp_frame( false, ARPMessage::OPCODE_REPLY, local_eth, local_ip ), {} } );
+      test.execute( Tick { 1 } );
+      test.execute( SendDatagram { make_datagram( 3 ), remote_ip } );
+      test.execute( ExpectFrame { datagram_frame( 3 ) } );
+      test.execute( ExpectNoFrame {} );
+      test.execute( ExpectARPStat { "refreshes", &ARPStats::refreshes, 1 } );
+      test.execute( ExpectARPStat { "refreshed", &ARPStats::refreshed, 1 } );
+      test.execute( ExpectARPStat { "stalls_avoided", &ARPStats::stalls_avoided, 1 } );
+
+      // which counts the refreshed mapping once, not every datagram sent with it
+      test.execute( SendDatagram { make_datagram( 4 ), remote_ip } );
+      test.execute( ExpectFrame { datagram_frame( 4 ) } );
+      test.execute( ExpectARPStat { "stalls_avoided", &ARPStats::stalls_avoided, 1 } );
+    }
+
+    {
+      // a refreshed mapping learned again from an unsolicited reply has no old expiry to have avoided a stall at
+      NetworkInterfaceTestHarness test { "refresh then relearn", local_eth, local_ip };
+      test.execute( SetARPRefresh { true } );
+      test.execute( ReceiveFrame { arp_frame( false, ARPMessage::OPCODE_REPLY, local_eth, local_ip ), {} } );
+      test.execute( SendDatagram { make_datagram( 1 ), remote_ip } );
+      test.execute( ExpectFrame { datagram_frame( 1 ) } );
+      test.execute( Tick { NetworkInterface::ARP_MAP_TTL - NetworkInterface::ARP_REFRESH_LEAD } );
+      test.execute( ExpectFrame { arp_frame( true, ARPMessage::OPCODE_REQUEST, remote_eth ) } );
+      test.execute( ReceiveFrame { arp_frame( false, ARPMessage::OPCODE_REPLY, local_eth, local_ip ), {} } );
+      test.execute( ReceiveFrame { arp_frame( false, ARPMessage::OPCODE_REPLY, local_eth, local_ip ), {} } );
+
+      test.execute( Tick { NetworkInterface::ARP_REFRESH_LEAD } );
+      test.execute( SendDatagram { make_datagram( 2 ), remote_ip } );
+      test.execute( ExpectFrame { datagram_frame( 2 ) } );
+      test.execute( ExpectARPStat { "refreshed", &ARPStats::refreshed, 1 } );
+      test.execute( ExpectARPStat { "stalls_avoided", &ARPStats::stalls_avoided, 0 } );
+    }
+
+    // mappings that aren't in use (or interfaces without refresh) just expire
+    for ( const bool refresh : { true, false } ) {
+      NetworkInterfaceTestHarness test { refresh ? "unused mapping" : "no refresh", local_eth, local_ip };
+      test.execute( SetARPRefresh { refresh } );
+      test.execute( ReceiveFrame { arp_frame( false, ARPMessage::OPCODE_REPLY, local_eth, local_ip ), {} } );
+      if ( not refresh ) {
+        test.execute( SendDatagram { make_datagram( 1 ), remote_ip } );
+        test.execute( ExpectFrame { datagram_frame( 1 ) } );
+      }
+      test.execute( Tick { NetworkInterface::ARP_MAP_TTL } );
+      test.execute( ExpectNoFrame {} );
+      test.execute( SendDatagram { make_datagram( 2 ), remote_ip } );
+      test.execute( ExpectFrame { arp_request() } );
+      test.execute( ExpectARPStat { "refreshes", &ARPStats::refreshes, 0 } );
+    }
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
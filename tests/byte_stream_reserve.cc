@@ -0,0 +1,111 @@
+#include "byte_stream.hh"
+#include "byte_stream_test_harness.hh"
+
+#include <exception>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+int main()
+{
+  try {
+    {
+      ByteStreamTestHarness test { "reserve-commit", 15 };
+
+      test.execute( PushInPlace { "cat" } );
+      test.execute( BytesPushed { 3 } );
+      test.execute( BytesBuffered { 3 } );
+      test.execute( AvailableCapacity { 12 } );
+      test.execute( Peek { "cat" } );
+
+      test.execute( PushInPlace { "tac" } );
+      test.execute( PushInPlace { "dog", 10 } );
+      test.execute( BytesPushed { 9 } );
+      test.execute( AvailableCapacity { 6 } );
+      test.execute( Peek { "cattacdog" } );
+
+      test.execute( Pop { 4 } );
+      test.execute( Peek { "acdog" } );
+      test.execute( Close {} );
+      test.execute( ReadAll { "acdog" } );
+      test.execute( IsFinished { true } );
+    }
+
+    {
+      ByteStreamTestHarness test { "reserve-limited-by-capacity", 2 };
+
+      test.execute( Reserve { 3, 2 } );
+      test.execute( PushInPlace { "cat" } );
+      test.execute( BytesPushed { 2 } );
+      test.execute( AvailableCapacity { 0 } );
+      test.execute( Reserve { 1, 0 } );
+      test.execute( Peek { "ca" } );
+
+      test.execute( Pop { 1 } );
+      test.execute( Reserve { 3, 1 } );
+      test.execute( PushInPlace { "tac" } );
+      test.execute( BytesPushed { 3 } );
+      test.execute( Peek { "at" } );
+    }
+
+    {
+      ByteStreamTestHarness test { "reserve-mixed-with-push", 20 };
+
+      test.execute( Push { "one " } );
+      test.execute( PushInPlace { "two " } );
+      test.execute( Push { "three " } );
+      test.execute( PushInPlace { "four" } );
+      test.execute( BytesBuffered { 18 } );
+      test.execute( Peek { "one two three four" } );
+      test.execute( Pop { 6 } );
+      test.execute( PushInPlace { "five" } );
+      test.execute( ReadAll { "o three fourfive" } );
+    }
+
+    {
+      ByteStreamTestHarness test { "commit-without-reserve", 10 };
+
+      test.execute( PushInPlace { "cat" } );
+      test.execute( Close {} );
+      test.execute( Reserve { 5, 0 } );
+      test.execute( BytesPushed { 3 } );
+      test.execute( ReadAll { "cat" } );
+      test.execute( IsFinished { true } );
+    }
+
+    {
+      ByteStreamTestHarness test { "reserve-capped-block", 1 << 20 };
+
+      // a whole window's reservation gets a block of at most 64 KiB
+      test.execute( Reserve { 1 << 20, 65536 } );
+      test.execute( PushInPlace { "cat", 1 << 20 } );
+      test.execute( Reserve { 1 << 20, 65533 } );
+      test.execute( ReadAll { "cat" } );
+    }
+
+    {
+      ByteStreamTestHarness test { "reserve-spans", 100000 };
+
+      // the rest of the first (16 KiB) block, then a new one
+      test.execute( PushInPlace { "cat" } );
+      test.execute( ReserveSpans { 100000, 16381, 65536 } );
+      string data;
+      for ( size_t i = 0; i < 20000; ++i ) {
+        data += static_cast<char>( 'a' + i % 26 );
+      }
+      test.execute( PushInPlaceSpans { data, 100000 } );
+      test.execute( BytesPushed { 20003 } );
+      test.execute( PeekOnce { "cat" + data.substr( 0, 16381 ) } );
+      test.execute( ReserveSpans { 10, 10, 0 } );
+      test.execute( PushInPlaceSpans { "dog", 10 } );
+      test.execute( Close {} );
+      test.execute( ReadAll { "cat" + data + "dog" } );
+    }
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
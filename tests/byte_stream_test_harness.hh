@@ -34,6 +34,78 @@ struct Push : public Action<ByteStream>
   void execute( ByteStream& bs ) const override { bs.writer().push( data_ ); }
 };
 
+struct PushInPlace : public Action<ByteStream>
+{
+  std::string data_;
+  uint64_t reserve_;
+
+  explicit PushInPlace( std::string data ) : data_( move( data ) ), reserve_( data_.size() ) {}
+  PushInPlace( std::string data, uint64_t reserve ) : data_( move( data ) ), reserve_( reserve ) {}
+  std::string description() const override
+  {
+    return "reserve( " + std::to_string( reserve_ ) + " ), then fill and commit \"" + Printer::prettify( data_ )
+           + "\"";
+  }
+  void execute( ByteStream& bs ) const override
+  {
+    const auto space = bs.writer().reserve( reserve_ );
+    bs.writer().commit( data_.copy( space.data(), space.size() ) );
+  }
+};
+
+struct PushInPlaceSpans : public Action<ByteStream>
+{
+  std::string data_;
+  uint64_t reserve_;
+
+  PushInPlaceSpans( std::string data, uint64_t reserve ) : data_( move( data ) ), reserve_( reserve ) {}
+  std::string description() const override
+  {
+    return "reserve_spans( " + std::to_string( reserve_ ) + " ), then fill and commit \""
+           + Printer::prettify( data_ ) + "\"";
+  }
+  void execute( ByteStream& bs ) const override
+  {
+    size_t filled = 0;
+    for ( const auto space : bs.writer().reserve_spans( reserve_ ) ) {
+      filled += data_.copy( space.data(), space.size(), filled );
+    }
+    bs.writer().commit( filled );
+  }
+};
+
+struct Reserve : public ExpectNumber<ByteStream, uint64_t>
+{
+  uint64_t len_;
+
+  Reserve( uint64_t len, uint64_t expected ) : ExpectNumber( expected ), len_( len ) {}
+  std::string name() const override { return "reserve( " + std::to_string( len_ ) + " ).size()"; }
+  size_t value( ByteStream& bs ) const override { return bs.writer().reserve( len_ ).size(); }
+};
+
+struct ReserveSpans : public Expectation<ByteStream>
+{
+  uint64_t len_;
+  uint64_t first_;
+  uint64_t second_;
+
+  ReserveSpans( uint64_t len, uint64_t first, uint64_t second ) : len_( len ), first_( first ), second_( second ) {}
+  std::string description() const override
+  {
+    return "reserve_spans( " + std::to_string( len_ ) + " ) sizes = " + std::to_string( first_ ) + ", "
+           + std::to_string( second_ );
+  }
+  void execute( ByteStream& bs ) const override
+  {
+    const auto spans = bs.writer().reserve_spans( len_ );
+    if ( spans[0].size() != first_ or spans[1].size() != second_ ) {
+      throw ExpectationViolation { "reserve_spans( " + std::to_string( len_ ) + " ) returned spans of "
+                                   + std::to_string( spans[0].size() ) + " and "
+                                   + std::to_string( spans[1].size() ) + " bytes" };
+    }
+  }
+};
+
 struct Close : public Action<ByteStream>
 {
   std::string description() const override { return "close"; }
@@ -0,0 +1,101 @@
+#include "checksum.hh"
+
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+constexpr size_t bytes_per_test = 1UL << 30;
+
+using Kernel = uint16_t ( * )( string_view, char* );
+
+// Copy `source` into `destination` and checksum it, over and over: either copying with memcpy and then summing
+// the copy, or both in one pass
+uint16_t run( const Kernel kernel, const bool fused, const string& source, vector<char>& destination )
+{
+  uint32_t sum = 0;
+  for ( size_t done = 0; done < bytes_per_test; done += source.size() ) {
+    if ( fused ) {
+      sum += kernel( source, destination.data() );
+    } else {
+      memcpy( destination.data(), source.data(), source.size() );
+      sum += kernel( { destination.data(), source.size() }, nullptr );
+    }
+  }
+  return sum;
+}
+
+void speed_test( const size_t size )
+{
+  default_random_engine rd { size };
+  uniform_int_distribution<char> ud;
+  string source;
+  for ( size_t i = 0; i < size; ++i ) {
+    source += ud( rd );
+  }
+  vector<char> destination( size );
+
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  const uint16_t expected = InternetChecksum::sum_scalar( source );
+  for ( const auto& [name, kernel] : { pair<string, Kernel> { "scalar", InternetChecksum::sum_scalar },
+                                       pair<string, Kernel> { "SIMD", InternetChecksum::sum_simd } } ) {
+    for ( const bool fused : { false, true } ) {
+      if ( kernel( source, nullptr ) != expected ) {
+        throw runtime_error( name + " checksum is wrong" );
+      }
+
+      const auto start_time = steady_clock::now();
+      const uint16_t sum = run( kernel, fused, source, destination );
+      const auto stop_time = steady_clock::now();
+
+      if ( sum != static_cast<uint16_t>( expected * ( ( bytes_per_test + size - 1 ) / size ) )
+           or memcmp( destination.data(), source.data(), size ) != 0 ) {
+        throw runtime_error( name + " copy or checksum is wrong" );
+      }
+
+      const auto test_duration = duration_cast<duration<double>>( stop_time - start_time );
+      const auto gigabytes_per_second = static_cast<double>( bytes_per_test ) / test_duration.count() / 1e9;
+      const string method = fused ? "fused copy+checksum" : "memcpy, then checksum";
+
+      cout << setw( 5 ) << size << "-byte payloads, " << method << " (" << name << "): " << fixed
+           << setprecision( 2 ) << gigabytes_per_second << " GB/s.\n";
+
+      debug_output << "  Checksum " << setw( 5 ) << size << " B " << setw( 21 ) << method << setw( 7 ) << name
+                   << ": " << fixed << setprecision( 2 ) << gigabytes_per_second << " GB/s\n";
+    }
+  }
+}
+
+void program_body()
+{
+  for ( const size_t size : { 64, 1460, 65536 } ) {
+    speed_test( size );
+  }
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
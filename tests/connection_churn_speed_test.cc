@@ -0,0 +1,338 @@
+#include "exception.hh"
+#include "tcp_config.hh"
+#include "tcp_peer.hh"
+#include "tcp_segment.hh"
+
+#include <malloc.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <optional>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+// every allocation in the process (the test is single-threaded)
+size_t allocations = 0;
+
+constexpr size_t connection_count = 10'000;
+constexpr size_t concurrent_connections = 64;
+constexpr size_t request_size = 1500;
+constexpr size_t response_size = 6000;
+constexpr size_t max_steps = 1000;
+constexpr size_t arena_size = 64 * 1024;
+
+enum class Strategy : uint8_t
+{
+  GLOBAL_HEAP, // every connection allocates from the heap
+  POOL,        // each connection has a std::pmr::unsynchronized_pool_resource
+  MONOTONIC,   // each connection has a std::pmr::monotonic_buffer_resource, over a reused arena
+};
+
+TCPConfig config( const uint16_t port_offset )
+{
+  TCPConfig cfg;
+  cfg.isn = Wrap32 { 1000U * port_offset };
+  return cfg;
+}
+
+void write( Writer& writer, size_t len )
+{
+  while ( len > 0 ) {
+    const auto space = writer.reserve( len );
+    if ( space.empty() ) {
+      throw runtime_error( "stream is full" );
+    }
+    fill( space.begin(), space.end(), 'x' );
+    writer.commit( space.size() );
+    len -= space.size();
+  }
+}
+
+size_t read_all( Reader& reader )
+{
+  size_t total = 0;
+  while ( reader.bytes_buffered() > 0 ) {
+    const auto len = reader.peek().size();
+    reader.pop( len );
+    total += len;
+  }
+  return total;
+}
+
+// A short-lived connection: the client sends a request and closes, then the server sends a response and closes.
+// Both TCPPeers, and the segments in flight between them, allocate from the connection's memory resource.
+class Connection
+{
+  TCPPeer client_;
+  TCPPeer server_;
+  pmr::vector<TCPMessage> to_client_;
+  pmr::vector<TCPMessage> to_server_;
+  size_t request_read_ {};
+  size_t response_read_ {};
+  size_t steps_ {};
+
+  static void deliver( pmr::vector<TCPMessage>& messages,
+                       TCPPeer& destination,
+                       pmr::vector<TCPMessage>& replies )
+  {
+    for ( auto& msg : messages ) {
+      destination.receive( move( msg ), [&]( TCPMessage reply ) { replies.push_back( move( reply ) ); } );
+    }
+    messages.clear();
+  }
+
+public:
+  explicit Connection( pmr::memory_resource* resource )
+    : client_( config( 1 ), resource )
+    , server_( config( 2 ), resource )
+    , to_client_( resource )
+    , to_server_( resource )
+  {
+    to_client_.reserve( 16 );
+    to_server_.reserve( 16 );
+    client_.push( [&]( TCPMessage msg ) { to_server_.push_back( move( msg ) ); } );
+    write( client_.outbound_writer(), request_size );
+    client_.outbound_writer().close();
+  }
+
+  // One round trip's worth of work; returns whether the connection is finished
+  bool step()
+  {
+    if ( ++steps_ > max_steps ) {
+      throw runtime_error( "connection did not finish" );
+    }
+
+    client_.push( [&]( TCPMessage msg ) { to_server_.push_back( move( msg ) ); } );
+    if ( server_.has_ackno() ) {
+      server_.push( [&]( TCPMessage msg ) { to_client_.push_back( move( msg ) ); } );
+    }
+    deliver( to_server_, server_, to_client_ );
+    deliver( to_client_, client_, to_server_ );
+
+    request_read_ += read_all( server_.inbound_reader() );
+    if ( server_.inbound_reader().is_finished() and not server_.outbound_writer().is_closed() ) {
+      if ( request_read_ != request_size ) {
+        throw runtime_error( "request was corrupted" );
+      }
+      write( server_.outbound_writer(), response_size );
+      server_.outbound_writer().close();
+    }
+    response_read_ += read_all( client_.inbound_reader() );
+
+    const bool finished = client_.inbound_reader().is_finished() and server_.outbound_writer().is_closed()
+                          and client_.sender().sequence_numbers_in_flight() == 0
+                          and server_.sender().sequence_numbers_in_flight() == 0 and to_client_.empty()
+                          and to_server_.empty();
+    if ( finished and response_read_ != response_size ) {
+      throw runtime_error( "response was corrupted" );
+    }
+    return finished;
+  }
+};
+
+// A place for one connection at a time, with the memory resource it allocates from
+struct Slot
+{
+  unique_ptr<array<byte, arena_size>> arena { make_unique<array<byte, arena_size>>() };
+  optional<pmr::monotonic_buffer_resource> monotonic {};
+  optional<pmr::unsynchronized_pool_resource> pool {};
+  optional<Connection> connection {};
+
+  void open( const Strategy strategy )
+  {
+    switch ( strategy ) {
+      case Strategy::GLOBAL_HEAP:
+        connection.emplace( pmr::new_delete_resource() );
+        break;
+      case Strategy::POOL:
+        connection.emplace( &pool.emplace() );
+        break;
+      case Strategy::MONOTONIC:
+        connection.emplace( &monotonic.emplace( arena->data(), arena->size() ) );
+        break;
+    }
+  }
+
+  // the connection goes first, then (all at once) the memory it had
+  void close()
+  {
+    connection.reset();
+    monotonic.reset();
+    pool.reset();
+  }
+};
+
+struct HeapUsage
+{
+  size_t peak_size {};    // Largest the heap grew to
+  size_t free_at_peak {}; // Of that, bytes free (but held by the allocator) at the time
+
+  void sample()
+  {
+    const auto info = mallinfo2();
+    if ( info.arena > peak_size ) {
+      peak_size = info.arena;
+      free_at_peak = info.fordblks;
+    }
+  }
+};
+
+void churn_test( const string& name, const Strategy strategy )
+{
+  vector<Slot> slots( concurrent_connections );
+  HeapUsage heap;
+
+  const size_t allocations_before = allocations;
+  const auto start_time = steady_clock::now();
+
+  size_t opened = 0;
+  size_t live = 0;
+  for ( auto& slot : slots ) {
+    slot.open( strategy );
+    ++opened;
+    ++live;
+  }
+
+  // connections finish at different times, so they come and go interleaved
+  while ( live > 0 ) {
+    for ( auto& slot : slots ) {
+      if ( not slot.connection.has_value() or not slot.connection->step() ) {
+        continue;
+      }
+      heap.sample();
+      slot.close();
+      --live;
+      if ( opened < connection_count ) {
+        slot.open( strategy );
+        ++opened;
+        ++live;
+      }
+    }
+  }
+
+  const auto stop_time = steady_clock::now();
+
+  const auto mallocs_per_connection
+    = static_cast<double>( allocations - allocations_before ) / static_cast<double>( connection_count );
+  const auto test_duration = duration_cast<duration<double>>( stop_time - start_time );
+  const auto us_per_connection = test_duration.count() * 1e6 / static_cast<double>( connection_count );
+  const auto free_percent
+    = heap.peak_size ? 100.0 * static_cast<double>( heap.free_at_peak ) / static_cast<double>( heap.peak_size ) : 0;
+
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  cout << connection_count << " short-lived connections (" << name << "): " << fixed << setprecision( 1 )
+       << mallocs_per_connection << " mallocs per connection, " << setprecision( 2 ) << us_per_connection
+       << " us per connection, peak heap " << heap.peak_size / 1024 << " KiB (" << setprecision( 1 ) << free_percent
+       << "% of it free).\n";
+
+  debug_output << "  Connection churn " << setw( 10 ) << name << ": " << fixed << setprecision( 1 )
+               << mallocs_per_connection << " mallocs/conn, " << setprecision( 2 ) << us_per_connection
+               << " us/conn, heap " << heap.peak_size / 1024 << " KiB, " << setprecision( 1 ) << free_percent
+               << "% free\n";
+}
+
+// each test runs in a child process, so that it starts with a fresh heap
+void run_in_child( const string& name, const Strategy strategy )
+{
+  cout.flush();
+  const pid_t pid = CheckSystemCall( "fork", fork() );
+  if ( pid == 0 ) {
+    try {
+      churn_test( name, strategy );
+    } catch ( const exception& e ) {
+      cerr << "Exception: " << e.what() << "\n";
+      exit( EXIT_FAILURE );
+    }
+    exit( EXIT_SUCCESS );
+  }
+
+  int status = 0;
+  CheckSystemCall( "waitpid", waitpid( pid, &status, 0 ) );
+  if ( not WIFEXITED( status ) or WEXITSTATUS( status ) != EXIT_SUCCESS ) {
+    throw runtime_error( "connection churn test (" + name + ") failed" );
+  }
+}
+
+void program_body()
+{
+  run_in_child( "heap", Strategy::GLOBAL_HEAP );
+  run_in_child( "pool", Strategy::POOL );
+  run_in_child( "monotonic", Strategy::MONOTONIC );
+}
+
+} // namespace
+
+void* operator new( size_t size )
+{
+  ++allocations;
+  if ( void* ptr = malloc( max( size, size_t { 1 } ) ) ) { // NOLINT(*-no-malloc)
+    return ptr;
+  }
+  throw bad_alloc {};
+}
+
+// GCC takes free() of a pointer from operator new for a mismatch, even in the replacement operator delete
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void operator delete( void* ptr ) noexcept
+{
+  free( ptr ); // NOLINT(*-no-malloc)
+}
+#pragma GCC diagnostic pop
+
+void operator delete( void* ptr, size_t size [[maybe_unused]] ) noexcept
+{
+  operator delete( ptr );
+}
+
+// std::pmr::new_delete_resource() allocates with the alignment it is given
+void* operator new( size_t size, align_val_t alignment )
+{
+  ++allocations;
+  const auto align = static_cast<size_t>( alignment );
+  if ( void* ptr = aligned_alloc( align, ( max( size, size_t { 1 } ) + align - 1 ) / align * align ) ) {
+    return ptr;
+  }
+  throw bad_alloc {};
+}
+
+void operator delete( void* ptr, align_val_t alignment [[maybe_unused]] ) noexcept
+{
+  free( ptr ); // NOLINT(*-no-malloc)
+}
+
+void operator delete( void* ptr, size_t size [[maybe_unused]], align_val_t alignment [[maybe_unused]] ) noexcept
+{
+  free( ptr ); // NOLINT(*-no-malloc)
+}
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
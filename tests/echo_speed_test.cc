@@ -0,0 +1,180 @@
+#include "coroutine.hh"
+#include "eventloop.hh"
+#include "socket.hh"
+
+#include <chrono>
+#include <cstddef>
+#include <exception>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <list>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+constexpr size_t num_connections = 64;
+constexpr size_t rounds = 500;
+constexpr size_t message_size = 64;
+
+// each round, send one message on every connection, then wait for all of the echoes
+void run_clients( const Address& server )
+{
+  vector<TCPSocket> sockets( num_connections );
+  for ( auto& socket : sockets ) {
+    socket.connect( server );
+  }
+
+  const string message( message_size, 'x' );
+  string reply;
+  for ( size_t round = 0; round < rounds; ++round ) {
+    for ( auto& socket : sockets ) {
+      socket.write( message );
+    }
+    for ( auto& socket : sockets ) {
+      size_t received = 0;
+      while ( received < message_size ) {
+        reply.clear();
+        socket.read( reply );
+        if ( reply.empty() ) {
+          throw runtime_error( "echo server closed the connection" );
+        }
+        received += reply.size();
+      }
+    }
+  }
+}
+
+// the server as a set of EventLoop rules: accept, and per connection, read into a buffer and write it back out
+void callback_server( TCPSocket& listener )
+{
+  struct Connection
+  {
+    TCPSocket socket;
+    string pending {};
+  };
+
+  EventLoop loop { EventLoop::Backend::Epoll };
+  loop.set_batch_limit( numeric_limits<size_t>::max() );
+  list<Connection> connections;
+  const size_t echo_category = loop.add_category( "echo" );
+
+  loop.add_rule(
+    "accept",
+    listener,
+    Direction::In,
+    [&] {
+      auto& connection = connections.emplace_back( Connection { listener.accept() } );
+      connection.socket.set_blocking( false );
+
+      loop.add_rule(
+        echo_category,
+        connection.socket,
+        Direction::In,
+        [&connection] { connection.socket.read( connection.pending ); },
+        [&connection] { return connection.pending.empty(); } );
+
+      loop.add_rule(
+        echo_category,
+        connection.socket,
+        Direction::Out,
+        [&connection] { connection.pending.erase( 0, connection.socket.write( connection.pending ) ); },
+        [&connection] { return not connection.pending.empty(); } );
+    },
+    [&] { return connections.size() < num_connections; } );
+
+  while ( loop.wait_next_event( -1 ) != EventLoop::Result::Exit ) {}
+}
+
+Task<> echo( CoroutineLoop& loop, TCPSocket socket )
+{
+  string buffer;
+  while ( true ) {
+    buffer.clear();
+    co_await loop.read( socket, buffer );
+    if ( buffer.empty() ) {
+      co_return;
+    }
+    co_await loop.write( socket, buffer );
+  }
+}
+
+Task<> accept_connections( CoroutineLoop& loop, TCPSocket& listener )
+{
+  for ( size_t i = 0; i < num_connections; ++i ) {
+    loop.spawn( echo( loop, co_await loop.accept( listener ) ) );
+  }
+}
+
+// the same server as one coroutine per connection
+void coroutine_server( TCPSocket& listener )
+{
+  CoroutineLoop loop { EventLoop::Backend::Epoll };
+  loop.spawn( accept_connections( loop, listener ) );
+  loop.run();
+}
+
+void speed_test( const string& name, void ( *server )( TCPSocket& ) )
+{
+  TCPSocket listener;
+  listener.set_reuseaddr();
+  listener.bind( Address { "127.0.0.1" } );
+  listener.listen( num_connections );
+  listener.set_blocking( false );
+
+  exception_ptr client_error;
+  const auto start_time = steady_clock::now();
+  thread clients { [&client_error, address = listener.local_address()] {
+    try {
+      run_clients( address );
+    } catch ( ... ) {
+      client_error = current_exception();
+    }
+  } };
+  server( listener );
+  clients.join();
+  const auto stop_time = steady_clock::now();
+
+  if ( client_error ) {
+    rethrow_exception( client_error );
+  }
+
+  const auto test_duration = duration_cast<duration<double>>( stop_time - start_time );
+  const auto echoes = static_cast<double>( num_connections * rounds );
+  const auto us_per_echo = test_duration.count() * 1e6 / echoes;
+
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  cout << "Echo server (" << name << ") with " << num_connections << " connections: " << fixed
+       << setprecision( 2 ) << us_per_echo << " us per echo.\n";
+
+  debug_output << "             Echo server " << setw( 9 ) << name << ": " << fixed << setprecision( 2 )
+               << us_per_echo << " us/echo\n";
+}
+
+void program_body()
+{
+  speed_test( "callbacks", callback_server );
+  speed_test( "coroutine", coroutine_server );
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
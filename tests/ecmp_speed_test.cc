@@ -0,0 +1,215 @@
+#include "address.hh"
+#include "arp_message.hh"
+#include "ethernet_frame.hh"
+#include "flow_hash.hh"
+#include "network_interface.hh"
+#include "router.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <tuple>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+constexpr size_t paths = 4;
+constexpr size_t flow_count = 4096;
+constexpr size_t datagrams_per_flow = 16;
+constexpr size_t hashes_per_test = 1 << 24;
+
+// Keeps the frames sent out of an interface
+class Sink : public NetworkInterface::OutputPort
+{
+public:
+  vector<EthernetFrame> frames {};
+
+  void transmit( const NetworkInterface& sender [[maybe_unused]], const EthernetFrame& frame ) override
+  {
+    frames.push_back( frame );
+  }
+};
+
+using Flow = tuple<uint32_t, uint32_t, uint16_t, uint16_t>; // addresses and ports
+
+InternetDatagram make_datagram( const Flow& flow )
+{
+  const auto [src, dst, src_port, dst_port] = flow;
+  InternetDatagram dgram;
+  dgram.header.src = src;
+  dgram.header.dst = dst;
+  string payload( 40, 0 ); // a TCP segment's worth, starting with the ports
+  payload[0] = static_cast<char>( src_port >> 8 );
+  payload[1] = static_cast<char>( src_port );
+  payload[2] = static_cast<char>( dst_port >> 8 );
+  payload[3] = static_cast<char>( dst_port );
+  dgram.payload = move( payload );
+  dgram.header.len = IPv4Header::LENGTH + dgram.payload.size();
+  dgram.header.compute_checksum();
+  return dgram;
+}
+
+Flow flow_of( const InternetDatagram& dgram )
+{
+  const string payload = dgram.payload.concatenate();
+  const auto port = [&]( const size_t i ) {
+    return static_cast<uint16_t>( static_cast<uint8_t>( payload.at( i ) ) << 8
+                                  | static_cast<uint8_t>( payload.at( i + 1 ) ) );
+  };
+  return { dgram.header.src, dgram.header.dst, port( 0 ), port( 2 ) };
+}
+
+vector<Flow> make_flows()
+{
+  default_random_engine rd { 144 };
+  uniform_int_distribution<uint32_t> address;
+  uniform_int_distribution<uint16_t> port;
+  vector<Flow> flows;
+  for ( size_t i = 0; i < flow_count; ++i ) {
+    // many flows between the same few hosts, which only their ports tell apart
+    flows.emplace_back( address( rd ) % 16, address( rd ) % 16, port( rd ), port( rd ) );
+  }
+  return flows;
+}
+
+// The cost of hashing a datagram's 5-tuple (and just its addresses, for comparison)
+void hash_test( const vector<Flow>& flows )
+{
+  vector<InternetDatagram> datagrams;
+  for ( const auto& flow : flows ) {
+    datagrams.push_back( make_datagram( flow ) );
+  }
+
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  for ( const bool ports : { false, true } ) {
+    uint64_t sum = 0;
+    const auto start_time = steady_clock::now();
+    for ( size_t i = 0; i < hashes_per_test; ++i ) {
+      const auto& dgram = datagrams[i % datagrams.size()];
+      sum += ports ? flow_hash( dgram ) : address_hash( dgram.header );
+    }
+    const auto test_duration = duration_cast<duration<double>>( steady_clock::now() - start_time );
+    if ( sum == 0 ) {
+      throw runtime_error( "hashes are all zero" );
+    }
+
+    const double ns_per_hash = test_duration.count() * 1e9 / hashes_per_test;
+    const string what = ports ? "5-tuple hash" : "address hash";
+    cout << what << ": " << fixed << setprecision( 2 ) << ns_per_hash << " ns per datagram.\n";
+    debug_output << "  " << setw( 13 ) << what << ": " << fixed << setprecision( 2 ) << ns_per_hash << " ns\n";
+  }
+}
+
+// Route the flows over a default route with several equal-cost paths, and check how they spread
+void balance_test( const vector<Flow>& flows )
+{
+  Router router;
+  vector<shared_ptr<Sink>> sinks;
+  {
+    const auto debug = cerr.rdbuf( nullptr ); // (interfaces and routes are chatty)
+    for ( size_t i = 0; i <= paths; ++i ) {
+      const EthernetAddress ethernet { 2, 0, 0, 0, 0, static_cast<uint8_t>( i ) };
+      const Address ip { "10.0." + to_string( i ) + ".1" };
+      auto& sink = sinks.emplace_back( make_shared<Sink>() );
+      router.add_interface( make_shared<NetworkInterface>( "eth" + to_string( i ), sink, ethernet, ip ) );
+
+      // learn the next hop's Ethernet address
+      const EthernetAddress neighbor { 2, 0, 0, 0, 1, static_cast<uint8_t>( i ) };
+      const ARPMessage arp { .opcode = ARPMessage::OPCODE_REPLY,
+                             .sender_ethernet_address = neighbor,
+                             .sender_ip_address = Address { "10.0." + to_string( i ) + ".2" }.ipv4_numeric(),
+                             .target_ethernet_address = ethernet,
+                             .target_ip_address = ip.ipv4_numeric() };
+      const EthernetHeader header { .dst = ethernet, .src = neighbor, .type = EthernetHeader::TYPE_ARP };
+      router.interface( i )->recv_frame( { .header = header, .payload = serialize( arp ) } );
+      if ( i > 0 ) {
+        router.add_route( 0, 0, Address { "10.0." + to_string( i ) + ".2" }, i );
+      }
+    }
+    cerr.rdbuf( debug );
+  }
+
+  // each flow's datagrams, interleaved with the other flows'
+  auto& ingress = router.interface( 0 )->datagrams_received();
+  for ( size_t round = 0; round < datagrams_per_flow; ++round ) {
+    for ( const auto& flow : flows ) {
+      ingress.push( make_datagram( flow ) );
+    }
+  }
+  const auto start_time = steady_clock::now();
+  router.route();
+  const auto test_duration = duration_cast<duration<double>>( steady_clock::now() - start_time );
+
+  // every flow should have taken one path
+  map<Flow, size_t> path_of;
+  vector<size_t> flows_per_path( paths + 1 );
+  for ( size_t i = 1; i <= paths; ++i ) {
+    for ( const auto& frame : sinks[i]->frames ) {
+      InternetDatagram dgram;
+      if ( not parse( dgram, frame.payload ) ) {
+        throw runtime_error( "router sent a bad datagram" );
+      }
+      const auto [it, added] = path_of.try_emplace( flow_of( dgram ), i );
+      if ( it->second != i ) {
+        throw runtime_error( "a flow took more than one path" );
+      }
+      flows_per_path[i] += added;
+    }
+  }
+  if ( path_of.size() != flows.size() ) {
+    throw runtime_error( "router sent " + to_string( path_of.size() ) + " of " + to_string( flows.size() )
+                         + " flows" );
+  }
+
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  const double fair_share = static_cast<double>( flows.size() ) / paths;
+  double worst = 0;
+  for ( size_t i = 1; i <= paths; ++i ) {
+    worst = max( worst, abs( static_cast<double>( flows_per_path[i] ) - fair_share ) / fair_share );
+    debug_output << "  Path " << i << ": " << flows_per_path[i] << " flows, " << sinks[i]->frames.size()
+                 << " datagrams\n";
+  }
+  const double mpps = static_cast<double>( flows.size() * datagrams_per_flow ) / test_duration.count() / 1e6;
+
+  cout << "ECMP over " << paths << " paths: " << flows.size() << " flows, largest deviation from an even share "
+       << fixed << setprecision( 1 ) << worst * 100 << "%, routed at " << setprecision( 2 ) << mpps << " Mpps.\n";
+  debug_output << "  ECMP: worst path is " << fixed << setprecision( 1 ) << worst * 100 << "% off an even share, "
+               << setprecision( 2 ) << mpps << " Mpps\n";
+}
+
+void program_body()
+{
+  const auto flows = make_flows();
+  hash_test( flows );
+  balance_test( flows );
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,191 @@
+#include "egress_queue.hh"
+#include "ethernet_frame.hh"
+#include "network_interface_test_harness.hh"
+
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// A frame of `size` bytes (header included), tagged with its flow and sequence number
+EthernetFrame make_frame( const uint8_t flow, const uint8_t sequence, const size_t size = 1514 )
+{
+  EthernetFrame frame;
+  frame.header.type = EthernetHeader::TYPE_IPv4;
+  string payload( size - EthernetHeader::LENGTH, 'x' );
+  payload[0] = static_cast<char>( flow );
+  payload[1] = static_cast<char>( sequence );
+  frame.payload = move( payload );
+  return frame;
+}
+
+uint8_t flow_of( const EthernetFrame& frame )
+{
+  return frame.payload.concatenate().at( 0 );
+}
+
+uint8_t sequence_of( const EthernetFrame& frame )
+{
+  return frame.payload.concatenate().at( 1 );
+}
+
+int main()
+{
+  try {
+    {
+      expect( EgressQueue::classify( 0 ) == EgressQueue::BEST_EFFORT, "TOS 0 to be best effort" );
+      expect( EgressQueue::classify( 46 << 2 ) == EgressQueue::INTERACTIVE, "DSCP EF to be interactive" );
+      expect( EgressQueue::classify( 34 << 2 ) == EgressQueue::INTERACTIVE, "DSCP AF41 to be interactive" );
+      expect( EgressQueue::classify( 8 << 2 ) == EgressQueue::BULK, "DSCP CS1 to be bulk" );
+      expect( EgressQueue::classify( 1 << 2 ) == EgressQueue::BULK, "DSCP LE to be bulk" );
+      expect( EgressQueue::classify( 18 << 2 ) == EgressQueue::BEST_EFFORT, "DSCP AF21 to be best effort" );
+    }
+
+    {
+      // a sparse flow isn't stuck behind a busy one in the same class
+      EgressQueue queue;
+      for ( uint8_t i = 0; i < 8; ++i ) {
+        queue.push( make_frame( 1, i ), EgressQueue::BEST_EFFORT, 1 );
+      }
+      queue.push( make_frame( 2, 0 ), EgressQueue::BEST_EFFORT, 2 );
+      vector<uint8_t> flows;
+      while ( auto frame = queue.pop() ) {
+        flows.push_back( flow_of( *frame ) );
+      }
+      expect( flows.size() == 9, "all the frames to come out" );
+      expect( flows.at( 0 ) == 1 and flows.at( 1 ) == 2, "the flows to take turns" );
+      expect( queue.queued_bytes() == 0, "the queue to be empty" );
+    }
+
+    {
+      // ARP goes first, and each flow's frames stay in order
+      EgressQueue queue;
+      for ( uint8_t i = 0; i < 4; ++i ) {
+        queue.push( make_frame( 1, i ), EgressQueue::BULK, 1 );
+        queue.push( make_frame( 2, i ), EgressQueue::INTERACTIVE, 2 );
+      }
+      queue.push( make_frame( 3, 0, 42 ), EgressQueue::CONTROL, 0 );
+      auto first = queue.pop();
+      expect( first.has_value() and flow_of( *first ) == 3, "ARP to go first" );
+      map<uint8_t, uint8_t> next_sequence;
+      while ( auto frame = queue.pop() ) {
+        expect( sequence_of( *frame ) == next_sequence[flow_of( *frame )]++, "flows to stay in order" );
+      }
+    }
+
+    {
+      // when both are busy, the interactive class gets four times the bulk class's share
+      EgressQueue queue;
+      for ( uint8_t i = 0; i < 100; ++i ) {
+        queue.push( make_frame( 1, i ), EgressQueue::BULK, 1 );
+        queue.push( make_frame( 2, i ), EgressQueue::INTERACTIVE, 2 );
+      }
+      size_t interactive = 0;
+      for ( size_t i = 0; i < 50; ++i ) {
+        interactive += flow_of( queue.pop().value() ) == 2;
+      }
+      expect( interactive == 40, "40 of 50 frames to be interactive (got " + to_string( interactive ) + ")" );
+    }
+
+    {
+      // over the class's limit, the longest flow loses frames from its head
+      EgressQueue queue;
+      const size_t limit_frames = EgressQueue::CLASS_LIMIT / 1514;
+      queue.push( make_frame( 2, 0 ), EgressQueue::BEST_EFFORT, 2 );
+      for ( size_t i = 0; i < limit_frames + 10; ++i ) {
+        queue.push( make_frame( 1, static_cast<uint8_t>( i ) ), EgressQueue::BEST_EFFORT, 1 );
+      }
+      expect( queue.queued_bytes() <= EgressQueue::CLASS_LIMIT, "the class's limit to hold" );
+      expect( queue.stats().dropped[EgressQueue::BEST_EFFORT] == 11, "11 frames to be dropped" );
+      vector<uint8_t> busy_sequences;
+      bool sparse_flow_sent = false;
+      while ( auto frame = queue.pop() ) {
+        if ( flow_of( *frame ) == 1 ) {
+          busy_sequences.push_back( sequence_of( *frame ) );
+        } else {
+          sparse_flow_sent = true;
+        }
+      }
+      expect( sparse_flow_sent, "the sparse flow's frame to survive" );
+      expect( busy_sequences.front() == 11, "the busy flow's oldest frames to be the ones dropped" );
+    }
+
+    {
+      // shaped to 151,400 bytes per second: a burst's worth at once, then 100 frames a second
+      EgressQueue queue;
+      queue.set_rate( 151400, 1514 * 4 );
+      for ( uint8_t i = 0; i < 20; ++i ) {
+        queue.push( make_frame( 1, i ), EgressQueue::BEST_EFFORT, 1 );
+      }
+      size_t sent = 0;
+      while ( queue.pop() ) {
+        ++sent;
+      }
+      expect( sent == 4, "a burst of 4 frames (got " + to_string( sent ) + ")" );
+      for ( size_t ms = 0; ms < 100; ++ms ) {
+        queue.tick( 1 );
+        while ( queue.pop() ) {
+          ++sent;
+        }
+      }
+      expect( sent == 14, "10 more frames in 100 ms (got " + to_string( sent ) + ")" );
+    }
+
+    {
+      // a shaped interface holds frames back until there are tokens for them, but answers ARP first
+      const EthernetAddress local_eth { 2, 0, 0, 0, 0, 1 };
+      const EthernetAddress remote_eth { 2, 0, 0, 0, 0, 2 };
+      const Address local_ip { "4.3.2.1", 0 };
+      const Address remote_ip { "4.3.2.2", 0 };
+      const auto output = make_shared<FramesOut>();
+      NetworkInterface iface { "shaped", output, local_eth, local_ip };
+
+      ARPMessage request { .opcode = ARPMessage::OPCODE_REQUEST,
+                           .sender_ethernet_address = remote_eth,
+                           .sender_ip_address = remote_ip.ipv4_numeric(),
+                           .target_ethernet_address = {},
+                           .target_ip_address = local_ip.ipv4_numeric() };
+      const EthernetFrame arp_frame {
+        .header = { .dst = ETHERNET_BROADCAST, .src = remote_eth, .type = EthernetHeader::TYPE_ARP },
+        .payload = serialize( request ) };
+      iface.recv_frame( arp_frame ); // (learns the remote address, and replies)
+      output->frames = {};
+
+      iface.set_egress_rate( 151400, 1514 );
+      InternetDatagram dgram;
+      dgram.header.src = local_ip.ipv4_numeric();
+      dgram.header.dst = remote_ip.ipv4_numeric();
+      dgram.payload = string( 1500 - IPv4Header::LENGTH, 'x' );
+      dgram.header.len = 1500;
+      dgram.header.compute_checksum();
+      for ( size_t i = 0; i < 5; ++i ) {
+        iface.send_datagram( dgram, remote_ip );
+      }
+      expect( output->frames.size() == 1, "one frame to go out at once" );
+      expect( iface.egress_queued_bytes() == 4 * 1514, "four frames to wait" );
+
+      iface.recv_frame( arp_frame );
+      iface.tick( 10 );
+      expect( output->frames.size() == 3, "two more frames after 10 ms" );
+      output->frames.pop();
+      expect( output->frames.front().header.type == EthernetHeader::TYPE_ARP, "the ARP reply to go first" );
+
+      iface.set_egress_rate( 0, 0 );
+      expect( output->frames.size() == 5 and iface.egress_queued_bytes() == 0, "unshaping to send the rest" );
+
+      // frames that went out without waiting count as sent, too
+      iface.send_datagram( dgram, remote_ip );
+      expect( output->frames.size() == 6, "an unshaped interface to send at once" );
+      expect( iface.egress_stats().sent[EgressQueue::CONTROL] == 2, "both ARP replies to be counted" );
+      expect( iface.egress_stats().sent[EgressQueue::BEST_EFFORT] == 6, "all six datagrams to be counted" );
+    }
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
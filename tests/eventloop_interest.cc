@@ -0,0 +1,107 @@
+#include "common.hh"
+#include "eventloop.hh"
+#include "file_descriptor.hh"
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <utility>
+
+using namespace std;
+
+namespace {
+
+using Result = EventLoop::Result;
+
+// One rule's callback makes a rule on another fd interested (as when bidirectional_stream_copy reads stdin and
+// then has something to write to the socket): the loop must notice before it waits.
+void cross_fd_interest( const EventLoop::Backend backend, const string& name )
+{
+  auto [in_read, in_write] = make_pipe();
+  auto [out_read, out_write] = make_pipe();
+  in_read.set_blocking( false );
+  out_read.set_blocking( false );
+
+  EventLoop loop { backend };
+  const size_t category = loop.add_category( "pipe" );
+
+  string pending;
+  size_t copies = 0;
+  loop.add_rule( category, in_read, Direction::In, [&] { in_read.read( pending ); } );
+  loop.add_rule(
+    category,
+    out_write,
+    Direction::Out,
+    [&] {
+      out_write.write( pending );
+      pending.clear();
+      ++copies;
+    },
+    [&] { return not pending.empty(); } );
+
+  expect( loop.wait_next_event( 0 ) == Result::Timeout, name + ": an idle loop to time out" );
+
+  in_write.write( "hello" );
+  expect( loop.wait_next_event( 1000 ) == Result::Success, name + ": the read rule to run" );
+  expect( pending == "hello", name + ": the read rule to read what was written" );
+  expect( loop.wait_next_event( 1000 ) == Result::Success, name + ": the write rule to run after the read" );
+  expect( copies == 1, name + ": the write rule to run once" );
+
+  string copied;
+  out_read.read( copied );
+  expect( copied == "hello", name + ": the write rule to write what was read" );
+
+  // and the write rule is uninterested again, so once the read side is done, there's nothing left to wait for
+  expect( loop.wait_next_event( 0 ) == Result::Timeout, name + ": the write rule to be uninterested again" );
+  in_write.close();
+  size_t waits = 0;
+  while ( loop.wait_next_event( 1000 ) != Result::Exit ) {
+    expect( ++waits < 10, name + ": the loop to exit once nothing is interested" );
+  }
+  expect( copies == 1, name + ": the write rule not to run without anything to write" );
+}
+
+// A rule without an interest function is dropped once its fd is closed, or reaches EOF, outside the loop's
+// callbacks (as when the owner of a socket closes it), with every backend.
+void defunct_outside_callback( const EventLoop::Backend backend, const string& name, const bool close )
+{
+  auto [read_end, write_end] = make_pipe();
+  read_end.set_blocking( false );
+
+  EventLoop loop { backend };
+  bool cancelled = false;
+  loop.add_rule(
+    loop.add_category( "pipe" ), read_end, Direction::In, [] {}, {}, [&] { cancelled = true; } );
+  expect( loop.wait_next_event( 0 ) == Result::Timeout, name + ": an idle pipe to time out" );
+
+  if ( close ) {
+    read_end.close();
+  } else {
+    write_end.close();
+    string buffer;
+    read_end.read( buffer );
+  }
+  expect( loop.wait_next_event( 0 ) == Result::Exit,
+          name + ": the loop to exit once the pipe is " + ( close ? "closed" : "at EOF" ) );
+  expect( cancelled, name + ": the dropped rule's cancel callback to run" );
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    for ( const auto& [backend, name] : { pair { EventLoop::Backend::Poll, "poll" },
+                                          pair { EventLoop::Backend::Epoll, "epoll" },
+                                          pair { EventLoop::Backend::IOUring, "io_uring" } } ) {
+      cross_fd_interest( backend, name );
+      defunct_outside_callback( backend, name, true );
+      defunct_outside_callback( backend, name, false );
+    }
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
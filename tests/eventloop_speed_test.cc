@@ -0,0 +1,283 @@
+#include "eventloop.hh"
+#include "exception.hh"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+string backend_name( const EventLoop::Backend backend )
+{
+  switch ( backend ) {
+    case EventLoop::Backend::Poll:
+      return "poll";
+    case EventLoop::Backend::Epoll:
+      return "epoll";
+    case EventLoop::Backend::IOUring:
+      return "io_uring";
+  }
+  return "unknown";
+}
+
+// make sure we can open one eventfd per rule
+size_t max_rules()
+{
+  rlimit limit {};
+  CheckSystemCall( "getrlimit", getrlimit( RLIMIT_NOFILE, &limit ) );
+  limit.rlim_cur = limit.rlim_max;
+  CheckSystemCall( "setrlimit", setrlimit( RLIMIT_NOFILE, &limit ) );
+  constexpr rlim_t reserved_fds = 64;
+  return limit.rlim_cur > reserved_fds ? limit.rlim_cur - reserved_fds : 1;
+}
+
+void speed_test( const EventLoop::Backend backend, const size_t requested_rules )
+{
+  const size_t num_rules = min( requested_rules, max_rules() );
+  const size_t iterations = 100000 / num_rules + 100;
+
+  EventLoop loop { backend };
+  const size_t category = loop.add_category( "eventfd" );
+
+  // one idle In rule per eventfd; only the last one (the worst case for a linear scan) ever becomes readable
+  vector<FileDescriptor> fds;
+  fds.reserve( num_rules );
+  size_t dispatched = 0;
+  for ( size_t i = 0; i < num_rules; ++i ) {
+    auto& fd = fds.emplace_back( CheckSystemCall( "eventfd", eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC ) ) );
+    loop.add_rule( category, fd, Direction::In, [&fd, &dispatched] {
+      string counter( sizeof( uint64_t ), 0 );
+      fd.read( counter );
+      ++dispatched;
+    } );
+  }
+
+  FileDescriptor& ready_fd = fds.back();
+  const uint64_t one = 1;
+  const string_view increment { reinterpret_cast<const char*>( &one ), // NOLINT(*-reinterpret-cast)
+                                sizeof( one ) };
+
+  // the first wait arms every rule (once, with epoll and io_uring): leave it out of the timing
+  if ( loop.wait_next_event( 0 ) != EventLoop::Result::Timeout ) {
+    throw runtime_error( "EventLoop reported an idle rule as ready" );
+  }
+
+  const auto start_time = steady_clock::now();
+  for ( size_t i = 0; i < iterations; ++i ) {
+    ready_fd.write( increment );
+    if ( loop.wait_next_event( -1 ) != EventLoop::Result::Success ) {
+      throw runtime_error( "EventLoop did not report a ready rule" );
+    }
+  }
+  const auto stop_time = steady_clock::now();
+
+  if ( dispatched != iterations ) {
+    throw runtime_error( "EventLoop dispatched " + to_string( dispatched ) + " events, expected "
+                         + to_string( iterations ) );
+  }
+
+  const auto test_duration = duration_cast<duration<double>>( stop_time - start_time );
+  const auto us_per_dispatch = test_duration.count() * 1e6 / static_cast<double>( iterations );
+
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  cout << "EventLoop (" << backend_name( loop.backend() ) << ") with " << num_rules << " rules: " << fixed
+       << setprecision( 2 ) << us_per_dispatch << " us per dispatch.\n";
+
+  debug_output << "          EventLoop " << setw( 8 ) << backend_name( loop.backend() ) << " @ " << setw( 5 )
+               << num_rules << " rules: " << fixed << setprecision( 2 ) << us_per_dispatch << " us/dispatch\n";
+}
+
+// every rule is ready at once: how many wakeups does it take to service them all?
+void batch_test( const EventLoop::Backend backend, const size_t batch_limit )
+{
+  constexpr size_t num_rules = 1000;
+  constexpr size_t rounds = 5;
+
+  EventLoop loop { backend };
+  loop.set_batch_limit( batch_limit );
+  const size_t category = loop.add_category( "eventfd" );
+
+  vector<FileDescriptor> fds;
+  fds.reserve( num_rules );
+  size_t dispatched = 0;
+  for ( size_t i = 0; i < num_rules; ++i ) {
+    auto& fd = fds.emplace_back( CheckSystemCall( "eventfd", eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC ) ) );
+    loop.add_rule( category, fd, Direction::In, [&fd, &dispatched] {
+      string counter( sizeof( uint64_t ), 0 );
+      fd.read( counter );
+      ++dispatched;
+    } );
+  }
+
+  const uint64_t one = 1;
+  const string_view increment { reinterpret_cast<const char*>( &one ), // NOLINT(*-reinterpret-cast)
+                                sizeof( one ) };
+
+  const auto start_time = steady_clock::now();
+  for ( size_t round = 0; round < rounds; ++round ) {
+    for ( auto& fd : fds ) {
+      fd.write( increment );
+    }
+    while ( dispatched < ( round + 1 ) * num_rules ) {
+      if ( loop.wait_next_event( -1 ) != EventLoop::Result::Success ) {
+        throw runtime_error( "EventLoop did not report a ready rule" );
+      }
+    }
+  }
+  const auto stop_time = steady_clock::now();
+
+  if ( loop.stats().rules_serviced != dispatched ) {
+    throw runtime_error( "EventLoop::Stats counted " + to_string( loop.stats().rules_serviced )
+                         + " rules serviced, expected " + to_string( dispatched ) );
+  }
+
+  // epoll reports every rule in one result, and wakeups cut short by the limit serve the rest of it in turn
+  const size_t expected_wakeups = rounds * ( ( num_rules + batch_limit - 1 ) / batch_limit );
+  if ( loop.backend() == EventLoop::Backend::Epoll and loop.stats().wakeups != expected_wakeups ) {
+    throw runtime_error( "EventLoop took " + to_string( loop.stats().wakeups ) + " wakeups, expected "
+                         + to_string( expected_wakeups ) );
+  }
+
+  const auto test_duration = duration_cast<duration<double>>( stop_time - start_time );
+  const auto us_per_rule = test_duration.count() * 1e6 / static_cast<double>( dispatched );
+  const auto rules_per_wakeup
+    = static_cast<double>( loop.stats().rules_serviced ) / static_cast<double>( loop.stats().wakeups );
+
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  cout << "EventLoop (" << backend_name( loop.backend() ) << ") with batch limit " << batch_limit << ": " << fixed
+       << setprecision( 2 ) << rules_per_wakeup << " rules per wakeup, " << us_per_rule << " us per rule.\n";
+
+  debug_output << "          EventLoop " << setw( 8 ) << backend_name( loop.backend() ) << " batch " << setw( 4 )
+               << batch_limit << ": " << fixed << setprecision( 2 ) << rules_per_wakeup << " rules/wakeup, "
+               << us_per_rule << " us/rule\n";
+}
+
+// a timer rule that keeps rearming itself: how late does the loop wake up for a sub-millisecond deadline?
+void timer_test( const EventLoop::Backend backend )
+{
+  constexpr auto period = microseconds( 250 );
+  constexpr size_t firings = 400;
+
+  EventLoop loop { backend };
+
+  optional<EventLoop::Clock::time_point> deadline = EventLoop::Clock::now() + period;
+  size_t fired = 0;
+  EventLoop::Clock::duration total_lateness {};
+  loop.add_timer_rule(
+    "periodic timer",
+    [&] { return deadline; },
+    [&] {
+      const auto now = EventLoop::Clock::now();
+      total_lateness += now - deadline.value();
+      if ( ++fired == firings ) {
+        deadline.reset();
+      } else {
+        deadline = now + period;
+      }
+    } );
+
+  const auto start_time = steady_clock::now();
+  while ( loop.wait_next_event( -1 ) != EventLoop::Result::Exit ) {}
+  const auto stop_time = steady_clock::now();
+
+  if ( fired != firings or loop.stats().rules_serviced != firings ) {
+    throw runtime_error( "timer fired " + to_string( fired ) + " times, expected " + to_string( firings ) );
+  }
+
+  const auto us_late = duration_cast<duration<double, micro>>( total_lateness ).count() / firings;
+  const auto test_duration = duration_cast<duration<double, milli>>( stop_time - start_time ).count();
+
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  cout << "EventLoop (" << backend_name( loop.backend() ) << ") " << duration_cast<microseconds>( period ).count()
+       << " us timer: " << fixed << setprecision( 2 ) << us_late << " us late on average, " << firings
+       << " firings in " << test_duration << " ms.\n";
+
+  debug_output << "          EventLoop " << setw( 8 ) << backend_name( loop.backend() ) << " timer: " << fixed
+               << setprecision( 2 ) << us_late << " us late on average\n";
+}
+
+// a rule whose interest changes outside the loop's callbacks is re-armed before the next wait
+void interest_test( const EventLoop::Backend backend )
+{
+  EventLoop loop { backend };
+  FileDescriptor fd { CheckSystemCall( "eventfd", eventfd( 1, EFD_NONBLOCK | EFD_CLOEXEC ) ) };
+  bool interested = false;
+  size_t dispatched = 0;
+  auto rule = loop.add_rule(
+    "eventfd",
+    fd,
+    Direction::In,
+    [&] {
+      string counter( sizeof( uint64_t ), 0 );
+      fd.read( counter );
+      ++dispatched;
+      interested = false;
+    },
+    [&] { return interested; } );
+
+  if ( loop.wait_next_event( 0 ) != EventLoop::Result::Exit ) {
+    throw runtime_error( "EventLoop waited for an uninterested rule" );
+  }
+  interested = true;
+  if ( loop.wait_next_event( 0 ) != EventLoop::Result::Success or dispatched != 1 ) {
+    throw runtime_error( "EventLoop (" + backend_name( loop.backend() ) + ") missed a change of interest" );
+  }
+  rule.cancel();
+  if ( loop.wait_next_event( 0 ) != EventLoop::Result::Exit ) {
+    throw runtime_error( "EventLoop kept a cancelled rule" );
+  }
+}
+
+void program_body()
+{
+  interest_test( EventLoop::Backend::Poll );
+  interest_test( EventLoop::Backend::Epoll );
+  interest_test( EventLoop::Backend::IOUring );
+
+  for ( const size_t num_rules : { 10, 1000, 10000 } ) {
+    speed_test( EventLoop::Backend::Poll, num_rules );
+    speed_test( EventLoop::Backend::Epoll, num_rules );
+    speed_test( EventLoop::Backend::IOUring, num_rules );
+  }
+
+  for ( const size_t batch_limit : { 1, 64 } ) {
+    batch_test( EventLoop::Backend::Poll, batch_limit );
+    batch_test( EventLoop::Backend::Epoll, batch_limit );
+    batch_test( EventLoop::Backend::IOUring, batch_limit );
+  }
+
+  timer_test( EventLoop::Backend::Poll );
+  timer_test( EventLoop::Backend::Epoll );
+  timer_test( EventLoop::Backend::IOUring );
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
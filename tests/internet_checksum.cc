@@ -0,0 +1,95 @@
+#include "checksum.hh"
+#include "common.hh"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+
+using namespace std;
+
+namespace {
+
+// RFC 1071, a byte at a time: add up the big-endian 16-bit words (an odd last byte is the high byte of a word
+// padded with zero), with end-around carry
+uint16_t reference_sum( const string_view data )
+{
+  uint32_t sum = 0;
+  for ( size_t i = 0; i < data.size(); i += 2 ) {
+    const uint32_t high = static_cast<uint8_t>( data[i] );
+    const uint32_t low = i + 1 < data.size() ? static_cast<uint8_t>( data[i + 1] ) : 0;
+    sum += ( high << 8 ) | low;
+    sum = ( sum >> 16 ) + ( sum & 0xffff );
+  }
+  return sum;
+}
+
+string random_string( default_random_engine& rd, const size_t length )
+{
+  uniform_int_distribution<char> ud;
+  string data;
+  for ( size_t i = 0; i < length; ++i ) {
+    data += ud( rd );
+  }
+  return data;
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    default_random_engine rd { 1071 };
+    uniform_int_distribution<size_t> length_dist { 0, 200 };
+
+    // each kernel, on every length (odd ones included), with and without copying
+    for ( size_t round = 0; round < 1000; ++round ) {
+      const size_t length = round <= 200 ? round : length_dist( rd );
+      const string data = random_string( rd, length );
+      const uint16_t expected = reference_sum( data );
+      const string what = " on " + to_string( length ) + " bytes";
+
+      expect( InternetChecksum::sum_scalar( data ) == expected, "sum_scalar to match RFC 1071" + what );
+      expect( InternetChecksum::sum_simd( data ) == expected, "sum_simd to match RFC 1071" + what );
+
+      for ( const auto kernel : { InternetChecksum::sum_scalar, InternetChecksum::sum_simd } ) {
+        string copy( length, 0 );
+        expect( kernel( data, copy.data() ) == expected, "the copying sum to match RFC 1071" + what );
+        expect( copy == data, "copy_to to receive the data" + what );
+      }
+    }
+
+    // a checksum built up from pieces of any size (so some start at an odd offset), added with or without a copy
+    for ( size_t round = 0; round < 1000; ++round ) {
+      const string data = random_string( rd, length_dist( rd ) );
+      string copy( data.size(), 0 );
+      string copied_only( data.size(), 0 ); // what add_copy should have written (the rest is left alone)
+
+      InternetChecksum checksum;
+      uniform_int_distribution<size_t> piece_dist { 0, 31 };
+      for ( size_t pos = 0; pos < data.size(); ) {
+        const size_t piece = min( piece_dist( rd ), data.size() - pos );
+        const string_view view { data.data() + pos, piece };
+        if ( rd() % 2 ) {
+          checksum.add_copy( view, copy.data() + pos );
+          copied_only.replace( pos, piece, view );
+        } else {
+          checksum.add( view );
+        }
+        pos += piece;
+      }
+
+      const string what = " on " + to_string( data.size() ) + " bytes";
+      expect( checksum.sum() == reference_sum( data ), "a chain of pieces to match RFC 1071" + what );
+      expect( checksum.value() == static_cast<uint16_t>( ~reference_sum( data ) ),
+              "the checksum to be the complemented sum" + what );
+      expect( copy == copied_only, "add_copy to copy its pieces into place" + what );
+    }
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,251 @@
+#include "ethernet_header.hh"
+#include "ip_fragmentation.hh"
+#include "ipv4_datagram.hh"
+#include "network_interface_test_harness.hh"
+
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <iostream>
+
+using namespace std;
+
+InternetDatagram make_datagram( const string& src_ip,
+                                const string& dst_ip,
+                                const size_t payload_length,
+                                const uint16_t id )
+{
+  InternetDatagram dgram;
+  dgram.header.src = Address( src_ip, 0 ).ipv4_numeric();
+  dgram.header.dst = Address( dst_ip, 0 ).ipv4_numeric();
+  dgram.header.id = id;
+  dgram.header.df = false;
+  string payload;
+  for ( size_t i = 0; i < payload_length; ++i ) {
+    payload += static_cast<char>( 'a' + ( i * 7 + id ) % 26 );
+  }
+  dgram.payload.emplace_back( move( payload ) );
+  dgram.header.len = static_cast<uint64_t>( dgram.header.hlen ) * 4 + payload_length;
+  dgram.header.compute_checksum();
+  return dgram;
+}
+
+// A frame carrying a datagram from `src` to `dst`
+EthernetFrame make_frame( const EthernetAddress& src, const EthernetAddress& dst, const InternetDatagram& dgram )
+{
+  return make_frame( src, dst, EthernetHeader::TYPE_IPv4, serialize( dgram ) );
+}
+
+int main()
+{
+  try {
+    {
+      const auto datagram = make_datagram( "5.6.7.8", "1.2.3.4", 3000, 1 );
+      const auto fragments = fragment_datagram( datagram, 1500 );
+
+      expect( fragments.size() == 3, "a 3020-byte datagram to take three fragments at MTU 1500" );
+      size_t offset = 0;
+      for ( const auto& fragment : fragments ) {
+        expect( fragment.header.len <= 1500, "fragments to fit within the MTU" );
+        expect( fragment.header.offset * 8UL == offset, "fragment offsets to follow one another" );
+        expect( fragment.header.mf == ( &fragment != &fragments.back() ), "MF on all but the last fragment" );
+        expect( fragment.header.id == datagram.header.id, "fragments to keep the datagram's identification" );
+        offset += fragment.header.payload_length();
+      }
+      expect( offset == 3000, "fragments to cover the payload" );
+      expect( fragment_datagram( datagram, 3020 ).size() == 1, "a datagram that fits to be left whole" );
+    }
+
+    {
+      // a datagram with options: a copied one (loose source route), a no-op, and an uncopied one (timestamp)
+      auto datagram = make_datagram( "5.6.7.8", "1.2.3.4", 1200, 6 );
+      const array<uint8_t, 12> options { 0x83, 7, 4, 10, 0, 0, 1, 1, 0x44, 4, 5, 0 };
+      copy( options.begin(), options.end(), datagram.header.options.begin() );
+      datagram.header.hlen = ( IPv4Header::LENGTH + options.size() ) / 4;
+      datagram.header.len = datagram.header.hlen * 4 + 1200;
+      datagram.header.compute_checksum();
+
+      const auto fragments = fragment_datagram( datagram, 576 );
+      expect( fragments.at( 0 ).header.hlen == 8, "the first fragment to keep all of the options" );
+      expect( equal( options.begin(), options.end(), fragments.at( 0 ).header.options.begin() ),
+              "the first fragment's options to be the datagram's" );
+      size_t offset = 0;
+      for ( const auto& fragment : fragments ) {
+        expect( fragment.header.len <= 576, "fragments with options to fit within the MTU" );
+        expect( fragment.header.offset * 8UL == offset, "fragments with options to follow one another" );
+        if ( &fragment != &fragments.front() ) {
+          expect( fragment.header.hlen == 7, "later fragments to keep only the copied option, padded" );
+          expect( equal( options.begin(), options.begin() + 7, fragment.header.options.begin() )
+                    and fragment.header.options.at( 7 ) == 0,
+                  "later fragments' options to be the copied option" );
+        }
+        offset += fragment.header.payload_length();
+      }
+      expect( offset == 1200, "fragments with options to cover the payload" );
+
+      const EthernetAddress local_eth = random_private_ethernet_address();
+      const EthernetAddress remote_eth = random_private_ethernet_address();
+      NetworkInterfaceTestHarness test { "reassemble fragments with options", local_eth, Address( "1.2.3.4", 0 ) };
+      for ( size_t i = fragments.size() - 1; i > 0; --i ) {
+        test.execute( ReceiveFrame { make_frame( remote_eth, local_eth, fragments.at( i ) ), {} } );
+      }
+      test.execute( ReceiveFrame { make_frame( remote_eth, local_eth, fragments.at( 0 ) ), datagram } );
+    }
+
+    {
+      // an interface can't be given an MTU too small to fragment for (which would fail in the router instead)
+      NetworkInterface iface {
+        "test", make_shared<FramesOut>(), random_private_ethernet_address(), Address( "1.2.3.4", 0 ) };
+      bool rejected = false;
+      try {
+        iface.set_mtu( NetworkInterface::MIN_MTU - 1 );
+      } catch ( const runtime_error& ) {
+        rejected = true;
+      }
+      expect( rejected and iface.mtu() == NetworkInterface::DEFAULT_MTU, "an MTU below 68 to be rejected" );
+      iface.set_mtu( NetworkInterface::MIN_MTU );
+      expect( iface.mtu() == NetworkInterface::MIN_MTU, "an MTU of 68 to be accepted" );
+    }
+
+    {
+      const EthernetAddress local_eth = random_private_ethernet_address();
+      const EthernetAddress remote_eth = random_private_ethernet_address();
+      NetworkInterfaceTestHarness test { "reassemble fragments in order", local_eth, Address( "1.2.3.4", 0 ) };
+
+      const auto datagram = make_datagram( "5.6.7.8", "1.2.3.4", 3000, 2 );
+      const auto fragments = fragment_datagram( datagram, 1500 );
+      test.execute( ReceiveFrame { make_frame( remote_eth, local_eth, fragments.at( 0 ) ), {} } );
+      test.execute( ReceiveFrame { make_frame( remote_eth, local_eth, fragments.at( 1 ) ), {} } );
+      test.execute( ReceiveFrame { make_frame( remote_eth, local_eth, fragments.at( 2 ) ), datagram } );
+      test.execute( ExpectNoFrame {} );
+    }
+
+    {
+      const EthernetAddress local_eth = random_private_ethernet_address();
+      const EthernetAddress remote_eth = random_private_ethernet_address();
+      NetworkInterfaceTestHarness test {
+        "reassemble fragments out of order, with duplicates", local_eth, Address( "1.2.3.4", 0 ) };
+
+      const auto datagram = make_datagram( "5.6.7.8", "1.2.3.4", 5000, 3 );
+      const auto fragments = fragment_datagram( datagram, 576 );
+      for ( size_t i = fragments.size() - 1; i > 0; --i ) {
+        test.execute( ReceiveFrame { make_frame( remote_eth, local_eth, fragments.at( i ) ), {} } );
+        test.execute( ReceiveFrame { make_frame( remote_eth, local_eth, fragments.at( i ) ), {} } );
+      }
+      test.execute( ReceiveFrame { make_frame( remote_eth, local_eth, fragments.at( 0 ) ), datagram } );
+    }
+
+    {
+      const EthernetAddress local_eth = random_private_ethernet_address();
+      const EthernetAddress remote_eth = random_private_ethernet_address();
+      NetworkInterfaceTestHarness test { "interleaved datagrams", local_eth, Address( "1.2.3.4", 0 ) };
+
+      const auto datagram1 = make_datagram( "5.6.7.8", "1.2.3.4", 2000, 4 );
+      const auto datagram2 = make_datagram( "5.6.7.8", "1.2.3.4", 2000, 5 );
+      const auto fragments1 = fragment_datagram( datagram1, 1500 );
+      const auto fragments2 = fragment_datagram( datagram2, 1500 );
+      test.execute( ReceiveFrame { make_frame( remote_eth, local_eth, fragments1.at( 1 ) ), {} } );
+      test.execute( ReceiveFrame { make_frame( remote_eth, local_eth, fragments2.at( 0 ) ), {} } );
+      test.execute( ReceiveFrame { make_frame( remote_eth, local_eth, fragments2.at( 1 ) ), datagram2 } );
+      test.execute( ReceiveFrame { make_frame( remote_eth, local_eth, fragments1.at( 0 ) ), datagram1 } );
+    }
+
+    {
+      const EthernetAddress local_eth = random_private_ethernet_address();
+      const EthernetAddress remote_eth = random_private_ethernet_address();
+      NetworkInterfaceTestHarness test {
+        "fragments for another host pass through", local_eth, Address( "1.2.3.4", 0 ) };
+
+      const auto datagram = make_datagram( "5.6.7.8", "9.9.9.9", 2000, 6 );
+      const auto fragments = fragment_datagram( datagram, 1500 );
+      test.execute( ReceiveFrame { make_frame( remote_eth, local_eth, fragments.at( 0 ) ), fragments.at( 0 ) } );
+      test.execute( ReceiveFrame { make_frame( remote_eth, local_eth, fragments.at( 1 ) ), fragments.at( 1 ) } );
+    }
+
+    {
+      const EthernetAddress local_eth = random_private_ethernet_address();
+      const EthernetAddress remote_eth = random_private_ethernet_address();
+      NetworkInterfaceTestHarness test { "incomplete datagrams time out", local_eth, Address( "1.2.3.4", 0 ) };
+
+      const auto datagram = make_datagram( "5.6.7.8", "1.2.3.4", 2000, 7 );
+      const auto fragments = fragment_datagram( datagram, 1500 );
+      test.execute( ReceiveFrame { make_frame( remote_eth, local_eth, fragments.at( 0 ) ), {} } );
+      test.execute( Tick { FragmentReassembler::DEFAULT_TIMEOUT_MS } );
+      // the first fragment is gone, so the second one starts over
+      test.execute( ReceiveFrame { make_frame( remote_eth, local_eth, fragments.at( 1 ) ), {} } );
+      test.execute( ReceiveFrame { make_frame( remote_eth, local_eth, fragments.at( 0 ) ), datagram } );
+    }
+
+    {
+      FragmentReassembler reassembler;
+      const auto fragments = fragment_datagram( make_datagram( "5.6.7.8", "1.2.3.4", 2000, 8 ), 1500 );
+
+      // a fragment overlapping (but not duplicating) another drops the datagram
+      auto overlapping = fragments.at( 1 );
+      overlapping.header.offset -= 1;
+      overlapping.header.len += 8;
+      overlapping.payload = make_datagram( "5.6.7.8", "1.2.3.4", overlapping.header.payload_length(), 8 ).payload;
+      expect( not reassembler.add( fragments.at( 0 ) ), "no datagram from the first fragment" );
+      expect( not reassembler.add( overlapping ), "no datagram from an overlapping fragment" );
+      expect( reassembler.datagrams_pending() == 0 and reassembler.stats().malformed == 1,
+              "an overlap to drop the datagram" );
+
+      // a fragment with MF set must carry a multiple of 8 bytes
+      auto ragged = fragments.at( 0 );
+      ragged.header.len -= 1;
+      expect( not reassembler.add( ragged ) and reassembler.stats().malformed == 2,
+              "a ragged fragment to be dropped" );
+    }
+
+    {
+      FragmentReassembler reassembler { 4096 };
+      for ( uint16_t id = 0; id < 4; ++id ) {
+        reassembler.add( fragment_datagram( make_datagram( "5.6.7.8", "1.2.3.4", 3000, id ), 1500 ).at( 0 ) );
+      }
+      expect( reassembler.bytes_pending() <= 4096, "the memory limit to hold" );
+      expect( reassembler.stats().evicted == 2 and reassembler.datagrams_pending() == 2,
+              "the oldest datagrams to be evicted" );
+
+      // the newest datagrams are still there
+      const auto datagram = make_datagram( "5.6.7.8", "1.2.3.4", 3000, 3 );
+      const auto fragments = fragment_datagram( datagram, 1500 );
+      reassembler.add( fragments.at( 1 ) );
+      const auto whole = reassembler.add( fragments.at( 2 ) );
+      expect( whole.has_value() and equal( *whole, datagram ), "the newest datagram to be reassembled" );
+    }
+
+    {
+      // a flood of tiny first fragments is charged its overheads, not just its 8-byte payloads
+      constexpr size_t charge = FragmentReassembler::DATAGRAM_OVERHEAD + FragmentReassembler::PIECE_OVERHEAD + 8;
+      FragmentReassembler reassembler { 4096 };
+      for ( uint16_t id = 0; id < 100; ++id ) {
+        reassembler.add( fragment_datagram( make_datagram( "5.6.7.8", "1.2.3.4", 16, id ), 28 ).at( 0 ) );
+      }
+      expect( reassembler.datagrams_pending() == 4096 / charge, "tiny fragments to fill the memory limit" );
+      expect( reassembler.bytes_pending() == reassembler.datagrams_pending() * charge,
+              "each tiny fragment to be charged its overheads" );
+    }
+
+    {
+      // and the number of datagrams held is capped too, losing the oldest
+      FragmentReassembler reassembler {
+        FragmentReassembler::DEFAULT_MEMORY_LIMIT, FragmentReassembler::DEFAULT_TIMEOUT_MS, 16 };
+      for ( uint16_t id = 0; id < 100; ++id ) {
+        reassembler.add( fragment_datagram( make_datagram( "5.6.7.8", "1.2.3.4", 16, id ), 28 ).at( 0 ) );
+      }
+      expect( reassembler.datagrams_pending() == 16 and reassembler.stats().evicted == 84,
+              "the datagram limit to evict the oldest datagrams" );
+
+      const auto datagram = make_datagram( "5.6.7.8", "1.2.3.4", 16, 99 );
+      const auto whole = reassembler.add( fragment_datagram( datagram, 28 ).at( 1 ) );
+      expect( whole.has_value() and equal( *whole, datagram ), "the newest datagram to be reassembled" );
+      expect( not reassembler.add( fragment_datagram( make_datagram( "5.6.7.8", "1.2.3.4", 16, 0 ), 28 ).at( 1 ) ),
+              "the oldest datagram to be gone" );
+    }
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
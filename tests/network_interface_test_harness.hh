@@ -2,6 +2,8 @@
 
 #include <compare>
 #include <optional>
+#include <random>
+#include <string>
 #include <utility>
 
 #include "arp_message.hh"
@@ -32,6 +34,79 @@ public:
   {}
 };
 
+struct SetARPRefresh : public Action<InterfaceAndOutput>
+{
+  bool enabled;
+
+  std::string description() const override { return std::string( "ARP refresh " ) + ( enabled ? "on" : "off" ); }
+  void execute( InterfaceAndOutput& interface ) const override { interface.first.set_arp_refresh( enabled ); }
+
+  explicit SetARPRefresh( const bool e ) : enabled( e ) {}
+};
+
+struct ExpectPendingBytes : public ExpectNumber<InterfaceAndOutput, size_t>
+{
+  using ExpectNumber::ExpectNumber;
+  std::string name() const override { return "pending_bytes"; }
+  size_t value( InterfaceAndOutput& interface ) const override { return interface.first.pending_bytes(); }
+};
+
+// One counter of NetworkInterface::arp_stats(), e.g. ExpectARPStat { "requests", &ARPStats::requests, 3 }
+struct ExpectARPStat : public ExpectNumber<InterfaceAndOutput, uint64_t>
+{
+  using ARPStats = NetworkInterface::ARPStats;
+
+  std::string stat;
+  uint64_t ARPStats::*field;
+
+  std::string name() const override { return "arp_stats()." + stat; }
+  uint64_t value( InterfaceAndOutput& interface ) const override { return interface.first.arp_stats().*field; }
+
+  ExpectARPStat( std::string s, uint64_t ARPStats::*f, const uint64_t expected )
+    : ExpectNumber( expected ), stat( std::move( s ) ), field( f )
+  {}
+};
+
+inline EthernetAddress random_private_ethernet_address()
+{
+  EthernetAddress addr;
+  for ( auto& byte : addr ) {
+    byte = std::random_device()(); // use a random local Ethernet address
+  }
+  addr.at( 0 ) |= 0x02; // "10" in last two binary digits marks a private Ethernet address
+  addr.at( 0 ) &= 0xfe;
+
+  return addr;
+}
+
+inline ARPMessage make_arp( const uint16_t opcode,
+                            const EthernetAddress sender_ethernet_address,
+                            const std::string& sender_ip_address,
+                            const EthernetAddress target_ethernet_address,
+                            const std::string& target_ip_address )
+{
+  ARPMessage arp;
+  arp.opcode = opcode;
+  arp.sender_ethernet_address = sender_ethernet_address;
+  arp.sender_ip_address = Address( sender_ip_address, 0 ).ipv4_numeric();
+  arp.target_ethernet_address = target_ethernet_address;
+  arp.target_ip_address = Address( target_ip_address, 0 ).ipv4_numeric();
+  return arp;
+}
+
+inline EthernetFrame make_frame( const EthernetAddress& src,
+                                 const EthernetAddress& dst,
+                                 const uint16_t type,
+                                 BufferList payload )
+{
+  EthernetFrame frame;
+  frame.header.src = src;
+  frame.header.dst = dst;
+  frame.header.type = type;
+  frame.payload = std::move( payload );
+  return frame;
+}
+
 inline std::string summary( const EthernetFrame& frame );
 
 struct SendDatagram : public Action<InterfaceAndOutput>
@@ -49,18 +124,15 @@ struct SendDatagram : public Action<InterfaceAndOutput>
   SendDatagram( InternetDatagram d, Address n ) : dgram( std::move( d ) ), next_hop( n ) {}
 };
 
-inline std::string concat( const std::vector<std::string>& buffers )
+inline std::string concat( const BufferList& buffers )
 {
-  return std::accumulate( buffers.begin(), buffers.end(), std::string {} );
+  return buffers.concatenate();
 }
 
 template<class T>
 bool equal( const T& t1, const T& t2 )
 {
-  const std::vector<std::string> t1s = serialize( t1 );
-  const std::vector<std::string> t2s = serialize( t2 );
-
-  return concat( t1s ) == concat( t2s );
+  return concat( serialize( t1 ) ) == concat( serialize( t2 ) );
 }
 
 struct ReceiveFrame : public Action<InterfaceAndOutput>
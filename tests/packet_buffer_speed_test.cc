@@ -0,0 +1,278 @@
+#include "address.hh"
+#include "buffer_pool.hh"
+#include "ethernet_frame.hh"
+#include "network_interface.hh"
+#include "parser.hh"
+#include "tcp_over_ip.hh"
+#include "tcp_receiver.hh"
+#include "tcp_sender.hh"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <queue>
+#include <string>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+// every allocation in the process (the test is single-threaded)
+size_t allocations = 0;
+size_t bytes_allocated = 0;
+
+constexpr size_t total_bytes = 64UL * 1024 * 1024;
+constexpr size_t write_size = 16384;
+constexpr uint64_t stream_capacity = 65536;
+constexpr size_t datagram_count = 1'000'000;
+constexpr size_t warmup_datagrams = 1000;
+
+class FrameQueue : public NetworkInterface::OutputPort
+{
+public:
+  queue<EthernetFrame, deque<EthernetFrame, PacketAllocator<EthernetFrame>>> frames {};
+
+  void transmit( const NetworkInterface& sender [[maybe_unused]], const EthernetFrame& frame ) override
+  {
+    frames.push( frame );
+  }
+};
+
+void deliver( FrameQueue& port, NetworkInterface& destination )
+{
+  while ( not port.frames.empty() ) {
+    destination.recv_frame( port.frames.front() );
+    port.frames.pop();
+  }
+}
+
+// The sending TCP's bytes, from its ByteStream to the receiving TCP's ByteStream: TCPSender, wrap_tcp_in_ip, an
+// Ethernet frame from one NetworkInterface to the other, unwrap_tcp_in_ip, then the TCPReceiver and Reassembler.
+// The application writes into the sending ByteStream in place, and reads the receiving one into a fixed buffer
+// (as it would write it to a file descriptor). Acknowledgments go straight back to the TCPSender.
+struct Path
+{
+  Address sender_ip { "10.0.0.1" };
+  Address receiver_ip { "10.0.0.2" };
+
+  shared_ptr<FrameQueue> sender_port { make_shared<FrameQueue>() };
+  shared_ptr<FrameQueue> receiver_port { make_shared<FrameQueue>() };
+  NetworkInterface sender_interface { "sender", sender_port, { 2, 0, 0, 0, 0, 1 }, sender_ip };
+  NetworkInterface receiver_interface { "receiver", receiver_port, { 2, 0, 0, 0, 0, 2 }, receiver_ip };
+
+  TCPOverIPv4Adapter sender_adapter {};
+  TCPOverIPv4Adapter receiver_adapter {};
+
+  TCPSender sender { ByteStream { stream_capacity }, Wrap32 { 0 }, 1000 };
+  TCPReceiver receiver { Reassembler { ByteStream { stream_capacity } } };
+
+  Path()
+  {
+    sender_adapter.config_mut().source = Address { "10.0.0.1", 1000 };
+    sender_adapter.config_mut().destination = Address { "10.0.0.2", 2000 };
+    receiver_adapter.config_mut().source = Address { "10.0.0.2", 2000 };
+    receiver_adapter.config_mut().destination = Address { "10.0.0.1", 1000 };
+
+    // resolve the receiver's Ethernet address ahead of time
+    sender_interface.send_datagram( {}, receiver_ip );
+    deliver( *sender_port, receiver_interface );
+    deliver( *receiver_port, sender_interface );
+    deliver( *sender_port, receiver_interface );
+    receiver_interface.datagrams_received() = {};
+  }
+
+  void transmit( const TCPSenderMessage& msg )
+  {
+    sender_interface.send_datagram( sender_adapter.wrap_tcp_in_ip( { .sender = msg, .receiver = {} } ),
+                                    receiver_ip );
+  }
+
+  void receive()
+  {
+    deliver( *sender_port, receiver_interface );
+    auto& datagrams = receiver_interface.datagrams_received();
+    while ( not datagrams.empty() ) {
+      auto msg = receiver_adapter.unwrap_tcp_in_ip( datagrams.front() );
+      datagrams.pop();
+      if ( not msg.has_value() ) {
+        throw runtime_error( "TCP segment was lost on the way" );
+      }
+      receiver.receive( move( msg->sender ) );
+    }
+    sender.receive( receiver.send() );
+  }
+
+  Path( const Path& other ) = delete;
+  Path& operator=( const Path& other ) = delete;
+  Path( Path&& other ) = delete;
+  Path& operator=( Path&& other ) = delete;
+  ~Path() = default;
+};
+
+void transfer( Path& path )
+{
+  array<char, write_size> destination {};
+  size_t written = 0;
+  size_t read = 0;
+
+  const auto transmit = [&]( const TCPSenderMessage& msg ) { path.transmit( msg ); };
+
+  while ( read < total_bytes ) {
+    Writer& writer = path.sender.writer();
+    while ( written < total_bytes and writer.available_capacity() > 0 ) {
+      const auto space = writer.reserve( min( write_size, total_bytes - written ) );
+      fill( space.begin(), space.end(), 'x' );
+      writer.commit( space.size() );
+      written += space.size();
+    }
+
+    path.sender.push( transmit );
+    path.receive();
+
+    Reader& reader = path.receiver.reader();
+    while ( reader.bytes_buffered() > 0 ) {
+      const auto chunk = reader.peek().substr( 0, destination.size() );
+      copy( chunk.begin(), chunk.end(), destination.begin() );
+      reader.pop( chunk.size() );
+      read += chunk.size();
+    }
+  }
+
+  if ( destination.front() != 'x' ) {
+    throw runtime_error( "data were corrupted on the way" );
+  }
+}
+
+// Datagrams alone, from one NetworkInterface to the other (serialized into a frame, parsed, and queued): once the
+// PacketBufferPool has warmed up, none of this should call malloc.
+void datagram_test( Path& path )
+{
+  InternetDatagram dgram;
+  dgram.header.src = path.sender_ip.ipv4_numeric();
+  dgram.header.dst = path.receiver_ip.ipv4_numeric();
+  const auto payload_storage = PacketBufferPool::global().make_buffer( 1400 );
+  fill_n( payload_storage.get(), 1400, 'x' );
+  dgram.payload = Buffer { payload_storage, { payload_storage.get(), 1400 } };
+  dgram.header.len = dgram.header.hlen * 4 + dgram.payload.size();
+  dgram.header.compute_checksum();
+
+  const auto send = [&] {
+    path.sender_interface.send_datagram( dgram, path.receiver_ip );
+    deliver( *path.sender_port, path.receiver_interface );
+    auto& datagrams = path.receiver_interface.datagrams_received();
+    if ( datagrams.size() != 1 or datagrams.front().payload.size() != dgram.payload.size() ) {
+      throw runtime_error( "datagram was lost on the way" );
+    }
+    datagrams.pop();
+  };
+
+  for ( size_t i = 0; i < warmup_datagrams; ++i ) {
+    send();
+  }
+
+  const size_t allocations_before = allocations;
+  const auto start_time = steady_clock::now();
+  for ( size_t i = 0; i < datagram_count; ++i ) {
+    send();
+  }
+  const auto stop_time = steady_clock::now();
+
+  const auto mallocs_per_datagram
+    = static_cast<double>( allocations - allocations_before ) / static_cast<double>( datagram_count );
+  const auto test_duration = duration_cast<duration<double>>( stop_time - start_time );
+  const auto ns_per_datagram = test_duration.count() * 1e9 / static_cast<double>( datagram_count );
+  const auto stats = PacketBufferPool::global().stats();
+
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  cout << "Datagrams between NetworkInterfaces: " << fixed << setprecision( 3 ) << mallocs_per_datagram
+       << " mallocs per datagram, " << setprecision( 1 ) << ns_per_datagram << " ns per datagram (pool: "
+       << stats.hits << " hits, " << stats.misses << " misses, " << stats.bytes_outstanding
+       << " bytes outstanding).\n";
+
+  debug_output << "    Datagram path: " << fixed << setprecision( 3 ) << mallocs_per_datagram << " mallocs/dgram, "
+               << setprecision( 1 ) << ns_per_datagram << " ns/dgram\n";
+
+  if ( allocations != allocations_before ) {
+    throw runtime_error( "the datagram path called malloc with a warm PacketBufferPool" );
+  }
+}
+
+void program_body()
+{
+  Path path;
+
+  const size_t allocations_before = allocations;
+  const size_t bytes_allocated_before = bytes_allocated;
+  const auto start_time = steady_clock::now();
+  transfer( path );
+  const auto stop_time = steady_clock::now();
+
+  const auto kib = static_cast<double>( total_bytes ) / 1024;
+  const auto allocations_per_kib = static_cast<double>( allocations - allocations_before ) / kib;
+  const auto bytes_per_byte
+    = static_cast<double>( bytes_allocated - bytes_allocated_before ) / static_cast<double>( total_bytes );
+  const auto test_duration = duration_cast<duration<double>>( stop_time - start_time );
+  const auto gigabits_per_second = static_cast<double>( total_bytes ) * 8.0 / test_duration.count() / 1e9;
+
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  cout << "TCP over IPv4 over Ethernet, " << total_bytes / 1024 / 1024 << " MiB: " << fixed << setprecision( 2 )
+       << allocations_per_kib << " allocations per KiB, " << bytes_per_byte
+       << " bytes allocated per payload byte, " << setprecision( 2 ) << gigabits_per_second << " Gbit/s.\n";
+
+  debug_output << "      Packet buffers: " << fixed << setprecision( 2 ) << allocations_per_kib << " allocs/KiB, "
+               << bytes_per_byte << " bytes allocated/byte, " << gigabits_per_second << " Gbit/s\n";
+
+  datagram_test( path );
+}
+
+} // namespace
+
+void* operator new( size_t size )
+{
+  ++allocations;
+  bytes_allocated += size;
+  if ( void* ptr = malloc( max( size, size_t { 1 } ) ) ) { // NOLINT(*-no-malloc)
+    return ptr;
+  }
+  throw bad_alloc {};
+}
+
+// GCC takes free() of a pointer from operator new for a mismatch, even in the replacement operator delete
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void operator delete( void* ptr ) noexcept
+{
+  free( ptr ); // NOLINT(*-no-malloc)
+}
+#pragma GCC diagnostic pop
+
+void operator delete( void* ptr, size_t size [[maybe_unused]] ) noexcept
+{
+  operator delete( ptr );
+}
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
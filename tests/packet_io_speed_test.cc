@@ -0,0 +1,209 @@
+#include "io_uring.hh"
+#include "socket.hh"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <exception>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+constexpr size_t packet_size = 1500;
+constexpr size_t batch_size = 32;
+constexpr size_t num_batches = 4000;
+
+// a connected pair of UDP sockets on the loopback interface
+pair<UDPSocket, UDPSocket> socket_pair()
+{
+  UDPSocket sender, receiver;
+  receiver.bind( Address { "127.0.0.1" } );
+  sender.bind( Address { "127.0.0.1" } );
+  sender.connect( receiver.local_address() );
+  receiver.connect( sender.local_address() );
+  return { move( sender ), move( receiver ) };
+}
+
+void check_size( const size_t size )
+{
+  if ( size != packet_size ) {
+    throw runtime_error( "expected a " + to_string( packet_size ) + "-byte packet, got " + to_string( size ) );
+  }
+}
+
+// one write(2) and one read(2) per packet
+void send_syscalls( UDPSocket& sender, UDPSocket& receiver )
+{
+  const string packet( packet_size, 'x' );
+  string buffer;
+  for ( size_t batch = 0; batch < num_batches; ++batch ) {
+    for ( size_t i = 0; i < batch_size; ++i ) {
+      sender.write( packet );
+    }
+    for ( size_t i = 0; i < batch_size; ++i ) {
+      buffer.clear();
+      receiver.read( buffer );
+      check_size( buffer.size() );
+    }
+  }
+}
+
+// each batch's writes and reads submitted together, into and out of strings
+void send_batched( UDPSocket& sender, UDPSocket& receiver )
+{
+  IOBatch io;
+  const string packet( packet_size, 'x' );
+  vector<string> buffers( batch_size );
+  for ( size_t batch = 0; batch < num_batches; ++batch ) {
+    for ( size_t i = 0; i < batch_size; ++i ) {
+      io.queue_write( sender, packet );
+    }
+    for ( auto& buffer : buffers ) {
+      buffer.clear();
+      io.queue_read( receiver, buffer );
+    }
+    io.submit();
+    for ( const auto& buffer : buffers ) {
+      check_size( buffer.size() );
+    }
+  }
+}
+
+// the same, with each packet written from two pieces (like a datagram's headers and its payload), gathered
+void send_batched_writev( UDPSocket& sender, UDPSocket& receiver )
+{
+  IOBatch io;
+  const string packet( packet_size, 'x' );
+  const array<iovec, 2> pieces { { { const_cast<char*>( packet.data() ), 40 }, // NOLINT(*-const-cast)
+                                   { const_cast<char*>( packet.data() ) + 40, packet_size - 40 } } }; // NOLINT
+  vector<string> buffers( batch_size );
+  for ( size_t batch = 0; batch < num_batches; ++batch ) {
+    for ( size_t i = 0; i < batch_size; ++i ) {
+      io.queue_writev( sender, pieces );
+    }
+    for ( auto& buffer : buffers ) {
+      buffer.clear();
+      io.queue_read( receiver, buffer );
+    }
+    io.submit();
+    for ( const auto& buffer : buffers ) {
+      check_size( buffer.size() );
+    }
+  }
+}
+
+// the same, with registered buffers: the first half of the slots are sent, the second half received into
+void send_batched_slots( UDPSocket& sender, UDPSocket& receiver )
+{
+  IOBatch io { 2 * batch_size, packet_size };
+  for ( size_t slot = 0; slot < batch_size; ++slot ) {
+    fill_n( io.slot_buffer( slot ), packet_size, 'x' );
+  }
+  for ( size_t batch = 0; batch < num_batches; ++batch ) {
+    for ( size_t slot = 0; slot < batch_size; ++slot ) {
+      io.queue_write_slot( sender, slot, packet_size );
+    }
+    for ( size_t slot = batch_size; slot < 2 * batch_size; ++slot ) {
+      io.queue_read_slot( receiver, slot );
+    }
+    io.submit();
+    for ( size_t slot = batch_size; slot < 2 * batch_size; ++slot ) {
+      check_size( io.slot_data( slot ).size() );
+    }
+  }
+}
+
+// recvmmsg/sendmmsg: one system call per batch in each direction
+void send_mmsg( UDPSocket& sender, UDPSocket& receiver, const size_t mmsg_batch_size )
+{
+  DatagramBatch outgoing { mmsg_batch_size, packet_size };
+  DatagramBatch incoming { mmsg_batch_size, packet_size };
+  const string packet( packet_size, 'x' );
+  for ( size_t sent = 0; sent < num_batches * batch_size; sent += mmsg_batch_size ) {
+    for ( size_t i = 0; i < mmsg_batch_size; ++i ) {
+      outgoing.push_back( packet );
+    }
+    sender.send_batch( outgoing );
+
+    size_t received = 0;
+    while ( received < mmsg_batch_size ) {
+      received += receiver.recv_batch( incoming );
+      for ( size_t i = 0; i < incoming.size(); ++i ) {
+        check_size( incoming.payload( i ).size() );
+      }
+    }
+  }
+}
+
+void report( const string& name, const size_t transfer_batch_size, const duration<double> test_duration )
+{
+  const auto packets = static_cast<double>( num_batches * batch_size );
+  const auto kpps = packets / test_duration.count() / 1e3;
+
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  cout << "Packet I/O (" << name << ") in batches of " << transfer_batch_size << ": " << fixed << setprecision( 1 )
+       << kpps << " thousand packets per second.\n";
+
+  debug_output << "          Packet I/O " << setw( 16 ) << name << " x " << setw( 2 ) << transfer_batch_size << ": "
+               << fixed << setprecision( 1 ) << kpps << " kpps\n";
+}
+
+void mmsg_test( const size_t mmsg_batch_size )
+{
+  auto [sender, receiver] = socket_pair();
+
+  const auto start_time = steady_clock::now();
+  send_mmsg( sender, receiver, mmsg_batch_size );
+  const auto stop_time = steady_clock::now();
+
+  report( "sendmmsg/recvmmsg", mmsg_batch_size, duration_cast<duration<double>>( stop_time - start_time ) );
+}
+
+void speed_test( const string& name, void ( *transfer )( UDPSocket&, UDPSocket& ) )
+{
+  auto [sender, receiver] = socket_pair();
+
+  const auto start_time = steady_clock::now();
+  transfer( sender, receiver );
+  const auto stop_time = steady_clock::now();
+
+  report( name, batch_size, duration_cast<duration<double>>( stop_time - start_time ) );
+}
+
+void program_body()
+{
+  const string batch_name = IOBatch {}.using_io_uring() ? "io_uring" : "fallback";
+
+  speed_test( "syscalls", send_syscalls );
+  speed_test( batch_name, send_batched );
+  speed_test( batch_name + " + writev", send_batched_writev );
+  speed_test( batch_name + " + slots", send_batched_slots );
+
+  for ( const size_t mmsg_batch_size : { 1, 8, 32, 64 } ) {
+    mmsg_test( mmsg_batch_size );
+  }
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
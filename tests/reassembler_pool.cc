@@ -0,0 +1,78 @@
+#include "buffer_pool.hh"
+#include "common.hh"
+#include "reassembler.hh"
+
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+namespace {
+
+constexpr uint64_t segments = 1000;
+// Far less than one packet buffer per segment
+constexpr auto max_pinned = static_cast<int64_t>( 4 * PacketBufferPool::SLOT_SIZES[PacketBufferPool::MTU] );
+
+int64_t pool_bytes_outstanding()
+{
+  return static_cast<int64_t>( PacketBufferPool::global().stats().bytes_outstanding );
+}
+
+// A one-byte segment in a packet buffer of its own, as read from a TUN device
+Buffer one_byte_segment( uint64_t index )
+{
+  auto packet = PacketBufferPool::global().make_buffer( PacketBufferPool::MTU_BUFFER_SIZE );
+  packet[0] = static_cast<char>( 'a' + index % 26 );
+  return { packet, { packet.get(), 1 } };
+}
+
+string expected_stream( uint64_t len )
+{
+  string ret;
+  for ( uint64_t i = 0; i < len; i++ ) {
+    ret.push_back( static_cast<char>( 'a' + i % 26 ) );
+  }
+  return ret;
+}
+
+// Whether held by the Reassembler (out of order) or buffered in the stream (in order), one-byte segments must not
+// keep the whole packet buffer each arrived in.
+void one_byte_segments( bool in_order )
+{
+  const int64_t before = pool_bytes_outstanding();
+  Reassembler reassembler { ByteStream { 65536 } };
+
+  for ( uint64_t i = 0; i < segments; i++ ) {
+    const uint64_t index = in_order ? i : segments - i;
+    reassembler.insert( index, one_byte_segment( index ), false );
+  }
+  expect( pool_bytes_outstanding() - before < max_pinned,
+          "packet buffers no longer pinned by " + to_string( segments ) + " one-byte segments" );
+
+  if ( not in_order ) {
+    reassembler.insert( 0, one_byte_segment( 0 ), false );
+  }
+  const uint64_t len = in_order ? segments : segments + 1;
+  expect( reassembler.writer().bytes_pushed() == len, "all segments pushed" );
+  string data;
+  read( reassembler.reader(), len, data );
+  expect( data == expected_stream( len ), "segments reassembled" );
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    one_byte_segments( false );
+    one_byte_segments( true );
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,284 @@
+#include "address.hh"
+#include "arp_message.hh"
+#include "ethernet_frame.hh"
+#include "network_interface.hh"
+#include "router.hh"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+constexpr size_t egress_interfaces = 4;
+constexpr size_t route_count = 1'000'000; // about a full Internet table
+constexpr size_t updates = 256;
+constexpr size_t probes = 65536;
+
+// Keeps the frames sent out of an interface
+class Sink : public NetworkInterface::OutputPort
+{
+public:
+  vector<EthernetFrame> frames {};
+
+  void transmit( const NetworkInterface& sender [[maybe_unused]], const EthernetFrame& frame ) override
+  {
+    frames.push_back( frame );
+  }
+};
+
+EthernetAddress ethernet_address( const uint8_t host )
+{
+  return { 2, 0, 0, 0, 0, host };
+}
+
+string next_hop( const size_t interface )
+{
+  return "10.0." + to_string( interface ) + ".2";
+}
+
+uint32_t mask( const unsigned prefix_length )
+{
+  return prefix_length == 0 ? 0 : static_cast<uint32_t>( 0xFFFF'FFFF << ( 32 - prefix_length ) );
+}
+
+uint64_t key( const uint32_t prefix, const unsigned prefix_length )
+{
+  return static_cast<uint64_t>( prefix & mask( prefix_length ) ) << 8 | prefix_length;
+}
+
+// A table shaped like the Internet's: mostly /24s, then /22s and /23s, a few shorter and longer prefixes, and a
+// default route. Each prefix's interface is kept to check lookups against.
+struct RouteFile
+{
+  string text {};
+  unordered_map<uint64_t, size_t> interface_of {};
+
+  RouteFile()
+  {
+    default_random_engine rd { 144 };
+    uniform_int_distribution<uint32_t> address;
+    discrete_distribution<unsigned> length_choice { { 1, 1, 2, 4, 6, 10, 18, 24, 54, 2, 1 } };
+    const unsigned lengths[] = { 8, 12, 16, 18, 20, 21, 22, 23, 24, 28, 32 };
+
+    ostringstream out;
+    out << "# a synthetic Internet table\n0.0.0.0/0 " << next_hop( 1 ) << " 1\n";
+    interface_of[key( 0, 0 )] = 1;
+    while ( interface_of.size() < route_count ) {
+      const unsigned prefix_length = lengths[length_choice( rd )];
+      const uint32_t prefix = address( rd ) & mask( prefix_length );
+      const size_t interface = 1 + address( rd ) % egress_interfaces;
+      if ( interface_of.try_emplace( key( prefix, prefix_length ), interface ).second ) {
+        out << Address::from_ipv4_numeric( prefix ).ip() << "/" << prefix_length << " " << next_hop( interface )
+            << " " << interface << "\n";
+      }
+    }
+    text = out.str();
+  }
+
+  // longest-prefix match, the slow way
+  size_t expected_interface( const uint32_t dst ) const
+  {
+    for ( int prefix_length = 32; prefix_length >= 0; --prefix_length ) {
+      const auto it = interface_of.find( key( dst, prefix_length ) );
+      if ( it != interface_of.end() ) {
+        return it->second;
+      }
+    }
+    throw runtime_error( "no default route" );
+  }
+};
+
+struct Network
+{
+  Router router {};
+  vector<shared_ptr<Sink>> sinks {};
+
+  Network()
+  {
+    const auto debug = cerr.rdbuf( nullptr ); // (interfaces are chatty)
+    for ( size_t i = 0; i <= egress_interfaces; ++i ) {
+      auto& sink = sinks.emplace_back( make_shared<Sink>() );
+      const Address ip { "10.0." + to_string( i ) + ".1" };
+      router.add_interface(
+        make_shared<NetworkInterface>( "eth" + to_string( i ), sink, ethernet_address( i ), ip ) );
+
+      // learn the next hop's Ethernet address
+      ARPMessage arp;
+      arp.opcode = ARPMessage::OPCODE_REPLY;
+      arp.sender_ethernet_address = ethernet_address( 100 + i );
+      arp.sender_ip_address = Address { next_hop( i ) }.ipv4_numeric();
+      arp.target_ethernet_address = ethernet_address( i );
+      arp.target_ip_address = ip.ipv4_numeric();
+      const EthernetHeader header {
+        .dst = ethernet_address( i ), .src = arp.sender_ethernet_address, .type = EthernetHeader::TYPE_ARP };
+      router.interface( i )->recv_frame( { .header = header, .payload = serialize( arp ) } );
+    }
+    cerr.rdbuf( debug );
+  }
+
+  // Route a datagram to each destination, and check each went out the interface its longest prefix says
+  void check( const vector<uint32_t>& destinations, const RouteFile& routes )
+  {
+    for ( const auto& sink : sinks ) {
+      sink->frames.clear();
+    }
+    auto& ingress = router.interface( 0 )->datagrams_received();
+    for ( const uint32_t dst : destinations ) {
+      InternetDatagram dgram;
+      dgram.header.src = Address { "10.0.0.2" }.ipv4_numeric();
+      dgram.header.dst = dst;
+      dgram.header.len = IPv4Header::LENGTH;
+      dgram.header.compute_checksum();
+      ingress.push( move( dgram ) );
+    }
+    router.route();
+
+    size_t total = 0;
+    for ( size_t i = 0; i < sinks.size(); ++i ) {
+      for ( const auto& frame : sinks[i]->frames ) {
+        InternetDatagram dgram;
+        if ( not parse( dgram, frame.payload ) ) {
+          throw runtime_error( "router sent a bad datagram" );
+        }
+        if ( routes.expected_interface( dgram.header.dst ) != i ) {
+          throw runtime_error( "datagram to " + Address::from_ipv4_numeric( dgram.header.dst ).ip()
+                               + " went out the wrong interface" );
+        }
+        ++total;
+      }
+    }
+    if ( total != destinations.size() ) {
+      throw runtime_error( "router sent " + to_string( total ) + " of " + to_string( destinations.size() )
+                           + " datagrams" );
+    }
+  }
+};
+
+vector<uint32_t> make_destinations( default_random_engine& rd )
+{
+  uniform_int_distribution<uint32_t> address;
+  vector<uint32_t> destinations;
+  for ( size_t i = 0; i < probes; ++i ) {
+    destinations.push_back( address( rd ) );
+  }
+  return destinations;
+}
+
+void program_body()
+{
+  RouteFile routes;
+  Network network;
+  default_random_engine rd { 144 };
+  const auto destinations = make_destinations( rd );
+
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  // the whole table at once
+  Router::LoadReport report;
+  {
+    istringstream file { routes.text };
+    report = network.router.load_routes( file );
+  }
+  if ( report.prefixes != route_count ) {
+    throw runtime_error( "loaded " + to_string( report.prefixes ) + " of " + to_string( route_count )
+                         + " prefixes" );
+  }
+  network.check( destinations, routes );
+
+  cout << "Loaded " << report.routes << " routes: parsed in " << fixed << setprecision( 1 )
+       << static_cast<double>( report.parse_time.count() ) / 1000 << " ms, forwarding table built in "
+       << static_cast<double>( report.build_time.count() ) / 1000 << " ms.\n";
+  debug_output << "  Load " << report.routes << " routes: parse " << fixed << setprecision( 1 )
+               << static_cast<double>( report.parse_time.count() ) / 1000 << " ms, build "
+               << static_cast<double>( report.build_time.count() ) / 1000 << " ms\n";
+
+  // changes to the full table, each publishing a new one: /24s, then short prefixes (whose subtrees are many)
+  for ( const unsigned prefix_length : { 24U, 12U } ) {
+    uniform_int_distribution<uint32_t> address;
+    vector<pair<uint32_t, size_t>> added;
+    for ( size_t i = 0; i < updates; ++i ) {
+      const uint32_t prefix = address( rd ) & mask( prefix_length );
+      const size_t interface = 1 + i % egress_interfaces;
+      if ( routes.interface_of.try_emplace( key( prefix, prefix_length ), interface ).second ) {
+        added.emplace_back( prefix, interface );
+      }
+    }
+
+    const auto start_time = steady_clock::now();
+    for ( const auto& [prefix, interface] : added ) {
+      network.router.add_route( prefix, prefix_length, Address { next_hop( interface ) }, interface );
+    }
+    const auto added_time = steady_clock::now();
+    network.check( destinations, routes );
+
+    const auto removal_time = steady_clock::now();
+    for ( const auto& [prefix, interface] : added ) {
+      if ( not network.router.remove_route( prefix, prefix_length ) ) {
+        throw runtime_error( "remove_route didn't find a route" );
+      }
+      routes.interface_of.erase( key( prefix, prefix_length ) );
+    }
+    const auto removed_time = steady_clock::now();
+    network.check( destinations, routes );
+
+    const auto per_update = [&]( const auto elapsed ) {
+      return duration_cast<duration<double>>( elapsed ).count() * 1e6 / static_cast<double>( added.size() );
+    };
+    cout << "Incremental updates of /" << prefix_length << "s: " << fixed << setprecision( 1 )
+         << per_update( added_time - start_time ) << " us per add, " << per_update( removed_time - removal_time )
+         << " us per remove.\n";
+    debug_output << "  Update /" << prefix_length << ": add " << fixed << setprecision( 1 )
+                 << per_update( added_time - start_time ) << " us, remove "
+                 << per_update( removed_time - removal_time ) << " us\n";
+  }
+
+  // reload the table while routing: forwarding goes on with the old table until the new one is published
+  size_t batches = 0;
+  {
+    atomic<bool> loaded {};
+    const jthread loader { [&] {
+      istringstream file { routes.text };
+      network.router.load_routes( file );
+      loaded = true;
+    } };
+    const vector<uint32_t> batch { destinations.begin(), destinations.begin() + 1024 };
+    while ( not loaded ) {
+      network.check( batch, routes );
+      ++batches;
+    }
+  }
+  network.check( destinations, routes );
+  cout << "Routed " << batches << " batches of 1024 datagrams while reloading the table.\n";
+  debug_output << "  Reload: routed " << batches << " batches meanwhile\n";
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
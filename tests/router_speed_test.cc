@@ -0,0 +1,240 @@
+#include "address.hh"
+#include "arp_message.hh"
+#include "ethernet_frame.hh"
+#include "network_interface.hh"
+#include "router.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+constexpr size_t egress_interfaces = 4;
+constexpr size_t route_count = 1024;
+constexpr size_t batch_size = 16384;
+constexpr size_t datagrams_per_test = 262144;
+
+// Counts the frames sent out of an interface (keeping them too, to check them)
+class Sink : public NetworkInterface::OutputPort
+{
+public:
+  size_t frames_sent {};
+  bool keep {};
+  vector<EthernetFrame> frames {};
+
+  void transmit( const NetworkInterface& sender [[maybe_unused]], const EthernetFrame& frame ) override
+  {
+    ++frames_sent;
+    if ( keep ) {
+      frames.push_back( frame );
+    }
+  }
+};
+
+EthernetAddress ethernet_address( const uint8_t host )
+{
+  return { 2, 0, 0, 0, 0, host };
+}
+
+uint32_t next_hop( const size_t interface )
+{
+  return Address { "10.0." + to_string( interface ) + ".2" }.ipv4_numeric();
+}
+
+struct Network
+{
+  Router router {};
+  vector<shared_ptr<Sink>> sinks {};
+  vector<InternetDatagram> traffic {};
+
+  // `flow_count` flows, equally busy (or, if `skewed`, the k-th busiest carrying 1/k as much as the busiest)
+  Network( const size_t workers, const size_t flow_count, const bool skewed )
+  {
+    default_random_engine rd { 144 };
+    const auto debug = cerr.rdbuf( nullptr ); // (interfaces and routes are chatty)
+
+    // interface 0 is where the traffic comes in
+    for ( size_t i = 0; i <= egress_interfaces; ++i ) {
+      auto& sink = sinks.emplace_back( make_shared<Sink>() );
+      router.add_interface( make_shared<NetworkInterface>(
+        "eth" + to_string( i ), sink, ethernet_address( i ), Address { "10.0." + to_string( i ) + ".1" } ) );
+
+      // learn the next hop's Ethernet address
+      ARPMessage arp;
+      arp.opcode = ARPMessage::OPCODE_REPLY;
+      arp.sender_ethernet_address = ethernet_address( 100 + i );
+      arp.sender_ip_address = next_hop( i );
+      arp.target_ethernet_address = ethernet_address( i );
+      arp.target_ip_address = Address { "10.0." + to_string( i ) + ".1" }.ipv4_numeric();
+      const EthernetHeader header {
+        .dst = ethernet_address( i ), .src = arp.sender_ethernet_address, .type = EthernetHeader::TYPE_ARP };
+      router.interface( i )->recv_frame( { .header = header, .payload = serialize( arp ) } );
+    }
+
+    // a table of prefixes from /8 to /24, with a default route so everything goes somewhere
+    uniform_int_distribution<uint32_t> address;
+    uniform_int_distribution<unsigned> length { 8, 24 };
+    for ( size_t i = 0; i < route_count; ++i ) {
+      const size_t interface = 1 + i % egress_interfaces;
+      const auto prefix_length = static_cast<uint8_t>( length( rd ) );
+      const auto hop = Address::from_ipv4_numeric( next_hop( interface ) );
+      router.add_route( address( rd ), prefix_length, hop, interface );
+    }
+    router.add_route( 0, 0, Address::from_ipv4_numeric( next_hop( 1 ) ), 1 );
+    cerr.rdbuf( debug );
+
+    // flows between random hosts; each datagram's payload is its flow and sequence number, e.g. "00075:3;". The
+    // first four bytes, which ECMP takes to be TCP ports, are the same for all of a flow's datagrams.
+    vector<pair<uint32_t, uint32_t>> flows;
+    for ( size_t i = 0; i < flow_count; ++i ) {
+      flows.emplace_back( address( rd ), address( rd ) );
+    }
+    vector<double> weights;
+    for ( size_t i = 0; i < flow_count; ++i ) {
+      weights.push_back( skewed ? 1.0 / static_cast<double>( i + 1 ) : 1.0 );
+    }
+    discrete_distribution<size_t> flow { weights.begin(), weights.end() };
+    vector<size_t> sequence( flow_count );
+    for ( size_t i = 0; i < batch_size; ++i ) {
+      const size_t f = flow( rd );
+      InternetDatagram dgram;
+      dgram.header.src = flows[f].first;
+      dgram.header.dst = flows[f].second;
+      string payload = to_string( 100000 + f ).substr( 1 ) + ":" + to_string( sequence[f]++ ) + ";";
+      payload.resize( 64, 'x' );
+      dgram.payload = move( payload );
+      dgram.header.len = IPv4Header::LENGTH + dgram.payload.size();
+      dgram.header.compute_checksum();
+      traffic.push_back( move( dgram ) );
+    }
+
+    router.set_workers( workers );
+  }
+
+  size_t frames_sent() const
+  {
+    size_t total = 0;
+    for ( const auto& sink : sinks ) {
+      total += sink->frames_sent;
+    }
+    return total;
+  }
+
+  // Check that every datagram came out, and each flow's in order
+  void check() const
+  {
+    map<size_t, size_t> next_sequence;
+    size_t total = 0;
+    for ( const auto& sink : sinks ) {
+      for ( const auto& frame : sink->frames ) {
+        InternetDatagram dgram;
+        if ( not parse( dgram, frame.payload ) ) {
+          throw runtime_error( "router sent a bad datagram" );
+        }
+        const string payload = dgram.payload.concatenate();
+        const size_t f = stoul( payload.substr( 0, payload.find( ':' ) ) );
+        const size_t sequence = stoul( payload.substr( payload.find( ':' ) + 1 ) );
+        if ( sequence != next_sequence[f]++ ) {
+          throw runtime_error( "router reordered flow " + to_string( f ) );
+        }
+        ++total;
+      }
+    }
+    if ( total != traffic.size() ) {
+      throw runtime_error( "router sent " + to_string( total ) + " of " + to_string( traffic.size() )
+                           + " datagrams" );
+    }
+  }
+
+  void offer()
+  {
+    auto& ingress = router.interface( 0 )->datagrams_received();
+    for ( const auto& dgram : traffic ) {
+      ingress.push( dgram );
+    }
+  }
+};
+
+void speed_test( const size_t workers, const size_t flow_count, const bool skewed )
+{
+  Network network { workers, flow_count, skewed };
+
+  // one batch to check the routing, then timed ones
+  for ( const auto& sink : network.sinks ) {
+    sink->keep = true;
+  }
+  network.offer();
+  network.router.route();
+  network.check();
+  for ( const auto& sink : network.sinks ) {
+    sink->keep = false;
+    sink->frames.clear();
+  }
+
+  duration<double> routing_time {};
+  const size_t frames_before = network.frames_sent();
+  for ( size_t done = 0; done < datagrams_per_test; done += batch_size ) {
+    network.offer();
+    const auto start_time = steady_clock::now();
+    network.router.route();
+    routing_time += steady_clock::now() - start_time;
+  }
+
+  if ( network.frames_sent() - frames_before != datagrams_per_test ) {
+    throw runtime_error( "router lost datagrams" );
+  }
+
+  const double mpps = static_cast<double>( datagrams_per_test ) / routing_time.count() / 1e6;
+  const auto cache = network.router.cache_stats();
+  const double hit_rate = static_cast<double>( cache.hits ) / static_cast<double>( cache.hits + cache.misses );
+  const string mode = workers == 0 ? "serial" : to_string( workers ) + " worker" + ( workers > 1 ? "s" : "" );
+  const string traffic = to_string( flow_count ) + ( skewed ? " skewed" : "" ) + " flows";
+
+  cout << "Router (" << route_count << " routes, " << traffic << "), " << mode << ": " << fixed << setprecision( 2 )
+       << mpps << " Mpps, route cache hit rate " << setprecision( 1 ) << hit_rate * 100 << "%.\n";
+
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+  debug_output << "  Router " << setw( 19 ) << traffic << setw( 11 ) << mode << ": " << fixed << setprecision( 2 )
+               << mpps << " Mpps, " << setprecision( 1 ) << hit_rate * 100 << "% cache hits\n";
+}
+
+void program_body()
+{
+  cout << "(" << thread::hardware_concurrency() << " hardware threads)\n";
+  for ( const size_t workers : { 0, 1, 2, 4, 8 } ) {
+    speed_test( workers, 256, false );
+  }
+  // more destinations than the route cache holds: with real (skewed) traffic, most still hit
+  speed_test( 0, 65536, false );
+  speed_test( 0, 65536, true );
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
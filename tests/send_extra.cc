@@ -1,10 +1,13 @@
 #include "random.hh"
 #include "sender_test_harness.hh"
 
+#include <algorithm>
+#include <array>
 #include <cstdint>
 #include <cstdlib>
 #include <exception>
 #include <iostream>
+#include <memory_resource>
 #include <optional>
 #include <stdexcept>
 #include <string>
@@ -663,6 +666,25 @@ int main()
       test.execute( ExpectMessage {}.with_syn( true ).with_fin( true ).with_payload_size( 0 ).with_seqno( isn ) );
       test.execute( ExpectNoSegment {} );
     }
+
+    {
+      // a sender with a memory resource of its own sends payloads that outlive the resource
+      const Wrap32 isn( rd() );
+      array<char, 16384> arena {};
+      optional<TCPSenderMessage> sent;
+      {
+        pmr::monotonic_buffer_resource resource { arena.data(), arena.size(), pmr::null_memory_resource() };
+        TCPSender sender { ByteStream { 1000, &resource }, isn, TCPConfig::TIMEOUT_DFLT };
+        sender.push( []( const TCPSenderMessage& ) {} );
+        sender.receive( { Wrap32 { isn + 1 }, 1000 } );
+        const auto space = sender.writer().reserve( 5 );
+        copy_n( "hello", 5, space.begin() );
+        sender.writer().commit( 5 );
+        sender.push( [&]( const TCPSenderMessage& msg ) { sent = msg; } );
+      }
+      arena.fill( 0 );
+      expect( sent.has_value() and sent->payload == "hello", "a sent payload to survive its sender's resource" );
+    }
   } catch ( const exception& e ) {
     cerr << e.what() << endl;
     return 1;
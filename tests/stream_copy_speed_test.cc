@@ -0,0 +1,171 @@
+#include "bidirectional_stream_copy.hh"
+#include "socket.hh"
+
+#include <chrono>
+#include <cstddef>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+constexpr size_t bytes_per_direction = 512UL << 20;
+constexpr size_t chunk_size = 65536;
+
+using CopyT = void ( * )( Socket&, FileDescriptor&, FileDescriptor&, string_view );
+
+// a connected pair of TCP sockets on the loopback interface
+pair<TCPSocket, TCPSocket> tcp_pair()
+{
+  TCPSocket listener;
+  listener.bind( Address { "127.0.0.1" } );
+  listener.listen();
+  TCPSocket client;
+  client.connect( listener.local_address() );
+  return { listener.accept(), move( client ) };
+}
+
+// What the copy reads as its "stdin" and writes as its "stdout", and the other end of each
+struct Endpoints
+{
+  FileDescriptor input;
+  FileDescriptor feeder;
+  FileDescriptor output;
+  FileDescriptor drainer;
+};
+
+Endpoints pipe_endpoints()
+{
+  auto [input, feeder] = make_pipe();
+  auto [drainer, output] = make_pipe();
+  return { move( input ), move( feeder ), move( output ), move( drainer ) };
+}
+
+Endpoints socket_endpoints()
+{
+  auto [input, feeder] = tcp_pair();
+  auto [output, drainer] = tcp_pair();
+  return { move( input ), move( feeder ), move( output ), move( drainer ) };
+}
+
+void write_all( FileDescriptor& fd, string_view data )
+{
+  while ( not data.empty() ) {
+    data.remove_prefix( fd.write( data ) );
+  }
+}
+
+// read until EOF, returning the number of bytes read
+size_t read_all( FileDescriptor& fd, const function<void( string_view )>& consume = {} )
+{
+  vector<char> buffer( 1048576 );
+  size_t total = 0;
+  while ( true ) {
+    const size_t bytes_read = fd.read_into( buffer );
+    if ( fd.eof() ) {
+      return total;
+    }
+    total += bytes_read;
+    if ( consume ) {
+      consume( { buffer.data(), bytes_read } );
+    }
+  }
+}
+
+// feed the copy's input, echo everything it sends to the peer back at it, and count what comes out its output
+void speed_test( const string& endpoints_name,
+                 Endpoints ( *make_endpoints )(),
+                 const string& copy_name,
+                 const CopyT copy )
+{
+  Endpoints endpoints = make_endpoints();
+  auto [relay_socket, peer] = tcp_pair();
+
+  exception_ptr error;
+  const auto capture_errors = [&error]( auto&& body ) {
+    return [&error, body] {
+      try {
+        body();
+      } catch ( ... ) {
+        error = current_exception();
+      }
+    };
+  };
+
+  const auto start_time = steady_clock::now();
+
+  thread relay { capture_errors( [&] {
+    copy( relay_socket, endpoints.input, endpoints.output, "peer" );
+    relay_socket.close();
+  } ) };
+
+  thread feeder { capture_errors( [&] {
+    const string chunk( chunk_size, 'x' );
+    for ( size_t sent = 0; sent < bytes_per_direction; sent += chunk_size ) {
+      write_all( endpoints.feeder, chunk );
+    }
+    endpoints.feeder.close();
+  } ) };
+
+  thread echoer { capture_errors( [&] {
+    read_all( peer, [&]( string_view data ) { write_all( peer, data ); } );
+    peer.shutdown( SHUT_WR );
+  } ) };
+
+  const size_t received = read_all( endpoints.drainer );
+
+  feeder.join();
+  echoer.join();
+  relay.join();
+  const auto stop_time = steady_clock::now();
+
+  if ( error ) {
+    rethrow_exception( error );
+  }
+  if ( received != bytes_per_direction ) {
+    throw runtime_error( "expected " + to_string( bytes_per_direction ) + " bytes back, got "
+                         + to_string( received ) );
+  }
+
+  const auto test_duration = duration_cast<duration<double>>( stop_time - start_time );
+  const auto gigabits_per_second = 2 * 8 * static_cast<double>( bytes_per_direction ) / test_duration.count() / 1e9;
+
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  cout << "Stream copy (" << copy_name << ") with stdin/stdout as " << endpoints_name << ": " << fixed
+       << setprecision( 2 ) << gigabits_per_second << " Gbit/s.\n";
+
+  debug_output << "             Stream copy " << setw( 11 ) << copy_name << " over " << setw( 7 ) << endpoints_name
+               << ": " << fixed << setprecision( 2 ) << gigabits_per_second << " Gbit/s\n";
+}
+
+void program_body()
+{
+  speed_test( "pipes", pipe_endpoints, "ByteStream", byte_stream_copy );
+  speed_test( "pipes", pipe_endpoints, "splice", splice_stream_copy );
+  speed_test( "sockets", socket_endpoints, "ByteStream", byte_stream_copy );
+  speed_test( "sockets", socket_endpoints, "splice", splice_stream_copy );
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,98 @@
+#include "common.hh"
+#include "fd_adapter.hh"
+#include "file_descriptor.hh"
+#include "tcp_minnow_socket_impl.hh"
+
+#include <cstdlib>
+#include <iostream>
+#include <optional>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+// Drops every segment written to it. Once `retransmissions_before_reset` segments have gone out, it makes its fd
+// readable and hands back a RST, which ends the connection attempt.
+class BlackHoleAdapter : public FdAdapterBase
+{
+  FileDescriptor _read_end;
+  FileDescriptor _write_end;
+  size_t _reset_after;
+  size_t _written {};
+
+public:
+  explicit BlackHoleAdapter( pair<FileDescriptor, FileDescriptor> pipe, size_t retransmissions_before_reset )
+    : _read_end( move( pipe.first ) )
+    , _write_end( move( pipe.second ) )
+    , _reset_after( retransmissions_before_reset )
+  {
+    _read_end.set_blocking( false );
+  }
+
+  FileDescriptor& fd() { return _read_end; }
+
+  void write( const TCPMessage& seg [[maybe_unused]] )
+  {
+    if ( ++_written == _reset_after ) {
+      _write_end.write( "x" );
+    }
+  }
+
+  void write_batch( const span<const TCPMessage> segments )
+  {
+    for ( const auto& seg : segments ) {
+      write( seg );
+    }
+  }
+
+  optional<TCPMessage> read()
+  {
+    string byte;
+    _read_end.read( byte );
+    if ( byte.empty() ) {
+      return {};
+    }
+    TCPMessage rst;
+    rst.sender.RST = true;
+    return rst;
+  }
+
+  void read_batch( vector<TCPMessage>& segments, const size_t budget [[maybe_unused]] )
+  {
+    segments.clear();
+    if ( auto seg = read(); seg.has_value() ) {
+      segments.push_back( move( seg.value() ) );
+    }
+  }
+};
+
+// With an RTO of 0, the SYN is due for retransmission as soon as it goes out. The socket's timer must still wait
+// for a whole millisecond between retransmissions rather than spin until the EventLoop gives up.
+void zero_rto_connect()
+{
+  constexpr size_t segments = 16;
+
+  TCPMinnowSocket<BlackHoleAdapter> socket { BlackHoleAdapter { make_pipe(), segments } };
+  TCPConfig tcp_config;
+  tcp_config.rt_timeout = 0;
+  socket.connect( tcp_config, {} );
+  socket.wait_until_closed();
+}
+
+} // namespace
+
+int main()
+{
+  try {
+    zero_rto_connect();
+  } catch ( const exception& e ) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
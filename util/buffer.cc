@@ -0,0 +1,84 @@
+#include "buffer.hh"
+
+using namespace std;
+
+Buffer::Buffer( string&& str )
+{
+  if ( str.empty() ) {
+    return;
+  }
+  auto owner = make_shared<const string>( move( str ) );
+  _view = *owner;
+  _owner = move( owner );
+}
+
+BufferList::BufferList( vector<string>&& strs )
+{
+  _buffers.reserve( max( strs.size(), INITIAL_CAPACITY ) );
+  for ( auto& str : strs ) {
+    append( Buffer { move( str ) } );
+  }
+}
+
+void BufferList::append( Buffer buffer )
+{
+  if ( not buffer.empty() ) {
+    if ( _buffers.capacity() == 0 ) {
+      _buffers.reserve( INITIAL_CAPACITY );
+    }
+    _size += buffer.size();
+    _buffers.push_back( move( buffer ) );
+  }
+}
+
+void BufferList::append( const BufferList& other )
+{
+  for ( const auto& buffer : other ) {
+    append( buffer );
+  }
+}
+
+void BufferList::remove_prefix( size_t n )
+{
+  n = min( n, _size );
+  _size -= n;
+
+  auto first = _buffers.begin();
+  while ( n > 0 and n >= first->size() ) {
+    n -= first->size();
+    ++first;
+  }
+  _buffers.erase( _buffers.begin(), first );
+  if ( n > 0 ) {
+    _buffers.front().remove_prefix( n );
+  }
+}
+
+BufferList BufferList::substr( size_t pos, size_t len ) const
+{
+  BufferList ret;
+  for ( const auto& buffer : _buffers ) {
+    if ( len == 0 ) {
+      break;
+    }
+    if ( pos >= buffer.size() ) {
+      pos -= buffer.size();
+      continue;
+    }
+    const auto piece = buffer.substr( pos, len );
+    len -= min( len, piece.size() );
+    pos = 0;
+    ret.append( piece );
+  }
+  return ret;
+}
+
+string BufferList::concatenate() const
+{
+  string ret;
+  ret.reserve( _size );
+  for ( const auto& buffer : _buffers ) {
+    ret.append( buffer );
+  }
+  return ret;
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "buffer_pool.hh"
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+//! \brief A reference-counted, read-only string.
+//! \details Copying a Buffer, or slicing one with substr() or remove_prefix(), shares its storage instead of
+//! copying the bytes. A Buffer made from a `std::string&&` takes over the string's storage.
+class Buffer
+{
+  std::shared_ptr<const void> _owner {}; //!< Keeps the storage alive (null if the Buffer only borrows it)
+  std::string_view _view {};
+
+public:
+  Buffer() = default;
+
+  //! Takes over the string (no bytes are copied)
+  Buffer( std::string&& str ); // NOLINT(*-explicit-*)
+
+  //! Copies the string
+  Buffer( const std::string& str ) : Buffer( std::string { str } ) {} // NOLINT(*-explicit-*)
+  Buffer( const char* str ) : Buffer( std::string { str } ) {}        // NOLINT(*-explicit-*)
+
+  //! Bytes within storage kept alive by `owner`
+  Buffer( std::shared_ptr<const void> owner, std::string_view view ) : _owner( std::move( owner ) ), _view( view )
+  {}
+
+  std::string_view str() const { return _view; }
+  operator std::string_view() const { return _view; } // NOLINT(*-explicit-*)
+  explicit operator std::string() const { return std::string { _view }; }
+
+  const char* data() const { return _view.data(); }
+  size_t size() const { return _view.size(); }
+  bool empty() const { return _view.empty(); }
+  char at( size_t n ) const { return _view.at( n ); }
+
+  void remove_prefix( size_t n ) { _view.remove_prefix( std::min( n, _view.size() ) ); }
+  void remove_suffix( size_t n ) { _view.remove_suffix( std::min( n, _view.size() ) ); }
+
+  //! A slice of this Buffer, sharing its storage
+  Buffer substr( size_t pos, size_t len = std::string::npos ) const { return { _owner, _view.substr( pos, len ) }; }
+
+  //! The owner of the storage, e.g. to extend a Buffer over bytes written after it into the same storage
+  const std::shared_ptr<const void>& owner() const { return _owner; }
+  bool owns_storage() const { return _owner != nullptr; }
+
+  bool operator==( std::string_view other ) const { return _view == other; }
+};
+
+//! \brief A sequence of Buffers, read as one string without joining them, e.g. a packet's headers followed by its
+//! payload. Its array comes from the PacketBufferPool.
+class BufferList
+{
+public:
+  using Buffers = std::vector<Buffer, PacketAllocator<Buffer>>;
+
+  //! Room reserved by the first append(), enough for a frame's headers and payload
+  static constexpr size_t INITIAL_CAPACITY = 8;
+
+private:
+  Buffers _buffers {};
+  size_t _size {};
+
+public:
+  BufferList() = default;
+
+  BufferList( Buffer buffer ) { append( std::move( buffer ) ); }                  // NOLINT(*-explicit-*)
+  BufferList( std::string&& str ) : BufferList( Buffer { std::move( str ) } ) {} // NOLINT(*-explicit-*)
+  BufferList( std::vector<std::string>&& strs );                                  // NOLINT(*-explicit-*)
+
+  //! Append a Buffer (sharing its storage); empty Buffers are skipped
+  void append( Buffer buffer );
+  void append( const BufferList& other );
+
+  template<typename... Targs>
+  void emplace_back( Targs&&... args )
+  {
+    append( Buffer { std::forward<Targs>( args )... } );
+  }
+
+  size_t size() const { return _size; }
+  bool empty() const { return _size == 0; }
+
+  const Buffers& buffers() const { return _buffers; }
+  auto begin() const { return _buffers.begin(); }
+  auto end() const { return _buffers.end(); }
+  const Buffer& front() const { return _buffers.front(); }
+  const Buffer& back() const { return _buffers.back(); }
+
+  void remove_prefix( size_t n );
+
+  //! `len` bytes starting at `pos` (clamped to the list), sharing the Buffers' storage
+  BufferList substr( size_t pos, size_t len = std::string::npos ) const;
+
+  //! The contents, copied into one string
+  std::string concatenate() const;
+  explicit operator std::string() const { return concatenate(); }
+};
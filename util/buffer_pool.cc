@@ -0,0 +1,256 @@
+#include "buffer_pool.hh"
+#include "exception.hh"
+
+#include <algorithm>
+#include <new>
+#include <optional>
+#include <sys/mman.h>
+
+#ifdef __SANITIZE_ADDRESS__
+#include <sanitizer/asan_interface.h>
+#endif
+
+using namespace std;
+
+namespace {
+thread_local bool thread_exiting = false; // the thread's cache has been destroyed
+
+// With AddressSanitizer, free slots are poisoned, so a use after free is caught as it would be with malloc
+void poison( [[maybe_unused]] void* slot, [[maybe_unused]] const size_t size )
+{
+#ifdef __SANITIZE_ADDRESS__
+  ASAN_POISON_MEMORY_REGION( slot, size );
+#endif
+}
+
+void unpoison( [[maybe_unused]] void* slot, [[maybe_unused]] const size_t size )
+{
+#ifdef __SANITIZE_ADDRESS__
+  ASAN_UNPOISON_MEMORY_REGION( slot, size );
+#endif
+}
+} // namespace
+
+//! A thread's free lists (and its statistics), in front of the pool's shared free lists
+class PacketBufferCache
+{
+public:
+  static constexpr size_t CAPACITY = 64; //!< Slots kept per class
+  static constexpr size_t BATCH = 32;    //!< Slots traded with the shared free list at a time
+
+  struct Counters
+  {
+    atomic<uint64_t> hits { 0 };
+    atomic<uint64_t> misses { 0 };
+    atomic<int64_t> bytes_outstanding { 0 }; // negative if this thread frees more than it allocates
+  };
+
+private:
+  PacketBufferPool& _pool;
+  array<vector<void*>, PacketBufferPool::NUM_CLASSES> _slots {};
+  Counters _counters {};
+
+  // only this thread writes the counters, so a relaxed load and store is enough (and cheaper than an atomic add)
+  template<typename T>
+  static void add( atomic<T>& counter, const T n )
+  {
+    counter.store( counter.load( memory_order_relaxed ) + n, memory_order_relaxed );
+  }
+
+public:
+  explicit PacketBufferCache( PacketBufferPool& pool ) : _pool( pool )
+  {
+    for ( auto& slots : _slots ) {
+      slots.reserve( CAPACITY );
+    }
+    const lock_guard lock { _pool._caches_lock };
+    _pool._caches.push_back( this );
+  }
+
+  ~PacketBufferCache()
+  {
+    thread_exiting = true;
+    for ( uint8_t c = 0; c < PacketBufferPool::NUM_CLASSES; ++c ) {
+      _pool.release( static_cast<PacketBufferPool::SizeClass>( c ), _slots.at( c ), _slots.at( c ).size() );
+    }
+    const lock_guard lock { _pool._caches_lock };
+    _pool._exited.hits += _counters.hits;
+    _pool._exited.misses += _counters.misses;
+    _pool._exited.bytes_outstanding += _counters.bytes_outstanding;
+    erase( _pool._caches, this );
+  }
+
+  void* allocate( const PacketBufferPool::SizeClass size_class )
+  {
+    auto& slots = _slots.at( size_class );
+    add( _counters.bytes_outstanding, static_cast<int64_t>( PacketBufferPool::SLOT_SIZES.at( size_class ) ) );
+    if ( slots.empty() ) {
+      add( _counters.misses, uint64_t { 1 } );
+      _pool.refill( size_class, slots, BATCH );
+    } else {
+      add( _counters.hits, uint64_t { 1 } );
+    }
+    void* const slot = slots.back();
+    slots.pop_back();
+    unpoison( slot, PacketBufferPool::SLOT_SIZES.at( size_class ) );
+    return slot;
+  }
+
+  void deallocate( const PacketBufferPool::SizeClass size_class, void* const slot )
+  {
+    auto& slots = _slots.at( size_class );
+    add( _counters.bytes_outstanding, -static_cast<int64_t>( PacketBufferPool::SLOT_SIZES.at( size_class ) ) );
+    poison( slot, PacketBufferPool::SLOT_SIZES.at( size_class ) );
+    if ( slots.size() == CAPACITY ) {
+      _pool.release( size_class, slots, BATCH );
+    }
+    slots.push_back( slot );
+  }
+
+  // a block too big for any class
+  void heap( const int64_t bytes )
+  {
+    add( _counters.misses, uint64_t { bytes > 0 } );
+    add( _counters.bytes_outstanding, bytes );
+  }
+
+  const Counters& counters() const { return _counters; }
+
+  PacketBufferCache( const PacketBufferCache& other ) = delete;
+  PacketBufferCache& operator=( const PacketBufferCache& other ) = delete;
+  PacketBufferCache( PacketBufferCache&& other ) = delete;
+  PacketBufferCache& operator=( PacketBufferCache&& other ) = delete;
+};
+
+namespace {
+
+// The thread's cache, or null if the thread is exiting and has already destroyed it
+PacketBufferCache* thread_cache()
+{
+  if ( thread_exiting ) {
+    return nullptr;
+  }
+  thread_local PacketBufferCache cache { PacketBufferPool::global() };
+  return &cache;
+}
+
+optional<PacketBufferPool::SizeClass> size_class_for( const size_t size )
+{
+  for ( uint8_t c = 0; c < PacketBufferPool::NUM_CLASSES; ++c ) {
+    if ( size <= PacketBufferPool::SLOT_SIZES.at( c ) ) {
+      return static_cast<PacketBufferPool::SizeClass>( c );
+    }
+  }
+  return {};
+}
+
+} // namespace
+
+PacketBufferPool& PacketBufferPool::global()
+{
+  static auto* const pool = new PacketBufferPool; // NOLINT(*-owning-memory)
+  return *pool;
+}
+
+void* PacketBufferPool::allocate( const size_t size )
+{
+  const auto size_class = size_class_for( size );
+  auto* const cache = thread_cache();
+  if ( not size_class.has_value() ) {
+    if ( cache ) {
+      cache->heap( static_cast<int64_t>( size ) );
+    }
+    return ::operator new( size );
+  }
+  if ( cache ) {
+    return cache->allocate( size_class.value() );
+  }
+
+  vector<void*> slot;
+  refill( size_class.value(), slot, 1 );
+  unpoison( slot.front(), SLOT_SIZES.at( size_class.value() ) );
+  return slot.front();
+}
+
+void PacketBufferPool::deallocate( void* const ptr, const size_t size )
+{
+  const auto size_class = size_class_for( size );
+  auto* const cache = thread_cache();
+  if ( not size_class.has_value() ) {
+    if ( cache ) {
+      cache->heap( -static_cast<int64_t>( size ) );
+    }
+    ::operator delete( ptr );
+    return;
+  }
+  if ( cache ) {
+    cache->deallocate( size_class.value(), ptr );
+    return;
+  }
+
+  poison( ptr, SLOT_SIZES.at( size_class.value() ) );
+  vector<void*> slot { ptr };
+  release( size_class.value(), slot, 1 );
+}
+
+shared_ptr<char[]> PacketBufferPool::make_buffer( const size_t size ) // NOLINT(*-avoid-c-arrays)
+{
+  return allocate_shared_for_overwrite<char[]>( PacketAllocator<char> {}, size ); // NOLINT(*-avoid-c-arrays)
+}
+
+void PacketBufferPool::refill( const SizeClass size_class, vector<void*>& out, const size_t count )
+{
+  auto& shared = _free.at( size_class );
+  const lock_guard lock { shared.lock };
+  if ( shared.slots.empty() ) {
+    map_slab( size_class );
+  }
+  const size_t n = min( count, shared.slots.size() );
+  out.insert( out.end(), shared.slots.end() - static_cast<ptrdiff_t>( n ), shared.slots.end() );
+  shared.slots.resize( shared.slots.size() - n );
+}
+
+void PacketBufferPool::release( const SizeClass size_class, vector<void*>& in, const size_t count )
+{
+  auto& shared = _free.at( size_class );
+  const lock_guard lock { shared.lock };
+  shared.slots.insert( shared.slots.end(), in.end() - static_cast<ptrdiff_t>( count ), in.end() );
+  in.resize( in.size() - count );
+}
+
+// Called with the class's shared free list locked
+void PacketBufferPool::map_slab( const SizeClass size_class )
+{
+  void* slab = MAP_FAILED; // NOLINT(*-cstyle-cast, *-int-to-ptr)
+  if ( _hugepages ) {
+    slab = mmap( nullptr, SLAB_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+  }
+  if ( slab == MAP_FAILED ) { // NOLINT(*-cstyle-cast, *-int-to-ptr)
+    slab = mmap( nullptr, SLAB_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if ( slab == MAP_FAILED ) { // NOLINT(*-cstyle-cast, *-int-to-ptr)
+      throw unix_error { "mmap" };
+    }
+    if ( _hugepages ) {
+      madvise( slab, SLAB_SIZE, MADV_HUGEPAGE ); // only a hint: failure leaves ordinary pages
+    }
+  }
+
+  poison( slab, SLAB_SIZE );
+  const size_t slot_size = SLOT_SIZES.at( size_class );
+  auto& slots = _free.at( size_class ).slots;
+  for ( size_t offset = 0; offset + slot_size <= SLAB_SIZE; offset += slot_size ) {
+    slots.push_back( static_cast<char*>( slab ) + offset );
+  }
+}
+
+PacketBufferPool::Stats PacketBufferPool::stats() const
+{
+  const lock_guard lock { _caches_lock };
+  Stats ret = _exited;
+  for ( const auto* cache : _caches ) {
+    ret.hits += cache->counters().hits.load( memory_order_relaxed );
+    ret.misses += cache->counters().misses.load( memory_order_relaxed );
+    ret.bytes_outstanding += cache->counters().bytes_outstanding.load( memory_order_relaxed );
+  }
+  return ret;
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class PacketBufferCache;
+
+//! \brief Fixed-size packet buffers, recycled instead of being returned to the heap.
+//! \details Memory comes in three size classes: SMALL slots for per-packet bookkeeping (e.g. a BufferList's
+//! array, or a queue's block), MTU slots for a frame, and LARGE slots for a 64 KiB super-segment. Each thread
+//! keeps a free list per class, and trades slots in batches with a free list shared by all threads. That one is
+//! refilled from slabs mapped with [mmap(2)](\ref man2::mmap), on huge pages if use_hugepages() asked for them.
+//! Slabs are never unmapped, so once a steady load has reached its high-water mark, allocating and freeing
+//! packets never calls malloc (or the kernel).
+class PacketBufferPool
+{
+public:
+  enum SizeClass : uint8_t
+  {
+    SMALL,
+    MTU,
+    LARGE,
+    NUM_CLASSES
+  };
+
+  //! Slot size of each class. Slots hold a shared_ptr's control block along with the data, so make_buffer() can
+  //! give out up to (slot size - BUFFER_OVERHEAD) bytes from one.
+  static constexpr std::array<size_t, NUM_CLASSES> SLOT_SIZES { 512, 2048, 65536 + 64 };
+  static constexpr size_t BUFFER_OVERHEAD = 64;
+  static constexpr size_t MTU_BUFFER_SIZE = SLOT_SIZES[MTU] - BUFFER_OVERHEAD;
+  static constexpr size_t LARGE_BUFFER_SIZE = SLOT_SIZES[LARGE] - BUFFER_OVERHEAD;
+
+  static constexpr size_t SLAB_SIZE = 2 * 1024 * 1024; //!< One (huge) page
+
+  struct Stats
+  {
+    uint64_t hits;              //!< Allocations served from the thread's free list
+    uint64_t misses;            //!< Allocations that needed the shared free list, a new slab, or the heap
+    uint64_t bytes_outstanding; //!< Bytes in slots (or heap blocks) allocated and not yet freed
+  };
+
+  //! The process's pool (never destroyed, so threads can return their slots to it when they exit)
+  static PacketBufferPool& global();
+
+  //! Memory for `size` bytes, from the smallest class that fits (or from the heap, if none does)
+  void* allocate( size_t size );
+  //! Free memory from allocate(); `size` must be the same as it was asked for
+  void deallocate( void* ptr, size_t size );
+
+  //! A writable buffer of `size` bytes (at most LARGE_BUFFER_SIZE to come from the pool), e.g. to read a
+  //! packet into. Buffers can share it, and it goes back to the pool when the last of them is gone.
+  std::shared_ptr<char[]> make_buffer( size_t size ); // NOLINT(*-avoid-c-arrays)
+
+  //! Back slabs mapped from now on with huge pages: explicitly reserved ones if the system has some, and
+  //! transparent huge pages otherwise
+  void use_hugepages( bool enable ) { _hugepages = enable; }
+
+  Stats stats() const;
+
+  PacketBufferPool( const PacketBufferPool& other ) = delete;
+  PacketBufferPool& operator=( const PacketBufferPool& other ) = delete;
+  PacketBufferPool( PacketBufferPool&& other ) = delete;
+  PacketBufferPool& operator=( PacketBufferPool&& other ) = delete;
+  ~PacketBufferPool() = default;
+
+private:
+  friend class PacketBufferCache;
+
+  PacketBufferPool() = default;
+
+  struct SharedFreeList
+  {
+    std::mutex lock {};
+    std::vector<void*> slots {};
+  };
+
+  std::array<SharedFreeList, NUM_CLASSES> _free {};
+  std::atomic<bool> _hugepages { false };
+
+  // Statistics are counted by each thread's cache, and added up by stats()
+  mutable std::mutex _caches_lock {};
+  std::vector<const PacketBufferCache*> _caches {};
+  Stats _exited {}; //!< Counts of threads that have exited
+
+  //! Move up to `count` free slots of `size_class` to `out`, mapping a new slab if there are none
+  void refill( SizeClass size_class, std::vector<void*>& out, size_t count );
+  //! Take back the last `count` slots of `in`
+  void release( SizeClass size_class, std::vector<void*>& in, size_t count );
+
+  void map_slab( SizeClass size_class );
+};
+
+//! \brief An allocator drawing from the PacketBufferPool, for containers and shared_ptrs on the datapath.
+template<class T>
+class PacketAllocator
+{
+public:
+  using value_type = T;
+
+  PacketAllocator() = default;
+
+  template<class U>
+  PacketAllocator( const PacketAllocator<U>& other [[maybe_unused]] ) // NOLINT(*-explicit-*)
+  {}
+
+  T* allocate( size_t n ) { return static_cast<T*>( PacketBufferPool::global().allocate( n * sizeof( T ) ) ); }
+  void deallocate( T* ptr, size_t n ) { PacketBufferPool::global().deallocate( ptr, n * sizeof( T ) ); }
+
+  template<class U>
+  bool operator==( const PacketAllocator<U>& other [[maybe_unused]] ) const
+  {
+    return true;
+  }
+};
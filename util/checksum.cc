@@ -0,0 +1,160 @@
+#include "checksum.hh"
+
+#include <array>
+#include <bit>
+#include <cstring>
+
+#if defined( __SSE2__ )
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+// Fold a one's-complement sum to 16 bits (end-around carry)
+uint16_t fold( uint64_t sum )
+{
+  while ( sum > 0xffff ) {
+    sum = ( sum >> 16 ) + ( sum & 0xffff );
+  }
+  return sum;
+}
+
+// The kernels add up 16-bit words in the machine's byte order. One's-complement addition doesn't care which byte
+// of a word is which (RFC 1071), so on a little-endian machine, the network-order sum is the folded sum with its
+// bytes swapped.
+uint16_t to_network_order( const uint16_t sum )
+{
+  if constexpr ( endian::native == endian::big ) {
+    return sum;
+  } else {
+    return __builtin_bswap16( sum );
+  }
+}
+
+// Add 64-bit words with end-around carry, copying them along the way if Copy
+template<bool Copy>
+uint64_t sum_words( const char* src, char* dst, size_t len, uint64_t sum )
+{
+  for ( ; len >= sizeof( uint64_t ); len -= sizeof( uint64_t ) ) {
+    uint64_t word {};
+    memcpy( &word, src, sizeof( word ) );
+    if constexpr ( Copy ) {
+      memcpy( dst, &word, sizeof( word ) );
+      dst += sizeof( word );
+    }
+    src += sizeof( word );
+    sum += word;
+    sum += static_cast<uint64_t>( sum < word ); // carry
+  }
+
+  // the last few bytes, padded with zero
+  if ( len > 0 ) {
+    uint64_t word {};
+    memcpy( &word, src, len );
+    if constexpr ( Copy ) {
+      memcpy( dst, src, len );
+    }
+    sum += word;
+    sum += static_cast<uint64_t>( sum < word );
+  }
+
+  return sum;
+}
+
+// A 64-bit end-around-carry sum is congruent to the 16-bit one, so it folds down to it
+uint16_t finish( const uint64_t sum )
+{
+  return to_network_order( fold( ( sum >> 32 ) + ( sum & 0xffff'ffff ) ) );
+}
+
+#if defined( __SSE2__ )
+template<bool Copy>
+uint16_t sum_sse2( const char* src, char* dst, size_t len )
+{
+  constexpr size_t block = 64;            // bytes per iteration
+  constexpr size_t max_iterations = 8192; // before a 32-bit lane could overflow: 8192 * 8 * 0xffff < 2^32
+
+  const __m128i zero = _mm_setzero_si128();
+  uint64_t total = 0;
+
+  while ( len >= block ) {
+    // each 32-bit lane accumulates 16-bit words
+    __m128i acc0 = zero;
+    __m128i acc1 = zero;
+    for ( size_t i = 0; i < max_iterations and len >= block; ++i, len -= block ) {
+      const auto* in = reinterpret_cast<const __m128i*>( src ); // NOLINT(*-reinterpret-cast)
+      const __m128i v0 = _mm_loadu_si128( in );
+      const __m128i v1 = _mm_loadu_si128( in + 1 );
+      const __m128i v2 = _mm_loadu_si128( in + 2 );
+      const __m128i v3 = _mm_loadu_si128( in + 3 );
+      if constexpr ( Copy ) {
+        auto* out = reinterpret_cast<__m128i*>( dst ); // NOLINT(*-reinterpret-cast)
+        _mm_storeu_si128( out, v0 );
+        _mm_storeu_si128( out + 1, v1 );
+        _mm_storeu_si128( out + 2, v2 );
+        _mm_storeu_si128( out + 3, v3 );
+        dst += block;
+      }
+      src += block;
+
+      acc0 = _mm_add_epi32( acc0, _mm_unpacklo_epi16( v0, zero ) );
+      acc1 = _mm_add_epi32( acc1, _mm_unpackhi_epi16( v0, zero ) );
+      acc0 = _mm_add_epi32( acc0, _mm_unpacklo_epi16( v1, zero ) );
+      acc1 = _mm_add_epi32( acc1, _mm_unpackhi_epi16( v1, zero ) );
+      acc0 = _mm_add_epi32( acc0, _mm_unpacklo_epi16( v2, zero ) );
+      acc1 = _mm_add_epi32( acc1, _mm_unpackhi_epi16( v2, zero ) );
+      acc0 = _mm_add_epi32( acc0, _mm_unpacklo_epi16( v3, zero ) );
+      acc1 = _mm_add_epi32( acc1, _mm_unpackhi_epi16( v3, zero ) );
+    }
+
+    // add up the lanes (as 64-bit integers, which can't overflow)
+    alignas( 16 ) array<uint32_t, 4> lanes0 {};
+    alignas( 16 ) array<uint32_t, 4> lanes1 {};
+    _mm_store_si128( reinterpret_cast<__m128i*>( lanes0.data() ), acc0 ); // NOLINT(*-reinterpret-cast)
+    _mm_store_si128( reinterpret_cast<__m128i*>( lanes1.data() ), acc1 ); // NOLINT(*-reinterpret-cast)
+    for ( size_t i = 0; i < lanes0.size(); ++i ) {
+      total += static_cast<uint64_t>( lanes0[i] ) + lanes1[i];
+    }
+  }
+
+  // the rest (fewer than 64 bytes, starting at an even offset)
+  return finish( sum_words<Copy>( src, dst, len, fold( total ) ) );
+}
+#endif
+
+} // namespace
+
+uint16_t InternetChecksum::sum_scalar( const string_view data, char* copy_to )
+{
+  if ( copy_to ) {
+    return finish( sum_words<true>( data.data(), copy_to, data.size(), 0 ) );
+  }
+  return finish( sum_words<false>( data.data(), nullptr, data.size(), 0 ) );
+}
+
+uint16_t InternetChecksum::sum_simd( const string_view data, char* copy_to )
+{
+#if defined( __SSE2__ )
+  if ( copy_to ) {
+    return sum_sse2<true>( data.data(), copy_to, data.size() );
+  }
+  return sum_sse2<false>( data.data(), nullptr, data.size() );
+#else
+  return sum_scalar( data, copy_to );
+#endif
+}
+
+// A sum that starts at an odd offset into the checksummed bytes has its words' bytes the other way around
+void InternetChecksum::add_sum( const uint16_t sum, const size_t length )
+{
+  sum_ += parity_ ? __builtin_bswap16( sum ) : sum;
+  sum_ = fold( sum_ ); // leaves room for the next addition
+  parity_ ^= static_cast<bool>( length & 1 );
+}
+
+uint16_t InternetChecksum::sum() const
+{
+  return fold( sum_ );
+}
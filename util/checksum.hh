@@ -1,6 +1,9 @@
 #pragma once
 
+#include "buffer.hh"
+
 #include <cstdint>
+#include <span>
 #include <string>
 #include <vector>
 
@@ -13,28 +16,28 @@ private:
 
 public:
   explicit InternetChecksum( const uint32_t sum = 0 ) : sum_( sum ) {}
-  void add( std::string_view data )
-  {
-    for ( const uint8_t i : data ) {
-      uint16_t val = i;
-      if ( not parity_ ) {
-        val <<= 8;
-      }
-      sum_ += val;
-      parity_ = !parity_;
-    }
-  }
 
-  uint16_t value() const
-  {
-    uint32_t ret = sum_;
+  //! \name Kernels
+  //! The one's-complement sum of `data` (16-bit words in network byte order, with an odd last byte padded with
+  //! zero), folded to 16 bits. If `copy_to` isn't null, `data` is copied there in the same pass: when bytes must
+  //! be copied anyway, that saves reading them a second time to checksum them.
+  //!@{
+  static uint16_t sum_scalar( std::string_view data, char* copy_to = nullptr );
+  static uint16_t sum_simd( std::string_view data, char* copy_to = nullptr ); //!< SSE2 (scalar if unavailable)
+  //!@}
 
-    while ( ret > 0xffff ) {
-      ret = ( ret >> 16 ) + static_cast<uint16_t>( ret );
-    }
+  void add( std::string_view data ) { add_sum( sum_simd( data ), data.size() ); }
 
-    return ~ret;
-  }
+  //! Copy `data` to `dst` (which must have room for it), and add it to the checksum in the same pass
+  void add_copy( std::string_view data, char* dst ) { add_sum( sum_simd( data, dst ), data.size() ); }
+
+  //! Add the sum (e.g. from sum_simd()) of `length` bytes
+  void add_sum( uint16_t sum, size_t length );
+
+  //! The sum so far, folded to 16 bits (not complemented)
+  uint16_t sum() const;
+
+  uint16_t value() const { return ~sum(); }
 
   void add( const std::vector<std::string>& data )
   {
@@ -43,6 +46,15 @@ public:
     }
   }
 
+  void add( std::span<const Buffer> data )
+  {
+    for ( const auto& x : data ) {
+      add( x.str() );
+    }
+  }
+
+  void add( const BufferList& data ) { add( std::span<const Buffer> { data.buffers() } ); }
+
   void add( const std::vector<std::string_view>& data )
   {
     for ( const auto& x : data ) {
@@ -0,0 +1,208 @@
+#include "coroutine.hh"
+
+#include <limits>
+#include <stdexcept>
+
+using namespace std;
+
+namespace {
+size_t direction_index( const EventLoop::Direction direction )
+{
+  return direction == EventLoop::Direction::In ? 0 : 1;
+}
+} // namespace
+
+CoroutineLoop::CoroutineLoop( const EventLoop::Backend backend )
+  : _loop( backend ), _fd_category( _loop.add_category( "coroutine waiting on fd" ) )
+{
+  // wake every coroutine whose fd is ready, then resume them all
+  _loop.set_batch_limit( numeric_limits<size_t>::max() );
+
+  _loop.add_timer_rule(
+    "coroutine sleeping",
+    [&]() -> optional<Clock::time_point> {
+      if ( _sleepers.empty() ) {
+        return {};
+      }
+      return _sleepers.top().deadline;
+    },
+    [&] {
+      const auto now = Clock::now();
+      while ( not _sleepers.empty() and _sleepers.top().deadline <= now ) {
+        _ready.push_back( _sleepers.top().handle );
+        _sleepers.pop();
+      }
+    } );
+}
+
+CoroutineLoop::~CoroutineLoop()
+{
+  // destroying a spawned coroutine also destroys the Tasks it was awaiting
+  for ( const auto& [id, handle] : _tasks ) {
+    handle.destroy();
+  }
+}
+
+CoroutineLoop::Detached CoroutineLoop::run_detached( CoroutineLoop& loop, const uint64_t id, Task<> task )
+{
+  try {
+    co_await std::move( task );
+  } catch ( ... ) {
+    if ( not loop._exception ) {
+      loop._exception = current_exception();
+    }
+  }
+  loop._tasks.erase( id );
+}
+
+void CoroutineLoop::spawn( Task<> task )
+{
+  const uint64_t id = _next_task_id++;
+  const auto handle = run_detached( *this, id, std::move( task ) ).handle;
+  _tasks.emplace( id, handle );
+  _ready.push_back( handle );
+}
+
+void CoroutineLoop::wait_for( FileDescriptor& fd,
+                              const EventLoop::Direction direction,
+                              const coroutine_handle<> handle )
+{
+  auto it = _watches.find( fd.fd_num() );
+  if ( it != _watches.end() and it->second->fd.closed() ) {
+    // the fd number has been closed and reused since it was last waited on
+    for ( auto& rule : it->second->rules ) {
+      if ( rule.has_value() ) {
+        rule->cancel();
+      }
+    }
+    _watches.erase( it );
+    it = _watches.end();
+  }
+
+  if ( it == _watches.end() ) {
+    it = _watches.emplace( fd.fd_num(), make_shared<Watch>( fd.duplicate() ) ).first;
+  }
+
+  const auto watch = it->second;
+  const size_t index = direction_index( direction );
+  if ( watch->waiters.at( index ) ) {
+    throw runtime_error( "CoroutineLoop: two coroutines waiting to "
+                         + string( direction == EventLoop::Direction::In ? "read" : "write" ) + " fd "
+                         + to_string( fd.fd_num() ) );
+  }
+  watch->waiters.at( index ) = handle;
+
+  // The rule is only interested while a coroutine waits (the EventLoop re-checks that before every wait, so an
+  // existing rule needs nothing more). If the EventLoop drops it (at EOF, on error or hangup), the waiting
+  // coroutine is resumed to find out.
+  if ( not watch->rules.at( index ).has_value() ) {
+    watch->rules.at( index ) = _loop.add_rule(
+      _fd_category,
+      fd,
+      direction,
+      [this, watch, index] { wake( *watch, index ); },
+      [watch, index] { return static_cast<bool>( watch->waiters.at( index ) ); },
+      [this, watch, index] {
+        watch->rules.at( index ).reset();
+        wake( *watch, index );
+      } );
+  }
+}
+
+void CoroutineLoop::wait_until( const Clock::time_point deadline, const coroutine_handle<> handle )
+{
+  _sleepers.push( { deadline, _next_sleeper++, handle } );
+}
+
+void CoroutineLoop::wake( Watch& watch, const size_t index )
+{
+  auto& waiter = watch.waiters.at( index );
+  if ( waiter ) {
+    _ready.push_back( exchange( waiter, {} ) );
+    _released_fds.push_back( watch.fd.fd_num() );
+  }
+}
+
+void CoroutineLoop::resume_ready()
+{
+  vector<coroutine_handle<>> resuming;
+  while ( not _ready.empty() ) {
+    swap( resuming, _ready );
+    for ( const auto& handle : resuming ) {
+      handle.resume();
+    }
+    resuming.clear();
+  }
+}
+
+// Drop the rules of fds that no coroutine went back to waiting on, so the EventLoop releases its duplicate of
+// the fd (and the fd can close when its owner is done with it).
+void CoroutineLoop::drop_idle_watches()
+{
+  for ( const int fd_num : _released_fds ) {
+    const auto it = _watches.find( fd_num );
+    if ( it == _watches.end() or it->second->waiters.at( 0 ) or it->second->waiters.at( 1 ) ) {
+      continue;
+    }
+    for ( auto& rule : it->second->rules ) {
+      if ( rule.has_value() ) {
+        rule->cancel();
+      }
+    }
+    _watches.erase( it );
+  }
+  _released_fds.clear();
+}
+
+void CoroutineLoop::run()
+{
+  while ( true ) {
+    resume_ready();
+    drop_idle_watches();
+
+    if ( _exception ) {
+      rethrow_exception( exchange( _exception, {} ) );
+    }
+
+    if ( _tasks.empty() ) {
+      return;
+    }
+
+    if ( _loop.wait_next_event( -1 ) == EventLoop::Result::Exit and _ready.empty() ) {
+      throw runtime_error( "CoroutineLoop: " + to_string( _tasks.size() )
+                           + " coroutines are suspended with nothing to wait for" );
+    }
+  }
+}
+
+Task<> CoroutineLoop::read( FileDescriptor& fd, string& buffer )
+{
+  const size_t size = buffer.size();
+  while ( true ) {
+    buffer.resize( size );
+    fd.read( buffer );
+    if ( not buffer.empty() or fd.eof() ) {
+      co_return;
+    }
+    co_await readable( fd );
+  }
+}
+
+Task<> CoroutineLoop::write( FileDescriptor& fd, string_view buffer )
+{
+  while ( true ) {
+    buffer.remove_prefix( fd.write( buffer ) );
+    if ( buffer.empty() ) {
+      co_return;
+    }
+    co_await writable( fd );
+  }
+}
+
+Task<TCPSocket> CoroutineLoop::accept( TCPSocket& listener )
+{
+  co_await readable( listener );
+  TCPSocket socket = listener.accept();
+  socket.set_blocking( false );
+  co_return socket;
+}
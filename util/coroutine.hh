@@ -0,0 +1,288 @@
+#pragma once
+
+#include "eventloop.hh"
+#include "file_descriptor.hh"
+#include "socket.hh"
+
+#include <array>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <queue>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+template<typename T>
+class Task;
+
+//! State shared by the promises of every Task: who to resume when the Task finishes, and how it failed.
+class TaskPromiseBase
+{
+  std::coroutine_handle<> _continuation {};
+  std::exception_ptr _exception {};
+
+  //! When a Task finishes, transfer control straight back to the coroutine that was awaiting it.
+  struct FinalAwaiter
+  {
+    bool await_ready() const noexcept { return false; }
+
+    template<typename Promise>
+    std::coroutine_handle<> await_suspend( std::coroutine_handle<Promise> handle ) const noexcept
+    {
+      const auto continuation = handle.promise()._continuation;
+      return continuation ? continuation : std::noop_coroutine();
+    }
+
+    void await_resume() const noexcept {}
+  };
+
+public:
+  std::suspend_always initial_suspend() const noexcept { return {}; }
+  FinalAwaiter final_suspend() const noexcept { return {}; }
+  void unhandled_exception() { _exception = std::current_exception(); }
+
+  void set_continuation( const std::coroutine_handle<> continuation ) { _continuation = continuation; }
+
+  void rethrow_if_failed() const
+  {
+    if ( _exception ) {
+      std::rethrow_exception( _exception );
+    }
+  }
+};
+
+template<typename T>
+class TaskPromise : public TaskPromiseBase
+{
+  std::optional<T> _value {};
+
+public:
+  void return_value( T value ) { _value.emplace( std::move( value ) ); }
+
+  T result()
+  {
+    rethrow_if_failed();
+    return std::move( _value.value() );
+  }
+};
+
+template<>
+class TaskPromise<void> : public TaskPromiseBase
+{
+public:
+  void return_void() const {}
+  void result() const { rethrow_if_failed(); }
+};
+
+//! \brief A coroutine that produces a T.
+//! \details A Task doesn't start until it is co_await-ed by another coroutine (which then resumes when the Task
+//! finishes, receiving its result or exception), or, for a Task<void>, handed to CoroutineLoop::spawn.
+template<typename T = void>
+class Task
+{
+public:
+  struct promise_type : public TaskPromise<T>
+  {
+    Task get_return_object() { return Task { std::coroutine_handle<promise_type>::from_promise( *this ) }; }
+  };
+
+private:
+  std::coroutine_handle<promise_type> _handle;
+
+  explicit Task( const std::coroutine_handle<promise_type> handle ) : _handle( handle ) {}
+
+  struct Awaiter
+  {
+    std::coroutine_handle<promise_type> handle;
+
+    bool await_ready() const noexcept { return handle.done(); }
+
+    std::coroutine_handle<> await_suspend( const std::coroutine_handle<> awaiting ) const noexcept
+    {
+      handle.promise().set_continuation( awaiting );
+      return handle;
+    }
+
+    T await_resume() const { return handle.promise().result(); }
+  };
+
+public:
+  Awaiter operator co_await() && noexcept { return Awaiter { _handle }; }
+
+  ~Task()
+  {
+    if ( _handle ) {
+      _handle.destroy();
+    }
+  }
+
+  // A Task can be moved, but not copied
+  Task( Task&& other ) noexcept : _handle( std::exchange( other._handle, {} ) ) {}
+  Task& operator=( Task&& other ) noexcept
+  {
+    if ( this != &other ) {
+      if ( _handle ) {
+        _handle.destroy();
+      }
+      _handle = std::exchange( other._handle, {} );
+    }
+    return *this;
+  }
+  Task( const Task& other ) = delete;
+  Task& operator=( const Task& other ) = delete;
+};
+
+//! \brief Runs coroutines on an EventLoop.
+//! \details Coroutines wait for file descriptors with readable()/writable() and for time with sleep_for(); the
+//! loop resumes them when the fd is ready or the time has come. Each fd gets one EventLoop rule per direction,
+//! kept while coroutines keep waiting on it (so a connection's steady state costs no extra system calls) and
+//! dropped once nobody does.
+//!
+//! read(), write() and accept() are the usual non-blocking operations, retried until they make progress. The
+//! FileDescriptor must be non-blocking: this includes sockets returned by accept() and the owner's side of a
+//! TCPMinnowSocket, whose streams can be read and written like any other socket.
+class CoroutineLoop
+{
+public:
+  using Clock = EventLoop::Clock;
+
+  explicit CoroutineLoop( EventLoop::Backend backend = EventLoop::Backend::Epoll );
+  ~CoroutineLoop();
+
+  //! Start a coroutine. It runs (alongside the others) during run(); an exception that escapes it is
+  //! rethrown by run().
+  void spawn( Task<> task );
+
+  //! Resume coroutines until every spawned coroutine has finished
+  void run();
+
+  //! Number of spawned coroutines that haven't finished
+  size_t tasks() const { return _tasks.size(); }
+
+  //! Suspends the awaiting coroutine until an fd is ready.
+  class FDAwaiter
+  {
+    CoroutineLoop& _loop;
+    FileDescriptor& _fd;
+    EventLoop::Direction _direction;
+
+  public:
+    FDAwaiter( CoroutineLoop& loop, FileDescriptor& fd, EventLoop::Direction direction )
+      : _loop( loop ), _fd( fd ), _direction( direction )
+    {}
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend( std::coroutine_handle<> handle ) { _loop.wait_for( _fd, _direction, handle ); }
+    void await_resume() const noexcept {}
+  };
+
+  //! Suspends the awaiting coroutine until a point in time.
+  class SleepAwaiter
+  {
+    CoroutineLoop& _loop;
+    Clock::time_point _deadline;
+
+  public:
+    SleepAwaiter( CoroutineLoop& loop, Clock::time_point deadline ) : _loop( loop ), _deadline( deadline ) {}
+
+    bool await_ready() const { return _deadline <= Clock::now(); }
+    void await_suspend( std::coroutine_handle<> handle ) { _loop.wait_until( _deadline, handle ); }
+    void await_resume() const noexcept {}
+  };
+
+  //! Wait until fd is readable (or has reached EOF, or failed)
+  FDAwaiter readable( FileDescriptor& fd ) { return { *this, fd, EventLoop::Direction::In }; }
+
+  //! Wait until fd is writable (or failed)
+  FDAwaiter writable( FileDescriptor& fd ) { return { *this, fd, EventLoop::Direction::Out }; }
+
+  SleepAwaiter sleep_until( Clock::time_point deadline ) { return { *this, deadline }; }
+  SleepAwaiter sleep_for( Clock::duration duration ) { return { *this, Clock::now() + duration }; }
+
+  //! Read at least one byte into `buffer` (sized as for FileDescriptor::read), or leave it empty at EOF
+  Task<> read( FileDescriptor& fd, std::string& buffer );
+
+  //! Write all of `buffer`
+  Task<> write( FileDescriptor& fd, std::string_view buffer );
+
+  //! Accept a connection on a listening socket. The new socket is non-blocking.
+  Task<TCPSocket> accept( TCPSocket& listener );
+
+  const EventLoop& event_loop() const { return _loop; }
+
+  // A CoroutineLoop owns the coroutines it runs and can't be copied or moved
+  CoroutineLoop( const CoroutineLoop& other ) = delete;
+  CoroutineLoop& operator=( const CoroutineLoop& other ) = delete;
+  CoroutineLoop( CoroutineLoop&& other ) = delete;
+  CoroutineLoop& operator=( CoroutineLoop&& other ) = delete;
+
+private:
+  //! The coroutines waiting on one fd (at most one per direction), and the EventLoop rules that wake them.
+  struct Watch
+  {
+    FileDescriptor fd; //!< A duplicate, to tell whether the fd number still refers to the same fd
+    std::array<std::coroutine_handle<>, 2> waiters {};
+    std::array<std::optional<EventLoop::RuleHandle>, 2> rules {};
+
+    explicit Watch( FileDescriptor&& s_fd ) : fd( std::move( s_fd ) ) {}
+  };
+
+  struct Sleeper
+  {
+    Clock::time_point deadline;
+    uint64_t sequence; //!< Sleepers with the same deadline wake in the order they fell asleep
+    std::coroutine_handle<> handle;
+
+    bool operator>( const Sleeper& other ) const
+    {
+      return std::tie( deadline, sequence ) > std::tie( other.deadline, other.sequence );
+    }
+  };
+
+  //! Wrapper that owns a spawned Task; it destroys itself when the Task finishes.
+  struct Detached
+  {
+    struct promise_type
+    {
+      Detached get_return_object()
+      {
+        return Detached { std::coroutine_handle<promise_type>::from_promise( *this ) };
+      }
+      std::suspend_always initial_suspend() const noexcept { return {}; }
+      std::suspend_never final_suspend() const noexcept { return {}; }
+      void return_void() const {}
+      [[noreturn]] void unhandled_exception() const { std::terminate(); }
+    };
+
+    std::coroutine_handle<promise_type> handle;
+  };
+
+  static Detached run_detached( CoroutineLoop& loop, uint64_t id, Task<> task );
+
+  EventLoop _loop;
+  size_t _fd_category;
+
+  std::vector<std::coroutine_handle<>> _ready {};
+  std::unordered_map<uint64_t, std::coroutine_handle<>> _tasks {};
+  uint64_t _next_task_id {};
+  std::exception_ptr _exception {};
+
+  std::unordered_map<int, std::shared_ptr<Watch>> _watches {};
+  std::vector<int> _released_fds {}; //!< Fds whose waiter was resumed, to drop if nobody waits again
+
+  std::priority_queue<Sleeper, std::vector<Sleeper>, std::greater<>> _sleepers {};
+  uint64_t _next_sleeper {};
+
+  void wait_for( FileDescriptor& fd, EventLoop::Direction direction, std::coroutine_handle<> handle );
+  void wait_until( Clock::time_point deadline, std::coroutine_handle<> handle );
+  void wake( Watch& watch, size_t index );
+  void resume_ready();
+  void drop_idle_watches();
+};
@@ -3,12 +3,10 @@
 #include "ethernet_header.hh"
 #include "parser.hh"
 
-#include <vector>
-
 struct EthernetFrame
 {
   EthernetHeader header {};
-  std::vector<std::string> payload {};
+  BufferList payload {};
 
   void parse( Parser& parser )
   {
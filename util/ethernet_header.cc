@@ -57,7 +57,8 @@ void EthernetHeader::parse( Parser& parser )
   parser.integer( type );
 }
 
-void EthernetHeader::serialize( Serializer& serializer ) const
+template<class SerializerT>
+void EthernetHeader::serialize( SerializerT& serializer ) const
 {
   // write destination address
   for ( const auto& b : dst ) {
@@ -72,3 +73,6 @@ void EthernetHeader::serialize( Serializer& serializer ) const
   // write frame type (e.g. IPv4, ARP, or something else)
   serializer.integer( type );
 }
+
+template void EthernetHeader::serialize( Serializer& serializer ) const;
+template void EthernetHeader::serialize( SpanSerializer& serializer ) const;
@@ -31,5 +31,6 @@ struct EthernetHeader
   std::string to_string() const;
 
   void parse( Parser& parser );
-  void serialize( Serializer& serializer ) const;
+  template<class SerializerT>
+  void serialize( SerializerT& serializer ) const;
 };
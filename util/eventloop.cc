@@ -1,13 +1,38 @@
 #include "eventloop.hh"
 #include "exception.hh"
+#include "io_uring.hh"
 #include "socket.hh"
 
+#include <algorithm>
 #include <cstring>
 #include <iomanip>
 #include <iostream>
+#include <limits>
 
 using namespace std;
 
+//! How many times a timer's callback may run in one wakeup without moving its deadline past the wakeup's start
+static constexpr size_t MAX_TIMER_ITERATIONS = 128;
+
+static_assert( EPOLLIN == POLLIN and EPOLLOUT == POLLOUT and EPOLLERR == POLLERR and EPOLLHUP == POLLHUP,
+               "epoll and poll event bits are expected to coincide" );
+
+EventLoop::EventLoop( const Backend backend ) : _backend( backend )
+{
+  _rule_categories.reserve( 64 );
+  if ( _backend == Backend::IOUring ) {
+    _uring = IOUring::try_create( 256, 4096 );
+    if ( not _uring ) {
+      _backend = Backend::Epoll;
+    }
+  }
+  if ( _backend == Backend::Epoll ) {
+    _epoll_fd.emplace( ::CheckSystemCall( "epoll_create1", epoll_create1( EPOLL_CLOEXEC ) ) );
+  }
+}
+
+EventLoop::~EventLoop() = default;
+
 unsigned int EventLoop::FDRule::service_count() const
 {
   return direction == Direction::In ? fd.read_count() : fd.write_count();
@@ -39,6 +64,10 @@ EventLoop::FDRule::FDRule( BasicRule&& base,
   , error( move( s_error ) )
 {}
 
+EventLoop::TimerRule::TimerRule( size_t s_category_id, DeadlineT s_deadline, CallbackT s_callback )
+  : BasicRule( s_category_id, [] { return true; }, move( s_callback ) ), deadline( move( s_deadline ) )
+{}
+
 EventLoop::RuleHandle EventLoop::add_rule( size_t category_id,
                                            FileDescriptor& fd,
                                            Direction direction,
@@ -51,10 +80,18 @@ EventLoop::RuleHandle EventLoop::add_rule( size_t category_id,
     throw out_of_range( "bad category_id" );
   }
 
-  _fd_rules.emplace_back( make_shared<FDRule>(
-    BasicRule { category_id, interest, callback }, fd.duplicate(), direction, cancel, error ) );
+  const bool conditional = static_cast<bool>( interest );
+  BasicRule base { category_id, conditional ? interest : [] { return true; }, callback };
+  _fd_rules.emplace_back( make_shared<FDRule>( move( base ), fd.duplicate(), direction, cancel, error ) );
+  _fd_rules.back()->self = prev( _fd_rules.end() );
+  _fd_rules.back()->conditional = conditional;
+
+  if ( _backend != Backend::Poll ) {
+    register_fd_rule( *_fd_rules.back() );
+    mark_dirty( fd.fd_num() );
+  }
 
-  return RuleHandle { _fd_rules.back() };
+  return RuleHandle { _fd_rules.back(), this };
 }
 
 EventLoop::RuleHandle EventLoop::add_rule( const size_t category_id,
@@ -70,18 +107,418 @@ EventLoop::RuleHandle EventLoop::add_rule( const size_t category_id,
   return RuleHandle { _non_fd_rules.back() };
 }
 
+EventLoop::RuleHandle EventLoop::add_timer_rule( const size_t category_id,
+                                                 const DeadlineT& deadline,
+                                                 const CallbackT& callback )
+{
+  if ( category_id >= _rule_categories.size() ) {
+    throw out_of_range( "bad category_id" );
+  }
+
+  _timer_rules.emplace_back( make_shared<TimerRule>( category_id, deadline, callback ) );
+
+  return RuleHandle { _timer_rules.back() };
+}
+
 void EventLoop::RuleHandle::cancel()
 {
   const shared_ptr<BasicRule> rule_shared_ptr = rule_weak_ptr_.lock();
   if ( rule_shared_ptr ) {
     rule_shared_ptr->cancel_requested = true;
+    if ( loop_ ) {
+      // so the rule is dropped before the next wait
+      loop_->mark_dirty( static_cast<const FDRule&>( *rule_shared_ptr ).fd.fd_num() );
+    }
+  }
+}
+
+void EventLoop::mark_dirty( const int fd_num )
+{
+  if ( _backend == Backend::Poll ) {
+    return; // every rule is re-evaluated on every wait anyway
+  }
+  const auto reg = _registrations.find( fd_num );
+  if ( reg != _registrations.end() and not reg->second.dirty ) {
+    reg->second.dirty = true;
+    _dirty_fds.push_back( fd_num );
+  }
+}
+
+void EventLoop::epoll_control( const int op, const int fd_num, const uint32_t events )
+{
+  epoll_event ev {};
+  ev.events = events;
+  ev.data.fd = fd_num;
+  ::CheckSystemCall( "epoll_ctl", ::epoll_ctl( _epoll_fd->fd_num(), op, fd_num, &ev ) );
+}
+
+// With Epoll, the fd is added to the epoll instance once, when the first rule for it appears, with no events
+// armed. wait_epoll() re-arms it only when the rules' combined interest changes. With IOUring, nothing is armed
+// until wait_uring() queues a poll.
+void EventLoop::register_fd_rule( FDRule& rule )
+{
+  const int fd_num = rule.fd.fd_num();
+  auto reg = _registrations.find( fd_num );
+
+  if ( reg != _registrations.end() and not reg->second.rules.empty() and reg->second.rules.front()->fd.closed() ) {
+    // the old fd was closed and its number reused before its rules were pruned: they are dropped before the
+    // next wait (not now, as a callback may be running)
+    _orphaned_rules.insert( _orphaned_rules.end(), reg->second.rules.begin(), reg->second.rules.end() );
+    erase_registration( reg, true );
+    reg = _registrations.end();
+  }
+
+  if ( reg == _registrations.end() ) {
+    reg = _registrations.emplace( fd_num, FDRegistration {} ).first;
+    epoll_event ev {};
+    ev.data.fd = fd_num;
+    if ( _backend == Backend::Epoll and ::epoll_ctl( _epoll_fd->fd_num(), EPOLL_CTL_ADD, fd_num, &ev ) < 0 ) {
+      if ( errno != EPERM ) {
+        throw unix_error { "epoll_ctl" };
+      }
+      reg->second.pollable = false; // e.g. a regular file: poll(2) would always report it ready
+      _unpollable_fds.push_back( fd_num );
+    }
+  }
+
+  reg->second.rules.push_back( &rule );
+}
+
+void EventLoop::unregister_fd_rule( const FDRule& rule )
+{
+  const auto reg = _registrations.find( rule.fd.fd_num() );
+  if ( reg == _registrations.end() ) {
+    return;
+  }
+
+  auto& rules = reg->second.rules;
+  const auto pos = ranges::find( rules, &rule );
+  if ( pos == rules.end() ) {
+    return;
+  }
+  rules.erase( pos );
+
+  if ( rules.empty() ) {
+    erase_registration( reg, rule.fd.closed() );
+  }
+}
+
+void EventLoop::erase_registration( const unordered_map<int, FDRegistration>::iterator reg, const bool fd_closed )
+{
+  if ( _backend == Backend::IOUring ) {
+    // cancelling by user data works even if the fd has been closed
+    if ( reg->second.poll_token ) {
+      _uring->queue_poll_remove( reg->second.poll_token, 0 );
+    }
+  } else if ( fd_closed ) {
+    // Can't EPOLL_CTL_DEL a closed fd number, and the kernel keeps the entry alive if another fd still shares
+    // the open file description. Start over with a fresh epoll instance instead.
+    _epoll_rebuild_needed = true;
+  } else if ( reg->second.pollable ) {
+    epoll_control( EPOLL_CTL_DEL, reg->first, 0 );
+  }
+  if ( not reg->second.pollable ) {
+    erase( _unpollable_fds, reg->first );
+  }
+  _wanted_fds -= reg->second.wanted != 0;
+  _registrations.erase( reg );
+}
+
+void EventLoop::epoll_rebuild()
+{
+  _epoll_fd.emplace( ::CheckSystemCall( "epoll_create1", epoll_create1( EPOLL_CLOEXEC ) ) );
+  for ( const auto& [fd_num, reg] : _registrations ) {
+    if ( reg.pollable ) {
+      epoll_control( EPOLL_CTL_ADD, fd_num, reg.armed );
+    }
+  }
+  _epoll_rebuild_needed = false;
+}
+
+void EventLoop::set_batch_limit( const size_t max_rules )
+{
+  if ( max_rules == 0 ) {
+    throw runtime_error( "EventLoop: batch limit must be at least 1" );
+  }
+  _batch_limit = max_rules;
+}
+
+// Within one wakeup, skip rules whose fd was closed by an earlier callback, and don't service the same fd in the
+// same direction twice: the readiness poll reported may already have been consumed.
+bool EventLoop::may_service( const FDRule& rule ) const
+{
+  if ( rule.cancel_requested or rule.fd.closed() ) {
+    return false;
+  }
+  return ranges::find( _serviced_fds, make_pair( rule.fd.fd_num(), rule.direction ) ) == _serviced_fds.end();
+}
+
+void EventLoop::record_wakeup()
+{
+  if ( _serviced_this_wakeup == 0 ) {
+    return;
+  }
+  ++_stats.wakeups;
+  _stats.rules_serviced += _serviced_this_wakeup;
+  _stats.limited_wakeups += batch_full();
+  ++_stats.serviced_per_wakeup.at( min( _serviced_this_wakeup, Stats::HISTOGRAM_SIZE ) - 1 );
+}
+
+list<shared_ptr<EventLoop::FDRule>>::iterator EventLoop::erase_fd_rule( list<shared_ptr<FDRule>>::iterator it )
+{
+  if ( _backend != Backend::Poll ) {
+    unregister_fd_rule( **it );
+  }
+  return _fd_rules.erase( it );
+}
+
+bool EventLoop::prune_and_collect_interest()
+{
+  bool something_to_poll = false;
+
+  for ( auto it = _fd_rules.begin(); it != _fd_rules.end(); ) { // NOTE: it gets erased or incremented in loop body
+    auto& this_rule = **it;
+
+    if ( retire_if_defunct( this_rule ) ) {
+      it = erase_fd_rule( it );
+      continue;
+    }
+
+    // uninterested rules are still polled with no events --- we still want errors
+    this_rule.polled_events = this_rule.interest() ? static_cast<int16_t>( this_rule.direction ) : 0;
+    something_to_poll |= ( this_rule.polled_events != 0 );
+    ++it;
+  }
+
+  return something_to_poll;
+}
+
+// Returns true if the rule is to be erased: it was cancelled, or its fd is closed or (for reading) at EOF
+bool EventLoop::retire_if_defunct( FDRule& rule )
+{
+  if ( rule.cancel_requested ) {
+    //      this_rule.cancel();
+    //      if rule is cancelled externally, no need to call the cancellation callback
+    //      this makes it easier to cancel rules and delete captured objects right away
+    return true;
+  }
+
+  if ( ( rule.direction == Direction::In and rule.fd.eof() ) or rule.fd.closed() ) {
+    // no more reading on this rule (it's reached eof), or nothing more at all
+    rule.cancel();
+    return true;
+  }
+
+  return false;
+}
+
+// With Epoll and IOUring, only the fds whose rules may have changed are re-evaluated before a wait: those with a
+// rule whose interest function may have a new answer (set by any callback, on any fd), those with a rule whose fd
+// was closed or reached EOF (anywhere, not only in a callback on that fd), those serviced by the last wakeup, and
+// those with rules added or cancelled. Finding them only reads flags and calls the interest functions, so the work
+// before each wait doesn't grow with the cost of re-arming always-interested rules.
+bool EventLoop::refresh_dirty_fds()
+{
+  for ( auto* rule : exchange( _orphaned_rules, {} ) ) {
+    if ( not rule->cancel_requested ) {
+      rule->cancel();
+    }
+    erase_fd_rule( rule->self );
+  }
+
+  for ( const auto& rule : _fd_rules ) {
+    const bool defunct
+      = rule->cancel_requested or rule->fd.closed() or ( rule->direction == Direction::In and rule->fd.eof() );
+    if ( defunct
+         or ( rule->conditional
+              and ( rule->interest() ? static_cast<int16_t>( rule->direction ) : 0 ) != rule->polled_events ) ) {
+      mark_dirty( rule->fd.fd_num() );
+    }
+  }
+
+  while ( not _dirty_fds.empty() ) { // (a cancel callback may mark more)
+    for ( const int fd_num : exchange( _dirty_fds, {} ) ) {
+      auto reg = _registrations.find( fd_num );
+      if ( reg == _registrations.end() ) {
+        continue;
+      }
+      reg->second.dirty = false;
+
+      const auto rules = reg->second.rules; // erasing the last rule erases the registration
+      for ( auto* rule : rules ) {
+        if ( retire_if_defunct( *rule ) ) {
+          erase_fd_rule( rule->self );
+          continue;
+        }
+        rule->polled_events = rule->interest() ? static_cast<int16_t>( rule->direction ) : 0;
+      }
+
+      reg = _registrations.find( fd_num );
+      if ( reg != _registrations.end() ) {
+        update_wanted( reg->second, fd_num );
+      }
+    }
+  }
+
+  return _wanted_fds > 0 or _ready_next < _ready_count;
+}
+
+// Combine the interest of the rules sharing an fd, and re-arm it if that changed
+void EventLoop::update_wanted( FDRegistration& reg, const int fd_num )
+{
+  uint32_t wanted = 0;
+  for ( const auto* rule : reg.rules ) {
+    wanted |= static_cast<uint16_t>( rule->polled_events );
+  }
+  _wanted_fds += ( wanted != 0 ) - ( reg.wanted != 0 );
+  reg.wanted = wanted;
+
+  if ( _backend == Backend::Epoll ) {
+    if ( reg.pollable and reg.wanted != reg.armed ) {
+      epoll_control( EPOLL_CTL_MOD, fd_num, reg.wanted );
+      reg.armed = reg.wanted;
+    }
+    return;
+  }
+
+  // IOUring: replace a poll whose interest changed, and arm one if there is none (e.g. the last one completed)
+  if ( reg.poll_token and reg.wanted != reg.armed ) {
+    _uring->queue_poll_remove( reg.poll_token, 0 );
+    reg.poll_token = 0;
+  }
+  if ( not reg.poll_token ) {
+    // uninterested rules are still polled with no events --- we still want errors
+    reg.poll_token = ( static_cast<uint64_t>( ++_uring_poll_sequence ) << 32 ) | static_cast<uint32_t>( fd_num );
+    _uring->queue_poll_add( fd_num, reg.wanted, reg.poll_token );
+    reg.armed = reg.wanted;
+  }
+}
+
+optional<EventLoop::Clock::time_point> EventLoop::next_timer_deadline()
+{
+  optional<Clock::time_point> earliest;
+
+  for ( auto it = _timer_rules.begin(); it != _timer_rules.end(); ) {
+    if ( ( *it )->cancel_requested ) {
+      it = _timer_rules.erase( it );
+      continue;
+    }
+
+    const auto deadline = ( *it )->deadline();
+    if ( deadline.has_value() and ( not earliest.has_value() or deadline.value() < earliest.value() ) ) {
+      earliest = deadline;
+    }
+    ++it;
+  }
+
+  return earliest;
+}
+
+// A timer is due if its deadline is no later than the time this function started. Its callback runs until the
+// deadline moves past that time, so a timer that fell behind catches up in one wakeup.
+void EventLoop::fire_due_timers()
+{
+  const auto now = Clock::now();
+
+  for ( auto it = _timer_rules.begin(); it != _timer_rules.end() and not batch_full(); ) {
+    auto& this_rule = **it;
+    bool rule_fired = false;
+
+    if ( this_rule.cancel_requested ) {
+      it = _timer_rules.erase( it );
+      continue;
+    }
+
+    size_t iterations = 0;
+    for ( auto deadline = this_rule.deadline(); deadline.has_value() and deadline.value() <= now;
+          deadline = this_rule.deadline() ) {
+      if ( iterations == MAX_TIMER_ITERATIONS ) {
+        throw runtime_error( "EventLoop: busy wait detected: timer \""
+                             + _rule_categories.at( this_rule.category_id ).name + "\" is still due after "
+                             + to_string( iterations ) + " iterations" );
+      }
+
+      rule_fired = true;
+      this_rule.callback();
+      ++iterations;
+    }
+
+    _serviced_this_wakeup += rule_fired;
+    ++it;
   }
 }
 
 // NOLINTBEGIN(*-cognitive-complexity)
 // NOLINTBEGIN(*-signed-bitwise)
+EventLoop::ServiceResult EventLoop::service_fd_rule( FDRule& this_rule, int16_t revents )
+{
+  if ( _serviced_this_wakeup > 0 or _backend != Backend::Poll ) {
+    // an earlier callback (in this wakeup, or since the rule's interest was last evaluated) may have changed
+    // whether this rule is interested
+    this_rule.polled_events = this_rule.interest() ? static_cast<int16_t>( this_rule.direction ) : 0;
+    revents &= static_cast<int16_t>( this_rule.polled_events | POLLERR | POLLHUP | POLLNVAL );
+  }
+
+  const auto poll_error = static_cast<bool>( revents & ( POLLERR | POLLNVAL ) );
+  if ( poll_error ) {
+    /* see if fd is a socket */
+    int socket_error = 0;
+    socklen_t optlen = sizeof( socket_error );
+    const int ret = getsockopt( this_rule.fd.fd_num(), SOL_SOCKET, SO_ERROR, &socket_error, &optlen );
+    if ( ret == -1 and errno == ENOTSOCK ) {
+      cerr << "error on polled file descriptor for rule \"" << _rule_categories.at( this_rule.category_id ).name
+           << "\"\n";
+    } else if ( ret == -1 ) {
+      throw unix_error( "getsockopt" );
+    } else if ( optlen != sizeof( socket_error ) ) {
+      throw runtime_error( "unexpected length from getsockopt: " + to_string( optlen ) );
+    } else if ( socket_error ) {
+      cerr << "error on polled socket for rule \"" << _rule_categories.at( this_rule.category_id ).name
+           << "\": " << strerror( socket_error ) << "\n";
+    }
+
+    this_rule.error();
+    this_rule.cancel();
+    return ServiceResult::Remove;
+  }
+
+  const auto events = this_rule.polled_events;
+  const auto poll_ready = static_cast<bool>( revents & events );
+  const auto poll_hup = static_cast<bool>( revents & POLLHUP );
+  if ( poll_hup && ( ( events && !poll_ready ) or ( this_rule.direction == Direction::Out ) ) ) {
+    // if we asked for the status, and the _only_ condition was a hangup, this FD is defunct:
+    //   - if it was POLLIN and nothing is readable, no more will ever be readable
+    //   - if it was POLLOUT, it will not be writable again
+    // additionally, consider FD defunct if rule will only query for Direction::Out
+    this_rule.cancel();
+    return ServiceResult::Remove;
+  }
+
+  if ( poll_ready ) {
+    // we only want to call callback if revents includes the event we asked for
+    const auto count_before = this_rule.service_count();
+    this_rule.callback();
+
+    if ( count_before == this_rule.service_count() and ( not this_rule.fd.closed() ) and this_rule.interest() ) {
+      throw runtime_error( "EventLoop: busy wait detected: rule \""
+                           + _rule_categories.at( this_rule.category_id ).name
+                           + "\" did not read/write fd and is still interested" );
+    }
+
+    ++_serviced_this_wakeup;
+    _serviced_fds.emplace_back( this_rule.fd.fd_num(), this_rule.direction );
+    return ServiceResult::Serviced;
+  }
+
+  return ServiceResult::Idle;
+}
+
 EventLoop::Result EventLoop::wait_next_event( const int timeout_ms )
 {
+  _serviced_this_wakeup = 0;
+  _serviced_fds = move( _ready_partly_served ); // (an fd reached the batch limit part way through its rules)
+  _ready_partly_served.clear();
+
   // first, handle the non-file-descriptor-related rules
   {
     for ( auto it = _non_fd_rules.begin(); it != _non_fd_rules.end(); ) {
@@ -106,118 +543,295 @@ EventLoop::Result EventLoop::wait_next_event( const int timeout_ms )
       }
 
       if ( rule_fired ) {
-        return Result::Success; /* only serve one rule on each iteration */
+        ++_serviced_this_wakeup;
+        if ( batch_full() ) {
+          record_wakeup();
+          return Result::Success; /* serve at most batch_limit() rules on each iteration */
+        }
       }
 
       ++it;
     }
   }
 
-  // now the file-descriptor-related rules. poll any "interested" file descriptors
+  // then the timers that are already due
+  fire_due_timers();
+  if ( batch_full() ) {
+    record_wakeup();
+    return Result::Success;
+  }
+
+  // quit if there is nothing left to wait for
+  const bool fds_interested = _backend == Backend::Poll ? prune_and_collect_interest() : refresh_dirty_fds();
+  const auto deadline = next_timer_deadline();
+  if ( not fds_interested and not deadline.has_value() and not _serviced_this_wakeup ) {
+    return Result::Exit;
+  }
+
+  // Sleep until the caller's timeout or the earliest timer deadline, whichever comes first (but don't block
+  // if a rule already did some work). An empty timeout means forever.
+  optional<Clock::duration> timeout;
+  if ( _serviced_this_wakeup ) {
+    timeout = Clock::duration::zero();
+  } else {
+    if ( timeout_ms >= 0 ) {
+      timeout = chrono::milliseconds( timeout_ms );
+    }
+    if ( deadline.has_value() ) {
+      const auto until_deadline = max( Clock::duration::zero(), deadline.value() - Clock::now() );
+      timeout = min( timeout.value_or( until_deadline ), until_deadline );
+    }
+  }
+
+  timespec timeout_spec {};
+  if ( timeout.has_value() ) {
+    const auto seconds = chrono::duration_cast<chrono::seconds>( timeout.value() );
+    timeout_spec.tv_sec = seconds.count();
+    timeout_spec.tv_nsec = chrono::duration_cast<chrono::nanoseconds>( timeout.value() - seconds ).count();
+  }
+  const timespec* const timeout_ptr = timeout.has_value() ? &timeout_spec : nullptr;
+
+  // now the file-descriptor-related rules, followed by any timers that came due while waiting
+  Result result {};
+  switch ( _backend ) {
+    case Backend::Poll:
+      result = wait_poll( timeout_ptr );
+      break;
+    case Backend::Epoll:
+      result = wait_epoll( timeout_ptr );
+      break;
+    case Backend::IOUring:
+      result = wait_uring( timeout_ptr );
+      break;
+  }
+  fire_due_timers();
+  if ( _serviced_this_wakeup ) {
+    result = Result::Success;
+  }
+
+  record_wakeup();
+  return result;
+}
+
+EventLoop::Result EventLoop::wait_poll( const timespec* const timeout )
+{
+  // set up the pollfd for each rule
   vector<pollfd> pollfds {};
   pollfds.reserve( _fd_rules.size() );
-  bool something_to_poll = false;
+  for ( const auto& rule : _fd_rules ) {
+    pollfds.push_back( { rule->fd.fd_num(), rule->polled_events, 0 } );
+  }
 
-  // set up the pollfd for each rule
-  for ( auto it = _fd_rules.begin(); it != _fd_rules.end(); ) { // NOTE: it gets erased or incremented in loop body
-    auto& this_rule = **it;
+  // call ppoll -- wait until one of the fds satisfies one of the rules (writeable/readable)
+  if ( 0 == CheckSystemCall( "ppoll", ::ppoll( pollfds.data(), pollfds.size(), timeout, nullptr ) ) ) {
+    return Result::Timeout;
+  }
 
-    if ( this_rule.cancel_requested ) {
-      //      this_rule.cancel();
-      //      if rule is cancelled externally, no need to call the cancellation callback
-      //      this makes it easier to cancel rules and delete captured objects right away
-      it = _fd_rules.erase( it );
+  // go through the poll results (rules added by callbacks weren't polled and are left for the next iteration)
+  vector<list<shared_ptr<FDRule>>::iterator> serviced;
+  for ( auto [it, idx] = make_pair( _fd_rules.begin(), static_cast<size_t>( 0 ) );
+        it != _fd_rules.end() and idx < pollfds.size() and not batch_full();
+        ++idx ) {
+    if ( not may_service( **it ) ) {
+      ++it;
       continue;
     }
 
-    if ( this_rule.direction == Direction::In && this_rule.fd.eof() ) {
-      // no more reading on this rule, it's reached eof
-      this_rule.cancel();
-      it = _fd_rules.erase( it );
-      continue;
+    switch ( service_fd_rule( **it, pollfds.at( idx ).revents ) ) {
+      case ServiceResult::Remove:
+        it = erase_fd_rule( it );
+        continue;
+      case ServiceResult::Serviced:
+        serviced.push_back( it );
+        break;
+      case ServiceResult::Idle:
+        break;
     }
 
-    if ( this_rule.fd.closed() ) {
-      this_rule.cancel();
-      it = _fd_rules.erase( it );
-      continue;
+    ++it; // if we got here, it means we didn't call _fd_rules.erase()
+  }
+
+  // round robin: if this wakeup was cut short, the rules it serviced wait behind the ones it didn't reach
+  if ( _batch_limit > 1 and batch_full() ) {
+    for ( const auto& it : serviced ) {
+      _fd_rules.splice( _fd_rules.end(), _fd_rules, it );
     }
+  }
+
+  return Result::Success;
+}
+
+int EventLoop::epoll_wait_for( const timespec* const timeout )
+{
+  const int max_events = static_cast<int>( _ready_events.size() );
 
-    if ( this_rule.interest() ) {
-      pollfds.push_back( { this_rule.fd.fd_num(), static_cast<int16_t>( this_rule.direction ), 0 } );
-      something_to_poll = true;
-    } else {
-      pollfds.push_back( { this_rule.fd.fd_num(), 0, 0 } ); // placeholder --- we still want errors
+  if ( not _epoll_pwait2_unavailable ) {
+    const int ready = ::epoll_pwait2( _epoll_fd->fd_num(), _ready_events.data(), max_events, timeout, nullptr );
+    if ( ready >= 0 or errno != ENOSYS ) {
+      return CheckSystemCall( "epoll_pwait2", ready );
     }
-    ++it;
+    _epoll_pwait2_unavailable = true;
   }
 
-  // quit if there is nothing left to poll
-  if ( not something_to_poll ) {
-    return Result::Exit;
+  // older kernels: epoll_wait(2) takes milliseconds, so round up rather than wake before the deadline
+  int timeout_ms = -1;
+  if ( timeout != nullptr ) {
+    const auto ns = chrono::seconds( timeout->tv_sec ) + chrono::nanoseconds( timeout->tv_nsec );
+    const auto ms = chrono::ceil<chrono::milliseconds>( ns ).count();
+    timeout_ms = static_cast<int>( min<chrono::milliseconds::rep>( ms, numeric_limits<int>::max() ) );
+  }
+  return CheckSystemCall( "epoll_wait",
+                          ::epoll_wait( _epoll_fd->fd_num(), _ready_events.data(), max_events, timeout_ms ) );
+}
+
+bool EventLoop::unpollable_wanted() const
+{
+  return ranges::any_of( _unpollable_fds, [&]( const int fd_num ) { return _registrations.at( fd_num ).wanted; } );
+}
+
+EventLoop::Result EventLoop::wait_epoll( const timespec* const timeout )
+{
+  if ( _ready_next < _ready_count ) {
+    return dispatch_ready( false ); // the rest of the last result, before waiting again
+  }
+
+  if ( _epoll_rebuild_needed ) {
+    epoll_rebuild();
+  }
+
+  // (the fds whose interest changed were re-armed by refresh_dirty_fds)
+  const bool always_ready = unpollable_wanted();
+  if ( _ready_events.size() < _registrations.size() ) {
+    _ready_events.resize( _registrations.size() );
+  }
+  if ( _ready_events.empty() ) {
+    _ready_events.resize( 1 );
   }
+  const timespec no_wait {};
+  const int ready = epoll_wait_for( always_ready ? &no_wait : timeout );
+  _ready_count = static_cast<size_t>( ready );
+  _ready_next = 0;
 
-  // call poll -- wait until one of the fds satisfies one of the rules (writeable/readable)
-  if ( 0 == CheckSystemCall( "poll", ::poll( pollfds.data(), pollfds.size(), timeout_ms ) ) ) {
+  if ( ready == 0 and not always_ready ) {
     return Result::Timeout;
   }
 
-  // go through the poll results
-  for ( auto [it, idx] = make_pair( _fd_rules.begin(), static_cast<size_t>( 0 ) ); it != _fd_rules.end(); ++idx ) {
-    const auto& this_pollfd = pollfds.at( idx );
-    auto& this_rule = **it;
+  return dispatch_ready( always_ready );
+}
 
-    const auto poll_error = static_cast<bool>( this_pollfd.revents & ( POLLERR | POLLNVAL ) );
-    if ( poll_error ) {
-      /* see if fd is a socket */
-      int socket_error = 0;
-      socklen_t optlen = sizeof( socket_error );
-      const int ret = getsockopt( this_rule.fd.fd_num(), SOL_SOCKET, SO_ERROR, &socket_error, &optlen );
-      if ( ret == -1 and errno == ENOTSOCK ) {
-        cerr << "error on polled file descriptor for rule \"" << _rule_categories.at( this_rule.category_id ).name
-             << "\"\n";
-      } else if ( ret == -1 ) {
-        throw unix_error( "getsockopt" );
-      } else if ( optlen != sizeof( socket_error ) ) {
-        throw runtime_error( "unexpected length from getsockopt: " + to_string( optlen ) );
-      } else if ( socket_error ) {
-        cerr << "error on polled socket for rule \"" << _rule_categories.at( this_rule.category_id ).name
-             << "\": " << strerror( socket_error ) << "\n";
+// Each armed fd has one one-shot poll in the ring, identified by a token (a sequence number and the fd number).
+// A poll whose interest changed is cancelled and replaced; the new polls are submitted by the same io_uring_enter
+// that waits for completions. A completed poll has disarmed itself and is re-armed on the next call.
+EventLoop::Result EventLoop::wait_uring( const timespec* const timeout )
+{
+  if ( _ready_next < _ready_count ) {
+    return dispatch_ready( false ); // the rest of the last result, before waiting again
+  }
+
+  // (the polls of fds that were serviced, or whose interest changed, were queued by refresh_dirty_fds)
+
+  const auto deadline = timeout ? optional { Clock::now() + chrono::seconds( timeout->tv_sec )
+                                             + chrono::nanoseconds( timeout->tv_nsec ) }
+                                : nullopt;
+  _ready_events.clear();
+  _ready_count = 0;
+  _ready_next = 0;
+  while ( true ) {
+    // completions of cancelled (or superseded) polls carry a stale token and are skipped
+    while ( const auto completion = _uring->pop_completion() ) {
+      const auto reg = _registrations.find( static_cast<int>( completion->user_data & 0xffffffffU ) );
+      if ( completion->user_data == 0 or reg == _registrations.end()
+           or reg->second.poll_token != completion->user_data ) {
+        continue;
       }
+      reg->second.poll_token = 0;
+      reg->second.armed = 0;
+      const auto revents = static_cast<uint32_t>( completion->result < 0 ? POLLNVAL : completion->result );
+      _ready_events.push_back( { revents, { .fd = reg->first } } );
+    }
 
-      this_rule.error();
-      this_rule.cancel();
-      it = _fd_rules.erase( it );
-      continue;
+    if ( not _ready_events.empty() ) {
+      _ready_count = _ready_events.size();
+      break;
+    }
+
+    timespec remaining {};
+    if ( deadline.has_value() ) {
+      const auto left = max( Clock::duration::zero(), deadline.value() - Clock::now() );
+      if ( left == Clock::duration::zero() and _uring->queued() == 0 ) {
+        return Result::Timeout;
+      }
+      const auto seconds = chrono::duration_cast<chrono::seconds>( left );
+      remaining.tv_sec = seconds.count();
+      remaining.tv_nsec = chrono::duration_cast<chrono::nanoseconds>( left - seconds ).count();
     }
+    _uring->submit( 1, deadline.has_value() ? &remaining : nullptr );
+  }
+
+  return dispatch_ready( false );
+}
 
-    const auto poll_ready = static_cast<bool>( this_pollfd.revents & this_pollfd.events );
-    const auto poll_hup = static_cast<bool>( this_pollfd.revents & POLLHUP );
-    if ( poll_hup && ( ( this_pollfd.events && !poll_ready ) or ( this_rule.direction == Direction::Out ) ) ) {
-      // if we asked for the status, and the _only_ condition was a hangup, this FD is defunct:
-      //   - if it was POLLIN and nothing is readable, no more will ever be readable
-      //   - if it was POLLOUT, it will not be writable again
-      // additionally, consider FD defunct if rule will only query for Direction::Out
-      this_rule.cancel();
-      it = _fd_rules.erase( it );
+// Hand the result to each rule on the fd. Defunct rules are only marked here (their cancel callback has
+// already run) and are erased by the next prune, so the pointers stay valid while callbacks run.
+bool EventLoop::dispatch_fd( const int fd_num, const uint32_t revents )
+{
+  const auto reg = _registrations.find( fd_num );
+  if ( reg == _registrations.end() ) {
+    return false;
+  }
+  mark_dirty( fd_num ); // re-evaluate the fd's rules (and re-arm its poll) before the next wait
+
+  const auto rules = reg->second.rules; // callbacks may add rules for this fd
+  for ( auto* rule : rules ) {
+    if ( not may_service( *rule ) ) {
       continue;
     }
+    if ( batch_full() ) {
+      return true;
+    }
 
-    if ( poll_ready ) {
-      // we only want to call callback if revents includes the event we asked for
-      const auto count_before = this_rule.service_count();
-      this_rule.callback();
+    const auto mask = static_cast<uint32_t>( rule->polled_events ) | EPOLLERR | EPOLLHUP | POLLNVAL;
+    if ( service_fd_rule( *rule, static_cast<int16_t>( revents & mask ) ) == ServiceResult::Remove ) {
+      rule->cancel_requested = true;
+    }
+  }
 
-      if ( count_before == this_rule.service_count() and ( not this_rule.fd.closed() ) and this_rule.interest() ) {
-        throw runtime_error( "EventLoop: busy wait detected: rule \""
-                             + _rule_categories.at( this_rule.category_id ).name
-                             + "\" did not read/write fd and is still interested" );
-      }
+  return false;
+}
 
-      return Result::Success; /* only serve one rule on each iteration */
+// A wakeup cut short by the batch limit leaves the rest of the result in _ready_events, and the next call serves
+// it (starting with the fd it stopped at, if it stopped part way through the fd's rules) before waiting again.
+EventLoop::Result EventLoop::dispatch_ready( const bool always_ready )
+{
+  while ( _ready_next < _ready_count ) {
+    if ( batch_full() ) {
+      return Result::Success; /* serve at most batch_limit() rules on each iteration */
     }
 
-    ++it; // if we got here, it means we didn't call _fd_rules.erase()
+    const auto event = _ready_events.at( _ready_next );
+    if ( dispatch_fd( event.data.fd, event.events ) ) {
+      for ( const auto& served : _serviced_fds ) {
+        if ( served.first == event.data.fd ) {
+          _ready_partly_served.push_back( served );
+        }
+      }
+      return Result::Success;
+    }
+    ++_ready_next;
+  }
+
+  if ( always_ready ) {
+    vector<pair<int, uint32_t>> unpollable;
+    for ( const int fd_num : _unpollable_fds ) {
+      if ( const auto wanted = _registrations.at( fd_num ).wanted ) {
+        unpollable.emplace_back( fd_num, wanted );
+      }
+    }
+    for ( const auto& [fd_num, wanted] : unpollable ) {
+      if ( dispatch_fd( fd_num, wanted ) or batch_full() ) {
+        break;
+      }
+    }
   }
 
   return Result::Success;
@@ -1,14 +1,22 @@
 #pragma once
 
+#include <array>
+#include <chrono>
 #include <functional>
 #include <list>
 #include <memory>
+#include <optional>
 #include <ostream>
 #include <poll.h>
 #include <string_view>
+#include <sys/epoll.h>
+#include <unordered_map>
+#include <vector>
 
 #include "file_descriptor.hh"
 
+class IOUring;
+
 //! Waits for events on file descriptors and executes corresponding callbacks.
 class EventLoop
 {
@@ -20,9 +28,23 @@ public:
     Out = POLLOUT //!< Callback will be triggered when Rule::fd is writable.
   };
 
+  //! Kernel interface used to wait for activity on the rules' file descriptors.
+  enum class Backend
+  {
+    Poll,   //!< Rebuild a pollfd array and call [poll(2)](\ref man2::poll) on every iteration.
+    Epoll,  //!< Register each fd once with [epoll(7)](\ref man7::epoll); before each wait, re-evaluate the
+            //!< rules with an interest function, and the others only if their fd was serviced, closed or at EOF,
+            //!< and re-arm only when interest changes.
+    IOUring //!< Queue one-shot polls in an [io_uring(7)](\ref man7::io_uring); arm them and wait in one system
+            //!< call. Falls back to Epoll if the kernel lacks io_uring.
+  };
+
+  using Clock = std::chrono::steady_clock;
+
 private:
   using CallbackT = std::function<void( void )>;
   using InterestT = std::function<bool( void )>;
+  using DeadlineT = std::function<std::optional<Clock::time_point>( void )>;
 
   struct RuleCategory
   {
@@ -45,6 +67,9 @@ private:
     Direction direction; //!< Direction::In for reading from fd, Direction::Out for writing to fd.
     CallbackT cancel;    //!< A callback that is called when the rule is cancelled (e.g. on EOF or hangup)
     CallbackT error;     //!< A callback that is called when the fd has an error before cancellation
+    int16_t polled_events {}; //!< Events requested on the most recent wait (0 if uninterested)
+    bool conditional {};      //!< Added with an interest function (otherwise, always interested)
+    std::list<std::shared_ptr<FDRule>>::iterator self {}; //!< The rule's place in EventLoop::_fd_rules
 
     FDRule( BasicRule&& base, FileDescriptor&& s_fd, Direction s_direction, CallbackT s_cancel, CallbackT s_error );
 
@@ -53,12 +78,81 @@ private:
     unsigned int service_count() const;
   };
 
+  struct TimerRule : public BasicRule
+  {
+    DeadlineT deadline; //!< When the callback is next due (empty if the timer is idle)
+
+    TimerRule( size_t s_category_id, DeadlineT s_deadline, CallbackT s_callback );
+  };
+
   std::vector<RuleCategory> _rule_categories {};
   std::list<std::shared_ptr<FDRule>> _fd_rules {};
   std::list<std::shared_ptr<BasicRule>> _non_fd_rules {};
+  std::list<std::shared_ptr<TimerRule>> _timer_rules {};
+
+  //! The rules watching one fd number, and the events currently armed for it (by the Epoll or IOUring backend).
+  struct FDRegistration
+  {
+    std::vector<FDRule*> rules {};
+    uint32_t armed {};      //!< Events the kernel is currently watching for
+    uint32_t wanted {};     //!< Events requested by the interested rules, as of their last re-evaluation
+    bool pollable { true }; //!< False for fds epoll refuses (e.g. regular files), which are always ready
+    bool dirty {};          //!< In _dirty_fds: the rules' interest is re-evaluated before the next wait
+    uint64_t poll_token {}; //!< IOUring: user data of the armed poll
+  };
+
+  Backend _backend;
+  std::unordered_map<int, FDRegistration> _registrations {};
+  std::vector<int> _dirty_fds {};        //!< Registrations whose rules may have changed since the last wait
+  std::vector<FDRule*> _orphaned_rules {}; //!< Rules of an fd that was closed and its number reused
+  std::vector<int> _unpollable_fds {};   //!< Registrations that epoll refused
+  size_t _wanted_fds {};                 //!< Registrations with an interested rule
+  std::vector<epoll_event> _ready_events {}; //!< The fds (and events) reported ready by epoll or io_uring
+  size_t _ready_count {};                    //!< ...the number of entries of _ready_events in the last result
+  //! The first entry of _ready_events not yet served (if a wakeup reached the batch limit), and the directions
+  //! of its fd already served, if the wakeup stopped part way through the fd's rules
+  size_t _ready_next {};
+  std::vector<std::pair<int, Direction>> _ready_partly_served {};
+
+  std::optional<FileDescriptor> _epoll_fd {};
+  bool _epoll_rebuild_needed {};
+  bool _epoll_pwait2_unavailable {}; //!< Kernel lacks epoll_pwait2(2); fall back to millisecond timeouts
+
+  std::unique_ptr<IOUring> _uring {};
+  uint32_t _uring_poll_sequence {};
 
 public:
-  EventLoop() { _rule_categories.reserve( 64 ); }
+  explicit EventLoop( Backend backend = Backend::Poll );
+  ~EventLoop();
+
+  EventLoop( const EventLoop& other ) = delete;
+  EventLoop& operator=( const EventLoop& other ) = delete;
+
+  Backend backend() const { return _backend; }
+
+  //! Counters describing how many rules each wakeup serviced.
+  struct Stats
+  {
+    static constexpr size_t HISTOGRAM_SIZE = 8;
+
+    uint64_t wakeups {};         //!< Calls to wait_next_event() that serviced at least one rule
+    uint64_t rules_serviced {};  //!< Rule callbacks run, summed over all wakeups
+    uint64_t limited_wakeups {}; //!< Wakeups that stopped because they reached the batch limit
+
+    //! serviced_per_wakeup[n] counts the wakeups that serviced n + 1 rules (the last bucket: n + 1 or more)
+    std::array<uint64_t, HISTOGRAM_SIZE> serviced_per_wakeup {};
+  };
+
+  //! Service up to `max_rules` ready rules per call to wait_next_event(), all from one poll/epoll result.
+  //! \details The default, 1, serves a single rule per call. With a larger limit, each fd is serviced at most
+  //! once per direction per call, and a rule's interest is re-checked if an earlier callback ran. Either way, a
+  //! wakeup that reaches the limit doesn't starve the rules it didn't get to: with Poll, the rules it serviced go
+  //! to the back of the line, and with Epoll and IOUring, the rest of its ready fds are served by the next
+  //! call(s), before waiting again.
+  void set_batch_limit( size_t max_rules );
+  size_t batch_limit() const { return _batch_limit; }
+
+  const Stats& stats() const { return _stats; }
 
   //! Returned by each call to EventLoop::wait_next_event.
   enum class Result
@@ -74,21 +168,31 @@ public:
   class RuleHandle
   {
     std::weak_ptr<BasicRule> rule_weak_ptr_;
+    EventLoop* loop_ {}; //!< For an FDRule, the loop it belongs to (alive as long as the rule is)
 
   public:
     template<class RuleType>
-    explicit RuleHandle( const std::shared_ptr<RuleType> x ) : rule_weak_ptr_( x )
+    explicit RuleHandle( const std::shared_ptr<RuleType> x, EventLoop* loop = nullptr )
+      : rule_weak_ptr_( x ), loop_( loop )
     {}
 
+    RuleHandle( const RuleHandle& other ) = default;
+    RuleHandle& operator=( const RuleHandle& other ) = default;
+    RuleHandle( RuleHandle&& other ) = default;
+    RuleHandle& operator=( RuleHandle&& other ) = default;
+    ~RuleHandle() = default;
+
     void cancel();
   };
 
+  //! Add a rule that runs `callback` when `fd` is ready in `direction`, while `interest` returns true (if given;
+  //! without it, the rule is always interested).
   RuleHandle add_rule(
     size_t category_id,
     FileDescriptor& fd,
     Direction direction,
     const CallbackT& callback,
-    const InterestT& interest = [] { return true; },
+    const InterestT& interest = {},
     const CallbackT& cancel = [] {},
     const CallbackT& error = [] {} );
 
@@ -97,7 +201,19 @@ public:
     const CallbackT& callback,
     const InterestT& interest = [] { return true; } );
 
-  //! Calls [poll(2)](\ref man2::poll) and then executes callback for each ready fd.
+  //! Add a timer: `callback` runs once the time returned by `deadline` has passed.
+  //! \details `deadline` is consulted on every wait (return an empty optional while the timer is idle), and
+  //! the loop sleeps no later than the earliest deadline, with nanosecond resolution. The callback must move the
+  //! deadline forward or clear it.
+  RuleHandle add_timer_rule( size_t category_id, const DeadlineT& deadline, const CallbackT& callback );
+
+  RuleHandle add_timer_rule( const std::string& name, const DeadlineT& deadline, const CallbackT& callback )
+  {
+    return add_timer_rule( add_category( name ), deadline, callback );
+  }
+
+  //! Waits with the configured Backend, until at most `timeout_ms` (or forever if negative) or the earliest
+  //! timer deadline, and then executes the callbacks of ready fds and due timers.
   Result wait_next_event( int timeout_ms );
 
   // convenience function to add category and rule at the same time
@@ -106,6 +222,54 @@ public:
   {
     return add_rule( add_category( name ), std::forward<Targs>( Fargs )... );
   }
+
+private:
+  size_t _batch_limit { 1 };
+  size_t _serviced_this_wakeup {};
+  std::vector<std::pair<int, Direction>> _serviced_fds {}; //!< fds (and directions) serviced this wakeup
+  Stats _stats {};
+
+  //! Outcome of handing one poll/epoll result to an FDRule.
+  enum class ServiceResult
+  {
+    Idle,     //!< Nothing happened on the rule's fd.
+    Serviced, //!< The rule's callback ran.
+    Remove    //!< The rule is defunct (error or hangup) and its cancel callback has run.
+  };
+
+  //! Drops rules that are cancelled, closed, or at EOF. Returns true if any remaining rule is interested.
+  bool prune_and_collect_interest();
+  //! Does the same for the fds in _dirty_fds only, and re-arms those whose interest changed (Epoll and IOUring)
+  bool refresh_dirty_fds();
+  void mark_dirty( int fd_num );
+  void update_wanted( FDRegistration& reg, int fd_num );
+  bool batch_full() const { return _serviced_this_wakeup >= _batch_limit; }
+  bool may_service( const FDRule& rule ) const;
+  void record_wakeup();
+  std::list<std::shared_ptr<FDRule>>::iterator erase_fd_rule( std::list<std::shared_ptr<FDRule>>::iterator it );
+  bool retire_if_defunct( FDRule& rule );
+  ServiceResult service_fd_rule( FDRule& rule, int16_t revents );
+  Result wait_poll( const timespec* timeout );
+  Result wait_epoll( const timespec* timeout );
+  int epoll_wait_for( const timespec* timeout );
+  Result wait_uring( const timespec* timeout );
+
+  //! Returns true if an fd that epoll refused (and is always ready) is wanted
+  bool unpollable_wanted() const;
+  //! Hands the entries of _ready_events not yet served (and wanted unpollable fds) to their rules
+  Result dispatch_ready( bool always_ready );
+  //! Returns true if the batch limit was reached before the result was offered to all of the fd's rules
+  bool dispatch_fd( int fd_num, uint32_t revents );
+
+  //! Drops cancelled timers and returns the earliest deadline among the rest
+  std::optional<Clock::time_point> next_timer_deadline();
+  void fire_due_timers();
+
+  void register_fd_rule( FDRule& rule );
+  void unregister_fd_rule( const FDRule& rule );
+  void erase_registration( std::unordered_map<int, FDRegistration>::iterator reg, bool fd_closed );
+  void epoll_control( int op, int fd_num, uint32_t events );
+  void epoll_rebuild();
 };
 
 using Direction = EventLoop::Direction;
@@ -3,6 +3,7 @@
 #include "exception.hh"
 
 #include <algorithm>
+#include <array>
 #include <fcntl.h>
 #include <iostream>
 #include <stdexcept>
@@ -151,6 +152,53 @@ void FileDescriptor::read( vector<string>& buffers )
   }
 }
 
+size_t FileDescriptor::read_into( const span<char> buffer )
+{
+  const iovec iov { buffer.data(), buffer.size() };
+  return read_into( span { &iov, 1 } );
+}
+
+size_t FileDescriptor::read_into( const span<const span<char>> buffers )
+{
+  // (a few buffers, the usual case, don't need an allocation)
+  array<iovec, 4> fixed {};
+  vector<iovec> more;
+  if ( buffers.size() > fixed.size() ) {
+    more.resize( buffers.size() );
+  }
+  const span<iovec> iovecs = more.empty() ? span { fixed }.first( buffers.size() ) : span { more };
+  ranges::transform( buffers, iovecs.begin(), []( const span<char> x ) { return iovec { x.data(), x.size() }; } );
+  return read_into( span<const iovec> { iovecs } );
+}
+
+size_t FileDescriptor::read_into( const span<const iovec> buffers )
+{
+  size_t total_size = 0;
+  for ( const auto& x : buffers ) {
+    total_size += x.iov_len;
+  }
+
+  const ssize_t bytes_read = ::readv( fd_num(), buffers.data(), static_cast<int>( buffers.size() ) );
+  if ( bytes_read < 0 ) {
+    if ( internal_fd_->non_blocking_ and ( errno == EAGAIN or errno == EINPROGRESS ) ) {
+      return 0;
+    }
+    throw unix_error { "readv" };
+  }
+
+  register_read();
+
+  if ( bytes_read == 0 and total_size != 0 ) {
+    internal_fd_->eof_ = true;
+  }
+
+  if ( bytes_read > static_cast<ssize_t>( total_size ) ) {
+    throw runtime_error( "read() read more than requested" );
+  }
+
+  return bytes_read;
+}
+
 size_t FileDescriptor::write( string_view buffer )
 {
   return write( vector<string_view> { buffer } );
@@ -170,20 +218,31 @@ size_t FileDescriptor::write( const vector<string_view>& buffers )
 {
   vector<iovec> iovecs;
   iovecs.reserve( buffers.size() );
-  size_t total_size = 0;
   for ( const auto x : buffers ) {
     iovecs.push_back( { const_cast<char*>( x.data() ), x.size() } ); // NOLINT(*-const-cast)
-    total_size += x.size();
+  }
+  return write( iovecs );
+}
+
+size_t FileDescriptor::write( const span<const iovec> iovecs )
+{
+  size_t total_size = 0;
+  for ( const auto& x : iovecs ) {
+    total_size += x.iov_len;
   }
 
   const ssize_t bytes_written
     = CheckSystemCall( "writev", ::writev( fd_num(), iovecs.data(), static_cast<int>( iovecs.size() ) ) );
-  register_write();
 
   if ( bytes_written == 0 and total_size != 0 ) {
+    if ( internal_fd_->non_blocking_ ) {
+      return 0; // EAGAIN: try again once the fd is writable
+    }
     throw runtime_error( "write returned 0 given non-empty input buffer" );
   }
 
+  register_write();
+
   if ( bytes_written > static_cast<ssize_t>( total_size ) ) {
     throw runtime_error( "write wrote more than length of input buffer" );
   }
@@ -191,6 +250,43 @@ size_t FileDescriptor::write( const vector<string_view>& buffers )
   return bytes_written;
 }
 
+size_t FileDescriptor::splice_from( FileDescriptor& source, size_t length )
+{
+  // SPLICE_F_NONBLOCK only covers the pipe end; the other end follows its own O_NONBLOCK flag
+  const ssize_t bytes_moved
+    = ::splice( source.fd_num(), nullptr, fd_num(), nullptr, length, SPLICE_F_MOVE | SPLICE_F_NONBLOCK );
+  if ( bytes_moved < 0 ) {
+    if ( errno == EAGAIN ) {
+      return 0;
+    }
+    throw unix_error { "splice" };
+  }
+
+  source.register_read();
+  register_write();
+
+  if ( bytes_moved == 0 and length != 0 ) {
+    source.set_eof();
+  }
+
+  return bytes_moved;
+}
+
+pair<FileDescriptor, FileDescriptor> make_pipe( size_t capacity )
+{
+  array<int, 2> fds {};
+  if ( ::pipe2( fds.data(), O_CLOEXEC ) < 0 ) {
+    throw unix_error { "pipe2" };
+  }
+  pair<FileDescriptor, FileDescriptor> ends { FileDescriptor { fds[0] }, FileDescriptor { fds[1] } };
+
+  if ( capacity > 0 ) {
+    ::fcntl( fds[1], F_SETPIPE_SZ, static_cast<int>( capacity ) ); // NOLINT(*-vararg): a smaller pipe still works
+  }
+
+  return ends;
+}
+
 void FileDescriptor::set_blocking( bool blocking )
 {
   int flags = CheckSystemCall( "fcntl", fcntl( fd_num(), F_GETFL ) ); // NOLINT(*-vararg)
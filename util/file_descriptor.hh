@@ -3,6 +3,9 @@
 #include <cstddef>
 #include <limits>
 #include <memory>
+#include <span>
+#include <sys/uio.h>
+#include <utility>
 #include <vector>
 
 // A reference-counted handle to a file descriptor
@@ -43,6 +46,9 @@ class FileDescriptor
   // private constructor used to duplicate the FileDescriptor (increase the reference count)
   explicit FileDescriptor( std::shared_ptr<FDWrapper> other_shared_ptr );
 
+  // IOBatch performs reads and writes on behalf of FileDescriptor
+  friend class IOBatch;
+
 protected:
   // size of buffer to allocate for read()
   static constexpr size_t kReadBufferSize = 16384;
@@ -65,11 +71,23 @@ public:
   void read( std::string& buffer );
   void read( std::vector<std::string>& buffers );
 
+  // Read into memory the caller already has (e.g. Writer::reserve), without allocating or initializing it
+  // returns number of bytes read (0 at EOF, or if a non-blocking fd isn't readable)
+  size_t read_into( std::span<char> buffer );
+  size_t read_into( std::span<const std::span<char>> buffers ); // filled in order (e.g. Writer::reserve_spans)
+  size_t read_into( std::span<const iovec> buffers ); // e.g. a fixed array, without allocating one
+
   // Attempt to write a buffer
-  // returns number of bytes written
+  // returns number of bytes written (0 if a non-blocking fd isn't writable)
   size_t write( std::string_view buffer );
   size_t write( const std::vector<std::string_view>& buffers );
   size_t write( const std::vector<std::string>& buffers );
+  size_t write( std::span<const iovec> buffers ); // e.g. a FrameSerializer's output
+
+  // Move up to `length` bytes from `source` into this fd without copying them through user space
+  // ([splice(2)](\ref man2::splice)); one of the two fds must be a pipe
+  // returns number of bytes moved (0 at EOF, or if either fd isn't ready)
+  size_t splice_from( FileDescriptor& source, size_t length );
 
   // Close the underlying file descriptor
   void close() { internal_fd_->close(); }
@@ -97,3 +115,7 @@ public:
   FileDescriptor( FileDescriptor&& other ) = default;                // move construction is allowed
   FileDescriptor& operator=( FileDescriptor&& other ) = default;     // move assignment is allowed
 };
+
+// Create a pipe, returning its read end and its write end. If `capacity` is nonzero, asks the kernel for that
+// much buffer space (which it may cap at /proc/sys/fs/pipe-max-size).
+std::pair<FileDescriptor, FileDescriptor> make_pipe( size_t capacity = 0 );
@@ -0,0 +1,396 @@
+#include "io_uring.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+int io_uring_setup( const unsigned entries, io_uring_params& params )
+{
+  const long ret = syscall( __NR_io_uring_setup, entries, &params ); // NOLINT(*-vararg)
+  return CheckSystemCall( "io_uring_setup", static_cast<int>( ret ) );
+}
+
+shared_ptr<void> map_ring( const int fd, const size_t length, const off_t offset )
+{
+  void* const addr = mmap( nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset );
+  if ( addr == MAP_FAILED ) { // NOLINT(*-cstyle-cast, *-int-to-ptr)
+    throw unix_error { "mmap" };
+  }
+  return { addr, [length]( void* const x ) { munmap( x, length ); } };
+}
+
+} // namespace
+
+IOUring::IOUring( const unsigned entries, const unsigned completion_entries )
+  : _params( [&] {
+    io_uring_params params {};
+    if ( completion_entries ) {
+      params.flags |= IORING_SETUP_CQSIZE;
+      params.cq_entries = completion_entries;
+    }
+    return params;
+  }() )
+  , _ring_fd( io_uring_setup( entries, _params ) )
+{
+  // one mapping holds both rings on every kernel with IORING_FEAT_SINGLE_MMAP (5.4+)
+  if ( not( _params.features & IORING_FEAT_SINGLE_MMAP ) ) {
+    throw runtime_error( "IOUring: kernel lacks IORING_FEAT_SINGLE_MMAP" );
+  }
+  // completions are never dropped (5.5+), and io_uring_enter takes a timeout (5.11+)
+  if ( not( _params.features & IORING_FEAT_NODROP ) or not( _params.features & IORING_FEAT_EXT_ARG ) ) {
+    throw runtime_error( "IOUring: kernel lacks IORING_FEAT_NODROP or IORING_FEAT_EXT_ARG" );
+  }
+
+  const size_t sq_length = _params.sq_off.array + _params.sq_entries * sizeof( unsigned );
+  const size_t cq_length = _params.cq_off.cqes + _params.cq_entries * sizeof( io_uring_cqe );
+  _sq_ring = map_ring( _ring_fd.fd_num(), max( sq_length, cq_length ), IORING_OFF_SQ_RING );
+  _cq_ring = _sq_ring;
+  _sqe_array = map_ring( _ring_fd.fd_num(), _params.sq_entries * sizeof( io_uring_sqe ), IORING_OFF_SQES );
+
+  // submission queue entry i always sits in slot i of the sqe array
+  auto* const sq_array = &sq_field<unsigned>( _params.sq_off.array );
+  for ( unsigned i = 0; i < _params.sq_entries; ++i ) {
+    sq_array[i] = i; // NOLINT(*-pointer-arithmetic)
+  }
+  _sq_tail = sq_field<unsigned>( _params.sq_off.tail );
+}
+
+unique_ptr<IOUring> IOUring::try_create( const unsigned entries, const unsigned completion_entries )
+{
+  try {
+    return make_unique<IOUring>( entries, completion_entries );
+  } catch ( const exception& ) {
+    return nullptr;
+  }
+}
+
+template<typename T>
+T& IOUring::sq_field( const uint32_t offset ) const
+{
+  return *reinterpret_cast<T*>( static_cast<char*>( _sq_ring.get() ) + offset ); // NOLINT(*-reinterpret-cast)
+}
+
+template<typename T>
+T& IOUring::cq_field( const uint32_t offset ) const
+{
+  return *reinterpret_cast<T*>( static_cast<char*>( _cq_ring.get() ) + offset ); // NOLINT(*-reinterpret-cast)
+}
+
+io_uring_sqe& IOUring::next_sqe()
+{
+  // if the submission ring is full, hand what's queued to the kernel first
+  if ( _sq_tail - atomic_ref( sq_field<unsigned>( _params.sq_off.head ) ).load( memory_order_acquire )
+       >= _params.sq_entries ) {
+    submit();
+  }
+
+  auto* const sqes = static_cast<io_uring_sqe*>( _sqe_array.get() );
+  io_uring_sqe& sqe = sqes[_sq_tail & sq_field<unsigned>( _params.sq_off.ring_mask )]; // NOLINT(*-arithmetic)
+  sqe = {};
+  ++_sq_tail;
+  ++_sq_queued;
+  return sqe;
+}
+
+io_uring_sqe& IOUring::prepare( const uint8_t opcode,
+                               const int fd,
+                               const char* const buffer,
+                               const size_t length,
+                               const uint64_t user_data )
+{
+  io_uring_sqe& sqe = next_sqe();
+  sqe.opcode = opcode;
+  sqe.fd = fd;
+  sqe.addr = reinterpret_cast<uint64_t>( buffer ); // NOLINT(*-reinterpret-cast)
+  sqe.len = static_cast<uint32_t>( length );
+  sqe.off = -1; // NOLINT(*-narrowing-conversions): use (and advance) the file position, like read(2)
+  sqe.user_data = user_data;
+  return sqe;
+}
+
+void IOUring::queue_read( const int fd, char* const buffer, const size_t length, const uint64_t user_data )
+{
+  prepare( IORING_OP_READ, fd, buffer, length, user_data );
+}
+
+void IOUring::queue_write( const int fd, const char* const buffer, const size_t length, const uint64_t user_data )
+{
+  prepare( IORING_OP_WRITE, fd, buffer, length, user_data );
+}
+
+void IOUring::queue_writev( const int fd, const iovec* const iovecs, const size_t count, const uint64_t user_data )
+{
+  prepare( IORING_OP_WRITEV, fd, nullptr, count, user_data ).addr = reinterpret_cast<uint64_t>( iovecs ); // NOLINT
+}
+
+void IOUring::queue_read_fixed( const int fd, char* const buffer, const size_t length, const uint64_t user_data )
+{
+  prepare( IORING_OP_READ_FIXED, fd, buffer, length, user_data ).buf_index = 0;
+}
+
+void IOUring::queue_write_fixed( const int fd,
+                                 const char* const buffer,
+                                 const size_t length,
+                                 const uint64_t user_data )
+{
+  prepare( IORING_OP_WRITE_FIXED, fd, buffer, length, user_data ).buf_index = 0;
+}
+
+void IOUring::queue_poll_add( const int fd, const uint32_t events, const uint64_t user_data )
+{
+  io_uring_sqe& sqe = next_sqe();
+  sqe.opcode = IORING_OP_POLL_ADD;
+  sqe.fd = fd;
+  sqe.poll32_events = events;
+  sqe.user_data = user_data;
+}
+
+void IOUring::queue_poll_remove( const uint64_t target, const uint64_t user_data )
+{
+  io_uring_sqe& sqe = next_sqe();
+  sqe.opcode = IORING_OP_POLL_REMOVE;
+  sqe.fd = -1;
+  sqe.addr = target;
+  sqe.user_data = user_data;
+}
+
+void IOUring::submit( const unsigned wait_for, const timespec* const timeout )
+{
+  atomic_ref( sq_field<unsigned>( _params.sq_off.tail ) ).store( _sq_tail, memory_order_release );
+
+  unsigned flags = wait_for ? IORING_ENTER_GETEVENTS : 0;
+  io_uring_getevents_arg arg {};
+  __kernel_timespec kernel_timeout {};
+  if ( timeout ) {
+    kernel_timeout.tv_sec = timeout->tv_sec;
+    kernel_timeout.tv_nsec = timeout->tv_nsec;
+    arg.ts = reinterpret_cast<uint64_t>( &kernel_timeout ); // NOLINT(*-reinterpret-cast)
+    flags |= IORING_ENTER_EXT_ARG;
+  }
+
+  long ret = 0;
+  while ( true ) {
+    ret = syscall( __NR_io_uring_enter, // NOLINT(*-vararg)
+                   _ring_fd.fd_num(),
+                   _sq_queued,
+                   wait_for,
+                   flags,
+                   timeout ? &arg : nullptr,
+                   timeout ? sizeof( arg ) : 0 );
+    if ( ret >= 0 ) {
+      break;
+    }
+    if ( errno == ETIME ) {
+      return; // the timeout expired before any completion arrived
+    }
+    if ( errno != EINTR ) {
+      throw unix_error { "io_uring_enter" };
+    }
+    // interrupted by a signal before anything was submitted: try again, unless there is a timeout, in which
+    // case the caller (which waits in a loop) works out how much of it is left
+    if ( timeout ) {
+      return;
+    }
+  }
+
+  _sq_queued -= min( _sq_queued, static_cast<unsigned>( ret ) );
+}
+
+optional<IOUring::Completion> IOUring::pop_completion()
+{
+  unsigned& head = cq_field<unsigned>( _params.cq_off.head );
+  if ( head == atomic_ref( cq_field<unsigned>( _params.cq_off.tail ) ).load( memory_order_acquire ) ) {
+    return {};
+  }
+
+  const auto* const cqes = &cq_field<io_uring_cqe>( _params.cq_off.cqes );
+  const auto& cqe = cqes[head & cq_field<unsigned>( _params.cq_off.ring_mask )]; // NOLINT(*-arithmetic)
+  const Completion completion { cqe.user_data, cqe.res };
+  atomic_ref( head ).store( head + 1, memory_order_release );
+  return completion;
+}
+
+void IOUring::register_buffer( char* const buffer, const size_t length )
+{
+  syscall( __NR_io_uring_register, _ring_fd.fd_num(), IORING_UNREGISTER_BUFFERS, nullptr, 0 ); // NOLINT(*-vararg)
+
+  const iovec iov { buffer, length };
+  CheckSystemCall( "io_uring_register",
+                   static_cast<int>( syscall( // NOLINT(*-vararg)
+                     __NR_io_uring_register,
+                     _ring_fd.fd_num(),
+                     IORING_REGISTER_BUFFERS,
+                     &iov,
+                     1 ) ) );
+}
+
+IOBatch::IOBatch( const size_t slot_count, const size_t slot_size )
+  : _ring( IOUring::try_create( 256 ) )
+  , _slot_count( slot_count )
+  , _slot_size( slot_size )
+  , _slots( make_unique<char[]>( slot_count * slot_size ) ) // NOLINT(*-avoid-c-arrays)
+  , _slot_lengths( slot_count )
+{
+  if ( _ring and slot_count ) {
+    try {
+      _ring->register_buffer( _slots.get(), slot_count * slot_size );
+    } catch ( const unix_error& ) {
+      _ring.reset(); // e.g. RLIMIT_MEMLOCK is too low to pin the slots: use the plain system calls
+    }
+  }
+}
+
+char* IOBatch::slot_buffer( const size_t slot )
+{
+  if ( slot >= _slot_count ) {
+    throw out_of_range( "IOBatch: bad slot" );
+  }
+  return _slots.get() + slot * _slot_size; // NOLINT(*-pointer-arithmetic)
+}
+
+string_view IOBatch::slot_data( const size_t slot ) const
+{
+  if ( slot >= _slot_count ) {
+    throw out_of_range( "IOBatch: bad slot" );
+  }
+  return { _slots.get() + slot * _slot_size, _slot_lengths.at( slot ) }; // NOLINT(*-pointer-arithmetic)
+}
+
+size_t IOBatch::queue( Operation&& op )
+{
+  _ops.push_back( move( op ) );
+  return _ops.size() - 1;
+}
+
+size_t IOBatch::queue_read( FileDescriptor& fd, string& buffer )
+{
+  if ( buffer.empty() ) {
+    buffer.resize( FileDescriptor::kReadBufferSize );
+  }
+  return queue( { fd.duplicate(), true, buffer, buffer, {} } );
+}
+
+size_t IOBatch::queue_write( FileDescriptor& fd, const string_view buffer )
+{
+  return queue( { fd.duplicate(), false, buffer, {}, {} } );
+}
+
+size_t IOBatch::queue_writev( FileDescriptor& fd, const span<const iovec> buffers )
+{
+  return queue( { fd.duplicate(), false, {}, {}, {}, buffers } );
+}
+
+size_t IOBatch::queue_read_slot( FileDescriptor& fd, const size_t slot )
+{
+  return queue( { fd.duplicate(), true, { slot_buffer( slot ), _slot_size }, {}, slot } );
+}
+
+size_t IOBatch::queue_write_slot( FileDescriptor& fd, const size_t slot, const size_t length )
+{
+  return queue( { fd.duplicate(), false, { slot_buffer( slot ), min( length, _slot_size ) }, {}, slot } );
+}
+
+void IOBatch::complete( const size_t op, const int result )
+{
+  auto& operation = _ops.at( op );
+  auto& fd = operation.fd;
+
+  if ( result < 0 ) {
+    if ( ( -result == EAGAIN or -result == EINPROGRESS ) and fd.internal_fd_->non_blocking_ ) {
+      // not ready: like FileDescriptor::read/write, report nothing transferred
+      _results.at( op ) = 0;
+    } else if ( not _error.has_value() ) {
+      _error.emplace( operation.is_read ? "read" : "write", -result );
+    }
+    if ( operation.buffer.has_value() ) {
+      operation.buffer->get().clear();
+    }
+    if ( operation.is_read and operation.slot.has_value() ) {
+      _slot_lengths.at( operation.slot.value() ) = 0;
+    }
+    return;
+  }
+
+  const auto transferred = static_cast<size_t>( result );
+  _results.at( op ) = transferred;
+
+  if ( operation.is_read ) {
+    fd.register_read();
+    if ( transferred == 0 ) {
+      fd.set_eof();
+    }
+    if ( operation.buffer.has_value() ) {
+      operation.buffer->get().resize( transferred );
+    }
+    if ( operation.slot.has_value() ) {
+      _slot_lengths.at( operation.slot.value() ) = transferred;
+    }
+  } else {
+    fd.register_write();
+  }
+}
+
+void IOBatch::submit()
+{
+  _results.assign( _ops.size(), 0 );
+  _error.reset();
+
+  if ( not _ring ) {
+    // fallback: one system call per operation
+    for ( size_t i = 0; i < _ops.size(); ++i ) {
+      const auto& op = _ops.at( i );
+      auto* const data = const_cast<char*>( op.data.data() ); // NOLINT(*-const-cast)
+      ssize_t ret = 0;
+      if ( op.is_read ) {
+        ret = ::read( op.fd.fd_num(), data, op.data.size() );
+      } else if ( not op.iovecs.empty() ) {
+        ret = ::writev( op.fd.fd_num(), op.iovecs.data(), static_cast<int>( op.iovecs.size() ) );
+      } else {
+        ret = ::write( op.fd.fd_num(), data, op.data.size() );
+      }
+      complete( i, ret < 0 ? -errno : static_cast<int>( ret ) );
+    }
+  } else {
+    for ( size_t i = 0; i < _ops.size(); ++i ) {
+      const auto& op = _ops.at( i );
+      auto* const data = const_cast<char*>( op.data.data() ); // NOLINT(*-const-cast)
+      if ( not op.iovecs.empty() ) {
+        _ring->queue_writev( op.fd.fd_num(), op.iovecs.data(), op.iovecs.size(), i );
+      } else if ( op.slot.has_value() ) {
+        op.is_read ? _ring->queue_read_fixed( op.fd.fd_num(), data, op.data.size(), i )
+                   : _ring->queue_write_fixed( op.fd.fd_num(), data, op.data.size(), i );
+      } else {
+        op.is_read ? _ring->queue_read( op.fd.fd_num(), data, op.data.size(), i )
+                   : _ring->queue_write( op.fd.fd_num(), data, op.data.size(), i );
+      }
+    }
+
+    // one io_uring_enter submits everything and waits for the completions (more only if the rings overflow)
+    size_t remaining = _ops.size();
+    while ( remaining ) {
+      const auto cqe = _ring->pop_completion();
+      if ( not cqe.has_value() ) {
+        _ring->submit( static_cast<unsigned>( min<size_t>( remaining, _ring->submission_entries() ) ) );
+        continue;
+      }
+      complete( cqe->user_data, cqe->result );
+      --remaining;
+    }
+  }
+
+  _ops.clear();
+
+  if ( _error.has_value() ) {
+    throw _error.value();
+  }
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+#include "exception.hh"
+#include "file_descriptor.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <linux/io_uring.h>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+//! \brief A submission/completion queue pair shared with the kernel ([io_uring(7)](\ref man7::io_uring)).
+//! \details Operations are queued in the submission ring without a system call; submit() hands all of them to
+//! the kernel (and optionally waits for completions) with one [io_uring_enter(2)](\ref man2::io_uring_enter).
+//! Completions are then read from the completion ring, again without a system call.
+class IOUring
+{
+  io_uring_params _params {};
+  FileDescriptor _ring_fd;
+
+  // the rings, mapped from the kernel
+  std::shared_ptr<void> _sq_ring {};
+  std::shared_ptr<void> _cq_ring {};
+  std::shared_ptr<void> _sqe_array {};
+
+  unsigned _sq_tail {};   //!< Our copy of the submission tail, published on submit()
+  unsigned _sq_queued {}; //!< Entries queued since the last submit()
+
+  template<typename T>
+  T& sq_field( uint32_t offset ) const;
+  template<typename T>
+  T& cq_field( uint32_t offset ) const;
+
+  io_uring_sqe& next_sqe();
+  io_uring_sqe& prepare( uint8_t opcode, int fd, const char* buffer, size_t length, uint64_t user_data );
+
+public:
+  //! \param[in] entries is the submission queue size; the completion queue is `completion_entries` long
+  //! \throws unix_error if the kernel doesn't support io_uring (or it is disabled)
+  explicit IOUring( unsigned entries, unsigned completion_entries = 0 );
+
+  //! An IOUring, or nothing if the kernel lacks io_uring or one of the features this class relies on
+  static std::unique_ptr<IOUring> try_create( unsigned entries, unsigned completion_entries = 0 );
+
+  //! Queue operations. Buffers must stay valid until the operation completes.
+  void queue_read( int fd, char* buffer, size_t length, uint64_t user_data );
+  void queue_write( int fd, const char* buffer, size_t length, uint64_t user_data );
+  //! Gather `count` buffers into one write, like [writev(2)](\ref man2::writev) (the iovecs must stay valid too)
+  void queue_writev( int fd, const iovec* iovecs, size_t count, uint64_t user_data );
+
+  //! Reads and writes within the buffer passed to register_buffer()
+  void queue_read_fixed( int fd, char* buffer, size_t length, uint64_t user_data );
+  void queue_write_fixed( int fd, const char* buffer, size_t length, uint64_t user_data );
+
+  //! One-shot [poll(2)](\ref man2::poll): completes (with the ready events as its result) once fd is ready
+  void queue_poll_add( int fd, uint32_t events, uint64_t user_data );
+  //! Cancel the poll queued with user data `target`
+  void queue_poll_remove( uint64_t target, uint64_t user_data );
+
+  //! Submit the queued operations and wait until at least `wait_for` completions are available, or the
+  //! timeout (if any) expires
+  void submit( unsigned wait_for = 0, const timespec* timeout = nullptr );
+
+  struct Completion
+  {
+    uint64_t user_data; //!< As passed to the queue_* call
+    int32_t result;     //!< What the system call would have returned, or -errno
+  };
+
+  //! Take the next completion off the completion ring
+  std::optional<Completion> pop_completion();
+
+  //! Register a buffer for the *_fixed operations (as buffer index 0)
+  void register_buffer( char* buffer, size_t length );
+
+  size_t queued() const { return _sq_queued; }
+  unsigned submission_entries() const { return _params.sq_entries; }
+};
+
+//! \brief Reads and writes on many FileDescriptors, performed together.
+//! \details With io_uring, submit() issues everything queued with one system call. Without it (an old kernel,
+//! or io_uring disabled), submit() falls back to one read/write system call per operation. Either way, each
+//! operation behaves like the corresponding FileDescriptor::read or FileDescriptor::write call.
+//!
+//! An IOBatch can also register `slot_count` buffers of `slot_size` bytes with the kernel once, for
+//! queue_read_slot() and queue_write_slot(), which skip the per-operation cost of mapping the caller's memory.
+class IOBatch
+{
+public:
+  explicit IOBatch( size_t slot_count = 0, size_t slot_size = 2048 );
+
+  bool using_io_uring() const { return _ring != nullptr; }
+
+  //! Queue a read into `buffer`: like FileDescriptor::read, the buffer is resized to the number of bytes read
+  //! (an empty buffer is first sized to FileDescriptor::kReadBufferSize). Returns the operation's index.
+  size_t queue_read( FileDescriptor& fd, std::string& buffer );
+
+  //! Queue a write of `buffer`, which must stay valid until submit() returns. Returns the operation's index.
+  size_t queue_write( FileDescriptor& fd, std::string_view buffer );
+
+  //! Queue a write of `buffers`, gathered into one write (e.g. a FrameSerializer's output, sent without joining
+  //! its pieces). The buffers, and the iovecs themselves, must stay valid until submit() returns.
+  size_t queue_writev( FileDescriptor& fd, std::span<const iovec> buffers );
+
+  //! Queue a read into registered slot `slot`
+  size_t queue_read_slot( FileDescriptor& fd, size_t slot );
+
+  //! Queue a write of the first `length` bytes of registered slot `slot`
+  size_t queue_write_slot( FileDescriptor& fd, size_t slot, size_t length );
+
+  //! Perform the queued operations and wait for all of them
+  //! \throws unix_error for the first operation that failed (other than a non-blocking fd not being ready)
+  void submit();
+
+  //! Bytes transferred by operation `op` of the last submit() (0 if a non-blocking fd wasn't ready)
+  size_t result( size_t op ) const { return _results.at( op ); }
+
+  //! Registered slot `slot`: the bytes written by the last read into it, or room to compose a write
+  std::string_view slot_data( size_t slot ) const;
+  char* slot_buffer( size_t slot );
+  size_t slot_count() const { return _slot_count; }
+  size_t slot_size() const { return _slot_size; }
+
+  size_t queued() const { return _ops.size(); }
+
+private:
+  struct Operation
+  {
+    FileDescriptor fd;
+    bool is_read;
+    std::string_view data; //!< Bytes to write, or room to read into
+    std::optional<std::reference_wrapper<std::string>> buffer {}; //!< The string read into by queue_read
+    std::optional<size_t> slot {};                                 //!< The slot read into by queue_read_slot
+    std::span<const iovec> iovecs {};                              //!< The buffers written by queue_writev
+  };
+
+  std::unique_ptr<IOUring> _ring;
+  std::vector<Operation> _ops {};
+  std::vector<size_t> _results {};
+
+  size_t _slot_count;
+  size_t _slot_size;
+  std::unique_ptr<char[]> _slots; // NOLINT(*-avoid-c-arrays)
+  std::vector<size_t> _slot_lengths;
+
+  std::optional<unix_error> _error {}; //!< The first failure in the current submit()
+
+  size_t queue( Operation&& op );
+
+  //! Apply a result (bytes transferred, or -errno) to the operation and its FileDescriptor
+  void complete( size_t op, int result );
+
+public:
+  IOBatch( const IOBatch& other ) = delete;
+  IOBatch& operator=( const IOBatch& other ) = delete;
+  IOBatch( IOBatch&& other ) = default;
+  IOBatch& operator=( IOBatch&& other ) = default;
+  ~IOBatch() = default;
+};
@@ -3,15 +3,11 @@
 #include "ipv4_header.hh"
 #include "parser.hh"
 
-#include <memory>
-#include <string>
-#include <vector>
-
 //! \brief [IPv4](\ref rfc::rfc791) Internet datagram
 struct IPv4Datagram
 {
   IPv4Header header {};
-  std::vector<std::string> payload {};
+  BufferList payload {};
 
   void parse( Parser& parser )
   {
@@ -22,9 +18,7 @@ struct IPv4Datagram
   void serialize( Serializer& serializer ) const
   {
     header.serialize( serializer );
-    for ( const auto& x : payload ) {
-      serializer.buffer( x );
-    }
+    serializer.buffer( payload );
   }
 };
 
@@ -1,6 +1,7 @@
 #include "ipv4_header.hh"
 #include "checksum.hh"
 
+#include <algorithm>
 #include <arpa/inet.h>
 #include <array>
 #include <cstddef>
@@ -11,6 +12,19 @@ using namespace std;
 // Parse from string.
 void IPv4Header::parse( Parser& parser )
 {
+  // Sum the header's raw bytes (options included) before they are consumed: the checksum is verified against
+  // them, instead of against the header serialized again from the parsed fields
+  InternetChecksum check;
+  const auto raw = parser.buffers();
+  if ( not raw.empty() ) {
+    uint64_t remaining = max( static_cast<uint64_t>( raw.front().at( 0 ) & 0x0f ) * 4, LENGTH );
+    for ( auto it = raw.begin(); it != raw.end() and remaining > 0; ++it ) {
+      const auto piece = it->str().substr( 0, remaining );
+      check.add( piece );
+      remaining -= piece.size();
+    }
+  }
+
   uint8_t first_byte {};
   parser.integer( first_byte );
   ver = first_byte >> 4;    // version
@@ -43,18 +57,17 @@ void IPv4Header::parse( Parser& parser )
     return;
   }
 
-  parser.remove_prefix( static_cast<uint64_t>( hlen ) * 4 - IPv4Header::LENGTH );
+  parser.string( { reinterpret_cast<char*>( options.data() ), options_length() } ); // NOLINT(*-reinterpret-cast)
 
-  // Verify checksum
-  const uint16_t given_cksum = cksum;
-  compute_checksum();
-  if ( cksum != given_cksum ) {
+  // Verify checksum (over a header that holds the right checksum, it comes out as zero)
+  if ( check.value() != 0 ) {
     parser.set_error();
   }
 }
 
 // Serialize the IPv4Header (does not recompute the checksum)
-void IPv4Header::serialize( Serializer& serializer ) const
+template<class SerializerT>
+void IPv4Header::serialize( SerializerT& serializer ) const
 {
   // consistency checks
   if ( ver != 4 ) {
@@ -77,6 +90,18 @@ void IPv4Header::serialize( Serializer& serializer ) const
 
   serializer.integer( src );
   serializer.integer( dst );
+
+  for ( size_t i = 0; i < options_length(); ++i ) {
+    serializer.integer( options[i] );
+  }
+}
+
+template void IPv4Header::serialize( Serializer& serializer ) const;
+template void IPv4Header::serialize( SpanSerializer& serializer ) const;
+
+size_t IPv4Header::options_length() const
+{
+  return hlen * 4UL > LENGTH ? min( hlen * 4UL - LENGTH, MAX_OPTIONS ) : 0;
 }
 
 uint16_t IPv4Header::payload_length() const
@@ -104,16 +129,23 @@ uint32_t IPv4Header::pseudo_checksum() const
   return pcksum;
 }
 
+// Sums the header's 16-bit words straight from the fields (the checksum field counts as zero)
 void IPv4Header::compute_checksum()
 {
-  cksum = 0;
-  Serializer s;
-  serialize( s );
+  const uint32_t fo_val = ( df ? 0x4000U : 0 ) | ( mf ? 0x2000U : 0 ) | ( offset & 0x1fffU );
+
+  uint32_t sum = ( static_cast<uint32_t>( ver ) << 12 ) | ( ( hlen & 0xfU ) << 8 ) | tos;
+  sum += len;
+  sum += id;
+  sum += fo_val;
+  sum += ( static_cast<uint32_t>( ttl ) << 8 ) | proto;
+  sum += ( src >> 16 ) + static_cast<uint16_t>( src );
+  sum += ( dst >> 16 ) + static_cast<uint16_t>( dst );
+  for ( size_t i = 0; i + 1 < options_length(); i += 2 ) {
+    sum += ( static_cast<uint32_t>( options[i] ) << 8 ) | options[i + 1];
+  }
 
-  // calculate checksum -- taken over header only
-  InternetChecksum check;
-  check.add( s.output() );
-  cksum = check.value();
+  cksum = InternetChecksum { sum }.value();
 }
 
 std::string IPv4Header::to_string() const
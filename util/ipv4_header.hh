@@ -2,18 +2,20 @@
 
 #include "parser.hh"
 
+#include <array>
 #include <cstddef>
 #include <cstdint>
 #include <string>
 
-// IPv4 Internet datagram header (note: IP options are not supported)
+// IPv4 Internet datagram header (options are kept as raw bytes, not interpreted)
 struct IPv4Header
 {
   static constexpr size_t LENGTH = 20;        // IPv4 header length, not including options
+  static constexpr size_t MAX_OPTIONS = 40;   // Most bytes of options (and padding) a header can have
   static constexpr uint8_t DEFAULT_TTL = 128; // A reasonable default TTL value
   static constexpr uint8_t PROTO_TCP = 6;     // Protocol number for TCP
 
-  static constexpr uint64_t serialized_length() { return LENGTH; }
+  uint64_t serialized_length() const { return LENGTH + options_length(); }
 
   /*
    *   0                   1                   2                   3
@@ -48,6 +50,11 @@ struct IPv4Header
   uint32_t src = 0;          // src address
   uint32_t dst = 0;          // dst address
 
+  std::array<uint8_t, MAX_OPTIONS> options {}; // options and padding: the first options_length() bytes
+
+  // Length of the options (and padding), from the header length
+  size_t options_length() const;
+
   // Length of the payload
   uint16_t payload_length() const;
 
@@ -61,5 +68,6 @@ struct IPv4Header
   std::string to_string() const;
 
   void parse( Parser& parser );
-  void serialize( Serializer& serializer ) const;
+  template<class SerializerT>
+  void serialize( SerializerT& serializer ) const;
 };
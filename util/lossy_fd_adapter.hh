@@ -5,9 +5,12 @@
 #include "tcp_config.hh"
 #include "tcp_segment.hh"
 
+#include <algorithm>
 #include <optional>
 #include <random>
+#include <span>
 #include <utility>
+#include <vector>
 
 //! An adapter class that adds random dropping behavior to an FD adapter
 template<typename AdapterT>
@@ -59,6 +62,31 @@ public:
     return _adapter.write( seg );
   }
 
+  //! \brief Read a batch from the underlying AdapterT instance, potentially dropping each segment read
+  void read_batch( std::vector<TCPMessage>& segments, const size_t budget )
+  {
+    _adapter.read_batch( segments, budget );
+    std::erase_if( segments, [&]( const TCPMessage& ) { return _should_drop( false ); } );
+  }
+
+  //! \brief Write a batch to the underlying AdapterT instance, potentially dropping each segment
+  //! \details The segments between drops are passed through as sub-batches.
+  void write_batch( const std::span<const TCPMessage> segments )
+  {
+    size_t begin = 0;
+    for ( size_t i = 0; i < segments.size(); ++i ) {
+      if ( _should_drop( true ) ) {
+        if ( i > begin ) {
+          _adapter.write_batch( segments.subspan( begin, i - begin ) );
+        }
+        begin = i + 1;
+      }
+    }
+    if ( begin < segments.size() ) {
+      _adapter.write_batch( segments.subspan( begin ) );
+    }
+  }
+
   //! \name
   //! Passthrough functions to the underlying AdapterT instance
 
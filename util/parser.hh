@@ -1,28 +1,62 @@
 #pragma once
 
+#include "buffer.hh"
+
 #include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
 #include <concepts>
 #include <cstdint>
 #include <cstring>
-#include <deque>
 #include <numeric>
 #include <span>
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <sys/uio.h>
 #include <vector>
 
+// Convert an integer between network (big-endian) and host byte order
+template<std::unsigned_integral T>
+constexpr T swap_network_order( const T value )
+{
+  if constexpr ( std::endian::native == std::endian::big or sizeof( T ) == 1 ) {
+    return value;
+  } else if constexpr ( sizeof( T ) == 2 ) {
+    return __builtin_bswap16( value );
+  } else if constexpr ( sizeof( T ) == 4 ) {
+    return __builtin_bswap32( value );
+  } else {
+    static_assert( sizeof( T ) == 8 );
+    return __builtin_bswap64( value );
+  }
+}
+
+// Parses a packet's buffers. Borrowed buffers (strings or string_views) must outlive the Parser, and the rest of
+// the input is copied out of them by all_remaining(); a BufferList's storage is shared instead.
 class Parser
 {
-  class BufferList
+  class Input
   {
     uint64_t size_ {};
-    std::deque<std::string> buffer_ {};
-    uint64_t skip_ {};
+    BufferList::Buffers buffer_ {};
+    size_t front_ {}; // index of the first buffer not yet parsed
 
   public:
-    explicit BufferList( const std::vector<std::string>& buffers )
+    explicit Input( const std::vector<std::string>& buffers )
     {
+      buffer_.reserve( buffers.size() );
+      for ( const auto& x : buffers ) {
+        append( { nullptr, x } );
+      }
+    }
+
+    explicit Input( std::string_view buffer ) { append( { nullptr, buffer } ); }
+
+    explicit Input( const BufferList& buffers )
+    {
+      buffer_.reserve( buffers.buffers().size() );
       for ( const auto& x : buffers ) {
         append( x );
       }
@@ -34,81 +68,104 @@ class Parser
 
     std::string_view peek() const
     {
-      if ( buffer_.empty() ) {
-        throw std::runtime_error( "peek on empty BufferList" );
+      if ( empty() ) {
+        throw std::runtime_error( "peek on empty Parser input" );
       }
-      return std::string_view { buffer_.front() }.substr( skip_ );
+      return buffer_[front_];
     }
 
     void remove_prefix( uint64_t len )
     {
-      while ( len and not buffer_.empty() ) {
-        const uint64_t to_pop_now = std::min( len, peek().size() );
-        skip_ += to_pop_now;
+      while ( len and not empty() ) {
+        auto& front = buffer_[front_];
+        const uint64_t to_pop_now = std::min( len, static_cast<uint64_t>( front.size() ) );
+        front.remove_prefix( to_pop_now );
         len -= to_pop_now;
         size_ -= to_pop_now;
-        if ( skip_ == buffer_.front().size() ) {
-          buffer_.pop_front();
-          skip_ = 0;
+        if ( front.empty() ) {
+          ++front_;
         }
       }
     }
 
+    // hand out the rest of the input as slices of the caller's buffers
+    void dump_all( std::vector<std::string_view>& out )
+    {
+      out.assign( buffer_.begin() + static_cast<ptrdiff_t>( front_ ), buffer_.end() );
+      clear();
+    }
+
+    // copy the rest of the input out, one string per remaining buffer
     void dump_all( std::vector<std::string>& out )
     {
       out.clear();
-      if ( empty() ) {
-        return;
-      }
-      std::string first_str = std::move( buffer_.front() );
-      if ( skip_ ) {
-        first_str = first_str.substr( skip_ );
-      }
-      out.emplace_back( std::move( first_str ) );
-      buffer_.pop_front();
-      for ( auto&& x : buffer_ ) {
-        out.emplace_back( std::move( x ) );
+      for ( size_t i = front_; i < buffer_.size(); ++i ) {
+        out.emplace_back( buffer_[i].str() );
       }
+      clear();
     }
 
     void dump_all( std::string& out )
     {
-      std::vector<std::string> concat;
-      dump_all( concat );
-      if ( concat.size() == 1 ) {
-        out = std::move( concat.front() );
-        return;
+      out.clear();
+      out.reserve( size_ );
+      for ( size_t i = front_; i < buffer_.size(); ++i ) {
+        out.append( buffer_[i] );
       }
+      clear();
+    }
 
-      out.clear();
-      for ( const auto& s : concat ) {
-        out.append( s );
+    // share the rest of the input (borrowed buffers are copied)
+    void dump_all( BufferList& out )
+    {
+      out = {};
+      for ( size_t i = front_; i < buffer_.size(); ++i ) {
+        out.append( owned( std::move( buffer_[i] ) ) );
       }
+      clear();
     }
 
-    std::vector<std::string_view> buffer() const
+    // the same, as one Buffer (copied if the rest of the input is in more than one buffer)
+    void dump_all( Buffer& out )
     {
-      if ( empty() ) {
-        return {};
+      if ( buffer_.size() - front_ == 1 ) {
+        out = owned( std::move( buffer_[front_] ) );
+      } else {
+        std::string joined;
+        dump_all( joined );
+        out = std::move( joined );
       }
-      std::vector<std::string_view> ret;
-      ret.reserve( buffer_.size() );
-      auto tmp_skip = skip_;
-      for ( const auto& x : buffer_ ) {
-        ret.push_back( std::string_view { x }.substr( tmp_skip ) );
-        tmp_skip = 0;
+      clear();
+    }
+
+    // the rest of the input, in place
+    std::span<const Buffer> buffers() const { return std::span { buffer_ }.subspan( front_ ); }
+
+    void append( Buffer buf )
+    {
+      if ( not buf.empty() ) {
+        size_ += buf.size();
+        buffer_.push_back( std::move( buf ) );
       }
-      return ret;
     }
 
-    void append( std::string str )
+    void clear()
     {
-      size_ += str.size();
-      buffer_.push_back( std::move( str ) );
+      buffer_.clear();
+      front_ = size_ = 0;
+    }
+
+  private:
+    static Buffer owned( Buffer&& buf )
+    {
+      if ( buf.owns_storage() ) {
+        return std::move( buf );
+      }
+      return std::string { buf.str() };
     }
   };
 
-  BufferList input_;
+  Input input_;
   bool error_ {};
 
   void check_size( const size_t size )
@@ -120,8 +177,10 @@ class Parser
 
 public:
   explicit Parser( const std::vector<std::string>& input ) : input_( input ) {}
+  explicit Parser( std::string_view input ) : input_( input ) {}
+  explicit Parser( const BufferList& input ) : input_( input ) {}
 
-  const BufferList& input() const { return input_; }
+  const Input& input() const { return input_; }
 
   bool has_error() const { return error_; }
   void set_error() { error_ = true; }
@@ -135,17 +194,21 @@ public:
       return;
     }
 
-    if constexpr ( sizeof( T ) == 1 ) {
-      out = static_cast<uint8_t>( input_.peek().front() );
-      input_.remove_prefix( 1 );
+    const std::string_view next = input_.peek();
+    if ( next.size() >= sizeof( T ) ) {
+      // contiguous: one (possibly unaligned) load
+      std::memcpy( &out, next.data(), sizeof( T ) );
+      out = swap_network_order( out );
+      input_.remove_prefix( sizeof( T ) );
       return;
-    } else {
-      out = static_cast<T>( 0 );
-      for ( size_t i = 0; i < sizeof( T ); i++ ) {
-        out <<= 8;
-        out |= static_cast<uint8_t>( input_.peek().front() );
-        input_.remove_prefix( 1 );
-      }
+    }
+
+    // the integer straddles two buffers
+    out = static_cast<T>( 0 );
+    for ( size_t i = 0; i < sizeof( T ); i++ ) {
+      out <<= 8;
+      out |= static_cast<uint8_t>( input_.peek().front() );
+      input_.remove_prefix( 1 );
     }
   }
 
@@ -164,37 +227,57 @@ public:
     }
   }
 
+  // The rest of the input: as views of the Parser's input (valid as long as those buffers are), copied, or as
+  // Buffers that share its storage
+  void all_remaining( std::vector<std::string_view>& out ) { input_.dump_all( out ); }
   void all_remaining( std::vector<std::string>& out ) { input_.dump_all( out ); }
   void all_remaining( std::string& out ) { input_.dump_all( out ); }
-  std::vector<std::string_view> buffer() const { return input_.buffer(); }
+  void all_remaining( BufferList& out ) { input_.dump_all( out ); }
+  void all_remaining( Buffer& out ) { input_.dump_all( out ); }
+  // The rest of the input, without consuming it (e.g. to checksum the raw bytes)
+  std::span<const Buffer> buffers() const { return input_.buffers(); }
 };
 
+// Serializes into a BufferList. Integers are written into a small buffer from the PacketBufferPool, which the
+// output then shares.
 class Serializer
 {
-  std::vector<std::string> output_ {};
-  std::string buffer_ {};
+  static constexpr size_t STAGING_SIZE = PacketBufferPool::SLOT_SIZES[PacketBufferPool::SMALL]
+                                         - PacketBufferPool::BUFFER_OVERHEAD;
 
-public:
-  Serializer() = default;
-  explicit Serializer( std::string&& buffer ) : buffer_( std::move( buffer ) ) {}
+  BufferList output_ {};
+  std::shared_ptr<char[]> staging_ {}; // NOLINT(*-avoid-c-arrays)
+  size_t flushed_ {};                  // bytes of staging_ already in output_
+  size_t used_ {};                     // bytes of staging_ written
 
+public:
   template<std::unsigned_integral T>
   void integer( const T val )
   {
-    constexpr uint64_t len = sizeof( T );
-
-    for ( uint64_t i = 0; i < len; ++i ) {
-      const uint8_t byte_val = val >> ( ( len - i - 1 ) * 8 );
-      buffer_.push_back( byte_val );
+    if ( not staging_ or used_ + sizeof( T ) > STAGING_SIZE ) {
+      flush();
+      staging_ = PacketBufferPool::global().make_buffer( STAGING_SIZE );
+      flushed_ = used_ = 0;
     }
+    const T big_endian = swap_network_order( val );
+    std::memcpy( staging_.get() + used_, &big_endian, sizeof( T ) );
+    used_ += sizeof( T );
   }
 
-  void buffer( std::string buf )
+  // Append a buffer, sharing its storage
+  void buffer( Buffer buf )
   {
     flush();
-    if ( not buf.empty() ) {
-      output_.push_back( std::move( buf ) );
-    }
+    output_.append( std::move( buf ) );
+  }
+
+  void buffer( std::string&& buf ) { buffer( Buffer { std::move( buf ) } ); }
+  void buffer( const std::string& buf ) { buffer( Buffer { buf } ); }
+
+  void buffer( const BufferList& bufs )
+  {
+    flush();
+    output_.append( bufs );
   }
 
   void buffer( const std::vector<std::string>& bufs )
@@ -206,22 +289,126 @@ public:
 
   void flush()
   {
-    if ( not buffer_.empty() ) {
-      output_.emplace_back( std::move( buffer_ ) );
-      buffer_.clear();
+    if ( used_ > flushed_ ) {
+      output_.append( Buffer { staging_, { staging_.get() + flushed_, used_ - flushed_ } } );
+      flushed_ = used_;
     }
   }
 
-  const std::vector<std::string>& output()
+  const BufferList& output()
   {
     flush();
     return output_;
   }
 };
 
+// Serializes into space the caller has already sized, e.g. for a header of known length
+class SpanSerializer
+{
+  std::span<char> output_;
+  size_t size_ {};
+
+  std::span<char> next( const size_t len )
+  {
+    if ( len > output_.size() - size_ ) {
+      throw std::runtime_error( "SpanSerializer: output is full" );
+    }
+    const auto ret = output_.subspan( size_, len );
+    size_ += len;
+    return ret;
+  }
+
+public:
+  explicit SpanSerializer( std::span<char> output ) : output_( output ) {}
+
+  template<std::unsigned_integral T>
+  void integer( const T val )
+  {
+    const T big_endian = swap_network_order( val );
+    std::memcpy( next( sizeof( T ) ).data(), &big_endian, sizeof( T ) );
+  }
+
+  void buffer( std::string_view buf ) { std::copy( buf.begin(), buf.end(), next( buf.size() ).begin() ); }
+
+  size_t size() const { return size_; }
+};
+
+// Serializes a frame from the inside out, without copying its payload. Each header is written in front of the
+// last (e.g. TCP, then IPv4, then Ethernet), into headroom in one inline buffer; payload buffers are referenced
+// and must outlive the FrameSerializer. The output is a short iovec array for writev(2): the headers, then the
+// payload.
+class FrameSerializer
+{
+public:
+  static constexpr size_t HEADROOM = 14 + 60 + 60; // Ethernet, IPv4 and TCP headers, with the most options
+  static constexpr size_t MAX_IOVECS = 16;         // the headers, and up to 15 payload buffers
+
+private:
+  std::array<char, HEADROOM> headers_ {};
+  size_t headers_start_ { HEADROOM };
+  mutable std::array<iovec, MAX_IOVECS> iovecs_ {}; // iovecs_[0] (the headers) is filled in by iovecs()
+  size_t iovec_count_ { 1 };
+  size_t size_ {};
+
+public:
+  // Write a `length`-byte header in front of everything serialized so far. `write` is handed a SpanSerializer
+  // over exactly that space, e.g. `[&]( SpanSerializer& s ) { header.serialize( s ); }`.
+  template<std::invocable<SpanSerializer&> WriteT>
+  void prepend( const size_t length, WriteT&& write )
+  {
+    if ( length > headers_start_ ) {
+      throw std::runtime_error( "FrameSerializer: out of headroom" );
+    }
+    SpanSerializer serializer { std::span<char> { headers_ }.subspan( headers_start_ - length, length ) };
+    std::forward<WriteT>( write )( serializer );
+    if ( serializer.size() != length ) {
+      throw std::runtime_error( "FrameSerializer: header is not " + std::to_string( length ) + " bytes long" );
+    }
+
+    headers_start_ -= length;
+    size_ += length;
+  }
+
+  // Append a payload buffer (by reference)
+  void payload( std::string_view buf )
+  {
+    if ( buf.empty() ) {
+      return;
+    }
+    if ( iovec_count_ == MAX_IOVECS ) {
+      throw std::runtime_error( "FrameSerializer: too many payload buffers" );
+    }
+    iovecs_.at( iovec_count_++ ) = { const_cast<char*>( buf.data() ), buf.size() }; // NOLINT(*-const-cast)
+    size_ += buf.size();
+  }
+
+  void payload( const BufferList& bufs )
+  {
+    for ( const auto& b : bufs ) {
+      payload( b.str() );
+    }
+  }
+
+  void payload( const std::vector<std::string>& bufs )
+  {
+    for ( const auto& b : bufs ) {
+      payload( b );
+    }
+  }
+
+  size_t size() const { return size_; }
+
+  // The headers, then the payload buffers
+  std::span<const iovec> iovecs() const
+  {
+    iovecs_[0] = { const_cast<char*>( headers_.data() ) + headers_start_, HEADROOM - headers_start_ }; // NOLINT
+    return { iovecs_.data(), iovec_count_ };
+  }
+};
+
 // Helper to serialize any object (without constructing a Serializer of the caller's own)
 template<class T>
-std::vector<std::string> serialize( const T& obj )
+BufferList serialize( const T& obj )
 {
   Serializer s;
   obj.serialize( s );
@@ -236,3 +423,11 @@ bool parse( T& obj, const std::vector<std::string>& buffers, Targs&&... Fargs )
   obj.parse( p, std::forward<Targs>( Fargs )... );
   return not p.has_error();
 }
+
+template<class T, typename... Targs>
+bool parse( T& obj, const BufferList& buffers, Targs&&... Fargs )
+{
+  Parser p { buffers };
+  obj.parse( p, std::forward<Targs>( Fargs )... );
+  return not p.has_error();
+}
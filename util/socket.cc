@@ -3,6 +3,7 @@
 #include "exception.hh"
 
 #include <cstddef>
+#include <cstring>
 #include <linux/if_packet.h>
 #include <net/if.h>
 #include <stdexcept>
@@ -138,6 +139,135 @@ void DatagramSocket::recv( Address& source_address, string& payload )
   payload.resize( recv_len );
 }
 
+DatagramBatch::DatagramBatch( const size_t capacity, const size_t max_datagram_size )
+  : _max_datagram_size( max_datagram_size )
+  , _arena( make_unique_for_overwrite<char[]>( capacity * max_datagram_size ) ) // NOLINT(*-avoid-c-arrays)
+  , _headers( capacity )
+  , _iovecs( capacity )
+  , _addresses( capacity )
+{
+  if ( capacity == 0 ) {
+    throw runtime_error( "DatagramBatch: capacity must be at least 1" );
+  }
+}
+
+void DatagramBatch::reset_headers()
+{
+  for ( size_t i = 0; i < capacity(); ++i ) {
+    _iovecs[i] = { slot( i ), _max_datagram_size };
+    auto& header = _headers[i].msg_hdr;
+    header = {};
+    header.msg_name = static_cast<sockaddr*>( _addresses[i] );
+    header.msg_namelen = sizeof( _addresses[i].storage );
+    header.msg_iov = &_iovecs[i];
+    header.msg_iovlen = 1;
+  }
+}
+
+void DatagramBatch::push_back( const string_view payload )
+{
+  if ( _size >= capacity() ) {
+    throw runtime_error( "DatagramBatch: batch is full" );
+  }
+  if ( payload.size() > _max_datagram_size ) {
+    throw runtime_error( "DatagramBatch: datagram of " + to_string( payload.size() ) + " bytes exceeds "
+                         + to_string( _max_datagram_size ) );
+  }
+
+  payload.copy( slot( _size ), payload.size() );
+  _iovecs[_size] = { slot( _size ), payload.size() };
+  auto& header = _headers[_size].msg_hdr;
+  header = {};
+  header.msg_iov = &_iovecs[_size];
+  header.msg_iovlen = 1;
+  ++_size;
+}
+
+void DatagramBatch::push_back( const Address& destination, const string_view payload )
+{
+  push_back( payload );
+  auto& raw = _addresses[_size - 1];
+  memcpy( &raw.storage, destination.raw(), destination.size() );
+  _headers[_size - 1].msg_hdr.msg_name = static_cast<sockaddr*>( raw );
+  _headers[_size - 1].msg_hdr.msg_namelen = destination.size();
+}
+
+string_view DatagramBatch::payload( const size_t index ) const
+{
+  if ( index >= _size ) {
+    throw out_of_range( "DatagramBatch: no datagram " + to_string( index ) );
+  }
+  return { slot( index ), _iovecs[index].iov_len };
+}
+
+Address DatagramBatch::source_address( const size_t index ) const
+{
+  if ( index >= _size ) {
+    throw out_of_range( "DatagramBatch: no datagram " + to_string( index ) );
+  }
+  return { _addresses[index], _headers[index].msg_hdr.msg_namelen };
+}
+
+void DatagramBatch::erase_front( const size_t count )
+{
+  for ( size_t i = count; i < _size; ++i ) {
+    const size_t to = i - count;
+    memcpy( slot( to ), slot( i ), _iovecs[i].iov_len );
+    _iovecs[to] = { slot( to ), _iovecs[i].iov_len };
+    _addresses[to] = _addresses[i];
+    auto& header = _headers[to].msg_hdr;
+    header = _headers[i].msg_hdr;
+    header.msg_iov = &_iovecs[to];
+    if ( header.msg_name ) {
+      header.msg_name = static_cast<sockaddr*>( _addresses[to] );
+    }
+  }
+  _size -= min( count, _size );
+}
+
+size_t DatagramSocket::recv_batch( DatagramBatch& batch )
+{
+  batch.reset_headers();
+  batch._size = 0;
+
+  const int received = CheckSystemCall( "recvmmsg",
+                                        ::recvmmsg( fd_num(),
+                                                    batch._headers.data(),
+                                                    static_cast<unsigned>( batch.capacity() ),
+                                                    MSG_WAITFORONE,
+                                                    nullptr ) );
+  if ( received == 0 ) {
+    return 0; // a non-blocking socket had nothing ready
+  }
+
+  register_read();
+  batch._size = received;
+  for ( size_t i = 0; i < batch._size; ++i ) {
+    if ( batch._headers[i].msg_hdr.msg_flags & MSG_TRUNC ) { // NOLINT(*-signed-bitwise)
+      throw runtime_error( "recvmmsg (oversized datagram)" );
+    }
+    batch._iovecs[i].iov_len = batch._headers[i].msg_len;
+  }
+
+  return batch._size;
+}
+
+size_t DatagramSocket::send_batch( DatagramBatch& batch )
+{
+  size_t total_sent = 0;
+  while ( not batch.empty() ) {
+    const int sent = CheckSystemCall(
+      "sendmmsg", ::sendmmsg( fd_num(), batch._headers.data(), static_cast<unsigned>( batch.size() ), 0 ) );
+    if ( sent == 0 ) {
+      break; // a non-blocking socket is full
+    }
+    register_write();
+    batch.erase_front( sent );
+    total_sent += sent;
+  }
+  return total_sent;
+}
+
 void DatagramSocket::sendto( const Address& destination, const string_view payload )
 {
   CheckSystemCall(
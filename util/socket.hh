@@ -5,7 +5,11 @@
 
 #include <cstdint>
 #include <functional>
+#include <memory>
+#include <optional>
+#include <string_view>
 #include <sys/socket.h>
+#include <vector>
 
 //! \brief Base class for network sockets (TCP, UDP, etc.)
 //! \details Socket is generally used via a subclass. See TCPSocket and UDPSocket for usage examples.
@@ -58,11 +62,64 @@ public:
   void throw_if_error() const;
 };
 
+//! \brief Storage for moving many datagrams with one system call (see DatagramSocket::recv_batch and send_batch)
+//! \details A DatagramBatch holds up to `capacity` datagrams of up to `max_datagram_size` bytes each, in one
+//! arena allocated up front and reused by every call.
+class DatagramBatch
+{
+public:
+  explicit DatagramBatch( size_t capacity = 64, size_t max_datagram_size = 2048 );
+
+  size_t capacity() const { return _headers.size(); }
+  size_t max_datagram_size() const { return _max_datagram_size; }
+
+  //! Number of datagrams in the batch (received by the last recv_batch(), or queued for send_batch())
+  size_t size() const { return _size; }
+  bool empty() const { return _size == 0; }
+  void clear() { _size = 0; }
+
+  //! Queue a copy of `payload` to be sent to the socket's connected address, or to `destination`
+  //! \throws std::runtime_error if the batch is full or the payload is bigger than max_datagram_size()
+  void push_back( std::string_view payload );
+  void push_back( const Address& destination, std::string_view payload );
+
+  //! Datagram `index` of the batch
+  std::string_view payload( size_t index ) const;
+  //! Sender of received datagram `index`
+  Address source_address( size_t index ) const;
+
+private:
+  friend class DatagramSocket;
+
+  size_t _max_datagram_size;
+  std::unique_ptr<char[]> _arena; // NOLINT(*-avoid-c-arrays)
+  std::vector<mmsghdr> _headers;
+  std::vector<iovec> _iovecs;
+  std::vector<Address::Raw> _addresses;
+  size_t _size {};
+
+  //! Point every header at its slot of the arena, with room for a whole datagram and address
+  void reset_headers();
+  //! Drop the first `count` datagrams, moving the rest to the front
+  void erase_front( size_t count );
+  char* slot( size_t index ) { return _arena.get() + index * _max_datagram_size; }
+  const char* slot( size_t index ) const { return _arena.get() + index * _max_datagram_size; }
+};
+
 class DatagramSocket : public Socket
 {
   using Socket::Socket;
 
 public:
+  //! Receive up to `batch.capacity()` datagrams with one [recvmmsg(2)](\ref man2::recvmmsg): waits for the first
+  //! (unless the socket is non-blocking), then takes whatever else has already arrived
+  //! \returns the number of datagrams received (also batch.size()); 0 if a non-blocking socket has none ready
+  size_t recv_batch( DatagramBatch& batch );
+
+  //! Send the datagrams in `batch` with [sendmmsg(2)](\ref man2::sendmmsg), removing them from the batch
+  //! \returns the number sent; a non-blocking socket that fills up leaves the rest in the batch
+  size_t send_batch( DatagramBatch& batch );
+
   //! Receive a datagram and the Address of its sender
   void recv( Address& source_address, std::string& payload );
 
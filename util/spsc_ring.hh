@@ -0,0 +1,83 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+//! \brief A bounded, lock-free queue between exactly one producer thread and one consumer thread.
+//! \details The producer only writes the tail and the consumer only writes the head, each on its own cache line,
+//! and each side keeps a cached copy of the other's index so that it reads the shared one only when the ring
+//! looks full (or empty). Slots hold default-constructed values, which are moved out of and into.
+template<class T>
+class SPSCRing
+{
+public:
+  //! A ring of at least `capacity` slots (rounded up to a power of two)
+  explicit SPSCRing( const size_t capacity )
+    : _slots( std::bit_ceil( std::max<size_t>( capacity, 2 ) ) ), _mask( _slots.size() - 1 )
+  {}
+
+  //! \name Producer side
+  //!@{
+
+  //! Move `value` into the ring, unless the ring is full (in which case `value` is left alone)
+  bool try_push( T&& value )
+  {
+    const size_t tail = _producer.tail.load( std::memory_order_relaxed );
+    if ( tail - _producer.cached_head == _slots.size() ) {
+      _producer.cached_head = _consumer.head.load( std::memory_order_acquire );
+      if ( tail - _producer.cached_head == _slots.size() ) {
+        return false;
+      }
+    }
+    _slots[tail & _mask] = std::move( value );
+    _producer.tail.store( tail + 1, std::memory_order_release );
+    return true;
+  }
+  //!@}
+
+  //! \name Consumer side
+  //!@{
+
+  //! Move the oldest value into `value`, unless the ring is empty
+  bool try_pop( T& value )
+  {
+    const size_t head = _consumer.head.load( std::memory_order_relaxed );
+    if ( head == _consumer.cached_tail ) {
+      _consumer.cached_tail = _producer.tail.load( std::memory_order_acquire );
+      if ( head == _consumer.cached_tail ) {
+        return false;
+      }
+    }
+    value = std::move( _slots[head & _mask] );
+    _consumer.head.store( head + 1, std::memory_order_release );
+    return true;
+  }
+  //!@}
+
+  size_t capacity() const { return _slots.size(); }
+
+private:
+  static constexpr size_t CACHE_LINE = 64;
+
+  std::vector<T> _slots;
+  size_t _mask;
+
+  struct alignas( CACHE_LINE ) Producer
+  {
+    std::atomic<size_t> tail {};
+    size_t cached_head {};
+  };
+
+  struct alignas( CACHE_LINE ) Consumer
+  {
+    std::atomic<size_t> head {};
+    size_t cached_tail {};
+  };
+
+  Producer _producer {};
+  Consumer _consumer {};
+};
@@ -78,6 +78,21 @@ private:
   //! Process events while specified condition is true
   void _tcp_loop( const std::function<bool()>& condition );
 
+  //! When TCPPeer was last told how much time has passed
+  EventLoop::Clock::time_point _last_tick {};
+
+  //! Pass the time elapsed since the last tick to TCPPeer
+  void _tick();
+
+  //! Segments read from the adapter in one wakeup (kept to reuse their storage)
+  std::vector<TCPMessage> _inbound_segments {};
+
+  //! Segments sent by TCPPeer, to be written to the adapter when the wakeup is over
+  std::vector<TCPMessage> _outbound_segments {};
+
+  //! Write and clear _outbound_segments
+  void _send_segments();
+
   //! Main loop of TCPPeer thread
   void _tcp_main();
 
@@ -4,9 +4,11 @@
 #include "parser.hh"
 #include "tun.hh"
 
+#include <algorithm>
 #include <cstddef>
 #include <exception>
 #include <iostream>
+#include <limits>
 #include <stdexcept>
 #include <string>
 #include <sys/socket.h>
@@ -15,36 +17,57 @@
 #include <unistd.h>
 #include <utility>
 
-static constexpr size_t TCP_TICK_MS = 10;
+//! How often the TCPPeer thread checks whether the owner has asked it to abort. TCP timers don't depend on this:
+//! the event loop wakes up at the next retransmission (or end-of-linger) deadline.
+static constexpr int TCP_ABORT_CHECK_MS = 100;
 
-inline uint64_t timestamp_ms()
+//! The most datagrams to take from the adapter per wakeup, so outbound data and timers still get their turn
+static constexpr size_t TCP_READ_BUDGET = 64;
+
+//! Tell TCPPeer (and the adapter) how much time has passed. The sub-millisecond remainder carries over to the next
+//! call, so no time is lost to rounding.
+template<TCPDatagramAdapter AdaptT>
+void TCPMinnowSocket<AdaptT>::_tick()
 {
-  static_assert( std::is_same<std::chrono::steady_clock::duration, std::chrono::nanoseconds>::value );
+  const auto elapsed
+    = std::chrono::duration_cast<std::chrono::milliseconds>( EventLoop::Clock::now() - _last_tick );
+  if ( elapsed.count() <= 0 ) {
+    return;
+  }
+  _last_tick += elapsed;
 
-  return std::chrono::steady_clock::now().time_since_epoch().count() / 1000000;
+  if ( _tcp.has_value() and _tcp->active() ) {
+    _tcp->tick( elapsed.count(), [&]( auto x ) { _outbound_segments.push_back( std::move( x ) ); } );
+    _datagram_adapter.tick( elapsed.count() );
+  }
 }
 
 //! \param[in] condition is a function returning true if loop should continue
 template<TCPDatagramAdapter AdaptT>
 void TCPMinnowSocket<AdaptT>::_tcp_loop( const std::function<bool()>& condition )
 {
-  auto base_time = timestamp_ms();
+  if ( not _tcp.has_value() ) {
+    throw std::runtime_error( "_tcp_loop entered before TCPPeer initialized" );
+  }
+
+  _last_tick = EventLoop::Clock::now();
+  _send_segments();
   while ( condition() ) {
-    auto ret = _eventloop.wait_next_event( TCP_TICK_MS );
+    auto ret = _eventloop.wait_next_event( TCP_ABORT_CHECK_MS );
+    _send_segments();
     if ( ret == EventLoop::Result::Exit or _abort ) {
       break;
     }
+  }
+}
 
-    if ( not _tcp.has_value() ) {
-      throw std::runtime_error( "_tcp_loop entered before TCPPeer initialized" );
-    }
-
-    if ( _tcp.value().active() ) {
-      const auto next_time = timestamp_ms();
-      _tcp.value().tick( next_time - base_time, [&]( auto x ) { _datagram_adapter.write( x ); } );
-      _datagram_adapter.tick( next_time - base_time );
-      base_time = next_time;
-    }
+//! Write the segments TCPPeer produced during this iteration of the event loop, all together
+template<TCPDatagramAdapter AdaptT>
+void TCPMinnowSocket<AdaptT>::_send_segments()
+{
+  if ( not _outbound_segments.empty() ) {
+    _datagram_adapter.write_batch( _outbound_segments );
+    _outbound_segments.clear();
   }
 }
 
@@ -68,7 +91,7 @@ void TCPMinnowSocket<AdaptT>::_initialize_TCP( const TCPConfig& config )
 
   // Set up the event loop
 
-  // There are three events to handle:
+  // There are four events to handle:
   //
   // 1) Incoming datagram received (needs to be given to TCPPeer::receive method)
   //
@@ -79,15 +102,21 @@ void TCPMinnowSocket<AdaptT>::_initialize_TCP( const TCPConfig& config )
   // 3) Incoming bytes reassembled by the Reassembler
   //    (needs to be read from the inbound_stream and written
   //    to the local stream socket back to the application)
+  //
+  // 4) A TCPPeer timer (retransmission or end of lingering)
+  //    expires (needs a call to TCPPeer::tick)
 
-  // rule 1: read from filtered packet stream and dump into TCPConnection
+  // rule 1: read from filtered packet stream and dump into TCPConnection (segments it sends in reply, like those
+  // of the other rules, are written together by _send_segments() once the wakeup is over)
   _eventloop.add_rule(
     "receive TCP segment from the network",
     _datagram_adapter.fd(),
     Direction::In,
     [&] {
-      if ( auto seg = _datagram_adapter.read() ) {
-        _tcp->receive( std::move( seg.value() ), [&]( auto x ) { _datagram_adapter.write( x ); } );
+      _tick(); // bring the timers up to date before the segment (e.g. an ack) restarts them
+      _datagram_adapter.read_batch( _inbound_segments, TCP_READ_BUDGET );
+      for ( auto& seg : _inbound_segments ) {
+        _tcp->receive( std::move( seg ), [&]( auto x ) { _outbound_segments.push_back( std::move( x ) ); } );
       }
 
       // debugging output:
@@ -105,10 +134,9 @@ void TCPMinnowSocket<AdaptT>::_initialize_TCP( const TCPConfig& config )
     _thread_data,
     Direction::In,
     [&] {
-      std::string data;
-      data.resize( _tcp->outbound_writer().available_capacity() );
-      _thread_data.read( data );
-      _tcp->outbound_writer().push( move( data ) );
+      _tick();
+      auto& writer = _tcp->outbound_writer();
+      writer.commit( _thread_data.read_into( writer.reserve_spans( writer.available_capacity() ) ) );
 
       if ( _thread_data.eof() ) {
         _tcp->outbound_writer().close();
@@ -121,7 +149,7 @@ void TCPMinnowSocket<AdaptT>::_initialize_TCP( const TCPConfig& config )
                   << " still in flight).\n";
       }
 
-      _tcp->push( [&]( auto x ) { _datagram_adapter.write( x ); } );
+      _tcp->push( [&]( auto x ) { _outbound_segments.push_back( std::move( x ) ); } );
     },
     [&] {
       return ( _tcp->active() ) and ( not _outbound_shutdown )
@@ -171,6 +199,22 @@ void TCPMinnowSocket<AdaptT>::_initialize_TCP( const TCPConfig& config )
       std::cerr << "DEBUG: minnow inbound stream had error.\n";
       _tcp->inbound_reader().set_error();
     } );
+
+  // rule 4: tick TCPPeer when its next timer expires
+  _eventloop.add_timer_rule(
+    "TCPPeer timers",
+    [&]() -> std::optional<EventLoop::Clock::time_point> {
+      const auto ms = _tcp->ms_until_next_tick();
+      if ( not ms.has_value() ) {
+        return {};
+      }
+      // _tick() only passes whole milliseconds, so a deadline sooner than that (an RTO of 0) wouldn't move
+      return _last_tick + std::chrono::milliseconds( std::max<uint64_t>( ms.value(), 1 ) );
+    },
+    [&] { _tick(); } );
+
+  // serve every ready rule (e.g. an inbound segment and outbound bytes) on each wakeup
+  _eventloop.set_batch_limit( std::numeric_limits<size_t>::max() );
 }
 
 //! \brief Call [socketpair](\ref man2::socketpair) and return connected Unix-domain sockets of specified type
@@ -236,7 +280,7 @@ void TCPMinnowSocket<AdaptT>::connect( const TCPConfig& c_tcp, const FdAdapterCo
     throw std::runtime_error( "TCPPeer not successfully initialized" );
   }
 
-  _tcp->push( [&]( auto x ) { _datagram_adapter.write( x ); } );
+  _tcp->push( [&]( auto x ) { _outbound_segments.push_back( std::move( x ) ); } );
 
   if ( _tcp->sender().sequence_numbers_in_flight() != 1 ) {
     throw std::runtime_error( "After TCPConnection::connect(), expected sequence_numbers_in_flight() == 1" );
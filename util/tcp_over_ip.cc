@@ -23,7 +23,8 @@ using namespace std;
 //! `_listen` flag and records the source and destination addresses and port numbers
 //! from the TCP header; it uses this information to filter future reads.
 //! \returns a std::optional<TCPSegment> that is empty if the segment was invalid or unrelated
-optional<TCPMessage> TCPOverIPv4Adapter::unwrap_tcp_in_ip( const InternetDatagram& ip_dgram )
+optional<TCPMessage> TCPOverIPv4Adapter::unwrap_tcp_in_ip( const InternetDatagram& ip_dgram,
+                                                           const bool checksum_verified )
 {
   // is the IPv4 datagram for us?
   // Note: it's valid to bind to address "0" (INADDR_ANY) and reply from actual address contacted
@@ -43,7 +44,7 @@ optional<TCPMessage> TCPOverIPv4Adapter::unwrap_tcp_in_ip( const InternetDatagra
 
   // is the payload a valid TCP segment?
   TCPSegment tcp_seg;
-  if ( not parse( tcp_seg, ip_dgram.payload, ip_dgram.header.pseudo_checksum() ) ) {
+  if ( not parse( tcp_seg, ip_dgram.payload, ip_dgram.header.pseudo_checksum(), not checksum_verified ) ) {
     return {};
   }
 
@@ -74,23 +75,59 @@ optional<TCPMessage> TCPOverIPv4Adapter::unwrap_tcp_in_ip( const InternetDatagra
 
 //! Takes a TCP segment, sets port numbers as necessary, and wraps it in an IPv4 datagram
 //! \param[in] seg is the TCP segment to convert
-InternetDatagram TCPOverIPv4Adapter::wrap_tcp_in_ip( const TCPMessage& msg )
+//! \param[in] checksum_offload leaves the TCP checksum for the device to complete
+InternetDatagram TCPOverIPv4Adapter::wrap_tcp_in_ip( const TCPMessage& msg, const bool checksum_offload )
 {
   TCPSegment seg { .message = msg };
-  // set the port numbers in the TCP segment
-  seg.udinfo.src_port = config().source.port();
-  seg.udinfo.dst_port = config().destination.port();
-
-  // create an Internet Datagram and set its addresses and length
   InternetDatagram ip_dgram;
-  ip_dgram.header.src = config().source.ipv4_numeric();
-  ip_dgram.header.dst = config().destination.ipv4_numeric();
-  ip_dgram.header.len = ip_dgram.header.hlen * 4 + 20 /* tcp header len */ + seg.message.sender.payload.size();
+  ip_dgram.header = prepare_headers( seg, msg.sender.payload.size() );
 
   // set payload, calculating TCP checksum using information from IP header
-  seg.compute_checksum( ip_dgram.header.pseudo_checksum() );
+  if ( checksum_offload ) {
+    seg.set_partial_checksum( ip_dgram.header.pseudo_checksum() );
+  } else {
+    seg.compute_checksum( ip_dgram.header.pseudo_checksum() );
+  }
   ip_dgram.header.compute_checksum();
   ip_dgram.payload = serialize( seg );
 
   return ip_dgram;
 }
+
+void TCPOverIPv4Adapter::serialize_tcp_in_ip( const TCPMessage& msg,
+                                              FrameSerializer& out,
+                                              const bool checksum_offload )
+{
+  // a segment without the payload, which stays where it is
+  TCPSegment seg { .message { .sender { .seqno = msg.sender.seqno,
+                                        .SYN = msg.sender.SYN,
+                                        .FIN = msg.sender.FIN,
+                                        .RST = msg.sender.RST },
+                              .receiver = msg.receiver } };
+  IPv4Header ip_header = prepare_headers( seg, msg.sender.payload.size() );
+
+  if ( checksum_offload ) {
+    seg.set_partial_checksum( ip_header.pseudo_checksum() );
+  } else {
+    seg.compute_checksum( ip_header.pseudo_checksum(), msg.sender.payload, msg.sender.payload_sum );
+  }
+  ip_header.compute_checksum();
+
+  out.payload( msg.sender.payload.str() );
+  out.prepend( TCPSegment::HEADER_LENGTH, [&]( SpanSerializer& s ) { seg.serialize_header( s ); } );
+  out.prepend( ip_header.serialized_length(), [&]( SpanSerializer& s ) { ip_header.serialize( s ); } );
+}
+
+IPv4Header TCPOverIPv4Adapter::prepare_headers( TCPSegment& seg, const size_t payload_length ) const
+{
+  // set the port numbers in the TCP segment
+  seg.udinfo.src_port = config().source.port();
+  seg.udinfo.dst_port = config().destination.port();
+
+  // create an IPv4 header and set its addresses and length
+  IPv4Header header;
+  header.src = config().source.ipv4_numeric();
+  header.dst = config().destination.ipv4_numeric();
+  header.len = header.hlen * 4 + TCPSegment::HEADER_LENGTH + payload_length;
+  return header;
+}
@@ -10,7 +10,17 @@
 class TCPOverIPv4Adapter : public FdAdapterBase
 {
 public:
-  std::optional<TCPMessage> unwrap_tcp_in_ip( const InternetDatagram& ip_dgram );
+  //! `checksum_verified` skips the TCP checksum (see TCPSegment::parse)
+  std::optional<TCPMessage> unwrap_tcp_in_ip( const InternetDatagram& ip_dgram, bool checksum_verified = false );
 
-  InternetDatagram wrap_tcp_in_ip( const TCPMessage& msg );
+  //! `checksum_offload` leaves the TCP checksum partial, to be completed downstream
+  InternetDatagram wrap_tcp_in_ip( const TCPMessage& msg, bool checksum_offload = false );
+
+  //! The same datagram, serialized without copying the payload: the TCP and IPv4 headers go into `out`'s
+  //! headroom, and `msg`'s payload is referenced (so `msg` must outlive `out`)
+  void serialize_tcp_in_ip( const TCPMessage& msg, FrameSerializer& out, bool checksum_offload = false );
+
+private:
+  //! Set the ports in the segment, and return an IPv4 header for it (without its checksum)
+  IPv4Header prepare_headers( TCPSegment& seg, size_t payload_length ) const;
 };
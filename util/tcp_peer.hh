@@ -7,7 +7,9 @@
 #include "tcp_sender.hh"
 #include "tcp_sender_message.hh"
 
+#include <algorithm>
 #include <functional>
+#include <memory_resource>
 #include <optional>
 
 class TCPPeer
@@ -18,7 +20,15 @@ class TCPPeer
   }
 
 public:
-  explicit TCPPeer( const TCPConfig& cfg ) : cfg_( cfg ) {}
+  // The peer's streams, and the sender's and receiver's bookkeeping, are allocated from `resource`. Giving each
+  // connection its own (e.g. a std::pmr::monotonic_buffer_resource) keeps connections from fragmenting the heap
+  // and frees everything in one shot. The resource must outlive the peer, but not the segments it has transmitted:
+  // their payloads are copied out of the resource (into the PacketBufferPool) as they are sent.
+  explicit TCPPeer( const TCPConfig& cfg, std::pmr::memory_resource* resource = std::pmr::get_default_resource() )
+    : cfg_( cfg )
+    , sender_( ByteStream { cfg_.send_capacity, resource }, cfg_.isn, cfg_.rt_timeout )
+    , receiver_( Reassembler { ByteStream { cfg_.recv_capacity, resource } } )
+  {}
 
   Writer& outbound_writer() { return sender_.writer(); }
   Reader& inbound_reader() { return receiver_.reader(); }
@@ -47,6 +57,27 @@ public:
     return ( not any_errors ) and ( sender_active or receiver_active or lingering );
   }
 
+  /* How long until tick() has something to do (a retransmission, or the end of lingering)? Empty if nothing. */
+  std::optional<uint64_t> ms_until_next_tick() const
+  {
+    if ( not active() ) {
+      return {};
+    }
+
+    std::optional<uint64_t> next = sender_.ms_until_timeout();
+
+    const bool streams_active = sender_.sequence_numbers_in_flight() or not sender_.reader().is_finished()
+                                or not receiver_.writer().is_closed();
+    if ( not streams_active ) {
+      // active() only because of lingering, which ends at a fixed time
+      const uint64_t linger_end = time_of_last_receipt_ + 10UL * cfg_.rt_timeout;
+      const uint64_t until_linger_end = linger_end > cumulative_time_ ? linger_end - cumulative_time_ : 0;
+      next = std::min( next.value_or( until_linger_end ), until_linger_end );
+    }
+
+    return next;
+  }
+
   void receive( TCPMessage msg, const TransmitFunction& transmit )
   {
     if ( not active() ) {
@@ -87,8 +118,8 @@ public:
 
 private:
   TCPConfig cfg_;
-  TCPSender sender_ { ByteStream { cfg_.send_capacity }, cfg_.isn, cfg_.rt_timeout };
-  TCPReceiver receiver_ { Reassembler { ByteStream { cfg_.recv_capacity } } };
+  TCPSender sender_;
+  TCPReceiver receiver_;
 
   bool need_send_ {};
 
@@ -1,23 +1,51 @@
 #include "tcp_segment.hh"
+#include "buffer_pool.hh"
 #include "checksum.hh"
 #include "wrapping_integers.hh"
 
 #include <cstddef>
 
-static constexpr uint32_t TCPHeaderMinLen = 5; // 32-bit words
+static constexpr uint32_t TCPHeaderMinLen = TCPSegment::HEADER_LENGTH / 4; // 32-bit words
 
 using namespace std;
 
-void TCPSegment::parse( Parser& parser, uint32_t datagram_layer_pseudo_checksum )
+void TCPSegment::parse( Parser& parser, uint32_t datagram_layer_pseudo_checksum, bool verify_checksum )
 {
   /* verify checksum */
-  InternetChecksum check { datagram_layer_pseudo_checksum };
-  check.add( parser.buffer() );
-  if ( check.value() ) {
-    parser.set_error();
+  if ( verify_checksum and parser.buffers().size() > 1 ) {
+    // The payload would be joined into one Buffer by all_remaining(): join the whole segment, and checksum it in
+    // the same pass, instead of reading it once for each
+    const size_t length = parser.input().size();
+    const auto joined = PacketBufferPool::global().make_buffer( length );
+    InternetChecksum check { datagram_layer_pseudo_checksum };
+    char* next = joined.get();
+    for ( const auto& buffer : parser.buffers() ) {
+      check.add_copy( buffer, next );
+      next += buffer.size();
+    }
+    parser.remove_prefix( length );
+    if ( check.value() ) {
+      parser.set_error();
+      return;
+    }
+
+    Parser joined_parser { BufferList { Buffer { joined, { joined.get(), length } } } };
+    parse( joined_parser, datagram_layer_pseudo_checksum, false );
+    if ( joined_parser.has_error() ) {
+      parser.set_error();
+    }
     return;
   }
 
+  if ( verify_checksum ) {
+    InternetChecksum check { datagram_layer_pseudo_checksum };
+    check.add( parser.buffers() );
+    if ( check.value() ) {
+      parser.set_error();
+      return;
+    }
+  }
+
   uint32_t raw32 {};
   uint16_t raw16 {};
   uint8_t octet {};
@@ -63,29 +91,69 @@ public:
 };
 
 void TCPSegment::serialize( Serializer& serializer ) const
+{
+  serialize_header( serializer );
+  serializer.buffer( message.sender.payload );
+}
+
+namespace {
+uint8_t flags( const TCPMessage& message )
+{
+  const bool reset = message.sender.RST or message.receiver.RST;
+  return ( message.receiver.ackno.has_value() ? 0b0001'0000U : 0 ) | ( reset ? 0b0000'0100U : 0 )
+         | ( message.sender.SYN ? 0b0000'0010U : 0 ) | ( message.sender.FIN ? 0b0000'0001U : 0 );
+}
+} // namespace
+
+template<class SerializerT>
+void TCPSegment::serialize_header( SerializerT& serializer ) const
 {
   serializer.integer( udinfo.src_port );
   serializer.integer( udinfo.dst_port );
   serializer.integer( Wrap32Serializable { message.sender.seqno }.raw_value() );
   serializer.integer( Wrap32Serializable { message.receiver.ackno.value_or( Wrap32 { 0 } ) }.raw_value() );
   serializer.integer( uint8_t { TCPHeaderMinLen << 4 } ); // data offset
-  const bool reset = message.sender.RST or message.receiver.RST;
-  const uint8_t flags = ( message.receiver.ackno.has_value() ? 0b0001'0000U : 0 ) | ( reset ? 0b0000'0100U : 0 )
-                        | ( message.sender.SYN ? 0b0000'0010U : 0 ) | ( message.sender.FIN ? 0b0000'0001U : 0 );
-  serializer.integer( flags );
+  serializer.integer( flags( message ) );
   serializer.integer( message.receiver.window_size );
   serializer.integer( udinfo.cksum );
   serializer.integer( uint16_t { 0 } ); // urgent pointer
-  serializer.buffer( message.sender.payload );
 }
 
+template void TCPSegment::serialize_header( Serializer& serializer ) const;
+template void TCPSegment::serialize_header( SpanSerializer& serializer ) const;
+
 void TCPSegment::compute_checksum( uint32_t datagram_layer_pseudo_checksum )
 {
-  udinfo.cksum = 0;
-  Serializer s;
-  serialize( s );
+  compute_checksum( datagram_layer_pseudo_checksum, message.sender.payload, message.sender.payload_sum );
+}
 
-  InternetChecksum check { datagram_layer_pseudo_checksum };
-  check.add( s.output() );
+// The header's 16-bit words are summed straight from the fields (the checksum field and urgent pointer count as
+// zero), and the payload in place
+void TCPSegment::compute_checksum( uint32_t datagram_layer_pseudo_checksum,
+                                   string_view payload,
+                                   optional<uint16_t> payload_sum )
+{
+  const uint32_t seqno = Wrap32Serializable { message.sender.seqno }.raw_value();
+  const uint32_t ackno = Wrap32Serializable { message.receiver.ackno.value_or( Wrap32 { 0 } ) }.raw_value();
+
+  uint32_t sum = datagram_layer_pseudo_checksum;
+  sum += udinfo.src_port;
+  sum += udinfo.dst_port;
+  sum += ( seqno >> 16 ) + static_cast<uint16_t>( seqno );
+  sum += ( ackno >> 16 ) + static_cast<uint16_t>( ackno );
+  sum += ( TCPHeaderMinLen << 12 ) | flags( message );
+  sum += message.receiver.window_size;
+
+  InternetChecksum check { sum };
+  if ( payload_sum.has_value() ) {
+    check.add_sum( *payload_sum, payload.size() );
+  } else {
+    check.add( payload );
+  }
   udinfo.cksum = check.value();
 }
+
+void TCPSegment::set_partial_checksum( uint32_t datagram_layer_pseudo_checksum )
+{
+  udinfo.cksum = ~InternetChecksum { datagram_layer_pseudo_checksum }.value();
+}
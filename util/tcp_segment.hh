@@ -5,6 +5,8 @@
 #include "tcp_sender_message.hh"
 #include "udinfo.hh"
 
+#include <optional>
+
 struct TCPMessage
 {
   TCPSenderMessage sender {};
@@ -13,11 +15,28 @@ struct TCPMessage
 
 struct TCPSegment
 {
+  static constexpr size_t HEADER_LENGTH = 20; // TCP header length, without options
+
   TCPMessage message {};
   UserDatagramInfo udinfo {};
 
-  void parse( Parser& parser, uint32_t datagram_layer_pseudo_checksum );
+  //! `verify_checksum` can be false if the checksum was already verified (e.g. by the NIC), or only partly
+  //! computed by a sender that left the rest to the NIC
+  void parse( Parser& parser, uint32_t datagram_layer_pseudo_checksum, bool verify_checksum = true );
   void serialize( Serializer& serializer ) const;
 
+  //! The header alone (HEADER_LENGTH bytes), e.g. for a FrameSerializer that references the payload
+  template<class SerializerT>
+  void serialize_header( SerializerT& serializer ) const;
+
   void compute_checksum( uint32_t datagram_layer_pseudo_checksum );
+
+  //! Compute the checksum for this header and `payload`, for a segment whose payload is held elsewhere. The
+  //! payload isn't read if its sum is already known (see TCPSenderMessage::payload_sum).
+  void compute_checksum( uint32_t datagram_layer_pseudo_checksum,
+                         std::string_view payload,
+                         std::optional<uint16_t> payload_sum = {} );
+
+  //! Leave the checksum to be completed downstream (checksum offload): the field holds the sum of the pseudo-header
+  void set_partial_checksum( uint32_t datagram_layer_pseudo_checksum );
 };
@@ -1,8 +1,10 @@
 #pragma once
 
+#include "buffer.hh"
 #include "wrapping_integers.hh"
 
-#include <string>
+#include <cstdint>
+#include <optional>
 
 /*
  * The TCPSenderMessage structure contains the information sent from a TCP sender to its receiver.
@@ -27,11 +29,15 @@ struct TCPSenderMessage
   Wrap32 seqno { 0 };
 
   bool SYN {};
-  std::string payload {};
+  Buffer payload {};
   bool FIN {};
 
   bool RST {};
 
+  // The payload's one's-complement sum (see InternetChecksum::sum()), if the sender computed it while copying
+  // the payload together, so that checksumming the segment needn't read the payload again
+  std::optional<uint16_t> payload_sum {};
+
   // How many sequence numbers does this segment use?
   size_t sequence_length() const { return SYN + payload.size() + FIN; }
 };
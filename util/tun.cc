@@ -5,6 +5,7 @@
 #include <fcntl.h>
 #include <linux/if.h>
 #include <linux/if_tun.h>
+#include <stdexcept>
 #include <sys/ioctl.h>
 
 static constexpr const char* CLONEDEV = "/dev/net/tun";
@@ -21,13 +22,16 @@ using namespace std;
 //!
 //! as root before calling this function.
 
-TunTapFD::TunTapFD( const string& devname, const bool is_tun )
+TunTapFD::TunTapFD( const string& devname, const bool is_tun, const TunTapOptions& options )
   : FileDescriptor( ::CheckSystemCall( "open", open( CLONEDEV, O_RDWR | O_CLOEXEC ) ) )
+  , _vnet_header( options.vnet_header )
 {
   struct ifreq tun_req
   {};
 
-  tun_req.ifr_flags = static_cast<int16_t>( ( is_tun ? IFF_TUN : IFF_TAP ) | IFF_NO_PI ); // no packetinfo
+  int flags = ( is_tun ? IFF_TUN : IFF_TAP ) | IFF_NO_PI; // no packetinfo
+  flags |= ( options.multi_queue ? IFF_MULTI_QUEUE : 0 ) | ( options.vnet_header ? IFF_VNET_HDR : 0 );
+  tun_req.ifr_flags = static_cast<int16_t>( flags );
 
   // copy devname to ifr_name, making sure to null terminate
 
@@ -35,4 +39,26 @@ TunTapFD::TunTapFD( const string& devname, const bool is_tun )
   tun_req.ifr_name[IFNAMSIZ - 1] = '\0';
 
   CheckSystemCall( "ioctl", ioctl( fd_num(), TUNSETIFF, static_cast<void*>( &tun_req ) ) );
+
+  if ( options.vnet_header ) {
+    int header_size = sizeof( VirtioNetHeader );
+    CheckSystemCall( "ioctl(TUNSETVNETHDRSZ)", ioctl( fd_num(), TUNSETVNETHDRSZ, &header_size ) );
+  }
+
+  if ( options.offloads != 0 and not options.vnet_header ) {
+    throw runtime_error( "TunTapFD: offloads need the virtio-net header" );
+  }
+  // offloads are a property of the device, so always set them: an earlier user may have left some enabled
+  CheckSystemCall( "ioctl(TUNSETOFFLOAD)", ioctl( fd_num(), TUNSETOFFLOAD, options.offloads ) );
+}
+
+vector<TunFD> TunFD::open_queues( const string& devname, const size_t count, TunTapOptions options )
+{
+  options.multi_queue = true;
+  vector<TunFD> queues;
+  queues.reserve( count );
+  for ( size_t i = 0; i < count; ++i ) {
+    queues.emplace_back( devname, options );
+  }
+  return queues;
 }
@@ -2,15 +2,58 @@
 
 #include "file_descriptor.hh"
 
+#include <cstddef>
+#include <cstdint>
+#include <linux/if_tun.h>
 #include <string>
+#include <vector>
+
+//! \brief The header before each packet on a TUN/TAP device opened with `vnet_header`.
+//! \details Mirrors `struct virtio_net_hdr` from <linux/virtio_net.h>, which declares a field named `class` and
+//! so can't be included from C++. Fields are in host byte order.
+struct VirtioNetHeader
+{
+  static constexpr uint8_t F_NEEDS_CSUM = 1; //!< The checksum at csum_start + csum_offset is still to be completed
+  static constexpr uint8_t F_DATA_VALID = 2; //!< The kernel has already verified the checksum
+  static constexpr uint8_t GSO_NONE = 0;
+  static constexpr uint8_t GSO_TCPV4 = 1; //!< A TCP super-segment, to be cut into gso_size-byte payloads
+
+  uint8_t flags;
+  uint8_t gso_type;
+  uint16_t hdr_len;     //!< Length of the IP and TCP headers
+  uint16_t gso_size;    //!< Payload size of each segment
+  uint16_t csum_start;  //!< Where checksumming starts (the TCP header)
+  uint16_t csum_offset; //!< Where the checksum goes, from csum_start
+};
+
+//! Features to ask for when opening a TUN/TAP device
+struct TunTapOptions
+{
+  //! IFF_MULTI_QUEUE: each open of the device is a separate queue, so that several threads can each read and
+  //! write their own (the device must have been created with `multi_queue`)
+  bool multi_queue = false;
+
+  //! IFF_VNET_HDR: every packet read or written is preceded by a VirtioNetHeader describing its checksum and
+  //! segmentation offloads
+  bool vnet_header = false;
+
+  //! TUN_F_* offloads (e.g. TUN_F_CSUM | TUN_F_TSO4) the reader can handle, set with TUNSETOFFLOAD: packets may
+  //! arrive with only a partial checksum, or as super-segments of up to 64 KiB (needs `vnet_header`)
+  unsigned offloads = 0;
+};
 
 //! A FileDescriptor to a [Linux TUN/TAP](https://www.kernel.org/doc/Documentation/networking/tuntap.txt) device
 class TunTapFD : public FileDescriptor
 {
+  bool _vnet_header;
+
 public:
   //! Open an existing persistent [TUN or TAP
   //! device](https://www.kernel.org/doc/Documentation/networking/tuntap.txt).
-  explicit TunTapFD( const std::string& devname, bool is_tun );
+  explicit TunTapFD( const std::string& devname, bool is_tun, const TunTapOptions& options = {} );
+
+  //! Are packets preceded by a VirtioNetHeader?
+  bool has_vnet_header() const { return _vnet_header; }
 };
 
 //! A FileDescriptor to a [Linux TUN](https://www.kernel.org/doc/Documentation/networking/tuntap.txt) device
@@ -18,7 +61,12 @@ class TunFD : public TunTapFD
 {
 public:
   //! Open an existing persistent [TUN device](https://www.kernel.org/doc/Documentation/networking/tuntap.txt).
-  explicit TunFD( const std::string& devname ) : TunTapFD( devname, true ) {}
+  explicit TunFD( const std::string& devname, const TunTapOptions& options = {} )
+    : TunTapFD( devname, true, options )
+  {}
+
+  //! Open `count` queues of a multi-queue TUN device, e.g. one per worker thread
+  static std::vector<TunFD> open_queues( const std::string& devname, size_t count, TunTapOptions options = {} );
 };
 
 //! A FileDescriptor to a [Linux TAP](https://www.kernel.org/doc/Documentation/networking/tuntap.txt) device
@@ -26,5 +74,7 @@ class TapFD : public TunTapFD
 {
 public:
   //! Open an existing persistent [TAP device](https://www.kernel.org/doc/Documentation/networking/tuntap.txt).
-  explicit TapFD( const std::string& devname ) : TunTapFD( devname, false ) {}
+  explicit TapFD( const std::string& devname, const TunTapOptions& options = {} )
+    : TunTapFD( devname, false, options )
+  {}
 };
@@ -1,21 +1,129 @@
 #include "tuntap_adapter.hh"
+#include "buffer_pool.hh"
 #include "parser.hh"
 
+#include <array>
+
 using namespace std;
 
-optional<TCPMessage> TCPOverIPv4OverTunFdAdapter::read()
+TCPOverIPv4OverTunFdAdapter::TCPOverIPv4OverTunFdAdapter( TunFD&& tun ) : _tun( std::move( tun ) )
+{
+  _tun.set_blocking( false );
+}
+
+// Most datagrams fit in an MTU-sized buffer. Only a super-segment (with offloads) can be bigger: it spills over
+// into a 64 KiB buffer, which the adapter keeps for the next read until a datagram actually uses it.
+bool TCPOverIPv4OverTunFdAdapter::read_datagram()
 {
-  vector<string> strs( 2 );
-  strs.front().resize( IPv4Header::LENGTH );
-  _tun.read( strs );
+  static_assert( PacketBufferPool::MTU_BUFFER_SIZE + PacketBufferPool::LARGE_BUFFER_SIZE >= MAX_DATAGRAM_SIZE );
+
+  auto& pool = PacketBufferPool::global();
+  const bool offloads = _tun.has_vnet_header();
+  auto first = pool.make_buffer( PacketBufferPool::MTU_BUFFER_SIZE );
+  if ( offloads and not _spill ) {
+    _spill = pool.make_buffer( PacketBufferPool::LARGE_BUFFER_SIZE );
+  }
+
+  const array<iovec, 3> iovecs { { { &_vnet_header, sizeof( _vnet_header ) },
+                                   { first.get(), PacketBufferPool::MTU_BUFFER_SIZE },
+                                   { _spill.get(), PacketBufferPool::LARGE_BUFFER_SIZE } } };
+  const size_t header_size = offloads ? sizeof( _vnet_header ) : 0;
+  const size_t bytes_read = _tun.read_into( offloads ? span { iovecs } : span { iovecs }.subspan( 1, 1 ) );
+
+  // the fd is non-blocking, so nothing read means no datagram was ready
+  if ( bytes_read == 0 or bytes_read < header_size ) {
+    return false;
+  }
+
+  const size_t datagram_length = bytes_read - header_size;
+  const size_t first_length = min( datagram_length, PacketBufferPool::MTU_BUFFER_SIZE );
+  _datagram = {};
+  _datagram.append( { first, { first.get(), first_length } } );
+  if ( datagram_length > first_length ) {
+    _datagram.append( { _spill, { _spill.get(), datagram_length - first_length } } );
+    _spill.reset();
+  }
+  return true;
+}
+
+optional<TCPMessage> TCPOverIPv4OverTunFdAdapter::parse_datagram()
+{
+  // the kernel marks datagrams whose checksum it verified, or (from a local sender) left for the NIC to fill in
+  const bool checksum_verified
+    = _tun.has_vnet_header()
+      and ( _vnet_header.flags & ( VirtioNetHeader::F_DATA_VALID | VirtioNetHeader::F_NEEDS_CSUM ) ); // NOLINT
 
   InternetDatagram ip_dgram;
-  const vector<string> buffers = { strs.at( 0 ), strs.at( 1 ) };
-  if ( parse( ip_dgram, buffers ) ) {
-    return unwrap_tcp_in_ip( ip_dgram );
+  if ( parse( ip_dgram, _datagram ) ) {
+    return unwrap_tcp_in_ip( ip_dgram, checksum_verified );
   }
   return {};
 }
 
+// With a virtio-net header, the kernel completes the TCP checksum, and cuts a segment too big for the link into
+// several.
+void TCPOverIPv4OverTunFdAdapter::serialize_datagram( const TCPMessage& seg, FrameSerializer& out )
+{
+  if ( not _tun.has_vnet_header() ) {
+    serialize_tcp_in_ip( seg, out );
+    return;
+  }
+
+  constexpr uint16_t tcp_checksum_offset = 16;
+
+  VirtioNetHeader vnet_header {};
+  vnet_header.flags = VirtioNetHeader::F_NEEDS_CSUM;
+  vnet_header.csum_start = IPv4Header::LENGTH;
+  vnet_header.csum_offset = tcp_checksum_offset;
+  if ( seg.sender.payload.size() > GSO_SEGMENT_SIZE ) {
+    vnet_header.gso_type = VirtioNetHeader::GSO_TCPV4;
+    vnet_header.gso_size = GSO_SEGMENT_SIZE;
+    vnet_header.hdr_len = IPv4Header::LENGTH + TCPSegment::HEADER_LENGTH;
+  }
+
+  serialize_tcp_in_ip( seg, out, true );
+  out.prepend( sizeof( vnet_header ), [&]( SpanSerializer& s ) {
+    s.buffer( { reinterpret_cast<const char*>( &vnet_header ), sizeof( vnet_header ) } ); // NOLINT(*-cast)
+  } );
+}
+
+optional<TCPMessage> TCPOverIPv4OverTunFdAdapter::read()
+{
+  if ( not read_datagram() ) {
+    return {};
+  }
+  return parse_datagram();
+}
+
+void TCPOverIPv4OverTunFdAdapter::read_batch( vector<TCPMessage>& segments, const size_t budget )
+{
+  segments.clear();
+  for ( size_t i = 0; i < budget and read_datagram(); ++i ) {
+    if ( auto seg = parse_datagram() ) {
+      segments.push_back( std::move( seg.value() ) );
+    }
+  }
+}
+
+void TCPOverIPv4OverTunFdAdapter::write_batch( const span<const TCPMessage> segments )
+{
+  if ( segments.size() <= 1 ) {
+    for ( const auto& seg : segments ) {
+      write( seg );
+    }
+    return;
+  }
+
+  // each datagram goes out in one gathering write, straight from its headers and the segment's payload (the
+  // serializers, and the segments, stay put until submit() returns)
+  _serializers.resize( segments.size() );
+  for ( size_t i = 0; i < segments.size(); ++i ) {
+    _serializers[i] = {};
+    serialize_datagram( segments[i], _serializers[i] );
+    _writes.queue_writev( _tun, _serializers[i].iovecs() );
+  }
+  _writes.submit();
+}
+
 //! Specialize LossyFdAdapter to TCPOverIPv4OverTunFdAdapter
 template class LossyFdAdapter<TCPOverIPv4OverTunFdAdapter>;
@@ -1,15 +1,19 @@
 #pragma once
 
+#include "io_uring.hh"
 #include "tcp_over_ip.hh"
 #include "tcp_segment.hh"
 #include "tun.hh"
 
+#include <memory>
 #include <optional>
+#include <span>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 template<class T>
-concept TCPDatagramAdapter = requires( T a, TCPMessage seg ) {
+concept TCPDatagramAdapter = requires( T a, TCPMessage seg, std::vector<TCPMessage> segs ) {
   {
     a.write( seg )
   } -> std::same_as<void>;
@@ -17,6 +21,15 @@ concept TCPDatagramAdapter = requires( T a, TCPMessage seg ) {
   {
     a.read()
   } -> std::same_as<std::optional<TCPMessage>>;
+
+  // read up to `budget` datagrams that are ready, replacing the contents of `segs`
+  {
+    a.read_batch( segs, size_t {} )
+  } -> std::same_as<void>;
+
+  {
+    a.write_batch( std::span<const TCPMessage> {} )
+  } -> std::same_as<void>;
 };
 
 //! \brief A FD adapter for IPv4 datagrams read from and written to a TUN device
@@ -25,15 +38,51 @@ class TCPOverIPv4OverTunFdAdapter : public TCPOverIPv4Adapter
 private:
   TunFD _tun;
 
+  BufferList _datagram {};                      //!< The last datagram read, in buffers from the PacketBufferPool
+  VirtioNetHeader _vnet_header {};              //!< Precedes the datagram read, if the TUN device uses them
+  IOBatch _writes {};                           //!< Submits the datagrams of a write_batch() together
+  std::vector<FrameSerializer> _serializers {}; //!< One per datagram queued, pointing into its TCPMessage
+
+  //! Where a super-segment read spills past its MTU buffer (taken from the pool with offloads only, and kept until
+  //! a datagram uses it)
+  std::shared_ptr<char[]> _spill {}; // NOLINT(*-avoid-c-arrays)
+
+  //! Largest datagram the kernel hands over with segmentation offload
+  static constexpr size_t MAX_DATAGRAM_SIZE = 65535;
+  //! Payload of each segment the kernel cuts a super-segment into (for a 1500-byte MTU)
+  static constexpr uint16_t GSO_SEGMENT_SIZE = 1460;
+
+  //! Reads one datagram into _datagram; returns false if none was ready
+  bool read_datagram();
+
+  //! Parses the datagram in _datagram, if it holds a TCP segment related to the current connection
+  std::optional<TCPMessage> parse_datagram();
+
+  //! Serialize the datagram carrying a segment, preceded by a virtio-net header if the TUN device uses them
+  void serialize_datagram( const TCPMessage& seg, FrameSerializer& out );
+
 public:
-  //! Construct from a TunFD
-  explicit TCPOverIPv4OverTunFdAdapter( TunFD&& tun ) : _tun( std::move( tun ) ) {}
+  //! Construct from a TunFD, which is made non-blocking
+  explicit TCPOverIPv4OverTunFdAdapter( TunFD&& tun );
 
   //! Attempts to read and parse an IPv4 datagram containing a TCP segment related to the current connection
   std::optional<TCPMessage> read();
 
+  //! Reads every datagram that is ready (up to `budget`) and keeps the TCP segments related to the current
+  //! connection
+  void read_batch( std::vector<TCPMessage>& segments, size_t budget );
+
   //! Creates an IPv4 datagram from a TCP segment and writes it to the TUN device
-  void write( const TCPMessage& seg ) { _tun.write( serialize( wrap_tcp_in_ip( seg ) ) ); }
+  void write( const TCPMessage& seg )
+  {
+    FrameSerializer datagram;
+    serialize_datagram( seg, datagram );
+    _tun.write( datagram.iovecs() );
+  }
+
+  //! Creates a datagram from each segment, and writes them all to the TUN device with one system call (where
+  //! io_uring is available)
+  void write_batch( std::span<const TCPMessage> segments );
 
   //! Access the underlying TUN device
   explicit operator TunFD&() { return _tun; }